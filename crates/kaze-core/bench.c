@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KZ_STATIC_API
+#include "kaze.h"
+#include "kz_threads.h"
+
+#ifndef _WIN32
+# include <sys/wait.h>
+#endif
+
+#define BENCH_NAME "kz_bench"
+
+#define bench_check(cond)                                                  \
+    ((cond) ? (void)0                                                      \
+            : (fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,     \
+                       __LINE__, #cond),                                   \
+               exit(EXIT_FAILURE)))
+
+typedef struct BenchOpts {
+    size_t      count;   /* round trips of the latency runs */
+    size_t      bytes;   /* bytes streamed for each size */
+    size_t      bufsize; /* buffer size of the channel */
+    int         flags;   /* extra `KZ_*` flags of the channel */
+    int         threads; /* run the peers in threads */
+    int         process; /* run the peers in child processes */
+    const char *only;    /* run only this suite */
+} BenchOpts;
+
+typedef struct BenchPeer {
+    size_t count;  /* messages to take */
+    size_t size;   /* size of the messages */
+    int    poll;   /* poll instead of waiting, the writer does not notify */
+    int    waitv;  /* `kz_has_futex_waitv` of the run */
+    void *(*func)(void *);
+} BenchPeer;
+
+typedef struct BenchResult {
+    uint64_t  elapsed; /* nanoseconds of the whole run */
+    size_t    msgs;    /* messages moved in `elapsed` */
+    size_t    bytes;   /* payload bytes of `msgs` */
+    uint64_t *samples; /* one way latencies, NULL if not measured */
+    size_t    nsamples;
+} BenchResult;
+
+static BenchOpts opts = {100000, (size_t)256 << 20, (size_t)4 << 20, 0, 1, 1,
+                         NULL};
+
+/* helpers */
+
+static void bench_setwaitv(int waitv) {
+#ifdef SYS_futex_waitv
+    /* 0 lets the next `kz_open()` check the kernel again */
+    kz_has_futex_waitv = waitv;
+#else
+    (void)waitv;
+#endif
+}
+
+static int bench_read(kz_State *S, kz_Context *ctx, int poll) {
+    int r, spins = 0;
+    while ((r = kz_read(S, ctx)) == KZ_AGAIN) {
+        if (!poll) return kz_waitcontext(ctx, -1);
+        kz_cancel(ctx);
+        if (++spins % KZ_SPINCHECK == 0) kz_yield();
+        else kz_pause();
+    }
+    return r;
+}
+
+static int bench_write(kz_State *S, kz_Context *ctx, size_t len) {
+    int r = kz_write(S, ctx, len);
+    return r == KZ_AGAIN ? kz_waitcontext(ctx, -1) : r;
+}
+
+static kz_State *bench_open(void) {
+    /* the waiting mode is shared with the threads, or inherited by the
+     * children, both sides must agree on it */
+    kz_State *S = kz_open(BENCH_NAME, 0, 0);
+    if (S == NULL) perror("kz_open");
+    bench_check(S != NULL);
+    return S;
+}
+
+static void bench_close(kz_State *S) {
+    /* closing drops the messages not read yet, so leave it to the driver */
+    kz_Context ctx;
+    while (bench_read(S, &ctx, 0) == KZ_OK) kz_commit(&ctx, 0);
+    kz_close(S);
+}
+
+static int bench_cmp(const void *lhs, const void *rhs) {
+    uint64_t l = *(const uint64_t *)lhs, r = *(const uint64_t *)rhs;
+    return l < r ? -1 : l > r;
+}
+
+static uint64_t bench_percentile(const BenchResult *res, double q) {
+    return res->samples[(size_t)(q * (double)(res->nsamples - 1))];
+}
+
+static void bench_header(void) {
+    printf("%-14s %-7s %6s %12s %10s %8s %8s %8s %8s %8s\n", "bench",
+           "peer", "size", "msgs/s", "MB/s", "p50", "p90", "p99", "p999",
+           "max");
+}
+
+static void bench_report(
+        const char *name, const char *peer, size_t size, BenchResult *res) {
+    double secs = (double)res->elapsed / 1.0e9;
+    printf("%-14s %-7s %6zu %12.0f %10.2f", name, peer, size,
+           (double)res->msgs / secs, (double)res->bytes / secs / 1.0e6);
+    if (res->samples && res->nsamples != 0) {
+        qsort(res->samples, res->nsamples, sizeof(uint64_t), bench_cmp);
+        printf(" %8llu %8llu %8llu %8llu %8llu",
+               (unsigned long long)bench_percentile(res, 0.5),
+               (unsigned long long)bench_percentile(res, 0.9),
+               (unsigned long long)bench_percentile(res, 0.99),
+               (unsigned long long)bench_percentile(res, 0.999),
+               (unsigned long long)res->samples[res->nsamples - 1]);
+    } else
+        printf(" %8s %8s %8s %8s %8s", "-", "-", "-", "-", "-");
+    printf("\n");
+    fflush(stdout);
+    free(res->samples);
+    res->samples = NULL;
+}
+
+/* peers */
+
+static void *echo_peer(void *ud) {
+    const BenchPeer *peer = (const BenchPeer *)ud;
+    kz_State        *S = bench_open();
+    size_t           i;
+    for (i = 0; i < peer->count; ++i) {
+        kz_Context rctx, wctx;
+        size_t     len = 0;
+        char      *buf;
+        if (bench_read(S, &rctx, peer->poll) != KZ_OK) break;
+        buf = kz_buffer(&rctx, &len);
+        if (bench_write(S, &wctx, len) != KZ_OK) break;
+        memcpy(kz_buffer(&wctx, NULL), buf, len);
+        bench_check(kz_commit(&rctx, 0) == KZ_OK);
+        kz_setnotify(&wctx, !peer->poll);
+        bench_check(kz_commit(&wctx, len) == KZ_OK);
+    }
+    bench_close(S);
+    return NULL;
+}
+
+static void *sink_peer(void *ud) {
+    const BenchPeer *peer = (const BenchPeer *)ud;
+    kz_State        *S = bench_open();
+    kz_Context       ctx;
+    size_t           i, len;
+    uint64_t         seq;
+    for (i = 0; i < peer->count; ++i) {
+        if (bench_read(S, &ctx, peer->poll) != KZ_OK) break;
+        memcpy(&seq, kz_buffer(&ctx, &len), sizeof(seq));
+        bench_check(seq == i && len == peer->size);
+        bench_check(kz_commit(&ctx, 0) == KZ_OK);
+    }
+    /* tell the writer everything is read */
+    if (bench_write(S, &ctx, 1) == KZ_OK) kz_commit(&ctx, 1);
+    bench_close(S);
+    return NULL;
+}
+
+static void bench_duplex(kz_State *S, size_t count, size_t size) {
+    /* send and receive `count` messages, sleeping in `kz_wait()` only when
+     * neither way can go on */
+    size_t reads = 0, writes = 0;
+    while (reads < count || writes < count) {
+        kz_Context ctx;
+        int        r = kz_wait(S, size, -1);
+        if (r < 0) break;
+        if ((r & KZ_READ) && reads < count) {
+            bench_check(kz_read(S, &ctx) == KZ_OK);
+            bench_check(kz_commit(&ctx, 0) == KZ_OK);
+            ++reads;
+        }
+        if ((r & KZ_WRITE) && writes < count) {
+            bench_check(kz_write(S, &ctx, size) == KZ_OK);
+            memset(kz_buffer(&ctx, NULL), 0, size);
+            bench_check(kz_commit(&ctx, size) == KZ_OK);
+            ++writes;
+        }
+    }
+}
+
+static void *duplex_peer(void *ud) {
+    const BenchPeer *peer = (const BenchPeer *)ud;
+    kz_State        *S = bench_open();
+    bench_duplex(S, peer->count, peer->size);
+    bench_close(S);
+    return NULL;
+}
+
+/* runners */
+
+typedef struct BenchRun {
+    kz_State *S;
+    int       isthread;
+    kz_Thread thread;
+#ifndef _WIN32
+    pid_t pid;
+#endif
+} BenchRun;
+
+static int bench_start(BenchRun *run, BenchPeer *peer, int isthread) {
+    run->isthread = isthread;
+    bench_setwaitv(peer->waitv);
+    kz_unlink(BENCH_NAME);
+    run->S = kz_open(
+            BENCH_NAME, KZ_CREATE | KZ_RESET | opts.flags | 0666,
+            opts.bufsize);
+    if (run->S == NULL) perror("kz_open");
+    bench_check(run->S != NULL);
+    bench_check(kz_size(run->S) >= peer->size + 16);
+    if (isthread) return kzT_spawn(&run->thread, peer->func, peer) == 0;
+#ifndef _WIN32
+    fflush(stdout);
+    if ((run->pid = fork()) == 0) {
+        peer->func(peer);
+        _exit(EXIT_SUCCESS);
+    }
+    return run->pid > 0;
+#else
+    return 0;
+#endif
+}
+
+static void bench_finish(BenchRun *run) {
+    kz_close(run->S);
+    if (run->isthread)
+        kzT_join(run->thread, NULL);
+#ifndef _WIN32
+    else {
+        int status = 0;
+        bench_check(waitpid(run->pid, &status, 0) == run->pid);
+        bench_check(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+#endif
+    kz_unlink(BENCH_NAME);
+    bench_setwaitv(0);
+}
+
+static void bench_pingpong(BenchPeer *peer, int isthread, BenchResult *res) {
+    /* one way latency is half of the round trip, the first tenth warms up
+     * the caches and the wait time estimates */
+    size_t     i, warmup = peer->count / 10;
+    BenchRun   run;
+    kz_Context ctx;
+    char      *buf = (char *)calloc(1, peer->size);
+    uint64_t   start = 0, before;
+    res->samples = (uint64_t *)malloc(sizeof(uint64_t) * peer->count);
+    bench_check(buf != NULL && res->samples != NULL);
+    bench_check(bench_start(&run, peer, isthread));
+    for (i = 0; i < peer->count; ++i) {
+        if (i == warmup) start = kzT_time();
+        before = kzT_time();
+        memcpy(buf, &i, sizeof(i));
+        bench_check(bench_write(run.S, &ctx, peer->size) == KZ_OK);
+        memcpy(kz_buffer(&ctx, NULL), buf, peer->size);
+        kz_setnotify(&ctx, !peer->poll);
+        bench_check(kz_commit(&ctx, peer->size) == KZ_OK);
+        bench_check(bench_read(run.S, &ctx, peer->poll) == KZ_OK);
+        bench_check(memcmp(kz_buffer(&ctx, NULL), buf, peer->size) == 0);
+        bench_check(kz_commit(&ctx, 0) == KZ_OK);
+        if (i >= warmup)
+            res->samples[i - warmup] = (kzT_time() - before) / 2;
+    }
+    res->elapsed = kzT_time() - start;
+    res->nsamples = peer->count - warmup;
+    res->msgs = res->nsamples * 2;
+    res->bytes = res->msgs * peer->size;
+    bench_finish(&run);
+    free(buf);
+}
+
+static void bench_stream(BenchPeer *peer, int isthread, BenchResult *res) {
+    BenchRun   run;
+    kz_Context ctx;
+    uint64_t   start, i;
+    bench_check(bench_start(&run, peer, isthread));
+    start = kzT_time();
+    for (i = 0; i < peer->count; ++i) {
+        char *buf;
+        bench_check(bench_write(run.S, &ctx, peer->size) == KZ_OK);
+        buf = kz_buffer(&ctx, NULL);
+        memcpy(buf, &i, sizeof(i));
+        kz_setnotify(&ctx, !peer->poll);
+        bench_check(kz_commit(&ctx, peer->size) == KZ_OK);
+    }
+    bench_check(bench_read(run.S, &ctx, 0) == KZ_OK);
+    bench_check(kz_commit(&ctx, 0) == KZ_OK);
+    res->elapsed = kzT_time() - start;
+    res->msgs = peer->count;
+    res->bytes = peer->count * peer->size;
+    res->samples = NULL;
+    bench_finish(&run);
+}
+
+static void bench_mux(BenchPeer *peer, int isthread, BenchResult *res) {
+    BenchRun run;
+    uint64_t start;
+    bench_check(bench_start(&run, peer, isthread));
+    start = kzT_time();
+    bench_duplex(run.S, peer->count, peer->size);
+    res->elapsed = kzT_time() - start;
+    res->msgs = peer->count * 2;
+    res->bytes = res->msgs * peer->size;
+    res->samples = NULL;
+    bench_finish(&run);
+}
+
+static void bench_run(
+        const char *name, BenchPeer *peer,
+        void (*runner)(BenchPeer *, int, BenchResult *)) {
+    BenchResult res;
+    memset(&res, 0, sizeof(res));
+    if (opts.threads) {
+        runner(peer, 1, &res);
+        bench_report(name, "thread", peer->size, &res);
+    }
+#ifndef _WIN32
+    if (opts.process) {
+        runner(peer, 0, &res);
+        bench_report(name, "process", peer->size, &res);
+    }
+#endif
+}
+
+static size_t bench_scale(size_t size) {
+    /* stream about the same bytes for each size, within a sane count */
+    size_t count = opts.bytes / size;
+    if (count > opts.count * 10) count = opts.count * 10;
+    if (count < opts.count / 100) count = opts.count / 100;
+    return count ? count : 1;
+}
+
+/* suites */
+
+static const size_t sizes[] = {8, 64, 512, 4096, 65536};
+
+#define BENCH_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static void suite_latency(void) {
+    BenchPeer peer = {0, 0, 0, 0, echo_peer};
+    size_t    i;
+    for (i = 0; i < 3; ++i) {
+        peer.count = opts.count, peer.size = sizes[i];
+        bench_run("pingpong", &peer, bench_pingpong);
+    }
+}
+
+static void suite_throughput(void) {
+    BenchPeer peer = {0, 0, 0, 0, sink_peer};
+    size_t    i;
+    for (i = 0; i < BENCH_SIZES; ++i) {
+        peer.count = bench_scale(sizes[i]), peer.size = sizes[i];
+        bench_run("stream", &peer, bench_stream);
+    }
+}
+
+static void suite_mux(void) {
+    BenchPeer peer = {0, 64, 0, 0, duplex_peer};
+    peer.count = bench_scale(peer.size);
+    bench_run("mux-waitv", &peer, bench_mux);
+#ifdef SYS_futex_waitv
+    peer.waitv = -1;
+    bench_run("mux-seq", &peer, bench_mux);
+#endif
+}
+
+static void suite_notify(void) {
+    BenchPeer peer = {0, 64, 0, 0, sink_peer};
+    peer.count = bench_scale(peer.size);
+    bench_run("stream-notify", &peer, bench_stream);
+    peer.poll = 1;
+    bench_run("stream-poll", &peer, bench_stream);
+    peer.func = echo_peer, peer.count = opts.count, peer.poll = 0;
+    bench_run("ping-notify", &peer, bench_pingpong);
+    peer.poll = 1;
+    bench_run("ping-poll", &peer, bench_pingpong);
+}
+
+static const struct {
+    const char *name;
+    void (*func)(void);
+} suites[] = {
+        {"latency", suite_latency},
+        {"throughput", suite_throughput},
+        {"mux", suite_mux},
+        {"notify", suite_notify},
+};
+
+static int bench_flags(const char *s) {
+    /* the flag letters of the Lua binding */
+    int r = 0;
+    for (; *s != '\0'; ++s) {
+        switch (*s) { /* clang-format off */
+        case 's': r |= KZ_SPIN;      break;
+        case 'm': r |= KZ_MPSC;      break;
+        case 'n': r |= KZ_NOTIFY;    break;
+        case 'h': r |= KZ_HUGEPAGE;  break;
+        case 'p': r |= KZ_PREFAULT;  break;
+        case 'l': r |= KZ_MLOCK;     break;
+        case 'd': r |= KZ_MIRROR;    break;
+        case 'i': r |= KZ_INDEXED;   break;
+        case 't': r |= KZ_TIMESTAMP; break;
+        default: return -1;
+        } /* clang-format on */
+    }
+    return r;
+}
+
+static int bench_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-n count] [-m MB] [-b bufsize] [-f flags] [-t|-p] "
+            "[suite]\n"
+            "  -n  round trips of the latency runs (default %zu)\n"
+            "  -m  megabytes streamed for each size (default %zu)\n"
+            "  -b  buffer size of the channel (default %zu)\n"
+            "  -f  channel flags: s(pin) m(psc) n(otify) h(ugepage)\n"
+            "      p(refault) l(mlock) d(mirror) i(ndexed) t(imestamp)\n"
+            "  -t  peers in threads only, -p peers in processes only\n"
+            "suites: latency throughput mux notify (default all)\n",
+            prog, opts.count, opts.bytes >> 20, opts.bufsize);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    size_t i;
+    int    n;
+    for (n = 1; n < argc; ++n) {
+        const char *arg = argv[n], *val = n + 1 < argc ? argv[n + 1] : NULL;
+        if (arg[0] != '-') {
+            opts.only = arg;
+            continue;
+        }
+        switch (arg[1]) {
+        case 't': opts.process = 0; continue;
+        case 'p': opts.threads = 0; continue;
+        case 'n': case 'm': case 'b': case 'f':
+            if (val == NULL) return bench_usage(argv[0]);
+            ++n;
+            break;
+        default: return bench_usage(argv[0]);
+        }
+        if (arg[1] == 'f') {
+            if ((opts.flags = bench_flags(val)) < 0)
+                return bench_usage(argv[0]);
+        } else {
+            size_t v = (size_t)strtoull(val, NULL, 10);
+            if (v == 0) return bench_usage(argv[0]);
+            if (arg[1] == 'n') opts.count = v;
+            if (arg[1] == 'm') opts.bytes = v << 20;
+            if (arg[1] == 'b') opts.bufsize = v;
+        }
+    }
+    bench_header();
+    for (i = 0; i < sizeof(suites) / sizeof(suites[0]); ++i)
+        if (opts.only == NULL || strcmp(opts.only, suites[i].name) == 0)
+            suites[i].func();
+    return EXIT_SUCCESS;
+}
+
+/* cc: flags+='-Wall -Wextra -O3' libs+='-lpthread' */
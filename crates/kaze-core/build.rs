@@ -1,4 +1,18 @@
 fn main() {
     cc::Build::new().file("kaze.c").compile("kaze");
     println!("cargo::rerun-if-changed=kaze.h");
+
+    // the C benchmark, run by the `kaze-bench` binary
+    if std::env::var_os("CARGO_FEATURE_BENCH").is_some() {
+        cc::Build::new()
+            .file("bench.c")
+            .define("main", "kz_bench_main")
+            .opt_level(3)
+            .compile("kazebench");
+        println!("cargo::rerun-if-changed=bench.c");
+        println!("cargo::rerun-if-changed=kz_threads.h");
+        if std::env::var_os("CARGO_CFG_UNIX").is_some() {
+            println!("cargo::rustc-link-lib=pthread");
+        }
+    }
 }
@@ -85,23 +85,39 @@
 #define KZ_AGAIN   (-5) /* no data available or no enough space */
 #define KZ_BUSY    (-6) /* another reading/writing operation is in progress */
 #define KZ_TIMEOUT (-7) /* operation timed out */
-
-#define KZ_CREATE (1 << 16)
-#define KZ_EXCL   (1 << 17)
-#define KZ_RESET  (1 << 18)
+#define KZ_DROPPED (-8) /* lagging broadcast reader was overrun */
+
+#define KZ_CREATE    (1 << 16)
+#define KZ_EXCL      (1 << 17)
+#define KZ_RESET     (1 << 18)
+#define KZ_SPIN      (1 << 19) /* spin before sleeping in waits */
+#define KZ_MPSC      (1 << 20) /* allow concurrent writers on each side */
+#define KZ_NOTIFY    (1 << 21) /* signal a pollable fd on wakeups (Linux) */
+#define KZ_HUGEPAGE  (1 << 22) /* back the ring by huge pages (Linux) */
+#define KZ_PREFAULT  (1 << 23) /* fault in the whole ring at open */
+#define KZ_MLOCK     (1 << 24) /* lock the ring in RAM at open */
+#define KZ_MIRROR    (1 << 25) /* map the ring twice, never wrap records */
+#define KZ_INDEXED   (1 << 26) /* per side indices on own cache lines */
+#define KZ_TIMESTAMP (1 << 27) /* stamp records, keep dwell histograms */
+#define KZ_LANES(n)  ((((n) - 1) & 7) << 28) /* n priority lanes, 8 max */
+#define KZ_RESIZABLE (1 << 13) /* reserve address space to grow into */
+#define KZ_DROP      (1 << 12) /* overrun lagging broadcast readers */
 
 #define KZ_READ  (1 << 0)
 #define KZ_WRITE (1 << 1)
 #define KZ_BOTH  (KZ_READ | KZ_WRITE)
 
 #define KZ_MAX_SIZE ((uint32_t)0xFFFFFFFFU)
+#define KZ_WAITMAX  128 /* max channels of `kz_waitmany()` */
+#define KZ_HISTMAX  256 /* buckets of `kz_Histogram` */
+#define KZ_MAXLANES 8   /* max lanes of `KZ_LANES()` */
 
 KZ_NS_BEGIN
 
 
 /* global operations */
 
-KZ_API size_t kz_aligned(size_t bufsize, size_t pagesize);
+KZ_API size_t kz_aligned(size_t bufsize, size_t pagesize); /* 0 for huge */
 KZ_API int    kz_exists(const char *name, int *powner, int *puser);
 KZ_API int    kz_unlink(const char *name);
 
@@ -110,8 +126,14 @@ KZ_API void        kz_freefailerror(const char *s);
 
 /* object daclarations */
 
-typedef struct kz_State   kz_State;
-typedef struct kz_Context kz_Context;
+typedef struct kz_State     kz_State;
+typedef struct kz_Context   kz_Context;
+typedef struct kz_Stats     kz_Stats;
+typedef struct kz_Histogram kz_Histogram;
+typedef struct kz_FutexWait kz_FutexWait;
+typedef struct kz_Block     kz_Block;
+typedef struct kz_Bcast     kz_Bcast;
+typedef struct kz_Dir       kz_Dir;
 
 /* queue creation/destruction */
 
@@ -119,6 +141,7 @@ KZ_API kz_State *kz_open(const char *name, int flags, size_t bufsize);
 KZ_API void      kz_close(kz_State *S);
 
 KZ_API int kz_shutdown(kz_State *S, int mode);
+KZ_API int kz_resize(kz_State *S, size_t bufsize); /* owner only */
 
 /* queue info */
 
@@ -129,6 +152,22 @@ KZ_API int kz_pid(const kz_State *S);
 KZ_API int kz_isowner(const kz_State *S);
 KZ_API int kz_isclosed(const kz_State *S);
 
+KZ_API int kz_stats(const kz_State *S, kz_Stats *stats);
+
+/* dwell time of messages (`KZ_TIMESTAMP`), in nanoseconds */
+
+KZ_API int      kz_histogram(const kz_State *S, int mode, kz_Histogram *hist);
+KZ_API uint64_t kz_percentile(const kz_Histogram *hist, double q);
+KZ_API uint64_t kz_histbound(size_t bucket);
+
+/* priority lanes (`KZ_LANES()`), lane 0 is the channel itself and first
+ * drained by `kz_readlanes()`, which returns the lane read */
+
+KZ_API int       kz_lanes(const kz_State *S);
+KZ_API kz_State *kz_lane(kz_State *S, int lane);
+KZ_API int       kz_readlanes(kz_State *S, kz_Context *ctx);
+KZ_API int       kz_waitlanes(kz_State *S, int millis);
+
 /* read/write */
 
 #define kz_setnotify(ctx,v) ((ctx)->notify = (v))
@@ -141,12 +180,125 @@ KZ_API char *kz_buffer(kz_Context *ctx, size_t *plen);
 KZ_API int   kz_commit(kz_Context *ctx, size_t len);
 KZ_API void  kz_cancel(kz_Context *ctx);
 
+/* read cursor, `kz_next()` moves a read context to the following published
+ * message without committing, committing any of them consumes all the
+ * messages up to it */
+
+#define kz_peek(S,ctx) kz_read((S), (ctx))
+
+KZ_API int kz_next(kz_Context *ctx);
+
+/* large messages, written in chunks of at most `kz_chunksize()` bytes, all
+ * but the last one committed with `more` set */
+
+KZ_API size_t kz_chunksize(const kz_State *S);
+KZ_API int    kz_commitchunk(kz_Context *ctx, size_t len, int more);
+KZ_API int    kz_more(const kz_Context *ctx);
+
+/* payload arena (`kz_openarena()`), blocks shared by both sides, a block is
+ * sent by its descriptor through the queue, and freed by the receiver once
+ * done with it */
+
+KZ_API kz_State *kz_openarena(const char *name, int flags, size_t bufsize, size_t blocksize, size_t count);
+
+KZ_API size_t kz_blocksize(const kz_State *S);
+KZ_API int    kz_alloc(kz_State *S, kz_Block *blk);
+KZ_API char  *kz_blockdata(kz_State *S, const kz_Block *blk);
+KZ_API int    kz_free(kz_State *S, const kz_Block *blk);
+
+/* slot mode (`kz_openslots()`), the queues are arrays of equal slots with no
+ * record header, every message takes a whole slot and is read in place; the
+ * slots of a batch are contiguous up to the end of the ring, so a batch is
+ * moved by one `memcpy()` for each side of the wrap */
+
+KZ_API kz_State *kz_openslots(const char *name, int flags, size_t bufsize, size_t slotsize);
+
+KZ_API size_t kz_slotsize(const kz_State *S);
+
+/* batched read/write */
+
+KZ_API int kz_readv(kz_State *S, kz_Context *ctxs, size_t count, size_t budget);
+KZ_API int kz_writev(kz_State *S, kz_Context *ctxs, const size_t *lens, size_t count);
+KZ_API int kz_commitv(kz_Context *ctxs, size_t count);
+
+/* `kz_writev()` reserves the whole batch or nothing; on `KZ_AGAIN` the first
+ * context is left pending, `kz_waitcontext()` on it waits for the space of
+ * the batch without reserving any, and returns `KZ_OK` with the context
+ * still pending. Then `kz_cancel()` it and call `kz_writev()` again, which
+ * may still get `KZ_AGAIN` if `KZ_MPSC` writers took the space meanwhile:
+ *
+ *   while ((r = kz_writev(S, ctxs, lens, n)) == KZ_AGAIN) {
+ *       r = kz_waitcontext(ctxs, millis);
+ *       kz_cancel(ctxs);
+ *       if (r != KZ_OK) break;
+ *   }
+ */
+
 /* sync waiting */
 
 #define kz_wouldblock(ctx) ((ctx)->result == KZ_AGAIN)
 
 KZ_API int kz_wait(kz_State *S, size_t len, int millis);
 KZ_API int kz_waitcontext(kz_Context *ctx, int millis);
+KZ_API int kz_waitmany(kz_State **Ss, int *modes, size_t count, size_t len, int millis);
+
+KZ_API int kz_setspin(kz_State *S, int micros);
+
+/* wake coalescing of the writes, the reader is woken once `bytes` or `count`
+ * are committed (0 for no limit) or `micros` passed since the first commit
+ * not woken, checked by the commits and waits, so `kz_flush()` before going
+ * idle otherwise */
+
+KZ_API int kz_setcoalesce(kz_State *S, size_t bytes, size_t count, int micros);
+KZ_API int kz_flush(kz_State *S);
+
+/* pollable notification (`KZ_NOTIFY`, Linux), the fd of `kz_notifyfd()`
+ * polls readable once the peer may have made `mode` (`KZ_READ` or
+ * `KZ_WRITE`) ready, `kz_clearnotify()` it on wake, then register again */
+
+KZ_API int kz_notifyfd(const kz_State *S, int mode);
+KZ_API int kz_clearnotify(kz_State *S, int mode);
+KZ_API int kz_register(kz_State *S, int mode, size_t len);
+KZ_API int kz_unregister(kz_State *S, int mode);
+
+/* futex words to wait on out of line (Linux), e.g. by io_uring
+ * `IORING_OP_FUTEX_WAITV` (6.7+), returns the modes ready just like
+ * `kz_register()`, or 0 and `*pcount` words to wait on, then
+ * `kz_unregister()` once the wait completes in any way */
+
+#define KZ_FUTEXMAX 4 /* words filled by `kz_prepwait()` at most */
+
+KZ_API int kz_prepwait(kz_State *S, int mode, size_t len, kz_FutexWait *waits, size_t *pcount);
+
+/* broadcast ring (Unix), one writer opening with `KZ_CREATE`, up to
+ * `readers` readers joining by opening without it and leaving by
+ * `kz_bcclose()`; every reader gets every message sent after it joined;
+ * `KZ_DROP` overruns the lagging readers instead of blocking the writer,
+ * the flags of channels are not accepted */
+
+KZ_API kz_Bcast *kz_bcopen(const char *name, int flags, size_t bufsize, int readers);
+KZ_API void      kz_bcclose(kz_Bcast *B);
+
+KZ_API int      kz_bcsend(kz_Bcast *B, const void *data, size_t len);
+KZ_API int      kz_bcrecv(kz_Bcast *B, void *buf, size_t *plen);
+KZ_API int      kz_bcwait(kz_Bcast *B, size_t len, int millis);
+KZ_API int      kz_bcreaders(const kz_Bcast *B);
+KZ_API uint64_t kz_bcdropped(const kz_Bcast *B); /* bytes lost by reader */
+
+/* channel directory (Unix), one shm object of `size` bytes holding up to
+ * `count` named channels, each one opened by `kz_openat()` just like by
+ * `kz_open()`, `KZ_CREATE` carving it from the directory; channels live as
+ * long as the directory, names are at most 51 bytes */
+
+KZ_API kz_Dir   *kz_opendir(const char *name, int flags, size_t size, size_t count);
+KZ_API void      kz_closedir(kz_Dir *D); /* open channels keep it mapped */
+KZ_API kz_State *kz_openat(kz_Dir *D, const char *name, int flags, size_t bufsize);
+
+/* local channel (Unix), both sides in anonymous memory of this process for
+ * its threads, waiting on private futexes; `Ss[0]` is the owner side and
+ * `Ss[1]` the user side, each one closed by `kz_close()` */
+
+KZ_API int kz_openlocal(int flags, size_t bufsize, kz_State **Ss);
 
 /* object definitions */
 
@@ -159,6 +311,48 @@ struct kz_Context {
     int32_t notify; /* whether notify opposite */
 };
 
+typedef struct kz_QueueStats {
+    uint64_t pushes;      /* messages committed by the writers */
+    uint64_t pops;        /* messages committed by the reader */
+    uint64_t push_bytes;  /* payload bytes of `pushes` */
+    uint64_t pop_bytes;   /* payload bytes of `pops` */
+    uint32_t push_sleeps; /* waits of the writers slept in the kernel */
+    uint32_t pop_sleeps;  /* waits of the reader slept in the kernel */
+    uint32_t push_wakes;  /* wakes issued by the writers */
+    uint32_t pop_wakes;   /* wakes issued by the reader */
+    uint32_t push_again;  /* `KZ_AGAIN` results of the writers */
+    uint32_t pop_again;   /* `KZ_AGAIN` results of the reader */
+    uint32_t push_busy;   /* `KZ_BUSY` results of the writers */
+    uint32_t pop_busy;    /* `KZ_BUSY` results of the reader */
+    uint32_t peak;        /* high-water mark of the bytes used */
+    uint32_t size;        /* size of the queue */
+    uint32_t used;        /* bytes used at the time of the call */
+} kz_QueueStats;
+
+struct kz_Stats {
+    kz_QueueStats write; /* the queue written by this side */
+    kz_QueueStats read;  /* the queue read by this side */
+};
+
+struct kz_Histogram {
+    uint64_t count; /* messages recorded */
+    uint64_t sum;   /* total dwell time of `count` */
+    uint32_t buckets[KZ_HISTMAX]; /* log-linear, see `kz_histbound()` */
+};
+
+struct kz_Block {
+    uint32_t offset; /* offset of the block in the arena */
+    uint32_t len;    /* bytes of the payload, set by the writer */
+    uint32_t gen;    /* generation of the block, stale after freed */
+};
+
+struct kz_FutexWait { /* layout of `struct futex_waitv` */
+    uint64_t val;      /* value of the word seen before the wait */
+    uint64_t uaddr;    /* address of the word in the mapping */
+    uint32_t flags;    /* `FUTEX2_SIZE_U32`, `FUTEX2_PRIVATE` if local */
+    uint32_t reserved; /* always 0 */
+};
+
 
 KZ_NS_END
 
@@ -180,42 +374,121 @@ KZ_NS_END
 #else
 # ifdef __linux__
 #   include <linux/futex.h> /* Definition of FUTEX_* constants */
+#   include <linux/magic.h> /* for HUGETLBFS_MAGIC */
+#   include <pthread.h>     /* for the peer watcher */
+#   include <sys/epoll.h>   /* for epoll_create1() */
+#   include <sys/eventfd.h> /* for eventfd() */
 #   include <sys/syscall.h> /* Definition of SYS_* constants */
+#   include <sys/vfs.h>     /* for statfs() */
 #   include <time.h>        /* Definition of CLOCK_* constants */
 #   include <unistd.h>
 # endif
 # include <fcntl.h>  /* for O_* macros */
 # include <limits.h> /* for INT_MAX */
+# include <sched.h>  /* for sched_yield() */
 # include <signal.h> /* for kill() */
+# include <stdio.h>  /* for snprintf() */
 # include <sys/mman.h>
 # include <sys/stat.h>
+# include <time.h>   /* for clock_gettime() */
 # include <unistd.h>
 #endif
 
+#if defined(_WIN32)
+# define kz_pause() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+# define kz_pause() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+# define kz_pause() __asm__ __volatile__("yield")
+#else
+# define kz_pause() ((void)0)
+#endif
+
+#ifdef _WIN32
+# define kz_yield() SwitchToThread()
+#else
+# define kz_yield() sched_yield()
+#endif
+
+#if defined(__linux__) && defined(SYS_futex_waitv) \
+        && defined(SYS_set_robust_list) && !defined(KZ_NO_WATCHER)
+# define KZ_USE_WATCHER 1 /* close the channel when the peer exits */
+#endif
+
 #define KZ_ALIGN    sizeof(uint32_t)
 #define KZ_MARK     ((uint32_t)KZ_MAX_SIZE)
 #define KZ_WAITREAD ((uint32_t)KZ_MAX_SIZE) /* used in `need` */
+#define KZ_PENDING  ((uint32_t)KZ_MAX_SIZE - 1) /* reserved, not committed */
+#define KZ_CLOSING  ((uint32_t)KZ_MAX_SIZE) /* pid of a side being closed */
+#define KZ_BATCH    ((size_t)-1) /* `pos` of a pending `kz_writev()` batch */
+#define KZ_SKIP     ((uint32_t)1 << 31) /* discarded record, with its length */
+#define KZ_MORE     ((uint32_t)1 << 30) /* more chunks of the message follow */
+#define KZ_PARKED   2 /* busy word of a waiting reader, see `kzQ_park()` */
+#define KZ_MOVING   3 /* parked, and held by `kz_resize()` */
+#define KZ_LANEMASK KZ_LANES(8)
+#define KZ_HASARENA (1 << 15) /* created by `kz_openarena()`, below KZ_* */
+#define KZ_LOCAL    (1 << 14) /* `kz_openlocal()`, waits on private futexes */
+#define KZ_SHMFLAGS                                             \
+    (KZ_MPSC | KZ_NOTIFY | KZ_HUGEPAGE | KZ_MIRROR | KZ_INDEXED \
+     | KZ_TIMESTAMP | KZ_LANEMASK | KZ_HASARENA | KZ_RESIZABLE)
+
+#define KZ_SPINDEFAULT 50     /* default spin budget in microseconds */
+#define KZ_SPINMIN     1000   /* minimal spin time in nanoseconds */
+#define KZ_SPINCHECK   64     /* spin iterations between clock checks */
+#define KZ_WAITSLICE   10     /* `kz_waitmany()` polling slice in millis */
+
+#ifndef KZ_HUGETLBFS
+# define KZ_HUGETLBFS "/dev/hugepages" /* hugetlbfs mount for `KZ_HUGEPAGE` */
+#endif
+
+#ifndef KZ_RESIZEMAX /* address space mapped for `kz_resize()` to grow into */
+# define KZ_RESIZEMAX (sizeof(void *) < 8 ? 0 : (size_t)1 << 30)
+#endif
+#define KZ_NORESIZE (KZ_HUGEPAGE | KZ_MIRROR | KZ_LANEMASK | KZ_HASARENA)
 
 KZ_NS_BEGIN
 
-typedef struct kzQ_ShmInfo {
+typedef struct kzQ_ShmStats {
     /* clang-format on */
+    uint64_t count;  /* Messages committed. */
+    uint64_t bytes;  /* Payload bytes of the messages. */
+    uint32_t sleeps; /* Waits slept in the kernel. */
+    uint32_t wakes;  /* Wakes issued to the peer. */
+    uint32_t again;  /* `KZ_AGAIN` results, rechecks in waits included. */
+    uint32_t busy;   /* `KZ_BUSY` results. */
+} kzQ_ShmStats;
+
+typedef struct kzQ_ShmInfo {
     uint32_t size;    /* Size of the queue. */
-    uint32_t used;    /* Number of bytes used in the queue (-1 == closed). */
+    uint32_t used;    /* Number of bytes used in the queue (-1 == closed),
+                       * commit counter for `KZ_MPSC`. */
     uint32_t reading; /* Whether the queue is being read. */
     uint32_t head;    /* Head of the queue. */
     uint32_t seq;     /* Operation sequence index, used by `kz_wait()`. */
-    uint32_t padding1[11];
-    uint32_t need;    /* Bytes need by `kz_write`. */
-    uint32_t writing; /* Whether the queue is being written to. */
-    uint32_t tail;    /* Tail of the queue. */
-    uint32_t waiters; /* Number of `kz_wait()` waiters on the queue. */
-    uint32_t padding2[12];
+    uint32_t notify;   /* User's eventfd + 1 signaled to the reader. */
+    uint32_t wnotify;  /* User's eventfd + 1 signaled to the writers. */
+    uint32_t gen;      /* Generation of the layout, see `kz_resize()`. */
+    kzQ_ShmStats rstats; /* Counters of the reader. */
+    uint32_t need;     /* Bytes need by `kz_write`. */
+    uint32_t writing;  /* Whether the queue is being written to. */
+    uint32_t tail;     /* Tail of the queue. */
+    uint32_t waiters;  /* Number of `kz_wait()` waiters on the queue. */
+    uint32_t reserved; /* Bytes reserved by writers (`KZ_MPSC` only). */
+    uint32_t pushers;  /* Writers waiting for space (`KZ_MPSC` only). */
+    uint32_t peak;     /* High-water mark of the bytes used. */
+    uint32_t slot;     /* Size of a slot, 0 for records (`kz_openslots()`). */
+    kzQ_ShmStats wstats; /* Counters of the writers. */
 } kzQ_ShmInfo;
 
+typedef struct kz_ShmLive {
+    uint64_t link;    /* `struct robust_list` of the watcher of the side. */
+    uint32_t tid;     /* Thread id of the watcher, a robust futex word. */
+    uint32_t pid;     /* Process of the watcher, stored after `tid`. */
+} kz_ShmLive;
+
 typedef struct kz_ShmHdr {
-    uint32_t size;      /* Size of the shared memory. 4GB max. */
-    uint32_t _offset;   /* Offset of the second queue buffer. */
+    uint32_t size;      /* Size of the shared memory (of a lane). 4GB max. */
+    uint32_t flags;     /* `KZ_SHMFLAGS` given at creation. */
     uint32_t owner_pid; /* Owner process id. */
     uint32_t user_pid;  /* User process id. */
 
@@ -224,17 +497,80 @@ typedef struct kz_ShmHdr {
      * for user, queues[0] is the receiving queue,
      * queues[1] is the sending queue */
     kzQ_ShmInfo queues[2];
+    uint32_t    notify_pid; /* User publishing the eventfds (`KZ_NOTIFY`). */
+    uint32_t    notified;   /* User whose eventfds the owner imported. */
+    uint32_t    owner_map;  /* Bytes mapped by the owner, see `kz_resize()`. */
+    uint32_t    user_map;   /* Bytes mapped by the user, 0 if none. */
+    kz_ShmLive  live[2];    /* Owner's and user's, see `kz_watcher()`. */
 } kz_ShmHdr;
 
+#define KZ_CONCAT_(a, b) a##b
+#define KZ_CONCAT(a, b)  KZ_CONCAT_(a, b) /* expands `a` and `b` first */
 #define KZ_STATIC_ASSERT(cond) \
-    typedef char __kz_static_assert_##__LINE__[(cond) ? 1 : -1]
+    typedef char KZ_CONCAT(kz_static_assert_, __LINE__)[(cond) ? 1 : -1]
 
-KZ_STATIC_ASSERT(sizeof(kz_ShmHdr) == 256 + 16);
+KZ_STATIC_ASSERT(sizeof(kz_ShmHdr) == 256 + 64);
+#ifdef SYS_futex_waitv
+KZ_STATIC_ASSERT(sizeof(kz_FutexWait) == sizeof(struct futex_waitv));
+#endif
+
+/* `KZ_INDEXED` queues keep the words changed on every operation on a cache
+ * line of the side changing it, `kzQ_ShmInfo` is only written on waits and
+ * closing. The indices run in [0, size*2) to tell a full queue from an
+ * empty one. */
+typedef struct kzQ_ShmIndex {
+    uint32_t     tail;    /* Writer's index, owned by the writer. */
+    uint32_t     writing; /* Whether the queue is being written to. */
+    uint32_t     peak;    /* High-water mark of the bytes used. */
+    uint32_t     padding1[1];
+    kzQ_ShmStats wstats;  /* Counters of the writer. */
+    uint32_t     padding2[4];
+    uint32_t     head;    /* Reader's index, owned by the reader. */
+    uint32_t     reading; /* Whether the queue is being read. */
+    uint32_t     padding3[2];
+    kzQ_ShmStats rstats;  /* Counters of the reader. */
+    uint32_t     padding4[4];
+} kzQ_ShmIndex;
+
+#define KZ_INDEXOFF ((sizeof(kz_ShmHdr) + 63) & ~(size_t)63)
+#define KZ_INDEXEND (KZ_INDEXOFF + sizeof(kzQ_ShmIndex) * 2)
+
+/* `KZ_TIMESTAMP` records carry the time they are committed after the length,
+ * the reader adds the time they stayed in the queue to the histogram of the
+ * queue when it commits them. The histograms follow the indices. */
+typedef struct kzQ_ShmHist {
+    uint64_t count; /* Messages recorded. */
+    uint64_t sum;   /* Total dwell time in nanoseconds. */
+    uint32_t buckets[KZ_HISTMAX]; /* See `kz_histbound()`. */
+} kzQ_ShmHist;
+
+#define KZ_STAMPHDR (sizeof(uint32_t) + sizeof(uint64_t))
+#define KZ_HISTOFF(flags) ((flags) & KZ_INDEXED ? KZ_INDEXEND : KZ_INDEXOFF)
+
+/* The arena of `kz_openarena()` takes the end of the shared memory, after
+ * the queues: a generation word for each block, the bitmap of the blocks
+ * taken, then the blocks on cache lines. Its header follows the rest. */
+typedef struct kzQ_ShmArena {
+    uint32_t offset;    /* Offset of the arena from the header. */
+    uint32_t blocksize; /* Size of a block, in cache lines. */
+    uint32_t count;     /* Number of blocks. */
+    uint32_t hint;      /* Bitmap word last taken from. */
+} kzQ_ShmArena;
+
+#define KZ_ARENAWORDS(count) (((count) + 31) / 32)
+#define KZ_ARENAMETA(count) \
+    kz_get_aligned_size(((count) + KZ_ARENAWORDS(count)) * 4, 64)
 
 typedef struct kzQ_State {
-    kz_State    *S;    /* Pointer to kz_State that owns this state */
-    kzQ_ShmInfo *info; /* Pointer to queue state in shm */
-    char        *data; /* Pointer to data start */
+    kz_State     *S;     /* Pointer to kz_State that owns this state */
+    kzQ_ShmInfo  *info;  /* Pointer to queue state in shm */
+    kzQ_ShmIndex *index; /* Pointer to queue indices, `KZ_INDEXED` only */
+    kzQ_ShmHist  *hist;  /* Pointer to dwell histogram, `KZ_TIMESTAMP` only */
+    char         *data;  /* Pointer to data start */
+    uint32_t      spin;  /* Estimated wait time in nanoseconds */
+    uint32_t      peer;  /* Cached index of the peer, `KZ_INDEXED` only */
+    uint32_t      gen;   /* Cached `gen` of the layout `data` is for */
+    uint32_t      slot;  /* Cached `slot` of the queue, 0 for records */
 #ifdef _WIN32
     HANDLE can_push;
     HANDLE can_pop;
@@ -255,21 +591,50 @@ struct kz_State {
 #else
     int self_pid;
     int shm_fd;
+    int event_fds[2];  /* Eventfds signaled to this side (`KZ_NOTIFY`). */
+    int signal_fds[2]; /* Eventfds signaled to the peer. */
+    int epoll_fds[2];  /* Owner's fds polling `event_fds`, -1 for user. */
+    uint32_t notify_pid;  /* User whose eventfds the owner imported. */
+    uint32_t notify_fail; /* User whose eventfds can not be imported. */
+    uint32_t importing;   /* Whether the owner is importing them. */
+#endif
+#ifdef KZ_USE_WATCHER
+    struct kz_Watcher *watcher; /* Closing the channel on peer exit. */
 #endif
     size_t     shm_size;
+    size_t     map_size; /* Size of the mapping, see `kz_reserveshm()` */
     kz_ShmHdr *hdr;
     kzQ_State  write;
     kzQ_State  read;
+    uint32_t   flags;    /* Copy of `hdr->flags` */
+    uint32_t   spin;     /* Spin budget in nanoseconds, 0 for no spinning */
+    uint32_t   spin_mux; /* Estimated wait time of `kz_wait()` */
+    uint32_t   coalesce; /* Longest delay of a wake in nanos, 0 for none */
+    uint32_t   co_count; /* Messages to wake the reader, 0 for no limit */
+    uint64_t   co_bytes; /* Bytes to wake the reader, 0 for no limit */
+    uint64_t   co_since; /* Time of the first commit not woken yet, or 0 */
+    uint64_t   woke_count; /* `count` of the write stats at the last wake */
+    uint64_t   woke_bytes; /* `bytes` of the write stats at the last wake */
+    kzQ_ShmArena *arena; /* Arena of `kz_openarena()`, or NULL */
+    uint32_t   arena_block; /* Block size of the arena to create */
+    uint32_t   arena_count; /* Blocks of the arena to create */
+    uint32_t   slot_size;   /* Slot size of the queues to create */
+    kz_Dir    *dir;      /* Directory of `kz_openat()`, or NULL */
+    kz_State **lanes;    /* All lanes of `KZ_LANES()`, owned by lane 0 */
+    int        lane;     /* Index of this lane */
     size_t     name_len;
     char       name_buf[1];
 };
 
 /* utils */
 
-static int kz_pidexists(int pid);
+static int    kz_pidexists(int pid);
+static size_t kz_pagesize(void);
+static size_t kz_shmpagesize(kz_State *S);
 
-static int kz_checkpid(kz_State *S, uint32_t *pid) {
-    return *pid == 0 || (int)*pid == S->self_pid || !kz_pidexists(*pid);
+static int kz_islocal(const kz_State *S) {
+    /* both sides in this process, the futexes are private */
+    return (S->flags & KZ_LOCAL) != 0;
 }
 
 static int kz_checksize(kz_State *S) {
@@ -277,6 +642,13 @@ static int kz_checksize(kz_State *S) {
     return queue_size >= sizeof(uint32_t) * 2 && S->shm_size < KZ_MAX_SIZE;
 }
 
+static void kz_touch(kz_State *S, size_t size) {
+    /* a read fault allocates the page of shm, the data is untouched */
+    volatile const char *p = (volatile const char *)S->hdr;
+    size_t               i, pagesize = kz_pagesize();
+    for (i = 0; i < size; i += pagesize) (void)p[i];
+}
+
 static int kz_is_aligned_to(size_t size, size_t align) {
     assert((align & (align - 1)) == 0);
     return (size & (align - 1)) == 0;
@@ -287,15 +659,29 @@ static size_t kz_get_aligned_size(size_t size, size_t align) {
     return (size + align - 1) & ~(align - 1);
 }
 
-static uint32_t kz_read_u32le(const char *data) {
-    uint32_t n;
-#ifdef __BIG_ENDIAN__
-    memcpy(&n, data, sizeof(n));
-    n = __builtin_bswap32(n);
+static unsigned kz_log2(uint64_t v) {
+    assert(v != 0);
+#if defined(_MSC_VER)
+    unsigned long r;
+    _BitScanReverse64(&r, v);
+    return (unsigned)r;
+#elif defined(__GNUC__)
+    return 63 - (unsigned)__builtin_clzll(v);
 #else
-    memcpy(&n, data, sizeof(n));
+    unsigned r = 0;
+    while (v >>= 1) ++r;
+    return r;
 #endif
-    return n;
+}
+
+static size_t kz_histbucket(uint64_t v) {
+    /* exact below 16, then 8 buckets for each power of two */
+    unsigned e;
+    size_t   b;
+    if (v < 16) return (size_t)v;
+    e = kz_log2(v);
+    b = 16 + (size_t)(e - 4) * 8 + (size_t)((v >> (e - 3)) & 7);
+    return b < KZ_HISTMAX ? b : KZ_HISTMAX - 1;
 }
 
 static void kz_write_u32le(char *data, uint32_t n) {
@@ -305,8 +691,108 @@ static void kz_write_u32le(char *data, uint32_t n) {
     memcpy(data, &n, sizeof(n));
 }
 
-static int kz_initqueues(kz_State *S);
-static int kz_resetqueues(kz_State *S);
+static size_t kz_arenaoff(uint32_t flags);
+
+static size_t kz_hdrsize(uint32_t flags) {
+    /* bytes before the data, including the indices of `KZ_INDEXED`, the
+     * histograms of `KZ_TIMESTAMP` and the arena header */
+    if ((flags & KZ_HASARENA))
+        return kz_arenaoff(flags) + sizeof(kzQ_ShmArena);
+    if ((flags & KZ_TIMESTAMP))
+        return KZ_HISTOFF(flags) + sizeof(kzQ_ShmHist) * 2;
+    return (flags & KZ_INDEXED) ? KZ_INDEXEND : sizeof(kz_ShmHdr);
+}
+
+static void kz_clearhdr(kz_ShmHdr *hdr, uint32_t flags) {
+    /* all but the `live` words, the robust lists of the watchers link them */
+    size_t live = offsetof(kz_ShmHdr, live), end = live + sizeof(hdr->live);
+    memset(hdr, 0, live);
+    memset((char *)hdr + end, 0, kz_hdrsize(flags) - end);
+}
+
+static size_t kz_arenaoff(uint32_t flags)
+{ return kz_get_aligned_size(kz_hdrsize(flags & ~KZ_HASARENA), 64); }
+
+static size_t kz_arenasize(uint32_t blocksize, uint32_t count)
+{ return count ? KZ_ARENAMETA(count) + (size_t)blocksize * count : 0; }
+
+static size_t kz_lanecount(uint32_t flags)
+{ return (size_t)((flags & KZ_LANEMASK) >> 28) + 1; }
+
+static size_t kz_lanesize(size_t size, uint32_t flags) {
+    /* every lane is a whole channel image, starts on its own cache line */
+    size_t n = kz_lanecount(flags);
+    return n > 1 ? (size / n) & ~(size_t)63 : size;
+}
+
+static void kz_freelanes(kz_State *S) {
+    size_t i, n = kz_lanecount(S->flags);
+    if (S->lanes == NULL) return;
+    for (i = 1; i < n; ++i) free(S->lanes[i]);
+    free(S->lanes);
+    S->lanes = NULL;
+}
+
+static void kz_shutdownlanes(kz_State *S, int mode) {
+    size_t i, n = kz_lanecount(S->flags);
+    if (S->lanes == NULL) return;
+    for (i = 1; i < n; ++i) kz_shutdown(S->lanes[i], mode);
+}
+
+static size_t kzQ_hdrlen(const kzQ_State *QS) {
+    /* bytes before the payload of a record, skipped records are never
+     * stamped, slots have no header */
+    if (QS->slot) return 0;
+    return (QS->S->flags & KZ_TIMESTAMP) ? KZ_STAMPHDR : sizeof(uint32_t);
+}
+
+static uint32_t kzQ_recsize(const kzQ_State *QS, size_t len) {
+    /* bytes a record of `len` takes in the queue, `KZ_MAX_SIZE` if it does
+     * not fit in a slot */
+    if (QS->slot) return len <= QS->slot ? QS->slot : KZ_MAX_SIZE;
+    return (uint32_t)kz_get_aligned_size(len + kzQ_hdrlen(QS), KZ_ALIGN);
+}
+
+static uint32_t *kzQ_spaceword(kzQ_State *QS) {
+    /* the word changes when space is freed, `KZ_MPSC` writers account the
+     * space by reservations */
+    if (QS->index) return &QS->index->head;
+    return (QS->S->flags & KZ_MPSC) ? &QS->info->reserved : &QS->info->used;
+}
+
+static uint32_t *kzQ_dataword(kzQ_State *QS) {
+    /* the word changes when data is published */
+    return QS->index ? &QS->index->tail : &QS->info->used;
+}
+
+static uint32_t *kzQ_sideword(kzQ_State *QS, int isread) {
+    if (QS->index) return isread ? &QS->index->reading : &QS->index->writing;
+    return isread ? &QS->info->reading : &QS->info->writing;
+}
+
+static uint32_t *kzQ_busyword(kzQ_State *QS)
+{ return kzQ_sideword(QS, QS == &QS->S->read); }
+
+static kzQ_ShmStats *kzQ_sidestats(const kzQ_State *QS, int isread) {
+    /* the counters live on the cache line of the side updating them */
+    if (QS->index) return isread ? &QS->index->rstats : &QS->index->wstats;
+    return isread ? &QS->info->rstats : &QS->info->wstats;
+}
+
+static kzQ_ShmStats *kzQ_stats(kzQ_State *QS)
+{ return kzQ_sidestats(QS, QS == &QS->S->read); }
+
+static uint32_t *kzQ_peakword(const kzQ_State *QS)
+{ return QS->index ? &QS->index->peak : &QS->info->peak; }
+
+static void kz_setowner(kz_State *S, int isowner);
+static int  kz_initqueues(kz_State *S);
+static int  kz_resetqueues(kz_State *S);
+static int  kz_initlanes(kz_State *S, int created);
+
+#ifndef _WIN32
+static void kzD_release(kz_Dir *D);
+#endif
 
 static int kzQ_checkclosed(const kzQ_State *QS, uint32_t used);
 static int kzQ_push(kz_Context *ctx, uint32_t used);
@@ -343,16 +829,39 @@ static uint32_t kzA_subfetch(uint32_t *ptr, uint32_t delta)
 static uint32_t kzA_subfetchR(uint32_t *ptr, uint32_t delta)
 { return __atomic_sub_fetch(ptr, delta, __ATOMIC_RELAXED); }
 
+static int kzA_cmpandswap(uint32_t *state, uint32_t expected, uint32_t desired) {
+    return __atomic_compare_exchange_n(
+            state, &expected, desired, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
 static int kzA_cmpandswapR(uint32_t *state, uint32_t expected, uint32_t desired) {
     return __atomic_compare_exchange_n(
             state, &expected, desired, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
 }
+
+static uint64_t kzA_load64(uint64_t *ptr)
+{ return __atomic_load_n(ptr, __ATOMIC_ACQUIRE); }
+
+static uint64_t kzA_load64R(uint64_t *ptr)
+{ return __atomic_load_n(ptr, __ATOMIC_RELAXED); }
+
+static void kzA_store64(uint64_t *ptr, uint64_t val)
+{ __atomic_store_n(ptr, val, __ATOMIC_RELEASE); }
+
+static void kzA_store64R(uint64_t *ptr, uint64_t val)
+{ __atomic_store_n(ptr, val, __ATOMIC_RELAXED); }
+
+static uint64_t kzA_fetchadd64R(uint64_t *ptr, uint64_t delta)
+{ return __atomic_fetch_add(ptr, delta, __ATOMIC_RELAXED); }
+
+static void kzA_fence(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
 /* clang-format on */
 
 /* waiting operations */
 
 #if defined(__APPLE__)
 /* see <bsd/sys/ulock.h>, this is not public API */
+#define UL_COMPARE_AND_WAIT        1
 #define UL_COMPARE_AND_WAIT_SHARED 3
 #define ULF_WAKE_ALL               0x00000100
 
@@ -418,23 +927,22 @@ static int kz_futex_waitv(struct futex_waitv *waiters, int count, int millis) {
 }
 #endif
 
-static int kz_futex_wait(void *addr, uint32_t ifValue, int millis) {
+static int kz_futex_wait(void *addr, uint32_t ifValue, int millis, int local) {
 #if defined(__APPLE__)
-    int r;
+    uint32_t flags = local ? 0 : OS_SYNC_WAIT_ON_ADDRESS_SHARED;
+    int      r;
     if (os_sync_wait_on_address_with_timeout && USE_OS_SYNC_WAIT_ON_ADDRESS) {
         if (millis <= 0)
             r = os_sync_wait_on_address(
-                    (void *)addr, (uint64_t)ifValue, 4,
-                    OS_SYNC_WAIT_ON_ADDRESS_SHARED);
+                    (void *)addr, (uint64_t)ifValue, 4, flags);
         else
             r = os_sync_wait_on_address_with_timeout(
-                    (void *)addr, (uint64_t)ifValue, 4,
-                    OS_SYNC_WAIT_ON_ADDRESS_SHARED, OS_CLOCK_MACH_ABSOLUTE_TIME,
-                    millis * 1000 * 1000);
+                    (void *)addr, (uint64_t)ifValue, 4, flags,
+                    OS_CLOCK_MACH_ABSOLUTE_TIME, millis * 1000 * 1000);
     } else if (__ulock_wait)
         r = __ulock_wait(
-                UL_COMPARE_AND_WAIT_SHARED, (void *)addr, (uint64_t)ifValue,
-                millis * 1000);
+                local ? UL_COMPARE_AND_WAIT : UL_COMPARE_AND_WAIT_SHARED,
+                (void *)addr, (uint64_t)ifValue, millis * 1000);
     else
         return (errno = ENOTSUP), KZ_FAIL;
 
@@ -456,7 +964,9 @@ static int kz_futex_wait(void *addr, uint32_t ifValue, int millis) {
         struct timespec ts;
         ts.tv_sec = millis / 1000;
         ts.tv_nsec = (millis % 1000) * 1000000;
-        r = syscall(SYS_futex, (void *)addr, FUTEX_WAIT, ifValue, &ts, NULL, 0);
+        r = syscall(SYS_futex, (void *)addr,
+                    local ? FUTEX_WAIT_PRIVATE : FUTEX_WAIT, ifValue, &ts,
+                    NULL, 0);
     }
 
     if (r >= 0) return KZ_OK;
@@ -466,30 +976,30 @@ static int kz_futex_wait(void *addr, uint32_t ifValue, int millis) {
     return KZ_FAIL;
 
 #else
+    (void)local;
     errno = ENOTSUP;
     return KZ_FAIL;
 #endif
 }
 
-static int kz_futex_wake(void *addr, int wakeAll) {
+static int kz_futex_wake(void *addr, int wakeAll, int local) {
 #if defined(__APPLE__)
-    int r;
+    uint32_t flags = local ? 0 : OS_SYNC_WAKE_BY_ADDRESS_SHARED;
+    uint32_t op = local ? UL_COMPARE_AND_WAIT : UL_COMPARE_AND_WAIT_SHARED;
+    int      r;
 redo:
     if (wakeAll) {
         if (os_sync_wake_by_address_all && USE_OS_SYNC_WAIT_ON_ADDRESS)
-            r = os_sync_wake_by_address_all(
-                    addr, 4, OS_SYNC_WAKE_BY_ADDRESS_SHARED);
+            r = os_sync_wake_by_address_all(addr, 4, flags);
         else if (__ulock_wake)
-            r = __ulock_wake(
-                    UL_COMPARE_AND_WAIT_SHARED | ULF_WAKE_ALL, addr, 0);
+            r = __ulock_wake(op | ULF_WAKE_ALL, addr, 0);
         else
             return (errno = ENOTSUP), KZ_FAIL;
     } else {
         if (os_sync_wake_by_address_any && USE_OS_SYNC_WAIT_ON_ADDRESS)
-            r = os_sync_wake_by_address_any(
-                    (void *)addr, 4, OS_SYNC_WAKE_BY_ADDRESS_SHARED);
+            r = os_sync_wake_by_address_any((void *)addr, 4, flags);
         else if (__ulock_wake)
-            r = __ulock_wake(UL_COMPARE_AND_WAIT_SHARED, (void *)addr, 0);
+            r = __ulock_wake(op, (void *)addr, 0);
         else
             return (errno = ENOTSUP), KZ_FAIL;
     }
@@ -500,27 +1010,417 @@ redo:
 
 #elif defined(__linux__)
     long r = syscall(
-            SYS_futex, (void *)addr, FUTEX_WAKE, (wakeAll ? INT_MAX : 1), NULL,
-            NULL, 0);
+            SYS_futex, (void *)addr, local ? FUTEX_WAKE_PRIVATE : FUTEX_WAKE,
+            (wakeAll ? INT_MAX : 1), NULL, NULL, 0);
     if (r >= 0) return KZ_OK;
     if (errno == ENOSYS) errno = ENOTSUP;
     return KZ_FAIL;
 
 #else
-    (void)addr, (void)wakeAll;
+    (void)addr, (void)wakeAll, (void)local;
+    errno = ENOTSUP;
+    return KZ_FAIL;
+#endif
+}
+
+static uint64_t kz_now(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) return 0;
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int kz_cpucount(void) { return (int)sysconf(_SC_NPROCESSORS_ONLN); }
+
+/* notification operations */
+
+#if defined(__linux__) && defined(SYS_pidfd_getfd)
+# define KZ_USE_EVENTFD 1
+#endif
+
+static void kz_signal(int fd) {
+    uint64_t one = 1;
+    ssize_t  r = fd < 0 ? 0 : write(fd, &one, sizeof(one));
+    (void)r; /* a full counter is signaled already */
+}
+
+static void kz_closenotify(kz_State *S) {
+    int i;
+    for (i = 0; i < 6; ++i) {
+        int *fd = i < 2 ? &S->event_fds[i]
+                : i < 4 ? &S->signal_fds[i - 2] : &S->epoll_fds[i - 4];
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+    }
+}
+
+#ifdef KZ_USE_EVENTFD
+static void kz_installfd(int *slot, int fd) {
+    /* a later user replaces the fds under the numbers in use, so pollers
+     * and signalers never see them closed */
+    if (*slot < 0) {
+        *slot = fd;
+        return;
+    }
+    if (dup2(fd, *slot) >= 0) fcntl(*slot, F_SETFD, FD_CLOEXEC);
+    close(fd);
+}
+#endif
+
+static void kz_importnotify(kz_State *S, uint32_t pid) {
+#ifdef KZ_USE_EVENTFD
+    /* the user creates the eventfds, so the owner takes them: the host is
+     * usually a child of the owner, and a parent may take the fds of its
+     * children under Yama `ptrace_scope` 1, but not the other way */
+    uint32_t words[4];
+    int      fds[4], i, n = 0, pidfd;
+    if (pid == S->notify_fail || !kzA_cmpandswap(&S->importing, 0, 1))
+        return;
+    words[0] = kzA_load(&S->read.info->notify);
+    words[1] = kzA_load(&S->write.info->wnotify);
+    words[2] = kzA_load(&S->write.info->notify);
+    words[3] = kzA_load(&S->read.info->wnotify);
+    pidfd = (int)syscall(SYS_pidfd_open, (pid_t)pid, 0);
+    for (n = 0; pidfd >= 0 && n < 4 && words[n] != 0; ++n) {
+        fds[n] = (int)syscall(SYS_pidfd_getfd, pidfd, (int)words[n] - 1, 0);
+        if (fds[n] < 0) break;
+    }
+    if (pidfd >= 0) close(pidfd);
+    if (n == 4 && kzA_load(&S->hdr->notify_pid) == pid) {
+        for (i = 0; i < 2; ++i) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN, ev.data.u64 = 0;
+            if (S->event_fds[i] >= 0)
+                epoll_ctl(S->epoll_fds[i], EPOLL_CTL_DEL, S->event_fds[i], 0);
+            kz_installfd(&S->event_fds[i], fds[i]);
+            kz_installfd(&S->signal_fds[i], fds[i + 2]);
+            epoll_ctl(S->epoll_fds[i], EPOLL_CTL_ADD, S->event_fds[i], &ev);
+        }
+        kzA_store(&S->notify_pid, pid);
+        kzA_store(&S->hdr->notified, pid);
+    } else { /* the waiters fallback to the blocking waits */
+        for (i = 0; i < n; ++i) close(fds[i]);
+        S->notify_fail = pid;
+    }
+    kzA_store(&S->importing, 0);
+#else
+    (void)S, (void)pid;
+#endif
+}
+
+static int kz_cannotify(kz_State *S) {
+    /* the user waits for the owner to import its eventfds, the owner
+     * imports them from every new user it sees */
+    uint32_t pid = kzA_loadR(&S->hdr->notify_pid);
+    if (S->epoll_fds[0] < 0)
+        return S->event_fds[0] >= 0 && pid == (uint32_t)S->self_pid
+            && kzA_load(&S->hdr->notified) == pid;
+    if (pid != 0 && (kzA_load(&S->hdr->notified) != pid
+                     || kzA_loadR(&S->notify_pid) != pid))
+        kz_importnotify(S, pid);
+    return pid != 0 && kzA_loadR(&S->notify_pid) == pid
+        && kzA_load(&S->hdr->notified) == pid;
+}
+
+static void kz_signalpeer(kz_State *S, int i) {
+    /* `i` is 0 for the peer reader, 1 for the peer writers */
+    if (S->signal_fds[i] >= 0 || S->epoll_fds[0] >= 0)
+        if (kz_cannotify(S)) kz_signal(S->signal_fds[i]);
+}
+
+static int kz_initnotify(kz_State *S, int isowner) {
+#ifdef KZ_USE_EVENTFD
+    int i;
+    if (isowner) {
+        /* the users come and go, so the owner polls their eventfds by
+         * epolls of its own */
+        for (i = 0; i < 2; ++i)
+            if ((S->epoll_fds[i] = epoll_create1(EPOLL_CLOEXEC)) < 0)
+                return KZ_FAIL;
+        (void)kz_cannotify(S); /* import from the user opened already */
+        return KZ_OK;
+    }
+    kzA_store(&S->hdr->notify_pid, 0); /* the owner imports them again */
+    kzA_store(&S->hdr->notified, 0);
+    for (i = 0; i < 2; ++i) {
+        S->event_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        S->signal_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (S->event_fds[i] < 0 || S->signal_fds[i] < 0) return KZ_FAIL;
+    }
+    kzA_store(&S->read.info->notify, (uint32_t)S->event_fds[0] + 1);
+    kzA_store(&S->write.info->wnotify, (uint32_t)S->event_fds[1] + 1);
+    kzA_store(&S->write.info->notify, (uint32_t)S->signal_fds[0] + 1);
+    kzA_store(&S->read.info->wnotify, (uint32_t)S->signal_fds[1] + 1);
+    kzA_storeR(&S->hdr->notify_pid, (uint32_t)S->self_pid);
+    return KZ_OK;
+#else
+    if (!isowner) return KZ_OK;
     errno = ENOTSUP;
     return KZ_FAIL;
 #endif
 }
 
+/* peer watching operations */
+
+#ifdef KZ_USE_WATCHER
+# define KZ_WATCHMAX (KZ_WAITMAX - 1) /* channels of a watcher thread */
+
+/* A process runs a watcher thread for up to `KZ_WATCHMAX` channels. Every
+ * side names the watcher of its process in its `live` word, linked on the
+ * robust futex list of that thread: when the process dies, the kernel
+ * marks the word `FUTEX_OWNER_DIED` and wakes the watcher of the peer, as
+ * it does for robust mutexes. So a watcher sleeps in `futex_waitv()` on
+ * the words of all its peers, and wakes only when one of them comes, goes
+ * or dies. The thread takes no robust mutexes, glibc keeps their list. */
+typedef struct kz_Watch {
+    kz_State *S;
+    uint32_t  closed; /* Dead peer closed already, 0 if none. */
+    int       linked; /* Whether the `live` word of `S` is on our list. */
+} kz_Watch;
+
+typedef struct kz_Watcher {
+    struct robust_list_head head; /* The `live` words of the sides. */
+    struct kz_Watcher *next;      /* Next watcher of the process. */
+    pthread_t thread;
+    int       pid;   /* Process of `thread`, the children have none. */
+    int       stop;  /* Whether `thread` is asked to exit. */
+    uint32_t  tid;   /* Thread id of `thread`, `KZ_MAX_SIZE` if failed. */
+    uint32_t  seq;   /* Bumped on changes, `thread` sleeps on it. */
+    size_t    count;
+    kz_Watch  watches[KZ_WATCHMAX];
+} kz_Watcher;
+
+static pthread_mutex_t kz_watchlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t  kz_watchonce = PTHREAD_ONCE_INIT;
+static kz_Watcher     *kz_watchers; /* Watchers of this process. */
+
+static uint32_t *kz_peerpid(kz_State *S) {
+    int isowner = S->write.info == S->hdr->queues;
+    return isowner ? &S->hdr->user_pid : &S->hdr->owner_pid;
+}
+
+static kz_ShmLive *kz_live(kz_State *S, int peer) {
+    int isowner = S->write.info == S->hdr->queues;
+    return &S->hdr->live[isowner ? peer : !peer];
+}
+
+static int kz_ownedtid(uint32_t tid) {
+    kz_Watcher *W;
+    for (W = kz_watchers; W != NULL; W = W->next)
+        if (W->tid == tid) return 1;
+    return 0;
+}
+
+static int kz_linklive(kz_Watcher *W, kz_State *S) {
+    /* with the lock held; a word named by a watcher of this process is
+     * linked already, by another state of the same side */
+    kz_ShmLive         *live = kz_live(S, 0);
+    struct robust_list *node = (struct robust_list *)&live->link;
+    if (kz_ownedtid(kzA_load(&live->tid) & FUTEX_TID_MASK)) return 0;
+    node->next = W->head.list.next;
+    __atomic_store_n(&W->head.list.next, node, __ATOMIC_RELEASE);
+    kzA_store(&live->tid, W->tid);
+    kzA_store(&live->pid, (uint32_t)W->pid);
+    kz_futex_wake(&live->tid, 1, 0); /* the watcher of the peer */
+    return 1;
+}
+
+static void kz_unlinklive(kz_Watcher *W, kz_State *S) {
+    kz_ShmLive         *live = kz_live(S, 0);
+    struct robust_list *node = (struct robust_list *)&live->link, *p;
+    for (p = &W->head.list; p->next != &W->head.list; p = p->next)
+        if (p->next == node) {
+            __atomic_store_n(&p->next, node->next, __ATOMIC_RELEASE);
+            break;
+        }
+    kzA_store(&live->tid, 0); /* left, not died */
+    kz_futex_wake(&live->tid, 1, 0);
+}
+
+static int kz_closepeer(kz_State *S, uint32_t pid) {
+    /* a new peer claims the pid word before it resets the queues, so it
+     * either makes the swap fail, or waits until they are closed */
+    uint32_t *ppid = kz_peerpid(S);
+    if (pid == 0 || !kzA_cmpandswap(ppid, pid, KZ_CLOSING)) return 0;
+    kz_shutdown(S, KZ_BOTH);
+    kzA_cmpandswap(ppid, KZ_CLOSING, pid); /* unless a reset cleared it */
+    return 1;
+}
+
+static void kz_watchpeer(kz_Watcher *W, kz_Watch *w, struct futex_waitv *v) {
+    /* with the lock held, sets `v` to sleep on the word of the peer */
+    kz_ShmLive *live = kz_live(w->S, 1);
+    uint32_t    word;
+    if (!w->linked) w->linked = kz_linklive(W, w->S); /* the linker left */
+    for (;;) { /* the kernel wakes a died word only if it has waiters */
+        word = kzA_load(&live->tid);
+        if (word == 0 || (word & (FUTEX_OWNER_DIED | FUTEX_WAITERS))) break;
+        if (kzA_cmpandswap(&live->tid, word, word | FUTEX_WAITERS)) {
+            word |= FUTEX_WAITERS;
+            break;
+        }
+    }
+    if (!(word & FUTEX_OWNER_DIED))
+        w->closed = 0; /* a new peer */
+    else if (w->closed == 0) { /* `pid` is of the died one if still died */
+        uint32_t pid = kzA_load(&live->pid);
+        if (kzA_load(&live->tid) == word && kz_closepeer(w->S, pid))
+            w->closed = pid;
+    }
+    v->uaddr = (uintptr_t)&live->tid;
+    v->val = word;
+    v->flags = FUTEX_32;
+    v->__reserved = 0;
+}
+
+static void *kz_watcher(void *ud) {
+    kz_Watcher        *W = (kz_Watcher *)ud;
+    struct futex_waitv waiters[KZ_WAITMAX];
+    uint32_t           tid = (uint32_t)syscall(SYS_gettid);
+    size_t             i;
+    int                stop = 0;
+    if (syscall(SYS_set_robust_list, &W->head, sizeof(W->head)) != 0)
+        tid = KZ_MAX_SIZE, stop = 1;
+    kzA_store(&W->tid, tid);
+    kz_futex_wake(&W->tid, 1, 1);
+    while (!stop) {
+        pthread_mutex_lock(&kz_watchlock);
+        waiters[0].uaddr = (uintptr_t)&W->seq;
+        waiters[0].val = kzA_load(&W->seq);
+        waiters[0].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+        waiters[0].__reserved = 0;
+        for (i = 0; i < W->count; ++i)
+            kz_watchpeer(W, &W->watches[i], &waiters[i + 1]);
+        stop = W->stop;
+        pthread_mutex_unlock(&kz_watchlock);
+        if (!stop) kz_futex_waitv(waiters, (int)i + 1, -1);
+    }
+    return NULL;
+}
+
+static void kz_watchprepare(void) { pthread_mutex_lock(&kz_watchlock); }
+static void kz_watchparent(void) { pthread_mutex_unlock(&kz_watchlock); }
+
+static void kz_watchchild(void) {
+    /* the threads are not forked, the states keep their watchers, which
+     * `kz_stopwatch()` knows by `pid` */
+    kz_watchers = NULL;
+    pthread_mutex_unlock(&kz_watchlock);
+}
+
+static void kz_watchinit(void)
+{ pthread_atfork(kz_watchprepare, kz_watchparent, kz_watchchild); }
+
+static kz_Watcher *kz_newwatcher(void) {
+    kz_Watcher *W = (kz_Watcher *)calloc(1, sizeof(kz_Watcher));
+    sigset_t    all, old;
+    int         r;
+    if (W == NULL) return NULL;
+    W->head.list.next = &W->head.list;
+    W->head.futex_offset = offsetof(kz_ShmLive, tid);
+    W->pid = getpid();
+    sigfillset(&all); /* the signals of the process are not for it */
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    r = pthread_create(&W->thread, NULL, kz_watcher, W);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (r != 0) return free(W), (kz_Watcher *)NULL;
+    while (kzA_load(&W->tid) == 0) kz_futex_wait(&W->tid, 0, -1, 1);
+    if (W->tid == KZ_MAX_SIZE) {
+        pthread_join(W->thread, NULL);
+        return free(W), (kz_Watcher *)NULL;
+    }
+    W->next = kz_watchers, kz_watchers = W;
+    return W;
+}
+
+static void kz_startwatch(kz_State *S) {
+    /* started at open, for the life of the state; the peers of local
+     * channels are threads */
+    kz_Watcher *W;
+    kz_Watch   *w;
+    if (kz_islocal(S) || kz_has_futex_waitv != 1) return;
+    pthread_once(&kz_watchonce, kz_watchinit);
+    pthread_mutex_lock(&kz_watchlock);
+    for (W = kz_watchers; W != NULL && W->count == KZ_WATCHMAX; W = W->next)
+        ;
+    if (W != NULL || (W = kz_newwatcher()) != NULL) {
+        w = &W->watches[W->count++];
+        w->S = S, w->closed = 0;
+        w->linked = kz_linklive(W, S);
+        S->watcher = W;
+        kzA_fetchadd(&W->seq, 1);
+        kz_futex_wake(&W->seq, 1, 1);
+    }
+    pthread_mutex_unlock(&kz_watchlock);
+}
+
+static void kz_stopwatch(kz_State *S) {
+    /* a forked child has no watcher, the one of its parent still has the
+     * `live` word, so it leaves it alone */
+    kz_Watcher *W = S->watcher, **pW, *O;
+    size_t      i;
+    int         linked, stop;
+    S->watcher = NULL;
+    if (W == NULL || W->pid != getpid()) return;
+    pthread_mutex_lock(&kz_watchlock);
+    for (i = 0; W->watches[i].S != S; ++i)
+        ;
+    if ((linked = W->watches[i].linked)) kz_unlinklive(W, S);
+    W->watches[i] = W->watches[--W->count];
+    if ((stop = W->count == 0)) {
+        for (pW = &kz_watchers; *pW != W; pW = &(*pW)->next)
+            ;
+        *pW = W->next, W->stop = 1;
+    }
+    kzA_fetchadd(&W->seq, 1);
+    kz_futex_wake(&W->seq, 1, 1);
+    for (O = linked ? kz_watchers : NULL; O != NULL; O = O->next) {
+        kzA_fetchadd(&O->seq, 1); /* another state of the side links it */
+        kz_futex_wake(&O->seq, 1, 1);
+    }
+    pthread_mutex_unlock(&kz_watchlock);
+    if (stop) pthread_join(W->thread, NULL), free(W);
+}
+#else
+# define kz_startwatch(S) ((void)(S))
+# define kz_stopwatch(S)  ((void)(S))
+#endif
+
 /* clang-format off */
 static void kzQ_setneed(kzQ_State *QS, uint32_t need)
 { kzA_storeR(&QS->info->need, need); }
 
+static int kzQ_sleepable(kzQ_State *QS) {
+    /* closing leaves the indices of `KZ_INDEXED` as is, so check it again
+     * after the wait is published, `kz_shutdown()` does it the other way */
+    if (QS->index == NULL) return 1;
+    kzA_fence();
+    return kzA_loadR(&QS->info->used) != KZ_MARK;
+}
+
+static int kzQ_sleep(kzQ_State *QS, uint32_t *addr, uint32_t val, int millis) {
+    if (!kzQ_sleepable(QS)) return KZ_OK;
+    kzA_fetchaddR(&kzQ_stats(QS)->sleeps, 1);
+    return kz_futex_wait(addr, val, millis, kz_islocal(QS->S));
+}
+
+static int kzQ_waitreserve(kzQ_State *QS, uint32_t need, int millis) {
+    uint32_t *pushers = &QS->info->pushers, reserved;
+    int       r = KZ_OK; /* clang-format on */
+    kzA_fetchadd(pushers, 1);
+    reserved = kzA_load(&QS->info->reserved);
+    if (QS->info->size - reserved < need)
+        r = kzQ_sleep(QS, &QS->info->reserved, reserved, millis);
+    kzA_subfetchR(pushers, 1);
+    if (kzQ_checkclosed(QS, kzA_load(&QS->info->used))) return KZ_CLOSED;
+    if (r != KZ_OK && r != KZ_TIMEOUT) return r;
+    return KZ_OK;
+}
+
 static int kzQ_waitpush(kzQ_State *QS, uint32_t used, uint32_t need, int millis) {
-    int r; /* clang-format on */
+    int r;
+    if ((QS->S->flags & KZ_MPSC)) return kzQ_waitreserve(QS, need, millis);
     if (!kzA_cmpandswapR(&QS->info->need, 0, need)) return KZ_OK;
-    r = kz_futex_wait(&QS->info->used, used, millis);
+    r = kzQ_sleep(QS, kzQ_spaceword(QS), QS->index ? QS->peer : used, millis);
     kzQ_setneed(QS, 0);
     if (kzQ_checkclosed(QS, kzA_load(&QS->info->used))) return KZ_CLOSED;
     if (r != KZ_OK && r != KZ_TIMEOUT) return r;
@@ -530,7 +1430,7 @@ static int kzQ_waitpush(kzQ_State *QS, uint32_t used, uint32_t need, int millis)
 static int kzQ_waitpop(kzQ_State *QS, uint32_t used, int millis) {
     int r;
     if (!kzA_cmpandswapR(&QS->info->need, 0, KZ_WAITREAD)) return KZ_OK;
-    r = kz_futex_wait(&QS->info->used, used, millis);
+    r = kzQ_sleep(QS, kzQ_dataword(QS), QS->index ? QS->peer : used, millis);
     kzQ_setneed(QS, 0);
     if (kzQ_checkclosed(QS, kzA_load(&QS->info->used))) return KZ_CLOSED;
     if (r != KZ_OK && r != KZ_TIMEOUT) return r;
@@ -542,57 +1442,139 @@ static int kzQ_waitmux(kz_State *S, const kz_Mux *m, int millis) {
     uint32_t *seq = &S->write.info->seq;
     int       r;
     kzA_fetchaddR(waiters, 1);
+    if (!kzQ_sleepable(&S->read) || !kzQ_sleepable(&S->write))
+        return kzA_subfetchR(waiters, 1), KZ_OK;
 #ifdef SYS_futex_waitv
     if (kz_has_futex_waitv == 1) {
         struct futex_waitv waiters[2];
-        int flags = FUTEX_32;
-        waiters[0].uaddr = (uintptr_t)&S->read.info->used;
-        waiters[0].val = 0;
+        int flags = FUTEX_32 | (kz_islocal(S) ? FUTEX_PRIVATE_FLAG : 0);
+        waiters[0].uaddr = (uintptr_t)kzQ_dataword(&S->read);
+        waiters[0].val = m->rused;
         waiters[0].flags = flags;
         waiters[0].__reserved = 0;
-        waiters[1].uaddr = (uintptr_t)&S->write.info->used;
+        waiters[1].uaddr = (uintptr_t)kzQ_spaceword(&S->write);
         waiters[1].val = m->wused;
         waiters[1].flags = flags;
         waiters[1].__reserved = 0;
         r = kz_futex_waitv(waiters, 2, millis);
     } else
 #endif
-        r = kz_futex_wait(seq, m->seq, millis);
+        r = kz_futex_wait(seq, m->seq, millis, kz_islocal(S));
     kzA_subfetchR(waiters, 1);
     return r;
 }
 
-static int kzQ_wakemux(kzQ_State *QS, int waked, int r) {
+static int kz_waitseqs(
+        kz_State **Ss, const int *events, const kz_Mux *muxes, size_t count,
+        int millis) {
+    uint64_t start = kz_now();
+    size_t   i, first = count, watched = 0;
+    int      r, slice = millis;
+
+    /* there is no word shared by the channels to sleep on, so sleep on the
+     * first one, and poll the others in slices */
+    for (i = 0; i < count; ++i)
+        if (events[i] && watched++ == 0) first = i;
+    if (watched > 1 && (millis <= 0 || millis > KZ_WAITSLICE))
+        slice = KZ_WAITSLICE;
+    for (;;) {
+        r = kz_futex_wait(&Ss[first]->write.info->seq, muxes[first].seq,
+                          slice, kz_islocal(Ss[first]));
+        if (r != KZ_OK && r != KZ_TIMEOUT) return r;
+        for (i = first; i < count; ++i)
+            if (events[i] && kzA_loadR(&Ss[i]->write.info->seq) != muxes[i].seq)
+                return KZ_OK;
+        if (millis > 0 && kz_now() - start >= (uint64_t)millis * 1000000)
+            return KZ_TIMEOUT;
+    }
+}
+
+static int kz_waitmanyv(
+        kz_State **Ss, const int *events, const kz_Mux *muxes, size_t count,
+        int millis) {
+    size_t i, n = 0;
+    int    r = KZ_OK, closed = 0;
+    for (i = 0; i < count; ++i) {
+        if (events[i]) {
+            kzA_fetchaddR(&Ss[i]->write.info->waiters, 1);
+            closed |= !kzQ_sleepable(&Ss[i]->read)
+                      || !kzQ_sleepable(&Ss[i]->write);
+        }
+        n += ((events[i] & KZ_READ) != 0) + ((events[i] & KZ_WRITE) != 0);
+    }
+#ifdef SYS_futex_waitv
+    if (!closed && kz_has_futex_waitv == 1 && n <= KZ_WAITMAX) {
+        struct futex_waitv waiters[KZ_WAITMAX];
+        memset(waiters, 0, sizeof(struct futex_waitv) * n);
+        for (i = 0, n = 0; i < count; ++i) {
+            int flags = FUTEX_32 | (kz_islocal(Ss[i]) ? FUTEX_PRIVATE_FLAG : 0);
+            if ((events[i] & KZ_READ)) {
+                waiters[n].uaddr = (uintptr_t)kzQ_dataword(&Ss[i]->read);
+                waiters[n].flags = flags;
+                waiters[n++].val = muxes[i].rused;
+            }
+            if ((events[i] & KZ_WRITE)) {
+                waiters[n].uaddr = (uintptr_t)kzQ_spaceword(&Ss[i]->write);
+                waiters[n].flags = flags;
+                waiters[n++].val = muxes[i].wused;
+            }
+        }
+        r = kz_futex_waitv(waiters, (int)n, millis);
+    } else
+#endif
+    if (!closed)
+        r = kz_waitseqs(Ss, events, muxes, count, millis);
+    for (i = 0; i < count; ++i)
+        if (events[i]) kzA_subfetchR(&Ss[i]->write.info->waiters, 1);
+    return r;
+}
+
+static int kzQ_wake(kzQ_State *QS, uint32_t *addr, int wakeAll) {
+    kzA_fetchaddR(&kzQ_stats(QS)->wakes, 1);
+    return kz_futex_wake(addr, wakeAll, kz_islocal(QS->S));
+}
+
+static int kzQ_wakemux(kzQ_State *QS, uint32_t *addr, int waked, int r) {
     uint32_t *waiters = &QS->S->read.info->waiters;
 #ifdef SYS_futex_waitv
     if (kz_has_futex_waitv == 1) {
         if (!waked && (int32_t)kzA_loadR(waiters) > 0)
-            r = kz_futex_wake(&QS->info->used, 0);
+            r = kzQ_wake(QS, addr, 0);
     } else
 #endif
     {
         uint32_t *seq = &QS->S->read.info->seq;
         kzA_fetchaddR(seq, 1);
-        if ((int32_t)kzA_loadR(waiters) > 0) r = kz_futex_wake(seq, 0);
+        if ((int32_t)kzA_loadR(waiters) > 0) r = kzQ_wake(QS, seq, 0);
     }
-    (void)waked;
+    (void)addr, (void)waked;
     return r;
 }
 
 static int kzQ_wakepush(kzQ_State *QS, uint32_t new_used) {
     int      r = KZ_OK, waked = 0;
     uint32_t need = kzA_loadR(&QS->info->need);
-    if (need > 0 && need < QS->info->size - new_used)
-        waked = 1, r = kz_futex_wake(&QS->info->used, 0);
-    return kzQ_wakemux(QS, waked, r);
+    if ((QS->S->flags & KZ_MPSC)) { /* any writer may fit in now */
+        if (kzA_loadR(&QS->info->pushers) > 0) {
+            waked = 1, r = kzQ_wake(QS, &QS->info->reserved, 1);
+            kz_signalpeer(QS->S, 1);
+        }
+    } else if (need > 0 && need < QS->info->size - new_used) {
+        waked = 1, r = kzQ_wake(QS, kzQ_spaceword(QS), 0);
+        kz_signalpeer(QS->S, 1);
+    }
+    return kzQ_wakemux(QS, kzQ_spaceword(QS), waked, r);
 }
 
 static int kzQ_wakepop(kzQ_State *QS, uint32_t old_used) {
     int      r = KZ_OK, waked = 0;
     uint32_t need = kzA_loadR(&QS->info->need);
     (void)old_used;
-    if (need > 0) waked = 1, r = kz_futex_wake(&QS->info->used, 0);
-    return kzQ_wakemux(QS, waked, r);
+    if (need > 0) {
+        waked = 1, r = kzQ_wake(QS, kzQ_dataword(QS), 0);
+        kz_signalpeer(QS->S, 0);
+    }
+    return kzQ_wakemux(QS, kzQ_dataword(QS), waked, r);
 }
 
 /* creation/cleanup operations */
@@ -604,13 +1586,57 @@ KZ_API void        kz_freefailerror(const char *s) { (void)s; }
 static int kz_pidexists(int pid)
 { int r = kill(pid, 0); return r == 0 || (r == -1 && errno == EPERM); }
 
-KZ_API int kz_unlink(const char *name)
-{ return shm_unlink(name) == 0 || errno == ENOENT ? KZ_OK : KZ_FAIL; }
+static size_t kz_pagesize(void) { return (size_t)sysconf(_SC_PAGESIZE); }
 /* clang-format on */
 
+static size_t kz_shmpagesize(kz_State *S) {
+    /* hugetlbfs reports the huge page size as the block size */
+    struct stat statbuf;
+    if (fstat(S->shm_fd, &statbuf) == -1) return kz_pagesize();
+    return (size_t)statbuf.st_blksize;
+}
+
+static size_t kz_hugepagesize(void) {
+#ifdef __linux__
+    struct statfs buf;
+    if (statfs(KZ_HUGETLBFS, &buf) == 0 && buf.f_type == HUGETLBFS_MAGIC)
+        return (size_t)buf.f_bsize;
+#endif
+    return 0;
+}
+
+static int kz_hugepath(const char *name, char *path) {
+    int r;
+    while (*name == '/') ++name;
+    r = snprintf(path, PATH_MAX, "%s/%s", KZ_HUGETLBFS, name);
+    if (r < 0 || r >= PATH_MAX) return errno = ENAMETOOLONG, KZ_FAIL;
+    return KZ_OK;
+}
+
+static int kz_shmopen(const char *name, int oflags, int mode) {
+    /* plain shm first, then the hugetlbfs file of `KZ_HUGEPAGE` */
+    char path[PATH_MAX];
+    int  fd = shm_open(name, oflags, mode);
+    if (fd != -1 || errno != ENOENT) return fd;
+    if (kz_hugepath(name, path) != KZ_OK) return errno = ENOENT, -1;
+    return open(path, oflags | O_CLOEXEC, mode);
+}
+
+KZ_API int kz_unlink(const char *name) {
+    char path[PATH_MAX];
+    if (shm_unlink(name) != 0 && errno != ENOENT) return KZ_FAIL;
+    if (kz_hugepath(name, path) != KZ_OK) return KZ_OK;
+    return unlink(path) == 0 || errno == ENOENT ? KZ_OK : KZ_FAIL;
+}
+
 static int kz_initfail(kz_State *S) {
     int err = errno;
-    if (S->hdr != NULL) munmap(S->hdr, S->shm_size);
+    kz_freelanes(S);
+    kz_closenotify(S);
+    if (S->dir != NULL)
+        kzD_release(S->dir);
+    else if (S->hdr != NULL)
+        munmap(S->hdr, S->map_size);
     close(S->shm_fd);
     free(S);
     errno = err;
@@ -623,62 +1649,202 @@ static int kz_mapshm(kz_State *S) {
     if (fstat(S->shm_fd, &statbuf) == -1) return KZ_FAIL;
     if (statbuf.st_size == 0) return (errno = ENOENT), KZ_FAIL;
 
-    S->shm_size = statbuf.st_size;
+    S->shm_size = S->map_size = statbuf.st_size;
     S->hdr = (kz_ShmHdr *)mmap(
             NULL, S->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, S->shm_fd,
             0);
     return S->hdr == MAP_FAILED ? KZ_FAIL : KZ_OK;
 }
 
-static int kz_createshm(kz_State *S, int flags) {
-    int oflags = O_CREAT | O_RDWR;
-    int created = 0;
-    if (!kz_checksize(S)) return errno = EINVAL, kz_initfail(S);
-
-    /* create a new shared memory object */
-    if ((flags & KZ_EXCL)) oflags |= O_EXCL;
-    S->shm_fd = shm_open(S->name_buf, oflags, flags & 0x1FF);
-    if (S->shm_fd == -1) return kz_initfail(S);
+static int kz_sizeshm(kz_State *S, int flags) {
+    struct stat statbuf;
 
     /* check if the file already exists */
-    {
-        struct stat statbuf;
-        if (fstat(S->shm_fd, &statbuf) == -1) return kz_initfail(S);
-        if ((flags & KZ_EXCL) && statbuf.st_size != 0)
-            return errno = EEXIST, kz_initfail(S);
-        created = (statbuf.st_size == 0);
-    }
+    if (fstat(S->shm_fd, &statbuf) == -1) return -1;
+    if ((flags & KZ_EXCL) && statbuf.st_size != 0) return errno = EEXIST, -1;
+    if (statbuf.st_size != 0) return 0;
 
     /* set the size of the shared memory object */
-    if (created && ftruncate(S->shm_fd, S->shm_size) == -1)
-        return kz_initfail(S);
-    if ((flags & KZ_RESET)) created = 1;
+    return ftruncate(S->shm_fd, S->shm_size) == -1 ? -1 : 1;
+}
 
-    if (kz_mapshm(S) != KZ_OK) return kz_initfail(S);
-    if (created) {
-        memset(S->hdr, 0, sizeof(kz_ShmHdr));
-        S->hdr->size = S->shm_size;
+static int kz_createhuge(kz_State *S, int oflags, int flags) {
+    char path[PATH_MAX];
+    int  created = -1, err;
+    if (kz_hugepagesize() == 0) return errno = ENOTSUP, -1;
+    if (kz_hugepath(S->name_buf, path) != KZ_OK) return -1;
+    S->shm_fd = open(path, oflags | O_CLOEXEC, flags & 0x1FF);
+    if (S->shm_fd == -1) return -1;
+    if ((created = kz_sizeshm(S, flags)) != -1 && kz_mapshm(S) == KZ_OK) {
+        /* the user opens plain shm first, drop a stale one */
+        shm_unlink(S->name_buf);
+        return created;
     }
 
-    if (!kz_checkpid(S, &S->hdr->owner_pid))
+    /* no huge pages left, the mapping fails on reservation */
+    err = errno;
+    if (created == 1) unlink(path);
+    close(S->shm_fd);
+    S->shm_fd = -1, S->hdr = NULL;
+    return (errno = err), -1;
+}
+
+static int kz_mapfixed(char *addr, size_t len, int fd, size_t offset) {
+    void *p = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                   fd, (off_t)offset);
+    return p == MAP_FAILED ? KZ_FAIL : KZ_OK;
+}
+
+static int kz_mirrorshm(kz_State *S) {
+    /* remap with each queue mapped twice back to back, so a record starting
+     * anywhere in the queue is contiguous in memory */
+    size_t qsize = S->hdr->queues[0].size, off = S->shm_size - qsize * 2;
+    size_t size = off + qsize * 4, pagesize = kz_shmpagesize(S);
+    int    isowner = S->write.info == S->hdr->queues;
+    char  *base;
+    if (!(S->flags & KZ_MIRROR)) return KZ_OK;
+    if (off < kz_hdrsize(S->flags) || off % pagesize || qsize % pagesize)
+        return errno = EINVAL, kz_initfail(S);
+
+    base = (char *)mmap(
+            NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return kz_initfail(S);
+    if (kz_mapfixed(base, off, S->shm_fd, 0) != KZ_OK
+        || kz_mapfixed(base + off, qsize, S->shm_fd, off) != KZ_OK
+        || kz_mapfixed(base + off + qsize, qsize, S->shm_fd, off) != KZ_OK
+        || kz_mapfixed(base + off + qsize * 2, qsize, S->shm_fd, off + qsize)
+                   != KZ_OK
+        || kz_mapfixed(base + off + qsize * 3, qsize, S->shm_fd, off + qsize)
+                   != KZ_OK) {
+        int err = errno;
+        munmap(base, size);
+        return (errno = err), kz_initfail(S);
+    }
+    munmap(S->hdr, S->map_size);
+    S->hdr = (kz_ShmHdr *)base;
+    S->map_size = size;
+    kz_setowner(S, isowner);
+    return KZ_OK;
+}
+
+static int kz_adviseshm(kz_State *S, int flags) {
+    /* only the pages backed by the shm, not the reserved ones */
+    size_t size = (S->flags & KZ_MIRROR) ? S->map_size : S->shm_size;
+#ifdef MADV_HUGEPAGE /* transparent huge pages of shmem, if enabled */
+    if ((S->flags & KZ_HUGEPAGE)) madvise(S->hdr, size, MADV_HUGEPAGE);
+#endif
+    if ((flags & KZ_PREFAULT)) {
+#ifdef MADV_POPULATE_WRITE /* Linux 5.14+, touch the pages by hand if not */
+        if (madvise(S->hdr, size, MADV_POPULATE_WRITE) != 0)
+#endif
+            kz_touch(S, size);
+    }
+    if ((flags & KZ_MLOCK) && mlock(S->hdr, size) != 0) return KZ_FAIL;
+    return KZ_OK;
+}
+
+static int kz_reserveshm(kz_State *S) {
+    /* map the address space `kz_resize()` may grow the shm into, so the
+     * mapping never moves under the other threads; the pages after the end
+     * of the shm are never touched before it grows */
+    int   isowner = S->write.info == S->hdr->queues;
+    char *base = (char *)MAP_FAILED;
+    if ((S->flags & KZ_RESIZABLE) && !(S->flags & KZ_NORESIZE)
+        && S->map_size < KZ_RESIZEMAX)
+        base = (char *)mmap(NULL, KZ_RESIZEMAX, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, S->shm_fd, 0);
+    if (base != MAP_FAILED) { /* or resize in the mapping only */
+        munmap(S->hdr, S->map_size);
+        S->hdr = (kz_ShmHdr *)base;
+        S->map_size = KZ_RESIZEMAX;
+        kz_setowner(S, isowner);
+    }
+    /* the owner grows the shm up to what both sides have mapped */
+    kzA_store(isowner ? &S->hdr->owner_map : &S->hdr->user_map,
+              (uint32_t)(S->map_size < KZ_MAX_SIZE ? S->map_size
+                                                    : KZ_MAX_SIZE));
+    return KZ_OK;
+}
+
+static int kz_resizeshm(kz_State *S, size_t size)
+{ return ftruncate(S->shm_fd, (off_t)size) == 0 ? KZ_OK : KZ_FAIL; }
+
+static int kz_claimpid(kz_State *S, uint32_t *ppid) {
+    /* the side is free if its process is gone; the watcher of the peer
+     * holds it `KZ_CLOSING` while it closes the queues of a dead one, so
+     * they are never closed under a new process, see `kz_closepeer()` */
+    uint32_t pid;
+    int      i = 0;
+    for (;;) {
+        if ((pid = kzA_load(ppid)) == KZ_CLOSING) {
+            if (++i % KZ_SPINCHECK) kz_pause(); else kz_yield();
+            continue;
+        }
+        if (pid != 0 && (int)pid != S->self_pid && kz_pidexists((int)pid))
+            return 0;
+        if (kzA_cmpandswap(ppid, pid, (uint32_t)S->self_pid)) return 1;
+    }
+}
+
+static int kz_createshm(kz_State *S, int flags) {
+    int oflags = O_CREAT | O_RDWR;
+    int created = -1;
+    if (!kz_checksize(S) || ((flags & KZ_MPSC) && (flags & KZ_INDEXED))
+            || ((flags & KZ_LANEMASK) && (flags & (KZ_MIRROR | KZ_NOTIFY))))
+        return errno = EINVAL, kz_initfail(S);
+    if ((flags & KZ_EXCL)) oflags |= O_EXCL;
+
+    /* try huge pages, fallback to plain shm if unavailable */
+    if ((flags & KZ_HUGEPAGE)) {
+        created = kz_createhuge(S, oflags, flags);
+        if (created == -1 && errno == EEXIST) return kz_initfail(S);
+    }
+
+    /* create a new shared memory object */
+    if (created == -1) {
+        S->shm_fd = shm_open(S->name_buf, oflags, flags & 0x1FF);
+        if (S->shm_fd == -1) return kz_initfail(S);
+        if ((created = kz_sizeshm(S, flags)) == -1) return kz_initfail(S);
+        if (kz_mapshm(S) != KZ_OK) return kz_initfail(S);
+    }
+    if ((flags & KZ_RESET)) created = 1;
+    if (created && kz_lanesize(S->shm_size, flags)
+                < kz_hdrsize(flags) + sizeof(uint32_t) * 4 + S->slot_size * 2
+                          + kz_arenasize(S->arena_block, S->arena_count))
+        return errno = EINVAL, kz_initfail(S); /* too small for the header */
+
+    if (created) {
+        kz_clearhdr(S->hdr, flags);
+        S->hdr->size = kz_lanesize(S->shm_size, flags);
+        S->hdr->flags = flags & KZ_SHMFLAGS;
+    }
+
+    if (!kz_claimpid(S, &S->hdr->owner_pid))
         return errno = EACCES, kz_initfail(S);
-    S->hdr->owner_pid = S->self_pid;
-    return created ? kz_initqueues(S) : kz_resetqueues(S);
+    if (created) kz_initqueues(S);
+    else kz_resetqueues(S);
+    if (kz_initlanes(S, created) != KZ_OK) return kz_initfail(S);
+    if (kz_mirrorshm(S) != KZ_OK) return KZ_FAIL;
+    return kz_reserveshm(S);
 }
 
 static int kz_openshm(kz_State *S) {
-    S->shm_fd = shm_open(S->name_buf, O_RDWR, 0666);
+    S->shm_fd = kz_shmopen(S->name_buf, O_RDWR, 0666);
     if (S->shm_fd == -1) return kz_initfail(S);
     if (kz_mapshm(S) != KZ_OK) return kz_initfail(S);
-    if (S->shm_size != S->hdr->size) return errno = EBADF, kz_initfail(S);
-    if (!kz_checkpid(S, &S->hdr->user_pid))
+    if (kz_lanesize(S->shm_size, S->hdr->flags) != S->hdr->size)
+        return errno = EBADF, kz_initfail(S);
+    if (!kz_claimpid(S, &S->hdr->user_pid))
         return errno = EACCES, kz_initfail(S);
-    return kz_resetqueues(S);
+    kz_resetqueues(S);
+    if (kz_initlanes(S, 0) != KZ_OK) return kz_initfail(S);
+    if (kz_mirrorshm(S) != KZ_OK) return KZ_FAIL;
+    return kz_reserveshm(S);
 }
 
 KZ_API int kz_exists(const char *name, int *powner, int *puser) {
     kz_State S;
-    S.shm_fd = shm_open(name, O_RDWR, 0);
+    S.shm_fd = kz_shmopen(name, O_RDWR, 0);
     S.hdr = NULL;
     if (S.shm_fd < 0) return errno == ENOENT ? 0 : KZ_FAIL;
     if (kz_mapshm(&S) != KZ_OK) return close(S.shm_fd), KZ_FAIL;
@@ -687,33 +1853,58 @@ KZ_API int kz_exists(const char *name, int *powner, int *puser) {
     return close(S.shm_fd), 1;
 }
 
+static void kzQ_wakeall(kzQ_State *QS) {
+    /* `KZ_INDEXED` readers and writers wait on different words */
+    int local = kz_islocal(QS->S);
+    kz_futex_wake(kzQ_dataword(QS), 1, local);
+    if (QS->index) kz_futex_wake(kzQ_spaceword(QS), 1, local);
+}
+
 KZ_API int kz_shutdown(kz_State *S, int mode) {
     int waked = 0;
     if (S && (mode & KZ_READ)) {
         kzA_store(&S->read.info->used, KZ_MARK);
+        kzA_fence(); /* see `kzQ_sleepable()` */
         if (kzA_loadR(&S->read.info->need))
-            waked = 1, kz_futex_wake(&S->read.info->used, 1);
+            waked = 1, kzQ_wakeall(&S->read);
+        if (kzA_loadR(&S->read.info->pushers))
+            kz_futex_wake(&S->read.info->reserved, 1, kz_islocal(S));
     }
     if (S && (mode & KZ_WRITE)) {
         kzA_store(&S->write.info->used, KZ_MARK);
+        kzA_fence();
         if (kzA_loadR(&S->write.info->need))
-            waked = 1, kz_futex_wake(&S->write.info->used, 1);
+            waked = 1, kzQ_wakeall(&S->write);
+        if (kzA_loadR(&S->write.info->pushers))
+            kz_futex_wake(&S->write.info->reserved, 1, kz_islocal(S));
     }
     if (S && mode != 0 && (int32_t)kzA_loadR(&S->read.info->waiters) > 0) {
 #ifdef SYS_futex_waitv
         if (kz_has_futex_waitv == 1) {
-            if (!waked) kz_futex_wake(&S->write.info->used, 1);
+            if (!waked)
+                kz_futex_wake(kzQ_dataword(&S->write), 1, kz_islocal(S));
         } else
 #endif
-            (void)waked, kz_futex_wake(&S->read.info->seq, 1);
+            (void)waked, kz_futex_wake(&S->read.info->seq, 1, kz_islocal(S));
     }
+    if (S && mode != 0) { /* wake the pollers of both sides */
+        kz_signal(S->event_fds[0]), kz_signal(S->event_fds[1]);
+        kz_signal(S->signal_fds[0]), kz_signal(S->signal_fds[1]);
+    }
+    if (S) kz_shutdownlanes(S, mode);
     return KZ_OK;
 }
 
 KZ_API void kz_close(kz_State *S) {
-    if (S == NULL) return;
+    if (S == NULL || S->lane != 0) return; /* lanes are closed with lane 0 */
     kz_shutdown(S, KZ_BOTH);
-    munmap(S->hdr, S->shm_size);
+    kz_stopwatch(S);
+    kz_freelanes(S);
+    kz_closenotify(S);
+    if (S->dir != NULL) /* the directory maps it */
+        kzD_release(S->dir);
+    else
+        munmap(S->hdr, S->map_size);
     close(S->shm_fd);
     free(S);
 }
@@ -725,10 +1916,11 @@ KZ_API void kz_close(kz_State *S) {
 /* clang-format off */
 typedef struct { uint32_t nonatomic; } kzA_atomic32_t;
 
-#define kzA_loadR     kzA_load
-#define kzA_storeR    kzA_store
-#define kzA_fetchaddR kzA_fetchadd
-#define kzA_subfetchR kzA_subfetch
+#define kzA_loadR       kzA_load
+#define kzA_storeR      kzA_store
+#define kzA_cmpandswapR kzA_cmpandswap
+#define kzA_fetchaddR   kzA_fetchadd
+#define kzA_subfetchR   kzA_subfetch
 
 static uint32_t kzA_load(uint32_t *ptr)
 { return _InterlockedCompareExchange((volatile LONG *)ptr, 0, 0); }
@@ -742,14 +1934,38 @@ static uint32_t kzA_fetchadd(uint32_t *ptr, uint32_t delta)
 static uint32_t kzA_subfetch(uint32_t *ptr, uint32_t delta)
 { return _InterlockedExchangeAdd((volatile LONG *)ptr, ~delta + 1) - delta; }
 
-static int kzA_cmpandswapR(uint32_t *state, uint32_t expected, uint32_t desired) {
+static int kzA_cmpandswap(uint32_t *state, uint32_t expected, uint32_t desired) {
     return _InterlockedCompareExchange((volatile LONG *)state,
             desired, expected) == expected;
 }
+
+static uint64_t kzA_load64R(uint64_t *ptr)
+{ return _InterlockedCompareExchange64((volatile LONG64 *)ptr, 0, 0); }
+
+static void kzA_store64R(uint64_t *ptr, uint64_t val)
+{ _InterlockedExchange64((volatile LONG64 *)ptr, (LONG64)val); }
+
+static uint64_t kzA_fetchadd64R(uint64_t *ptr, uint64_t delta)
+{ return _InterlockedExchangeAdd64((volatile LONG64 *)ptr, (LONG64)delta); }
+
+static void kzA_fence(void) { MemoryBarrier(); }
 /* clang-format on */
 
 /* waiting operations */
 
+static uint64_t kz_now(void) {
+    LARGE_INTEGER counter, freq;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)(counter.QuadPart / (double)freq.QuadPart * 1.0e9);
+}
+
+static int kz_cpucount(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+
 static int kzQ_waitpush(kzQ_State *QS, uint32_t need, int millis) {
     DWORD dwWaitRet = WaitForSingleObject(QS->can_push, millis);
     (void)need;
@@ -801,11 +2017,43 @@ static int kzQ_waitmux(kz_State *S, const kz_Mux *m, int millis) {
     return dwRet == WAIT_FAILED ? KZ_FAIL : KZ_OK;
 }
 
+static int kz_waitmanyv(
+        kz_State **Ss, const int *events, const kz_Mux *muxes, size_t count,
+        int millis) {
+    HANDLE aHandles[MAXIMUM_WAIT_OBJECTS];
+    DWORD  n = 0, dwRet;
+    size_t i;
+    (void)muxes;
+    for (i = 0; i < count && n < MAXIMUM_WAIT_OBJECTS; ++i) {
+        if ((events[i] & KZ_READ)) aHandles[n++] = Ss[i]->read.can_pop;
+        if ((events[i] & KZ_WRITE) && n < MAXIMUM_WAIT_OBJECTS)
+            aHandles[n++] = Ss[i]->write.can_push;
+    }
+    dwRet = WaitForMultipleObjects(n, aHandles, FALSE, millis);
+    if (dwRet == WAIT_FAILED) return KZ_FAIL;
+    return dwRet == WAIT_TIMEOUT ? KZ_TIMEOUT : KZ_OK;
+}
+
+/* notification operations */
+
+static int kz_cannotify(kz_State *S) { return (void)S, 0; }
+#define kz_startwatch(S) ((void)(S))
+
+static int kz_initnotify(kz_State *S, int isowner) {
+    (void)S;
+    if (!isowner) return KZ_OK;
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return KZ_FAIL;
+}
+
 /* creation/cleanup operations */
 
 KZ_API int  kz_unlink(const char *name) { return (void)name, KZ_OK; }
 KZ_API void kz_freefailerror(const char *s) { LocalFree((HLOCAL)s); }
 
+static int kz_resizeshm(kz_State *S, size_t size)
+{ return (void)S, (void)size, SetLastError(ERROR_NOT_SUPPORTED), KZ_FAIL; }
+
 static void kz_cleanup(kz_State *S) {
     if (S->hdr != NULL) UnmapViewOfFile(S->hdr);
     if (S->shm_fd != NULL) CloseHandle(S->shm_fd);
@@ -823,6 +2071,24 @@ static int kz_initfail(kz_State *S) {
     return KZ_FAIL;
 }
 
+static size_t kz_pagesize(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+}
+
+/* large pages need SeLockMemoryPrivilege, `KZ_HUGEPAGE` is ignored */
+static size_t kz_hugepagesize(void) { return 0; }
+
+static size_t kz_shmpagesize(kz_State *S) { return (void)S, kz_pagesize(); }
+
+static int kz_adviseshm(kz_State *S, int flags) {
+    if ((flags & KZ_PREFAULT)) kz_touch(S, S->shm_size);
+    if ((flags & KZ_MLOCK) && !VirtualLock(S->hdr, S->shm_size))
+        return KZ_FAIL;
+    return KZ_OK;
+}
+
 static int kz_pidexists(DWORD pid) {
     DWORD  exitCode;
     int    isRunning = 0;
@@ -834,6 +2100,10 @@ static int kz_pidexists(DWORD pid) {
     return isRunning;
 }
 
+static int kz_checkpid(kz_State *S, uint32_t *pid) {
+    return *pid == 0 || (int)*pid == S->self_pid || !kz_pidexists(*pid);
+}
+
 static HANDLE kz_openevent(const char *name, const char *suffix, int flags) {
     char buf[MAX_PATH];
     StringCbPrintfA(buf, MAX_PATH, "%s-%s", name, suffix);
@@ -864,7 +2134,8 @@ static int kz_initevents(kz_State *S, kzQ_State *q0, kzQ_State *q1, int cr) {
 
 static int kz_createshm(kz_State *S, int flags) {
     int created = 0;
-    if (!kz_checksize(S))
+    if (!kz_checksize(S) || ((flags & KZ_MPSC) && (flags & KZ_INDEXED))
+            || (flags & KZ_LANEMASK)) /* lanes need their own events */
         return SetLastError(ERROR_INVALID_PARAMETER), kz_initfail(S);
 
     /* create a new shared memory object */
@@ -889,7 +2160,7 @@ static int kz_createshm(kz_State *S, int flags) {
     if (S->hdr == NULL) return kz_initfail(S);
     created = (flags & KZ_RESET) || S->hdr->size != S->shm_size;
     if (created) {
-        memset(S->hdr, 0, sizeof(kz_ShmHdr));
+        memset(S->hdr, 0, kz_hdrsize(flags));
         S->hdr->size = (uint32_t)S->shm_size;
     }
 
@@ -986,12 +2257,14 @@ KZ_API int kz_shutdown(kz_State *S, int mode) {
         kzQ_setneed(&S->read, 0);
         SetEvent(S->write.can_pop);
     }
+    if (S) kz_shutdownlanes(S, mode);
     return KZ_OK;
 }
 
 KZ_API void kz_close(kz_State *S) {
-    if (S == NULL) return;
+    if (S == NULL || S->lane != 0) return;
     kz_shutdown(S, KZ_BOTH);
+    kz_freelanes(S);
     kz_cleanup(S);
     free(S);
 }
@@ -1000,94 +2273,554 @@ KZ_API void kz_close(kz_State *S) {
 
 /* queue operations */
 
+static uint32_t kzQ_pos(const kzQ_State *QS, uint32_t index)
+{ return index < QS->info->size ? index : index - QS->info->size; }
+
+static uint32_t kzQ_head(const kzQ_State *QS) {
+    if (QS->index) return kzQ_pos(QS, kzA_loadR(&QS->index->head));
+    return QS->info->head;
+}
+
+static uint32_t kzQ_tail(const kzQ_State *QS) {
+    if (QS->index) return kzQ_pos(QS, kzA_loadR(&QS->index->tail));
+    return QS->info->tail;
+}
+
+static uint32_t kzQ_distance(const kzQ_State *QS, uint32_t head, uint32_t tail)
+{ return tail >= head ? tail - head : tail + QS->info->size * 2 - head; }
+
+static uint32_t kzQ_indexused(kzQ_State *QS, int reload) {
+    /* the peer's index is loaded only when asked, or when the cached one is
+     * too old to be right */
+    int      isread = QS == &QS->S->read;
+    uint32_t own = kzA_loadR(isread ? &QS->index->head : &QS->index->tail);
+    uint32_t peer = kzA_loadR(&QS->peer), used;
+    used = isread ? kzQ_distance(QS, own, peer) : kzQ_distance(QS, peer, own);
+    if (!reload && used <= QS->info->size) return used;
+    peer = kzA_load(isread ? &QS->index->tail : &QS->index->head);
+    kzA_storeR(&QS->peer, peer);
+    return isread ? kzQ_distance(QS, own, peer) : kzQ_distance(QS, peer, own);
+}
+
+static uint32_t kzQ_loadused(kzQ_State *QS) {
+    /* bytes used in the queue, or `KZ_MARK` if closed */
+    uint32_t used = kzA_load(&QS->info->used);
+    if (used == KZ_MARK || QS->index == NULL) return used;
+    return kzQ_indexused(QS, 0);
+}
+
+static void kzQ_advance(kzQ_State *QS, uint32_t *pindex, uint32_t size) {
+    /* the fence orders the new index before loading `need` of the waiters,
+     * which is what the locked `used` updates do */
+    uint32_t index = kzA_loadR(pindex) + size;
+    if (index >= QS->info->size * 2) index -= QS->info->size * 2;
+    kzA_store(pindex, index);
+    kzA_fence();
+}
+
+static int kzQ_shared(const kzQ_State *QS)
+{ return QS != &QS->S->read && (QS->S->flags & KZ_MPSC); }
+
+static void kzQ_count(kzQ_State *QS, uint32_t *counter) {
+    /* the counters of a side are updated without RMW, except the ones
+     * shared by `KZ_MPSC` writers */
+    if (kzQ_shared(QS))
+        kzA_fetchaddR(counter, 1);
+    else
+        kzA_storeR(counter, kzA_loadR(counter) + 1);
+}
+
+static void kzQ_countmsg(kzQ_State *QS, uint64_t count, uint64_t bytes) {
+    kzQ_ShmStats *stats = kzQ_stats(QS);
+    if (kzQ_shared(QS)) {
+        kzA_fetchadd64R(&stats->count, count);
+        kzA_fetchadd64R(&stats->bytes, bytes);
+        return;
+    }
+    kzA_store64R(&stats->count, kzA_load64R(&stats->count) + count);
+    kzA_store64R(&stats->bytes, kzA_load64R(&stats->bytes) + bytes);
+}
+
+static void kzQ_countpeak(kzQ_State *QS, uint32_t used) {
+    /* only the writer holding `writing` updates it */
+    uint32_t *peak = kzQ_peakword(QS);
+    if (used > kzA_loadR(peak)) kzA_storeR(peak, used);
+}
+
+static uint64_t kzQ_time(const kzQ_State *QS)
+{ return (QS->S->flags & KZ_TIMESTAMP) ? kz_now() : 0; }
+
+static void kzQ_stamp(kzQ_State *QS, uint32_t pos, uint64_t now) {
+    /* the stamp is published with the header following it */
+    if ((QS->S->flags & KZ_TIMESTAMP))
+        memcpy(QS->data + pos + sizeof(uint32_t), &now, sizeof(now));
+}
+
+static void kzQ_dwell(kzQ_State *QS, const kz_Context *ctxs, size_t count) {
+    /* only the reader holding `reading` updates the histogram */
+    kzQ_ShmHist *hist = QS->hist;
+    uint64_t     now = kz_now(), stamp, sum = 0;
+    size_t       i;
+    for (i = 0; i < count; ++i) {
+        uint32_t *bucket;
+        memcpy(&stamp, QS->data + ctxs[i].pos + sizeof(uint32_t),
+               sizeof(stamp));
+        stamp = now > stamp ? now - stamp : 0;
+        bucket = &hist->buckets[kz_histbucket(stamp)];
+        kzA_storeR(bucket, kzA_loadR(bucket) + 1);
+        sum += stamp;
+    }
+    kzA_store64R(&hist->count, kzA_load64R(&hist->count) + count);
+    kzA_store64R(&hist->sum, kzA_load64R(&hist->sum) + sum);
+}
+
 static int kzQ_checkclosed(const kzQ_State *QS, uint32_t used) {
     if (used == KZ_MARK) {
-        uint32_t *s = QS == &QS->S->read ? /* clang-format off */
-            &QS->info->reading : &QS->info->writing;
-        return kzA_storeR(s, 0), 1; /* clang-format on */
+        /* `KZ_MPSC` writers hold `writing` only inside `kzQ_reserve()` */
+        if (QS == &QS->S->read || !(QS->S->flags & KZ_MPSC))
+            kzA_storeR(kzQ_busyword((kzQ_State *)QS), 0);
+        return 1;
     }
     return 0;
 }
 
+static int kzQ_relocate(kzQ_State *QS) {
+    /* `kz_resize()` changes the layout only with all the busy words held, so
+     * check it after holding one */
+    kz_State *S = QS->S;
+    uint32_t  gen = kzA_load(&QS->info->gen);
+    size_t    off = kz_hdrsize(S->flags), qsize = S->hdr->queues[0].size;
+    if (QS->gen == gen) return 0;
+    QS->gen = gen;
+    QS->data = (char *)S->hdr + off
+             + qsize * (size_t)(QS->info - S->hdr->queues);
+    if (QS->index)
+        QS->peer = kzA_load(
+                QS == &S->read ? &QS->index->tail : &QS->index->head);
+    return 1;
+}
+
+static int kzQ_moved(kzQ_State *QS) {
+    /* retry the operation if moved */
+    if (!kzQ_relocate(QS)) return 0;
+    kzA_storeR(kzQ_busyword(QS), 0);
+    return 1;
+}
+
+static int kzQ_park(kz_Context *ctx, int r) {
+    /* a reader waiting for data has no position in the queue, so let
+     * `kz_resize()` move the queue under it meanwhile */
+    kzQ_State *QS = (kzQ_State *)ctx->state;
+    if (r == KZ_AGAIN && QS == &QS->S->read)
+        kzA_store(kzQ_busyword(QS), KZ_PARKED);
+    return ctx->result = r;
+}
+
+static void kzQ_unpark(kzQ_State *QS) {
+    uint32_t *word = kzQ_busyword(QS);
+    int       i;
+    if (QS != &QS->S->read) return;
+    for (i = 0; !kzA_cmpandswap(word, KZ_PARKED, 1);) {
+        if (kzA_load(word) != KZ_MOVING) return; /* not parked */
+        if (++i % KZ_SPINCHECK) kz_pause(); else kz_yield();
+    }
+    kzQ_relocate(QS);
+}
+
+static uint32_t kzQ_loadhdr(const kzQ_State *QS, uint32_t pos) {
+    uint32_t n = kzA_load((uint32_t *)(QS->data + pos));
+#ifdef __BIG_ENDIAN__
+    n = __builtin_bswap32(n);
+#endif
+    return n;
+}
+
+static void kzQ_storehdr(kzQ_State *QS, uint32_t pos, uint32_t n) {
+#ifdef __BIG_ENDIAN__
+    n = __builtin_bswap32(n);
+#endif
+    kzA_store((uint32_t *)(QS->data + pos), n);
+}
+
+static uint32_t kzQ_span(const kzQ_State *QS, uint32_t from, uint32_t to) {
+    /* bytes from `from` to `to` along the ring, including the wasted tail
+     * skipped by a `KZ_MARK`; equal positions means the whole ring */
+    return to > from ? to - from : QS->info->size - from + to;
+}
+
+static uint32_t kzQ_next(const kz_Context *ctx) {
+    const kzQ_State *QS = (const kzQ_State *)ctx->state;
+    size_t size = kz_get_aligned_size(ctx->len, KZ_ALIGN);
+    return (uint32_t)((ctx->pos + size) % QS->info->size);
+}
+
 static uint32_t kzQ_calcneed(const kzQ_State *QS, uint32_t size) {
-    uint32_t need_size = (uint32_t)kz_get_aligned_size(
-            size + sizeof(uint32_t), KZ_ALIGN);
-    uint32_t remain = QS->info->size - QS->info->tail;
-    if (need_size > remain) need_size += remain;
+    uint32_t need_size = kzQ_recsize(QS, size);
+    uint32_t remain = QS->info->size - kzQ_tail(QS);
+    if (QS->slot) return need_size; /* a slot never wraps */
+    if (need_size > remain && !(QS->S->flags & KZ_MIRROR))
+        need_size += remain; /* the tail is wasted by a `KZ_MARK` */
     return need_size;
 }
 
+static int kzQ_reserve(
+        kzQ_State *QS, kz_Context *ctxs, const size_t *lens, size_t count);
+
 static int kzQ_push(kz_Context *ctx, uint32_t used) {
     kzQ_State *QS = (kzQ_State *)ctx->state;
+    if ((QS->S->flags & KZ_MPSC)) { /* retry with the length kept in `pos` */
+        size_t len = ctx->pos;
+        return kzQ_reserve(QS, ctx, &len, 1);
+    }
 
-    /* check if there is enough space */
-    uint32_t remain = QS->info->size - QS->info->tail;
+    /* check if there is enough space, the cached head may be too old */
+    uint32_t tail = kzQ_tail(QS), remain = QS->info->size - tail;
     uint32_t free_size = QS->info->size - used;
-    if (free_size < ctx->len) return KZ_AGAIN;
+    if (free_size < ctx->len && QS->index)
+        free_size = QS->info->size - kzQ_indexused(QS, 1);
+    if (free_size < ctx->len)
+        return kzQ_count(QS, &kzQ_stats(QS)->again), KZ_AGAIN;
+    if (QS->slot) return ctx->pos = tail, KZ_OK; /* `len` is the slot */
+    if ((QS->S->flags & KZ_MIRROR)) remain = free_size; /* never wraps */
 
     /* write the offset and the size */
-    assert(QS->info->tail < QS->info->size);
+    assert(tail < QS->info->size);
     if (ctx->len > remain) {
-        kz_write_u32le(QS->data + QS->info->tail, KZ_MARK);
+        kz_write_u32le(QS->data + tail, KZ_MARK);
         ctx->pos = 0;
         ctx->len = free_size - remain;
     } else {
-        ctx->pos = QS->info->tail;
-        ctx->len = remain;
+        ctx->pos = tail;
+        ctx->len = free_size < remain ? free_size : remain;
     }
     return KZ_OK;
 }
 
-static int kzQ_commitpush(kz_Context *ctx, uint32_t len) {
-    kzQ_State *QS = (kzQ_State *)ctx->state;
-    uint32_t   old_used, size;
-    if (kzQ_checkclosed(QS, kzA_load(&QS->info->used))) return KZ_CLOSED;
+static int kzQ_flushpop(kzQ_State *QS, uint32_t old_used) {
+    kzQ_ShmStats *stats = kzQ_stats(QS);
+    kz_State     *S = QS->S;
+    S->woke_count = kzA_load64R(&stats->count);
+    S->woke_bytes = kzA_load64R(&stats->bytes);
+    kzA_store64R(&S->co_since, 0);
+    return kzQ_wakepop(QS, old_used);
+}
+
+static int kzQ_notifypop(kzQ_State *QS, uint32_t old_used) {
+    kzQ_ShmStats *stats = kzQ_stats(QS);
+    kz_State     *S = QS->S;
+    uint64_t      now, since;
+    if (S->coalesce == 0) return kzQ_wakepop(QS, old_used);
+
+    /* the stats count the writes of all the `KZ_MPSC` writers, so the
+     * thresholds are of the queue, only the deadline is of this writer */
+    if ((S->co_count
+         && kzA_load64R(&stats->count) - S->woke_count >= S->co_count)
+        || (S->co_bytes
+            && kzA_load64R(&stats->bytes) - S->woke_bytes >= S->co_bytes))
+        return kzQ_flushpop(QS, 0);
+    now = kz_now();
+    if ((since = kzA_load64R(&S->co_since)) == 0)
+        kzA_store64R(&S->co_since, since = now);
+    return now - since < S->coalesce ? KZ_OK : kzQ_flushpop(QS, 0);
+}
 
-    size = (uint32_t)kz_get_aligned_size(len + sizeof(uint32_t), KZ_ALIGN);
-    if (size > ctx->len) return KZ_INVALID;
-    kz_write_u32le(QS->data + ctx->pos, (uint32_t)len);
-    QS->info->tail = (uint32_t)((ctx->pos + size) % QS->info->size);
-    assert(kz_is_aligned_to(QS->info->tail, KZ_ALIGN));
+static int kzQ_publish(kzQ_State *QS, uint32_t tail, int notify) {
+    uint32_t old_used, size = kzQ_span(QS, kzQ_tail(QS), tail);
+    assert(kz_is_aligned_to(tail, KZ_ALIGN));
+    if (QS->index) {
+        kzQ_advance(QS, &QS->index->tail, size);
+        kzQ_countpeak(QS, kzQ_indexused(QS, 0));
+        kzA_storeR(&QS->index->writing, 0);
+        return notify ? kzQ_notifypop(QS, 0) : KZ_OK;
+    }
+
+    QS->info->tail = tail;
 
-    old_used = kzA_fetchadd(&QS->info->used, (uint32_t)size);
-    if (old_used == KZ_MARK) kzA_store(&QS->info->used, KZ_MARK);
+    old_used = kzA_fetchadd(&QS->info->used, size);
+    if (old_used == KZ_MARK)
+        kzA_store(&QS->info->used, KZ_MARK);
+    else
+        kzQ_countpeak(QS, old_used + size);
     kzA_storeR(&QS->info->writing, 0);
-    return ctx->notify ? kzQ_wakepop(QS, old_used) : KZ_OK;
+    return notify ? kzQ_notifypop(QS, old_used) : KZ_OK;
 }
 
-static int kzQ_pop(kz_Context *ctx, uint32_t used) {
+static int kzQ_publishmp(kzQ_State *QS, int notify) {
+    uint32_t *used = &QS->info->used, old;
+
+    /* the headers are already visible, bump the counter for the waiters */
+    do old = kzA_loadR(used);
+    while (old != KZ_MARK
+           && !kzA_cmpandswapR(used, old, old + 1 == KZ_MARK ? 0 : old + 1));
+    if (old == KZ_MARK) return KZ_CLOSED;
+    return notify ? kzQ_notifypop(QS, old) : KZ_OK;
+}
+
+static int kzQ_commitmp(kz_Context *ctx, uint32_t len, uint32_t more) {
     kzQ_State *QS = (kzQ_State *)ctx->state;
+    uint32_t   pos = (uint32_t)ctx->pos, size, cap;
+
+    size = (uint32_t)kz_get_aligned_size(len + kzQ_hdrlen(QS), KZ_ALIGN);
+    cap = (uint32_t)kz_get_aligned_size(ctx->len, KZ_ALIGN);
+    if (size > cap) return KZ_INVALID;
+    if (size < cap) /* skip the unused part of the reservation */
+        kzQ_storehdr(QS, pos + size, KZ_SKIP | (cap - size - sizeof(uint32_t)));
+    kzQ_stamp(QS, pos, kzQ_time(QS));
+    kzQ_storehdr(QS, pos, len | more);
+    kzQ_countmsg(QS, 1, len);
+    return kzQ_publishmp(QS, ctx->notify);
+}
 
-    /* check if there is enough data */
-    if (used == 0) return KZ_AGAIN;
-    assert(used >= sizeof(uint32_t));
+static int kzQ_commitpush(kz_Context *ctx, uint32_t len, uint32_t more) {
+    kzQ_State *QS = (kzQ_State *)ctx->state;
+    uint32_t   size;
+    if (kzQ_checkclosed(QS, kzA_load(&QS->info->used))) return KZ_CLOSED;
+    if ((QS->S->flags & KZ_MPSC)) return kzQ_commitmp(ctx, len, more);
 
-    /* read the size of the data */
-    assert(QS->info->head < QS->info->size);
-    ctx->pos = QS->info->head;
-    ctx->len = kz_read_u32le(QS->data + ctx->pos);
-    if (ctx->len == KZ_MARK) {
-        ctx->pos = 0;
-        ctx->len = kz_read_u32le(QS->data + ctx->pos);
+    size = kzQ_recsize(QS, len);
+    if (size > ctx->len || (more && QS->slot)) return KZ_INVALID;
+    if (QS->slot) /* the payload is the whole slot, as the reader sees it */
+        len = QS->slot;
+    else {
+        kzQ_stamp(QS, (uint32_t)ctx->pos, kzQ_time(QS));
+        kz_write_u32le(QS->data + ctx->pos, len | more);
     }
-    ctx->len += sizeof(uint32_t);
-    return KZ_OK;
+    kzQ_countmsg(QS, 1, len);
+    return kzQ_publish(
+            QS, (uint32_t)((ctx->pos + size) % QS->info->size), ctx->notify);
+}
+
+static uint32_t kzQ_layout(
+        kzQ_State *QS, kz_Context *ctxs, const size_t *lens, size_t count) {
+    uint32_t pos = kzQ_tail(QS), total = 0, wrapped = 0;
+    size_t   i, hdrlen = kzQ_hdrlen(QS);
+    for (i = 0; i < count; ++i) {
+        uint32_t size = QS->info->size - pos, need;
+        if (lens[i] >= KZ_MORE) return KZ_MAX_SIZE;
+        if ((need = kzQ_recsize(QS, lens[i])) == KZ_MAX_SIZE) return need;
+        if (need > size && !(QS->S->flags & KZ_MIRROR)) {
+            /* put a mark and wrap once */
+            if (wrapped || total + size < total) return KZ_MAX_SIZE;
+            total += size, pos = 0, wrapped = 1;
+        }
+        if (total + need < total) return KZ_MAX_SIZE;
+        ctxs[i].state = QS;
+        ctxs[i].pos = pos;
+        ctxs[i].len = QS->slot ? QS->slot : lens[i] + hdrlen;
+        ctxs[i].result = KZ_OK;
+        ctxs[i].notify = 1;
+        total += need, pos += need;
+        if (pos >= QS->info->size) pos -= QS->info->size, wrapped = 1;
+    }
+    return total;
+}
+
+static int kzQ_reserve(
+        kzQ_State *QS, kz_Context *ctxs, const size_t *lens, size_t count) {
+    uint32_t used = kzA_load(&QS->info->used), need, pos;
+    size_t   i;
+    if (used == KZ_MARK) return KZ_CLOSED;
+
+    memset(ctxs, 0, sizeof(kz_Context));
+    ctxs->state = QS;
+    ctxs->notify = 1;
+
+    /* writers only serialize on laying out the batch and storing its
+     * pending headers, the data is filled and committed concurrently */
+    for (i = 0; !kzA_cmpandswap(&QS->info->writing, 0, 1);)
+        if (++i % KZ_SPINCHECK) kz_pause(); else kz_yield();
+    if (kzQ_moved(QS)) return kzQ_reserve(QS, ctxs, lens, count);
+    need = kzQ_layout(QS, ctxs, lens, count);
+    if (need > QS->info->size)
+        ctxs->result = KZ_TOOBIG;
+    else if (need > QS->info->size - kzA_load(&QS->info->reserved)) {
+        /* keep the length to retry in `pos`, see `kzQ_push()`, a batch of
+         * `kz_writev()` is marked by the caller */
+        ctxs->pos = lens[0];
+        ctxs->len = need;
+        ctxs->result = KZ_AGAIN;
+        kzQ_count(QS, &kzQ_stats(QS)->again);
+    } else {
+        for (pos = QS->info->tail, i = 0; i < count; ++i) {
+            if (ctxs[i].pos != pos) kzQ_storehdr(QS, pos, KZ_MARK);
+            kzQ_storehdr(QS, (uint32_t)ctxs[i].pos, KZ_PENDING);
+            pos = kzQ_next(&ctxs[i]);
+        }
+        QS->info->tail = pos;
+        kzQ_countpeak(QS, kzA_fetchadd(&QS->info->reserved, need) + need);
+    }
+    kzA_store(&QS->info->writing, 0);
+    return ctxs->result;
 }
 
-static int kzQ_commitpop(kz_Context *ctx) {
+static void kzQ_discard(kz_Context *ctx) {
     kzQ_State *QS = (kzQ_State *)ctx->state;
-    uint32_t   new_used, size;
+    uint32_t   cap = (uint32_t)kz_get_aligned_size(ctx->len, KZ_ALIGN);
+    kzQ_storehdr(QS, (uint32_t)ctx->pos, KZ_SKIP | (cap - sizeof(uint32_t)));
+    kzQ_publishmp(QS, ctx->notify);
+}
+
+static int kzQ_commitmpv(kz_Context *ctxs, size_t count) {
+    kzQ_State *QS = (kzQ_State *)ctxs->state;
+    size_t     i = count, bytes = 0, hdrlen = kzQ_hdrlen(QS);
+    uint64_t   now = kzQ_time(QS);
+
+    /* the reader stops at the first pending header, so commit it last to
+     * never expose a partial batch */
+    while (i-- > 0) {
+        bytes += ctxs[i].len - hdrlen;
+        kzQ_stamp(QS, (uint32_t)ctxs[i].pos, now);
+        kzQ_storehdr(
+                QS, (uint32_t)ctxs[i].pos, (uint32_t)(ctxs[i].len - hdrlen));
+    }
+    kzQ_countmsg(QS, count, bytes);
+    return kzQ_publishmp(QS, ctxs->notify);
+}
+
+static int kzQ_commitpushv(kz_Context *ctxs, size_t count) {
+    kzQ_State *QS = (kzQ_State *)ctxs->state;
+    uint32_t   pos = kzQ_tail(QS);
+    size_t     i, bytes = 0, hdrlen = kzQ_hdrlen(QS);
+    uint64_t   now;
     if (kzQ_checkclosed(QS, kzA_load(&QS->info->used))) return KZ_CLOSED;
+    if ((QS->S->flags & KZ_MPSC)) return kzQ_commitmpv(ctxs, count);
+    if (QS->slot) { /* no headers, the slots are consecutive */
+        kzQ_countmsg(QS, count, (uint64_t)count * QS->slot);
+        return kzQ_publish(QS, kzQ_next(&ctxs[count - 1]), ctxs->notify);
+    }
+
+    /* the whole batch becomes visible with one update of `used` */
+    for (now = kzQ_time(QS), i = 0; i < count; ++i) {
+        if (ctxs[i].pos != pos) kz_write_u32le(QS->data + pos, KZ_MARK);
+        kzQ_stamp(QS, (uint32_t)ctxs[i].pos, now);
+        kz_write_u32le(
+                QS->data + ctxs[i].pos, (uint32_t)(ctxs[i].len - hdrlen));
+        bytes += ctxs[i].len - hdrlen;
+        pos = kzQ_next(&ctxs[i]);
+    }
+    kzQ_countmsg(QS, count, bytes);
+    return kzQ_publish(QS, pos, ctxs->notify);
+}
+
+static int kzQ_scan(
+        kz_Context *ctx, uint32_t pos, uint32_t *ptotal, uint32_t avail) {
+    kzQ_State *QS = (kzQ_State *)ctx->state;
+    uint32_t   total = *ptotal, n;
+
+    /* find the message at `pos` within `avail` bytes from `head`, `total`
+     * counts the bytes passed, including marks and skipped records */
+    if (QS->slot && total < avail) { /* slots are found by arithmetic */
+        ctx->pos = pos;
+        ctx->len = QS->slot;
+        *ptotal = total + QS->slot;
+        return KZ_OK;
+    }
+    for (; total < avail; total += n, pos = (pos + n) % QS->info->size) {
+        uint32_t hdr = kzQ_loadhdr(QS, pos);
+        if (hdr == KZ_PENDING) break;
+        if (hdr == KZ_MARK) {
+            n = QS->info->size - pos;
+            continue;
+        }
+        if ((hdr & KZ_SKIP)) {
+            n = (uint32_t)kz_get_aligned_size(
+                    (hdr & ~KZ_SKIP) + sizeof(uint32_t), KZ_ALIGN);
+            continue;
+        }
+        hdr &= ~KZ_MORE; /* see `kz_more()` */
+        n = (uint32_t)kz_get_aligned_size(hdr + kzQ_hdrlen(QS), KZ_ALIGN);
+        ctx->pos = pos;
+        ctx->len = hdr + kzQ_hdrlen(QS);
+        *ptotal = total + n;
+        return KZ_OK;
+    }
+    *ptotal = total;
+    return KZ_AGAIN;
+}
+
+static uint32_t kzQ_avail(kzQ_State *QS, uint32_t used) {
+    /* `KZ_MPSC` headers are valid in all the reserved bytes, but may be
+     * still pending */
+    return (QS->S->flags & KZ_MPSC) ? kzA_load(&QS->info->reserved) : used;
+}
+
+static int kzQ_readable(kzQ_State *QS, uint32_t used) {
+    kz_Context ctx;
+    uint32_t   total = 0;
+    if (!(QS->S->flags & KZ_MPSC)) return used != 0;
+    ctx.state = QS;
+    return kzQ_scan(&ctx, kzQ_head(QS), &total, kzQ_avail(QS, used)) == KZ_OK;
+}
+
+static uint32_t kzQ_consume(kzQ_State *QS, uint32_t head) {
+    uint32_t new_used, size = kzQ_span(QS, kzQ_head(QS), head);
+    assert(kz_is_aligned_to(head, KZ_ALIGN));
+    if (QS->index) {
+        kzQ_advance(QS, &QS->index->head, size);
+        return kzQ_indexused(QS, 0);
+    }
 
-    size = (uint32_t)kz_get_aligned_size(ctx->len, KZ_ALIGN);
-    QS->info->head = (uint32_t)((ctx->pos + size) % QS->info->size);
-    assert(kz_is_aligned_to(QS->info->head, KZ_ALIGN));
+    QS->info->head = head;
 
+    if ((QS->S->flags & KZ_MPSC))
+        return kzA_subfetch(&QS->info->reserved, size);
     new_used = kzA_subfetch(&QS->info->used, (uint32_t)size);
     if (new_used + (uint32_t)size == KZ_MARK)
         kzA_store(&QS->info->used, KZ_MARK);
-    kzA_storeR(&QS->info->reading, 0);
-    return ctx->notify ? kzQ_wakepush(QS, new_used) : KZ_OK;
+    return new_used;
+}
+
+static int kzQ_pop(kz_Context *ctx, uint32_t used) {
+    kzQ_State *QS = (kzQ_State *)ctx->state;
+    uint32_t   total = 0, head = kzQ_head(QS);
+    int        r = kzQ_scan(ctx, head, &total, kzQ_avail(QS, used));
+
+    /* the cached tail may be too old, look again with the current one */
+    if (r == KZ_AGAIN && QS->index)
+        r = kzQ_scan(
+                ctx, (head + total) % QS->info->size, &total,
+                kzQ_indexused(QS, 1));
+
+    /* free the records skipped before a pending one at once */
+    if (r == KZ_AGAIN) kzQ_count(QS, &kzQ_stats(QS)->again);
+    if (r == KZ_AGAIN && total != 0)
+        kzQ_wakepush(QS, kzQ_consume(QS, (head + total) % QS->info->size));
+    return r;
+}
+
+static void kzQ_countpassed(kzQ_State *QS, const kz_Context *last) {
+    /* count the messages from `head` up to `last`, see `kz_next()` */
+    kz_Context cur = *last;
+    uint32_t   pos = kzQ_head(QS), total = 0, n = 0;
+    uint32_t   avail = kzQ_span(QS, pos, kzQ_next(last));
+    uint64_t   bytes = 0;
+    while (kzQ_scan(&cur, pos, &total, avail) == KZ_OK) {
+        n += 1, bytes += cur.len - kzQ_hdrlen(QS);
+        if (QS->hist) kzQ_dwell(QS, &cur, 1);
+        pos = kzQ_next(&cur);
+    }
+    kzQ_countmsg(QS, n, bytes);
+}
+
+static int kzQ_commitpop(kz_Context *ctxs, size_t count) {
+    kzQ_State  *QS = (kzQ_State *)ctxs->state;
+    kz_Context *last = &ctxs[count - 1];
+    size_t      i, bytes = 0, hdrlen = kzQ_hdrlen(QS);
+    uint32_t    new_used;
+    if (kzQ_checkclosed(QS, kzA_load(&QS->info->used))) return KZ_CLOSED;
+    if (count == 1 && ctxs->pos != kzQ_head(QS))
+        kzQ_countpassed(QS, ctxs);
+    else {
+        for (i = 0; i < count; ++i) bytes += ctxs[i].len - hdrlen;
+        kzQ_countmsg(QS, count, bytes);
+        if (QS->hist) kzQ_dwell(QS, ctxs, count);
+    }
+
+    /* everything from `head` up to the end of `last` is consumed, so
+     * committing the last context of a batch commits the whole batch */
+    new_used = kzQ_consume(QS, kzQ_next(last));
+    kzA_storeR(kzQ_busyword(QS), 0);
+    return ctxs->notify ? kzQ_wakepush(QS, new_used) : KZ_OK;
 }
 
 static kz_State *kz_newstate(const char *name) {
@@ -1100,55 +2833,150 @@ static kz_State *kz_newstate(const char *name) {
     S->self_pid = GetCurrentProcessId();
 #else
     S->self_pid = getpid();
+    S->shm_fd = -1;
+    S->event_fds[0] = S->event_fds[1] = S->signal_fds[0] = -1;
+    S->signal_fds[1] = S->epoll_fds[0] = S->epoll_fds[1] = -1;
 #endif
     return S;
 }
 
 static void kz_setowner(kz_State *S, int isowner) {
-    int write = 0, read = 1;
+    size_t qsize = S->hdr->queues[0].size, off = kz_hdrsize(S->hdr->flags);
+    int    write = 0, read = 1;
     if (isowner)
         S->hdr->owner_pid = S->self_pid;
     else {
         S->hdr->user_pid = S->self_pid;
         write = 1, read = 0;
     }
+    S->flags = S->hdr->flags;
+    if ((S->flags & KZ_MIRROR)) /* queues after the header pages, twice */
+        off = S->hdr->size - qsize * 2, qsize *= 2;
     S->write.S = S;
     S->write.info = &S->hdr->queues[write];
-    S->write.data = (char *)(S->hdr + 1) + S->hdr->queues[0].size * write;
+    S->write.data = (char *)S->hdr + off + qsize * write;
     S->read.S = S;
     S->read.info = &S->hdr->queues[read];
-    S->read.data = (char *)(S->hdr + 1) + S->hdr->queues[0].size * read;
+    S->read.data = (char *)S->hdr + off + qsize * read;
+    S->write.gen = kzA_load(&S->write.info->gen);
+    S->read.gen = kzA_load(&S->read.info->gen);
+    S->write.slot = S->write.info->slot;
+    S->read.slot = S->read.info->slot;
+    if ((S->flags & KZ_INDEXED)) {
+        kzQ_ShmIndex *index = (kzQ_ShmIndex *)((char *)S->hdr + KZ_INDEXOFF);
+        S->write.index = index + write;
+        S->read.index = index + read;
+    }
+    if ((S->flags & KZ_TIMESTAMP)) {
+        kzQ_ShmHist *hist =
+                (kzQ_ShmHist *)((char *)S->hdr + KZ_HISTOFF(S->flags));
+        S->write.hist = hist + write;
+        S->read.hist = hist + read;
+    }
+    if ((S->flags & KZ_HASARENA))
+        S->arena = (kzQ_ShmArena *)((char *)S->hdr + kz_arenaoff(S->flags));
+}
+
+static void kz_initpeers(kz_State *S) {
+    /* the cached indices start with the current ones of the peer */
+    if (!(S->flags & KZ_INDEXED)) return;
+    S->write.peer = kzA_load(&S->write.index->head);
+    S->read.peer = kzA_load(&S->read.index->tail);
+}
+
+static uint32_t kz_queuesize(const kz_ShmHdr *hdr) {
+    size_t total_size = hdr->size - kz_hdrsize(hdr->flags);
+    if ((hdr->flags & KZ_HASARENA)) { /* the arena takes the end */
+        const kzQ_ShmArena *arena = (const kzQ_ShmArena *)(
+                (const char *)hdr + kz_arenaoff(hdr->flags));
+        total_size = arena->offset - kz_hdrsize(hdr->flags);
+    }
+    size_t aligned_size = kz_get_aligned_size(total_size, KZ_ALIGN);
+    if (aligned_size > total_size) aligned_size -= KZ_ALIGN;
+    assert(aligned_size <= total_size && aligned_size / 2 < KZ_MAX_SIZE);
+    total_size = aligned_size / 2;
+    if (hdr->queues[0].slot) /* queues of whole slots */
+        total_size -= total_size % hdr->queues[0].slot;
+    return (uint32_t)total_size;
+}
+
+static void kz_initarena(kz_State *S) {
+    /* the blocks past `count` in the last bitmap word are never free */
+    kz_ShmHdr    *hdr = S->hdr;
+    kzQ_ShmArena *arena = (kzQ_ShmArena *)((char *)hdr
+                                           + kz_arenaoff(hdr->flags));
+    uint32_t      count = S->arena_count, *bitmap;
+    size_t        size = kz_arenasize(S->arena_block, count);
+    arena->offset = (uint32_t)((hdr->size - size) & ~(size_t)63);
+    arena->blocksize = S->arena_block;
+    arena->count = count;
+    arena->hint = 0;
+    memset((char *)hdr + arena->offset, 0, KZ_ARENAMETA(count));
+    bitmap = (uint32_t *)((char *)hdr + arena->offset) + count;
+    if (count % 32) bitmap[count / 32] = ~(uint32_t)0 << (count % 32);
 }
 
 static int kz_initqueues(kz_State *S) {
     kz_ShmHdr *hdr = S->hdr;
-    size_t     total_size = hdr->size - sizeof(kz_ShmHdr);
-    size_t     aligned_size = kz_get_aligned_size(total_size, KZ_ALIGN);
     uint32_t   queue_size;
-    if (aligned_size > total_size) aligned_size -= KZ_ALIGN;
-    assert(aligned_size <= total_size && aligned_size / 2 < KZ_MAX_SIZE);
-    queue_size = (uint32_t)(aligned_size / 2);
+    if ((hdr->flags & KZ_HASARENA)) kz_initarena(S);
+    hdr->queues[0].slot = hdr->queues[1].slot = S->slot_size;
+    queue_size = kz_queuesize(hdr);
+    if ((hdr->flags & KZ_MIRROR)) /* queues are mapped in whole pages */
+        queue_size &= ~(uint32_t)(kz_shmpagesize(S) - 1);
     hdr->queues[0].size = queue_size;
     hdr->queues[1].size = queue_size;
     kz_setowner(S, 1);
+    kz_initpeers(S);
     return KZ_OK;
 }
 
 static int kz_resetqueues(kz_State *S) {
     assert(S->hdr->queues[0].size != 0);
     kz_setowner(S, 0);
-    kzA_storeR(&S->read.info->reading, 0);
-    kzA_storeR(&S->write.info->writing, 0);
+    kzA_storeR(kzQ_busyword(&S->read), 0);
+    kzA_storeR(kzQ_busyword(&S->write), 0);
     if (kzA_load(&S->read.info->used) == KZ_MARK) {
         S->read.info->head = S->read.info->tail = 0;
+        S->read.info->reserved = 0;
+        if (S->read.index) S->read.index->head = S->read.index->tail = 0;
         kzA_store(&S->read.info->used, 0);
         kzQ_setneed(&S->read, 0);
     }
     if (kzA_load(&S->write.info->used) == KZ_MARK) {
         S->write.info->head = S->write.info->tail = 0;
+        S->write.info->reserved = 0;
+        if (S->write.index) S->write.index->head = S->write.index->tail = 0;
         kzA_store(&S->write.info->used, 0);
         kzQ_setneed(&S->write, 0);
     }
+    kz_initpeers(S);
+    return KZ_OK;
+}
+
+static int kz_initlanes(kz_State *S, int created) {
+    /* lanes after the first share the mapping of `S`, each one in its own
+     * region of `hdr->size` bytes */
+    size_t i, n = kz_lanecount(S->flags), size = S->hdr->size;
+    if (n == 1) return KZ_OK;
+    S->lanes = (kz_State **)calloc(n, sizeof(kz_State *));
+    if (S->lanes == NULL) return KZ_FAIL;
+    S->lanes[0] = S;
+    for (i = 1; i < n; ++i) {
+        kz_State *L = kz_newstate(S->name_buf);
+        if (L == NULL) return KZ_FAIL;
+        S->lanes[i] = L;
+        L->hdr = (kz_ShmHdr *)((char *)S->hdr + size * i);
+        L->shm_size = size;
+        L->lane = (int)i;
+        if (created) {
+            memset(L->hdr, 0, kz_hdrsize(S->flags));
+            L->hdr->size = (uint32_t)size;
+            L->hdr->flags = S->flags;
+            kz_initqueues(L);
+        } else
+            kz_resetqueues(L);
+    }
     return KZ_OK;
 }
 
@@ -1160,12 +2988,31 @@ KZ_API int         kz_pid(const kz_State *S) { return S?S->self_pid : 0; }
 KZ_API size_t kz_size(const kz_State *S)
 { return S && S->hdr ? S->hdr->queues[0].size : 0; }
 
+static void kz_relayout(kz_State *S, size_t size) {
+    /* both queues are empty, start them over in the new size */
+    kz_ShmHdr    *hdr = S->hdr;
+    kzQ_ShmIndex *index = (kzQ_ShmIndex *)((char *)hdr + KZ_INDEXOFF);
+    int           i;
+    hdr->size = (uint32_t)size;
+    S->shm_size = size;
+    for (i = 0; i < 2; ++i) {
+        kzQ_ShmInfo *info = &hdr->queues[i];
+        info->size = kz_queuesize(hdr);
+        info->head = info->tail = info->reserved = 0;
+        if ((S->flags & KZ_INDEXED)) index[i].head = index[i].tail = 0;
+        kzA_store(&info->gen, info->gen + 1);
+    }
+}
+
 static kzQ_State *kz_checkstate(kz_Context *ctx)
 { return ctx ? (kzQ_State *)ctx->state : NULL; }
 /* clang-format on */
 
 KZ_API size_t kz_aligned(size_t bufsize, size_t pagesize) {
-    size_t required_size = kz_get_aligned_size(
+    size_t required_size;
+    if (pagesize == 0 && (pagesize = kz_hugepagesize()) == 0)
+        pagesize = kz_pagesize();
+    required_size = kz_get_aligned_size(
             sizeof(kz_ShmHdr) + bufsize * 2, pagesize);
     if (!kz_is_aligned_to(required_size, KZ_ALIGN))
         required_size &= ~(KZ_ALIGN - 1); /* LCOV_EXCL_LINE */
@@ -1187,50 +3034,211 @@ KZ_API int kz_isclosed(const kz_State *S) {
     return ((wused == KZ_MARK) << 1) | (rused == KZ_MARK);
 }
 
+static uint32_t kzQ_peekused(const kzQ_State *QS) {
+    /* `KZ_MPSC` writers may still be filling reserved bytes */
+    uint32_t used = kzA_load(&QS->info->used);
+    if (used == KZ_MARK) return used;
+    if ((QS->S->flags & KZ_MPSC)) return kzA_load(&QS->info->reserved);
+    if (QS->index == NULL) return used;
+    return kzQ_distance(QS, kzA_load(&QS->index->head),
+                        kzA_load(&QS->index->tail));
+}
+
+static size_t kz_mapcap(const kz_State *S) {
+    /* the reservation of either side may have failed, or not been asked */
+    uint32_t owner = kzA_load(&S->hdr->owner_map);
+    uint32_t user = kzA_load(&S->hdr->user_map);
+    return user != 0 && user < owner ? user : owner;
+}
+
+KZ_API int kz_resize(kz_State *S, size_t bufsize) {
+    uint32_t *words[4], wused, rused;
+    size_t    i, size, hdrsize;
+    int       r = KZ_OK;
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    if (kz_isowner(S) != 1 || (S->flags & KZ_NORESIZE) || S->dir != NULL)
+        return KZ_INVALID;
+    hdrsize = kz_hdrsize(S->flags);
+    size = kz_get_aligned_size(hdrsize + bufsize, KZ_ALIGN);
+    if ((size - hdrsize) / 2 < sizeof(uint32_t) * 2) return KZ_INVALID;
+    if (size > S->map_size || size > kz_mapcap(S) || size >= KZ_MAX_SIZE)
+        return KZ_TOOBIG;
+
+    /* the layout changes at a message boundary: both queues are empty, and
+     * no one is in them, as all the busy words are held */
+    words[0] = kzQ_sideword(&S->write, 0);
+    words[1] = kzQ_sideword(&S->write, 1);
+    words[2] = kzQ_sideword(&S->read, 0);
+    words[3] = kzQ_sideword(&S->read, 1);
+    for (i = 0; i < 4; ++i) { /* a parked reader is held as it is */
+        if (kzA_cmpandswap(words[i], 0, 1)) continue;
+        if (!(i & 1) || !kzA_cmpandswap(words[i], KZ_PARKED, KZ_MOVING)) break;
+    }
+    wused = kzQ_peekused(&S->write);
+    rused = kzQ_peekused(&S->read);
+    if (i < 4)
+        r = KZ_BUSY;
+    else if (wused == KZ_MARK || rused == KZ_MARK)
+        r = KZ_CLOSED;
+    else if (wused != 0 || rused != 0)
+        r = KZ_AGAIN;
+    else if (size > S->shm_size && kz_resizeshm(S, size) != KZ_OK)
+        r = KZ_FAIL;
+    else if (size != S->shm_size) {
+        int shrink = size < S->shm_size;
+        kz_relayout(S, size);
+        /* the peer moves before touching the queues again, the tail of the
+         * shm is no longer used by anyone */
+        if (shrink) kz_resizeshm(S, size);
+    }
+    while (i-- > 0)
+        kzA_store(words[i], kzA_load(words[i]) == KZ_MOVING ? KZ_PARKED : 0);
+    return r;
+}
+
+static void kzQ_loadstats(const kzQ_State *QS, kz_QueueStats *out) {
+    kzQ_ShmStats *w = kzQ_sidestats(QS, 0), *r = kzQ_sidestats(QS, 1);
+    uint32_t      used = kzQ_peekused(QS);
+    memset(out, 0, sizeof(kz_QueueStats)); /* no garbage in the padding */
+    out->pushes = kzA_load64R(&w->count);
+    out->pops = kzA_load64R(&r->count);
+    out->push_bytes = kzA_load64R(&w->bytes);
+    out->pop_bytes = kzA_load64R(&r->bytes);
+    out->push_sleeps = kzA_loadR(&w->sleeps);
+    out->pop_sleeps = kzA_loadR(&r->sleeps);
+    out->push_wakes = kzA_loadR(&w->wakes);
+    out->pop_wakes = kzA_loadR(&r->wakes);
+    out->push_again = kzA_loadR(&w->again);
+    out->pop_again = kzA_loadR(&r->again);
+    out->push_busy = kzA_loadR(&w->busy);
+    out->pop_busy = kzA_loadR(&r->busy);
+    out->peak = kzA_loadR(kzQ_peakword(QS));
+    out->size = QS->info->size;
+    out->used = used == KZ_MARK ? 0 : used;
+}
+
+KZ_API int kz_stats(const kz_State *S, kz_Stats *stats) {
+    if (S == NULL || S->hdr == NULL || stats == NULL) return KZ_INVALID;
+    kzQ_loadstats(&S->write, &stats->write);
+    kzQ_loadstats(&S->read, &stats->read);
+    return KZ_OK;
+}
+
+KZ_API int kz_histogram(const kz_State *S, int mode, kz_Histogram *hist) {
+    const kzQ_State *QS;
+    size_t           i;
+    if (S == NULL || S->hdr == NULL || hist == NULL) return KZ_INVALID;
+    if (mode != KZ_READ && mode != KZ_WRITE) return KZ_INVALID;
+    QS = mode == KZ_READ ? &S->read : &S->write;
+    if (QS->hist == NULL) return KZ_INVALID;
+    hist->count = kzA_load64R(&QS->hist->count);
+    hist->sum = kzA_load64R(&QS->hist->sum);
+    for (i = 0; i < KZ_HISTMAX; ++i)
+        hist->buckets[i] = kzA_loadR(&QS->hist->buckets[i]);
+    return KZ_OK;
+}
+
+KZ_API uint64_t kz_histbound(size_t bucket) {
+    /* the least dwell time counted in `bucket`, the last one has no upper
+     * bound */
+    size_t e;
+    if (bucket < 16) return bucket;
+    if (bucket > KZ_HISTMAX) bucket = KZ_HISTMAX;
+    e = 4 + (bucket - 16) / 8;
+    return (uint64_t)(8 + (bucket - 16) % 8) << (e - 3);
+}
+
+KZ_API uint64_t kz_percentile(const kz_Histogram *hist, double q) {
+    /* the upper bound of the bucket holding the `q` quantile, the buckets
+     * are copied while updated so they are summed up again */
+    uint64_t total = 0, rank, seen = 0;
+    double   pos;
+    size_t   i;
+    if (hist == NULL) return 0;
+    for (i = 0; i < KZ_HISTMAX; ++i) total += hist->buckets[i];
+    if (total == 0) return 0;
+    pos = q < 0 ? 0 : q > 1 ? (double)total : q * (double)total;
+    rank = (uint64_t)pos;
+    if ((double)rank < pos || rank == 0) ++rank;
+    for (i = 0; i < KZ_HISTMAX - 1; ++i)
+        if ((seen += hist->buckets[i]) >= rank) break;
+    return kz_histbound(i + 1);
+}
+
 KZ_API int kz_read(kz_State *S, kz_Context *ctx) {
     uint32_t used;
     if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
 
-    used = kzA_load(&S->read.info->used);
+    used = kzQ_loadused(&S->read);
     if (used == KZ_MARK) return KZ_CLOSED;
 
     memset(ctx, 0, sizeof(kz_Context));
     ctx->state = &S->read;
     ctx->notify = 1;
-    if (kzA_cmpandswapR(&S->read.info->reading, 0, 1)) {
+    if (kzA_cmpandswapR(kzQ_busyword(&S->read), 0, 1)) {
+        if (kzQ_moved(&S->read)) return kz_read(S, ctx);
         ctx->result = kzQ_pop(ctx, used);
         assert(ctx->result == KZ_OK || ctx->result == KZ_AGAIN);
-        return ctx->result;
+        return kzQ_park(ctx, ctx->result);
     }
+    kzA_fetchaddR(&kzQ_stats(&S->read)->busy, 1);
     return ctx->result = KZ_BUSY;
 }
 
 KZ_API int kz_write(kz_State *S, kz_Context *ctx, size_t len) {
     size_t used, need;
     if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    if ((S->flags & KZ_MPSC)) return kzQ_reserve(&S->write, ctx, &len, 1);
 
-    used = kzA_load(&S->write.info->used);
+    used = kzQ_loadused(&S->write);
     need = kzQ_calcneed(&S->write, len);
-    if (need > S->write.info->size) return KZ_TOOBIG;
+    if (len >= KZ_MORE || need > S->write.info->size) return KZ_TOOBIG;
     if (used == KZ_MARK) return KZ_CLOSED;
 
     memset(ctx, 0, sizeof(kz_Context));
     ctx->state = &S->write;
     ctx->notify = 1;
     ctx->len = need;
-    if (kzA_cmpandswapR(&S->write.info->writing, 0, 1)) {
+    if (kzA_cmpandswapR(kzQ_busyword(&S->write), 0, 1)) {
+        if (kzQ_moved(&S->write)) return kz_write(S, ctx, len);
         ctx->result = kzQ_push(ctx, used);
         assert(ctx->result == KZ_OK || ctx->result == KZ_AGAIN);
         return ctx->result;
     }
+    kzA_fetchaddR(&kzQ_stats(&S->write)->busy, 1);
     return ctx->result = KZ_BUSY;
 }
 
 KZ_API char *kz_buffer(kz_Context *ctx, size_t *plen) {
     kzQ_State *QS = kz_checkstate(ctx);
     if (QS == NULL || ctx->result != KZ_OK) return NULL;
-    if (plen) *plen = ctx->len - sizeof(uint32_t);
-    return QS->data + ctx->pos + sizeof(uint32_t);
+    if (plen) *plen = ctx->len - kzQ_hdrlen(QS);
+    return QS->data + ctx->pos + kzQ_hdrlen(QS);
+}
+
+KZ_API int kz_next(kz_Context *ctx) {
+    kzQ_State *QS = kz_checkstate(ctx);
+    kz_Context next;
+    uint32_t   used, total;
+    if (QS == NULL || ctx->result != KZ_OK || QS != &QS->S->read)
+        return KZ_INVALID;
+    used = kzQ_loadused(QS);
+    if (used == KZ_MARK) return KZ_CLOSED;
+
+    /* scan on from the end of this message, `ctx` is left as is when none
+     * is published after it */
+    next = *ctx;
+    total = kzQ_span(QS, kzQ_head(QS), kzQ_next(ctx));
+    if (kzQ_scan(&next, kzQ_next(ctx), &total, kzQ_avail(QS, used)) == KZ_OK)
+        return *ctx = next, KZ_OK;
+    if (QS->index == NULL) return KZ_AGAIN;
+
+    /* the cached tail may be too old, see `kzQ_pop()` */
+    if (kzQ_scan(&next, (kzQ_head(QS) + total) % QS->info->size, &total,
+                 kzQ_indexused(QS, 1))
+        != KZ_OK)
+        return KZ_AGAIN;
+    return *ctx = next, KZ_OK;
 }
 
 KZ_API int kz_isread(const kz_Context *ctx) {
@@ -1242,35 +3250,351 @@ KZ_API int kz_isread(const kz_Context *ctx) {
 KZ_API void kz_cancel(kz_Context *ctx) {
     kzQ_State *QS = kz_checkstate(ctx);
     if (QS == NULL) return;
-    kzA_storeR(kz_isread(ctx) ? &QS->info->reading : &QS->info->writing, 0);
+    if (!kz_isread(ctx) && (QS->S->flags & KZ_MPSC)) {
+        /* the space is reserved already, leave a record to skip */
+        if (ctx->result == KZ_OK) kzQ_discard(ctx);
+        return;
+    }
+    if (ctx->result == KZ_AGAIN) kzQ_unpark(QS);
+    kzA_storeR(kzQ_busyword(QS), 0);
 }
 
 KZ_API int kz_commit(kz_Context *ctx, size_t len) {
     kzQ_State *QS = kz_checkstate(ctx);
     if (QS == NULL || ctx->result != KZ_OK) return KZ_INVALID;
-    return kz_isread(ctx) ? kzQ_commitpop(ctx) : kzQ_commitpush(ctx, len);
+    if (!kz_isread(ctx)) return kzQ_commitpush(ctx, (uint32_t)len, 0);
+    return kzQ_commitpop(ctx, 1);
 }
 
-KZ_API int kz_waitcontext(kz_Context *ctx, int millis) {
+KZ_API size_t kz_chunksize(const kz_State *S) {
+    /* a quarter of the queue, so the writer fills a chunk while the reader
+     * drains the others, and a chunk always fits even after a wrap */
+    size_t size, hdrlen;
+    if (S == NULL || S->hdr == NULL || S->write.slot) return 0;
+    hdrlen = kzQ_hdrlen(&S->write);
+    size = (S->write.info->size / 4) & ~(size_t)(KZ_ALIGN - 1);
+    if (size >= KZ_MORE) size = KZ_MORE - KZ_ALIGN;
+    return size > hdrlen ? size - hdrlen : 0;
+}
+
+KZ_API int kz_commitchunk(kz_Context *ctx, size_t len, int more) {
+    /* chunks of `KZ_MPSC` writers would interleave, only the last one of a
+     * message is allowed */
     kzQ_State *QS = kz_checkstate(ctx);
-    int        r, isread = kz_isread(ctx);
-    uint32_t   used;
-    if (QS == NULL) return KZ_INVALID;
-    if (ctx->result != KZ_AGAIN) return ctx->result;
-    used = kzA_load(&QS->info->used);
-    if (kzQ_checkclosed(QS, used)) return KZ_CLOSED;
-    r = isread ? kzQ_pop(ctx, used) : kzQ_push(ctx, used);
-    if (millis == 0) return ctx->result = r;
-    for (;;) { /* clang-format off */
-        if (r == KZ_AGAIN)
-            r = isread ? kzQ_waitpop(QS, used, millis)
-                       : kzQ_waitpush(QS, used, ctx->len, millis);
-        if (r != KZ_OK && r != KZ_AGAIN) break;
-        used = kzA_load(&QS->info->used);
-        if (kzQ_checkclosed(QS, used)) return KZ_CLOSED;
-        r = isread ? kzQ_pop(ctx, used) : kzQ_push(ctx, used);
+    if (QS == NULL || ctx->result != KZ_OK || kz_isread(ctx))
+        return KZ_INVALID;
+    if (more && (QS->S->flags & KZ_MPSC)) return KZ_INVALID;
+    return kzQ_commitpush(ctx, (uint32_t)len, more ? KZ_MORE : 0);
+}
+
+KZ_API int kz_more(const kz_Context *ctx) {
+    /* the header is stable until the record is committed */
+    const kzQ_State *QS = kz_checkstate((kz_Context *)ctx);
+    if (QS == NULL || ctx->result != KZ_OK || QS != &QS->S->read
+        || QS->slot)
+        return 0;
+    return (kzQ_loadhdr(QS, (uint32_t)ctx->pos) & KZ_MORE) != 0;
+}
+
+static uint32_t *kz_arenaword(kz_State *S, uint32_t i)
+{ return (uint32_t *)((char *)S->hdr + S->arena->offset) + i; }
+
+static uint32_t *kz_checkblock(kz_State *S, const kz_Block *blk) {
+    /* the generation word of the block, if `blk` is one of the arena */
+    kzQ_ShmArena *arena = S && S->hdr ? S->arena : NULL;
+    if (arena == NULL || blk == NULL || blk->offset % arena->blocksize
+        || blk->offset / arena->blocksize >= arena->count
+        || blk->len > arena->blocksize)
+        return NULL;
+    return kz_arenaword(S, blk->offset / arena->blocksize);
+}
+
+KZ_API size_t kz_blocksize(const kz_State *S)
+{ return S && S->hdr && S->arena ? S->arena->blocksize : 0; }
+
+KZ_API int kz_alloc(kz_State *S, kz_Block *blk) {
+    kzQ_ShmArena *arena;
+    uint32_t      i, words, start;
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    if ((arena = S->arena) == NULL || blk == NULL) return KZ_INVALID;
+
+    /* take the first free bit, from the word taken last by any side */
+    words = KZ_ARENAWORDS(arena->count);
+    start = kzA_loadR(&arena->hint);
+    for (i = 0; i < words; ++i) {
+        uint32_t  w = (start + i) % words, index;
+        uint32_t *word = kz_arenaword(S, arena->count + w), bits, bit;
+        while ((bits = kzA_load(word)) != ~(uint32_t)0) {
+            bit = ~bits & (bits + 1);
+            if (!kzA_cmpandswap(word, bits, bits | bit)) continue;
+            if (w != start) kzA_storeR(&arena->hint, w);
+            index = w * 32 + kz_log2(bit);
+            blk->offset = index * arena->blocksize;
+            blk->len = 0;
+            blk->gen = kzA_load(kz_arenaword(S, index));
+            return KZ_OK;
+        }
+    }
+    return KZ_AGAIN;
+}
+
+KZ_API char *kz_blockdata(kz_State *S, const kz_Block *blk) {
+    uint32_t *gen = kz_checkblock(S, blk);
+    if (gen == NULL || kzA_load(gen) != blk->gen) return NULL;
+    return (char *)S->hdr + S->arena->offset + KZ_ARENAMETA(S->arena->count)
+         + blk->offset;
+}
+
+KZ_API int kz_free(kz_State *S, const kz_Block *blk) {
+    /* a new generation makes the descriptors of the block stale before it
+     * can be taken again, and a second free of one fail */
+    uint32_t *gen = kz_checkblock(S, blk), *word, bits, bit, index;
+    if (gen == NULL || !kzA_cmpandswap(gen, blk->gen, blk->gen + 1))
+        return KZ_INVALID;
+    index = blk->offset / S->arena->blocksize;
+    word = kz_arenaword(S, S->arena->count + index / 32);
+    bit = (uint32_t)1 << (index % 32);
+    do bits = kzA_load(word);
+    while (!kzA_cmpandswap(word, bits, bits & ~bit));
+    return KZ_OK;
+}
+
+KZ_API int kz_readv(kz_State *S, kz_Context *ctxs, size_t count, size_t budget) {
+    kzQ_State *QS;
+    uint32_t   used, avail, total;
+    size_t     n, bytes;
+    int        r;
+    if (ctxs == NULL || count == 0) return KZ_INVALID;
+    if ((r = kz_read(S, ctxs)) != KZ_OK) return r;
+
+    /* collect every published message after the first one */
+    QS = &S->read;
+    used = kzQ_loadused(QS);
+    if (used == KZ_MARK) return 1;
+    avail = kzQ_avail(QS, used);
+    total = kzQ_span(QS, kzQ_head(QS), kzQ_next(ctxs));
+    bytes = ctxs[0].len - kzQ_hdrlen(QS);
+    for (n = 1; n < count; ++n) {
+        kz_Context *ctx = &ctxs[n];
+        *ctx = ctxs[n - 1];
+        if (kzQ_scan(ctx, kzQ_next(ctx), &total, avail) != KZ_OK) break;
+        bytes += ctx->len - kzQ_hdrlen(QS);
+        if (budget != 0 && bytes > budget) break;
+    }
+    return (int)n;
+}
+
+KZ_API int kz_writev(
+        kz_State *S, kz_Context *ctxs, const size_t *lens, size_t count) {
+    kzQ_State *QS;
+    uint32_t   used, need;
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    if (ctxs == NULL || lens == NULL || count == 0) return KZ_INVALID;
+
+    QS = &S->write;
+    if ((S->flags & KZ_MPSC)) {
+        if (kzQ_reserve(QS, ctxs, lens, count) == KZ_AGAIN)
+            ctxs->pos = KZ_BATCH;
+        return ctxs->result;
+    }
+    used = kzQ_loadused(QS);
+    if (used == KZ_MARK) return KZ_CLOSED;
+
+    memset(ctxs, 0, sizeof(kz_Context));
+    ctxs->state = QS;
+    ctxs->notify = 1;
+    if (!kzA_cmpandswapR(kzQ_busyword(QS), 0, 1)) {
+        kzA_fetchaddR(&kzQ_stats(QS)->busy, 1);
+        return ctxs->result = KZ_BUSY;
+    }
+    if (kzQ_moved(QS)) return kz_writev(S, ctxs, lens, count);
+    need = kzQ_layout(QS, ctxs, lens, count);
+    if (need > QS->info->size) {
+        kzA_storeR(kzQ_busyword(QS), 0);
+        return ctxs->result = KZ_TOOBIG;
+    }
+    if (need > QS->info->size - used && QS->index)
+        used = kzQ_indexused(QS, 1);
+    if (need > QS->info->size - used) {
+        /* leave the first context pending on the space of whole batch */
+        kzQ_count(QS, &kzQ_stats(QS)->again);
+        ctxs->pos = KZ_BATCH;
+        ctxs->len = need;
+        return ctxs->result = KZ_AGAIN;
+    }
+    return KZ_OK;
+}
+
+KZ_API int kz_commitv(kz_Context *ctxs, size_t count) {
+    kz_Context *last;
+    int         isread = kz_isread(ctxs);
+    if (isread < 0 || count == 0 || ctxs->result != KZ_OK) return KZ_INVALID;
+    if (!isread) return kzQ_commitpushv(ctxs, count);
+    last = &ctxs[count - 1];
+    if (kz_checkstate(last) == NULL || last->result != KZ_OK)
+        return KZ_INVALID;
+    return kzQ_commitpop(ctxs, count);
+}
+
+static int kzQ_isready(kzQ_State *QS, uint32_t need) {
+    uint32_t used = kzA_loadR(&QS->info->used);
+    if (used == KZ_MARK) return 1;
+    if (QS->index) { /* the cached index is left to the operations */
+        used = kzQ_distance(
+                QS, kzA_loadR(&QS->index->head), kzA_loadR(&QS->index->tail));
+        return need == KZ_WAITREAD ? used != 0 : QS->info->size - used >= need;
+    }
+    if (need == KZ_WAITREAD) return kzQ_readable(QS, used);
+    return QS->info->size - kzA_loadR(kzQ_spaceword(QS)) >= need;
+}
+
+static int kz_spin(
+        kz_State *S, uint32_t *pest, kzQ_State *QS, uint32_t need,
+        kzQ_State *RS, uint64_t *pstart) {
+    uint32_t est = kzA_loadR(pest), limit;
+    int      i;
+    if (S->spin == 0) return 0;
+
+    /* spin up to twice of the recent wait time, but never when recent waits
+     * are longer than the budget, the futex will be used anyway */
+    *pstart = kz_now();
+    if (est > S->spin) return 0;
+    limit = est * 2 + KZ_SPINMIN;
+    if (limit > S->spin) limit = S->spin;
+    for (;;) {
+        for (i = 0; i < KZ_SPINCHECK; ++i) {
+            if (kzQ_isready(QS, need)) return 1;
+            if (RS && kzQ_isready(RS, KZ_WAITREAD)) return 1;
+            kz_pause();
+        }
+        if (kz_now() - *pstart >= limit) return 0;
+    }
+}
+
+static void kz_spinlearn(kz_State *S, uint32_t *pest, uint64_t start) {
+    int64_t est = kzA_loadR(pest), elapsed;
+    if (S->spin == 0) return;
+    elapsed = (int64_t)(kz_now() - start);
+    if (elapsed > (int64_t)S->spin * 2) elapsed = (int64_t)S->spin * 2;
+    est += (elapsed - est) / 8;
+    kzA_storeR(pest, (uint32_t)est);
+}
+
+KZ_API int kz_setspin(kz_State *S, int micros) {
+    if (S == NULL) return KZ_INVALID;
+    if (micros < 0) micros = KZ_SPINDEFAULT;
+    if (micros > 1000000) micros = 1000000;
+    if (kz_cpucount() <= 1) micros = 0; /* peer can not run while spinning */
+    S->spin = (uint32_t)micros * 1000;
+    S->read.spin = S->write.spin = S->spin_mux = S->spin / 2;
+    if (S->lanes) {
+        size_t i, n = kz_lanecount(S->flags);
+        for (i = 1; i < n; ++i) kz_setspin(S->lanes[i], micros);
+    }
+    return KZ_OK;
+}
+
+KZ_API int kz_setcoalesce(
+        kz_State *S, size_t bytes, size_t count, int micros) {
+    if (S == NULL || S->hdr == NULL) return KZ_INVALID;
+    if (micros < 0) micros = 0;
+    if (micros > 1000000) micros = 1000000;
+    kz_flush(S); /* never leave a wake behind the old policy */
+    S->woke_count = kzA_load64R(&kzQ_stats(&S->write)->count);
+    S->woke_bytes = kzA_load64R(&kzQ_stats(&S->write)->bytes);
+    S->coalesce = (uint32_t)micros * 1000;
+    S->co_count = count > KZ_MAX_SIZE ? KZ_MAX_SIZE : (uint32_t)count;
+    S->co_bytes = bytes;
+    if (S->lanes) {
+        size_t i, n = kz_lanecount(S->flags);
+        for (i = 1; i < n; ++i)
+            kz_setcoalesce(S->lanes[i], bytes, count, micros);
+    }
+    return KZ_OK;
+}
+
+static int kz_flushstate(kz_State *S) {
+    if (kzA_load64R(&S->co_since) == 0) return KZ_OK;
+    return kzQ_flushpop(&S->write, 0);
+}
+
+KZ_API int kz_flush(kz_State *S) {
+    int r;
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    r = kz_flushstate(S);
+    if (S->lanes) {
+        size_t i, n = kz_lanecount(S->flags);
+        for (i = 1; i < n; ++i) kz_flushstate(S->lanes[i]);
+    }
+    return r < 0 ? r : KZ_OK;
+}
+
+static int kzQ_batchroom(kzQ_State *QS, uint32_t need, uint32_t used) {
+    if ((QS->S->flags & KZ_MPSC))
+        used = kzA_load(&QS->info->reserved);
+    else if (need > QS->info->size - used && QS->index)
+        used = kzQ_indexused(QS, 1);
+    if (need <= QS->info->size - used) return 1;
+    kzQ_count(QS, &kzQ_stats(QS)->again);
+    return 0;
+}
+
+static int kzQ_waitbatch(kz_Context *ctx, int millis) {
+    /* a pending batch reserves nothing, it waits for the space of the whole
+     * batch and stays pending, to be canceled and laid out again */
+    kzQ_State *QS = (kzQ_State *)ctx->state;
+    uint32_t   need = (uint32_t)ctx->len, used;
+    uint64_t   start;
+    int        r, waited = 0;
+    for (;;) {
+        used = kzQ_loadused(QS);
+        if (kzQ_checkclosed(QS, used)) return KZ_CLOSED;
+        if (kzQ_batchroom(QS, need, used)) return KZ_OK;
+        if (millis == 0) return KZ_AGAIN;
+        if (waited && millis > 0) return KZ_TIMEOUT;
+        kz_flushstate(QS->S); /* the peer may wait for them to reply */
+        start = 0;
+        r = kz_spin(QS->S, &QS->spin, QS, need, NULL, &start)
+                  ? KZ_OK
+                  : kzQ_waitpush(QS, used, need, millis);
+        kz_spinlearn(QS->S, &QS->spin, start);
+        if (r != KZ_OK) return r;
+        waited = 1;
+    }
+}
+
+KZ_API int kz_waitcontext(kz_Context *ctx, int millis) {
+    kzQ_State *QS = kz_checkstate(ctx);
+    int        r, isread = kz_isread(ctx);
+    uint32_t   used;
+    if (QS == NULL) return KZ_INVALID;
+    if (ctx->result != KZ_AGAIN) return ctx->result;
+    if (!isread && ctx->pos == KZ_BATCH) return kzQ_waitbatch(ctx, millis);
+    kzQ_unpark(QS);
+    used = kzQ_loadused(QS);
+    if (kzQ_checkclosed(QS, used)) return KZ_CLOSED;
+    r = isread ? kzQ_pop(ctx, used) : kzQ_push(ctx, used);
+    if (millis == 0 || r != KZ_AGAIN) return kzQ_park(ctx, r);
+    for (;;) { /* clang-format off */
+        if (r == KZ_AGAIN) {
+            uint32_t need = isread ? KZ_WAITREAD : (uint32_t)ctx->len;
+            uint64_t start = 0;
+            kzQ_park(ctx, r);
+            kz_flushstate(QS->S); /* the peer may wait for them to reply */
+            if (kz_spin(QS->S, &QS->spin, QS, need, NULL, &start))
+                r = KZ_OK;
+            else
+                r = isread ? kzQ_waitpop(QS, used, millis)
+                           : kzQ_waitpush(QS, used, ctx->len, millis);
+            kz_spinlearn(QS->S, &QS->spin, start);
+            kzQ_unpark(QS);
+        }
+        if (r != KZ_OK && r != KZ_AGAIN) break;
+        used = kzQ_loadused(QS);
+        if (kzQ_checkclosed(QS, used)) return KZ_CLOSED;
+        r = isread ? kzQ_pop(ctx, used) : kzQ_push(ctx, used);
         if (r != KZ_AGAIN) break;
-        if (millis > 0) return (ctx->result = r), KZ_TIMEOUT;
+        if (millis > 0) return kzQ_park(ctx, r), KZ_TIMEOUT;
     } /* clang-format on */
     return ctx->result = r;
 }
@@ -1280,23 +3604,42 @@ static int kz_checkmux(kz_State *S, kz_Mux *m) {
     m->wused = kzA_load(&S->write.info->used);
     m->rused = kzA_load(&S->read.info->used);
     if (m->wused == KZ_MARK || m->rused == KZ_MARK) return KZ_CLOSED;
+    if ((S->flags & KZ_INDEXED)) { /* the words to wait on are the indices */
+        m->wused = kzA_load(kzQ_spaceword(&S->write));
+        m->rused = kzA_load(kzQ_dataword(&S->read));
+        can_write = kzQ_isready(&S->write, m->need);
+        can_read = kzQ_isready(&S->read, KZ_WAITREAD);
+        return (can_write << 1) | can_read;
+    }
+    if ((S->flags & KZ_MPSC)) m->wused = kzA_load(&S->write.info->reserved);
     can_write = (S->write.info->size - m->wused >= m->need);
-    can_read = (m->rused != 0);
+    can_read = kzQ_readable(&S->read, m->rused);
     return (can_write << 1) | can_read;
 }
 
 KZ_API int kz_wait(kz_State *S, size_t len, int millis) {
-    kz_Mux mux;
-    int    r;
+    kz_Mux   mux;
+    uint32_t need;
+    int      r;
     mux.need = kzQ_calcneed(&S->write, len);
     if (mux.need > S->write.info->size) return KZ_TOOBIG;
     r = kz_checkmux(S, &mux);
     if (millis == 0) return r;
+    /* `KZ_MPSC` queues wake the waiters on freed reservations instead, so
+     * leave `need` to the reader */
+    need = (S->flags & KZ_MPSC) ? 0 : mux.need;
+    if (r == 0) kz_flushstate(S);
     while (r == 0) {
-        mux.seq = kzA_loadR(&S->write.info->seq);
-        kzA_cmpandswapR(&S->write.info->need, 0, mux.need);
-        r = kzQ_waitmux(S, &mux, millis);
-        kzA_cmpandswapR(&S->write.info->need, mux.need, 0);
+        uint64_t start = 0;
+        if (kz_spin(S, &S->spin_mux, &S->write, mux.need, &S->read, &start))
+            r = KZ_OK;
+        else {
+            mux.seq = kzA_loadR(&S->write.info->seq);
+            kzA_cmpandswapR(&S->write.info->need, 0, need);
+            r = kzQ_waitmux(S, &mux, millis);
+            kzA_cmpandswapR(&S->write.info->need, need, 0);
+        }
+        kz_spinlearn(S, &S->spin_mux, start);
         if (r != KZ_OK) break;
         r = kz_checkmux(S, &mux);
         if (millis > 0 && r == 0) r = KZ_TIMEOUT;
@@ -1304,21 +3647,1033 @@ KZ_API int kz_wait(kz_State *S, size_t len, int millis) {
     return r;
 }
 
-KZ_API kz_State *kz_open(const char *name, int flags, size_t bufsize) {
-    kz_State *S = kz_newstate(name);
-    int       r;
-    if (S == NULL) return NULL;
-    S->hdr = NULL;
+static int kz_checkmany(
+        kz_State **Ss, int *modes, const int *events, kz_Mux *muxes,
+        size_t count) {
+    size_t i;
+    int    ready = 0;
+    for (i = 0; i < count; ++i) {
+        int r = 0;
+        if (events[i] != 0) {
+            muxes[i].seq = kzA_loadR(&Ss[i]->write.info->seq);
+            r = kz_checkmux(Ss[i], &muxes[i]);
+            r = r == KZ_CLOSED ? events[i] : r & events[i];
+        }
+        ready += (modes[i] = r) != 0;
+    }
+    return ready;
+}
+
+KZ_API int kz_waitmany(
+        kz_State **Ss, int *modes, size_t count, size_t len, int millis) {
+    int    events[KZ_WAITMAX], watched = 0, r;
+    kz_Mux muxes[KZ_WAITMAX];
+    size_t i;
+    if (Ss == NULL || modes == NULL || count > KZ_WAITMAX) return KZ_INVALID;
+    for (i = 0; i < count; ++i) {
+        events[i] = Ss[i] && Ss[i]->hdr ? modes[i] & KZ_BOTH : 0;
+        muxes[i].need = 0;
+        if ((events[i] & KZ_WRITE)) {
+            muxes[i].need = kzQ_calcneed(&Ss[i]->write, len);
+            if (muxes[i].need > Ss[i]->write.info->size) return KZ_TOOBIG;
+        }
+        watched += events[i] != 0;
+    }
+    if (watched == 0) return KZ_INVALID;
+
+    /* closed channels are reported ready for all the modes asked, then the
+     * following operations return `KZ_CLOSED` */
+    r = kz_checkmany(Ss, modes, events, muxes, count);
+    if (millis == 0) return r;
+    for (i = 0; r == 0 && i < count; ++i)
+        if (events[i]) kz_flushstate(Ss[i]);
+    while (r == 0) {
+        r = kz_waitmanyv(Ss, events, muxes, count, millis);
+        if (r != KZ_OK) break;
+        r = kz_checkmany(Ss, modes, events, muxes, count);
+        if (millis > 0 && r == 0) r = KZ_TIMEOUT;
+    }
+    return r;
+}
+
+KZ_API int kz_lanes(const kz_State *S) {
+    if (S == NULL || S->hdr == NULL) return 0;
+    return S->lanes ? (int)kz_lanecount(S->flags) : 1;
+}
+
+KZ_API kz_State *kz_lane(kz_State *S, int lane) {
+    if (lane < 0 || lane >= kz_lanes(S)) return NULL;
+    return S->lanes ? S->lanes[lane] : S;
+}
+
+KZ_API int kz_readlanes(kz_State *S, kz_Context *ctx) {
+    int i, n = kz_lanes(S), closed = 0, busy = 0;
+    if (n == 0) return KZ_CLOSED;
+    if (ctx == NULL) return KZ_INVALID;
+    for (i = 0; i < n; ++i) {
+        int r = kz_read(kz_lane(S, i), ctx);
+        if (r == KZ_OK) return i;
+        if (r == KZ_AGAIN) kz_cancel(ctx); /* wait by `kz_waitlanes()` */
+        closed |= r == KZ_CLOSED, busy |= r == KZ_BUSY;
+    }
+    return closed ? KZ_CLOSED : busy ? KZ_BUSY : KZ_AGAIN;
+}
+
+KZ_API int kz_waitlanes(kz_State *S, int millis) {
+    int modes[KZ_MAXLANES], i, n = kz_lanes(S);
+    if (n == 0) return KZ_CLOSED;
+    for (i = 0; i < n; ++i) modes[i] = KZ_READ;
+    return kz_waitmany(S->lanes ? S->lanes : &S, modes, n, 0, millis);
+}
+
+static void kz_interest(kz_State *S, int mode, uint32_t need) {
+    if ((mode & KZ_READ))
+        kzA_cmpandswapR(&S->read.info->need, 0, KZ_WAITREAD);
+    if ((mode & KZ_WRITE) && (S->flags & KZ_MPSC))
+        kzA_fetchaddR(&S->write.info->pushers, 1);
+    else if ((mode & KZ_WRITE))
+        kzA_cmpandswapR(&S->write.info->need, 0, need);
+}
+
+KZ_API int kz_notifyfd(const kz_State *S, int mode) {
+#ifdef _WIN32
+    return (void)S, (void)mode, -1;
+#else
+    int i = mode == KZ_READ ? 0 : mode == KZ_WRITE ? 1 : -1;
+    if (S == NULL || i < 0) return -1;
+    return S->epoll_fds[i] >= 0 ? S->epoll_fds[i] : S->event_fds[i];
+#endif
+}
+
+KZ_API int kz_clearnotify(kz_State *S, int mode) {
+    int r = 0;
+#ifndef _WIN32
+    uint64_t count;
+    int      i;
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    for (i = 0; i < 2; ++i) { /* the signals all go to the eventfds */
+        int m = i == 0 ? KZ_READ : KZ_WRITE;
+        if ((mode & m) && S->event_fds[i] >= 0
+            && read(S->event_fds[i], &count, sizeof(count)) > 0)
+            r |= m;
+    }
+#endif
+    (void)S, (void)mode;
+    return r;
+}
 
+KZ_API int kz_register(kz_State *S, int mode, size_t len) {
+    uint32_t need = 0;
+    int      r = 0;
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    if (!(S->flags & KZ_NOTIFY) || (mode & KZ_BOTH) == 0) return KZ_INVALID;
+    if (!kz_cannotify(S)) return KZ_AGAIN;
+    kz_flushstate(S);
+    if ((mode & KZ_WRITE)) {
+        need = kzQ_calcneed(&S->write, len);
+        if (need > S->write.info->size) return KZ_TOOBIG;
+    }
+
+    /* the peer signals only when it sees the interest, so check again after
+     * published it, just like the futex does */
+    kz_interest(S, mode, need);
+    kzA_fence();
+    if ((mode & KZ_READ) && kzQ_isready(&S->read, KZ_WAITREAD)) r |= KZ_READ;
+    if ((mode & KZ_WRITE) && kzQ_isready(&S->write, need)) r |= KZ_WRITE;
+    if (r != 0) kz_unregister(S, mode);
+    return r;
+}
+
+KZ_API int kz_unregister(kz_State *S, int mode) {
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    if ((mode & KZ_READ)) kzQ_setneed(&S->read, 0);
+    if ((mode & KZ_WRITE) && (S->flags & KZ_MPSC))
+        kzA_subfetchR(&S->write.info->pushers, 1);
+    else if ((mode & KZ_WRITE))
+        kzQ_setneed(&S->write, 0);
+    return KZ_OK;
+}
+
+#ifdef __linux__
+static size_t kzQ_futexwords(kzQ_State *QS, uint32_t *word, kz_FutexWait *w) {
+    /* closing marks `used`, so watch it too if it is not the word already,
+     * the mark of a wait set up late fails it at once instead of a wake */
+    size_t i, n = word == &QS->info->used ? 1 : 2;
+    for (i = 0; i < n; ++i, word = &QS->info->used) {
+        w[i].val = kzA_loadR(word);
+        w[i].uaddr = (uint64_t)(uintptr_t)word;
+        w[i].flags = 0x02; /* FUTEX2_SIZE_U32 */
+        if (kz_islocal(QS->S)) w[i].flags |= 0x80; /* FUTEX2_PRIVATE */
+        w[i].reserved = 0;
+    }
+    return n;
+}
+#endif
+
+KZ_API int kz_prepwait(
+        kz_State *S, int mode, size_t len, kz_FutexWait *waits,
+        size_t *pcount) {
+#ifdef __linux__
+    uint32_t need = 0, *word;
+    size_t   n = 0;
+    int      r = 0;
+    if (S == NULL || S->hdr == NULL) return KZ_CLOSED;
+    if ((mode & KZ_BOTH) == 0 || waits == NULL || pcount == NULL)
+        return KZ_INVALID;
+    kz_flushstate(S);
+    if ((mode & KZ_WRITE)) {
+        need = kzQ_calcneed(&S->write, len);
+        if (need > S->write.info->size) return KZ_TOOBIG;
+    }
+
+    /* the same handshake as `kz_register()`, with the words taken before
+     * checking, so any change after the check fails the wait at once */
+    kz_interest(S, mode, need);
+    kzA_fence();
+    if ((mode & KZ_READ))
+        n += kzQ_futexwords(&S->read, kzQ_dataword(&S->read), waits + n);
+    if ((mode & KZ_WRITE)) {
+        word = (S->flags & KZ_MPSC) ? &S->write.info->reserved
+                                    : kzQ_spaceword(&S->write);
+        n += kzQ_futexwords(&S->write, word, waits + n);
+    }
+    if ((mode & KZ_READ) && kzQ_isready(&S->read, KZ_WAITREAD)) r |= KZ_READ;
+    if ((mode & KZ_WRITE) && kzQ_isready(&S->write, need)) r |= KZ_WRITE;
+    if (r != 0) kz_unregister(S, mode);
+    *pcount = r != 0 ? 0 : n;
+    return r;
+#else
+    (void)S, (void)mode, (void)len, (void)waits, (void)pcount;
+    return KZ_INVALID;
+#endif
+}
+
+/* open the channel of a new state, with the arena or the slots to create */
+static kz_State *kz_openstate(kz_State *S, int flags, size_t bufsize) {
+    size_t huge;
+    int    r;
 #ifdef SYS_futex_waitv
     kz_check_waitv();
 #endif
 
     S->shm_size = kz_get_aligned_size(sizeof(kz_ShmHdr) + bufsize, KZ_ALIGN);
+    huge = (flags & KZ_HUGEPAGE) ? kz_hugepagesize() : 0;
+    if ((flags & KZ_CREATE) && (flags & KZ_MIRROR) && bufsize / 2 != 0) {
+        /* a page for the header, and the queues in whole pages */
+        size_t pagesize = huge ? huge : kz_pagesize();
+        S->shm_size = pagesize + kz_get_aligned_size(bufsize / 2, pagesize) * 2;
+    }
+    else if ((flags & KZ_CREATE) && (flags & KZ_LANEMASK)) {
+        /* equal lanes, every one with its own header */
+        size_t n = kz_lanecount(flags);
+        S->shm_size = n * kz_get_aligned_size(
+                kz_hdrsize(flags) + bufsize / n, 64);
+    }
+    else if ((flags & KZ_CREATE))
+        S->shm_size += kz_hdrsize(flags) - sizeof(kz_ShmHdr)
+                     + kz_arenasize(S->arena_block, S->arena_count);
+    if ((flags & KZ_CREATE) && huge != 0) /* hugetlbfs needs this */
+        S->shm_size = kz_get_aligned_size(S->shm_size, huge);
     r = flags & KZ_CREATE ? kz_createshm(S, flags) : kz_openshm(S);
-    return r == KZ_OK ? S : NULL;
+    if (r != KZ_OK) return NULL;
+    if (((S->flags & KZ_NOTIFY) && kz_initnotify(S, flags & KZ_CREATE))
+            || kz_adviseshm(S, flags) != KZ_OK) {
+        kz_initfail(S);
+        return NULL;
+    }
+    if ((flags & KZ_SPIN)) kz_setspin(S, KZ_SPINDEFAULT);
+    kz_startwatch(S);
+    return S;
+}
+
+KZ_API kz_State *kz_open(const char *name, int flags, size_t bufsize)
+{ return kz_openarena(name, flags, bufsize, 0, 0); }
+
+KZ_API kz_State *kz_openarena(
+        const char *name, int flags, size_t bufsize, size_t blocksize,
+        size_t count) {
+    kz_State *S;
+    flags &= ~KZ_HASARENA;
+    if ((flags & KZ_CREATE) && count != 0) {
+        /* the arena is laid out only at creation, in whole cache lines */
+        blocksize = kz_get_aligned_size(blocksize, 64);
+        if (blocksize == 0 || blocksize >= KZ_MAX_SIZE || count >= KZ_MAX_SIZE
+            || (flags & (KZ_MIRROR | KZ_LANEMASK)))
+            return errno = EINVAL, (kz_State *)NULL;
+        flags |= KZ_HASARENA;
+    }
+    if ((S = kz_newstate(name)) == NULL) return NULL;
+    S->hdr = NULL;
+    if ((flags & KZ_HASARENA)) {
+        S->arena_block = (uint32_t)blocksize;
+        S->arena_count = (uint32_t)count;
+    }
+    return kz_openstate(S, flags, bufsize);
+}
+
+KZ_API kz_State *kz_openslots(
+        const char *name, int flags, size_t bufsize, size_t slotsize) {
+    /* the slots are laid out only at creation, a slot has no header to
+     * mark a wrap, a reservation of `KZ_MPSC`, a chunk or a stamp */
+    kz_State *S;
+    flags &= ~KZ_HASARENA;
+    if ((flags & KZ_CREATE)) {
+        slotsize = kz_get_aligned_size(slotsize, KZ_ALIGN);
+        if (slotsize == 0 || slotsize > bufsize / 2 || bufsize >= KZ_MAX_SIZE
+            || (flags & (KZ_MPSC | KZ_MIRROR | KZ_TIMESTAMP | KZ_LANEMASK)))
+            return errno = EINVAL, (kz_State *)NULL;
+    }
+    if ((S = kz_newstate(name)) == NULL) return NULL;
+    S->hdr = NULL;
+    if ((flags & KZ_CREATE)) S->slot_size = (uint32_t)slotsize;
+    return kz_openstate(S, flags, bufsize);
+}
+
+KZ_API size_t kz_slotsize(const kz_State *S)
+{ return S && S->hdr ? S->write.slot : 0; }
+
+/* broadcast ring */
+
+#ifndef _WIN32
+
+/* The indices count the bytes since creation and never wrap. The writer
+ * owns `tail` and `start`, the messages kept are in [start, tail); every
+ * reader owns the `head` of its cursor. The writer moves `start` before
+ * overwriting anything, the readers check it again after copying a message
+ * out, so a `KZ_DROP` writer never waits for the readers it overruns. */
+#define KZ_JOINING ((uint32_t)KZ_MAX_SIZE) /* pid of a cursor being set up */
+
+typedef struct kzB_ShmHdr {
+    uint32_t size;      /* Size of the ring. */
+    uint32_t flags;     /* `KZ_DROP` given at creation. */
+    uint32_t owner_pid; /* Writer process id, 0 once closed. */
+    uint32_t readers;   /* Slots of the cursor table. */
+    uint32_t closed;    /* Whether the writer has closed. */
+    uint32_t seq;       /* Bumped on sends, the readers wait on it. */
+    uint32_t waiters;   /* Readers waiting on `seq`. */
+    uint32_t freed;     /* Bumped on reads, the writer waits on it. */
+    uint32_t need;      /* Bytes the writer waits for, 0 if not waiting. */
+    uint32_t padding[3];
+    uint64_t tail;      /* Index of the next message. */
+    uint64_t start;     /* Index of the oldest message kept. */
+} kzB_ShmHdr;
+
+typedef struct kzB_ShmCursor {
+    uint32_t pid;     /* Reader process id, 0 if the slot is free. */
+    uint32_t padding1[1];
+    uint64_t head;    /* Index of the next message to read. */
+    uint64_t dropped; /* Bytes overrun before read, `KZ_DROP` only. */
+    uint32_t padding2[10];
+} kzB_ShmCursor;
+
+KZ_STATIC_ASSERT(sizeof(kzB_ShmHdr) == 64 && sizeof(kzB_ShmCursor) == 64);
+
+struct kz_Bcast {
+    int            self_pid;
+    int            shm_fd;
+    size_t         shm_size;
+    kzB_ShmHdr    *hdr;
+    kzB_ShmCursor *cursor;  /* Slot of this reader, NULL for the writer. */
+    char          *data;    /* The ring, after the cursor table. */
+    uint64_t       minhead; /* Cached head of the slowest reader. */
+};
+
+/* clang-format off */
+static size_t kzB_metasize(uint32_t readers)
+{ return sizeof(kzB_ShmHdr) + sizeof(kzB_ShmCursor) * (size_t)readers; }
+
+static kzB_ShmCursor *kzB_cursors(const kz_Bcast *B)
+{ return (kzB_ShmCursor *)(B->hdr + 1); }
+
+static uint32_t kzB_recsize(size_t len)
+{ return (uint32_t)kz_get_aligned_size(len + sizeof(uint32_t), KZ_ALIGN); }
+
+static uint32_t *kzB_hdrword(const kz_Bcast *B, uint32_t pos)
+{ return (uint32_t *)(B->data + pos); }
+/* clang-format on */
+
+static int kzB_initfail(kz_Bcast *B) {
+    int err = errno;
+    if (B->hdr != NULL) munmap(B->hdr, B->shm_size);
+    if (B->shm_fd >= 0) close(B->shm_fd);
+    free(B);
+    errno = err;
+    return KZ_FAIL;
+}
+
+static int kzB_mapshm(kz_Bcast *B) {
+    struct stat statbuf;
+    void       *p;
+    if (fstat(B->shm_fd, &statbuf) == -1) return KZ_FAIL;
+    if ((size_t)statbuf.st_size < sizeof(kzB_ShmHdr))
+        return errno = ENOENT, KZ_FAIL;
+    B->shm_size = (size_t)statbuf.st_size;
+    p = mmap(NULL, B->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+             B->shm_fd, 0);
+    if (p == MAP_FAILED) return KZ_FAIL;
+    B->hdr = (kzB_ShmHdr *)p;
+    return KZ_OK;
+}
+
+static int kzB_createshm(
+        kz_Bcast *B, const char *name, int flags, size_t bufsize,
+        int readers) {
+    size_t      size = kz_get_aligned_size(bufsize, KZ_ALIGN);
+    int         oflags = O_CREAT | O_RDWR, created;
+    uint32_t    pid;
+    struct stat statbuf;
+    if (readers <= 0 || bufsize >= KZ_MAX_SIZE || size < sizeof(uint32_t) * 2
+        || kzB_metasize((uint32_t)readers) + size >= KZ_MAX_SIZE)
+        return errno = EINVAL, kzB_initfail(B);
+    if ((flags & KZ_EXCL)) oflags |= O_EXCL;
+    B->shm_fd = shm_open(name, oflags, flags & 0x1FF);
+    if (B->shm_fd == -1 || fstat(B->shm_fd, &statbuf) == -1)
+        return kzB_initfail(B);
+    created = statbuf.st_size == 0 || (flags & KZ_RESET);
+    if (created
+        && ftruncate(B->shm_fd,
+                     (off_t)(kzB_metasize((uint32_t)readers) + size)) == -1)
+        return kzB_initfail(B);
+    if (kzB_mapshm(B) != KZ_OK) return kzB_initfail(B);
+    if (created) {
+        memset(B->hdr, 0, kzB_metasize((uint32_t)readers));
+        B->hdr->size = (uint32_t)size;
+        B->hdr->flags = flags & KZ_DROP;
+        B->hdr->readers = (uint32_t)readers;
+    }
+    if (B->hdr->size != size || B->hdr->readers != (uint32_t)readers
+        || B->shm_size != kzB_metasize(B->hdr->readers) + size)
+        return errno = EINVAL, kzB_initfail(B);
+    B->data = (char *)B->hdr + kzB_metasize(B->hdr->readers);
+
+    /* take over the ring left by a writer gone, the readers stay */
+    pid = kzA_load(&B->hdr->owner_pid);
+    if (pid != 0 && (int)pid != B->self_pid && kz_pidexists((int)pid))
+        return errno = EACCES, kzB_initfail(B);
+    kzA_store(&B->hdr->owner_pid, (uint32_t)B->self_pid);
+    kzA_store(&B->hdr->closed, 0);
+    return KZ_OK;
+}
+
+static void kzB_wakewriter(kz_Bcast *B, uint64_t head) {
+    /* wake the writer only if this reader is not in its way any more */
+    kzB_ShmHdr *hdr = B->hdr;
+    uint32_t    need;
+    kzA_fence(); /* pairs with the one in `kz_bcwait()` */
+    need = kzA_loadR(&hdr->need);
+    if (need == 0 || kzA_load64R(&hdr->tail) + need > head + hdr->size)
+        return;
+    kzA_fetchadd(&hdr->freed, 1);
+    kz_futex_wake(&hdr->freed, 0, 0);
+}
+
+static int kzB_joinshm(kz_Bcast *B, const char *name) {
+    kzB_ShmCursor *c;
+    uint32_t       i, pid;
+    B->shm_fd = kz_shmopen(name, O_RDWR, 0666);
+    if (B->shm_fd == -1 || kzB_mapshm(B) != KZ_OK) return kzB_initfail(B);
+    if (B->hdr->readers == 0
+        || B->shm_size != kzB_metasize(B->hdr->readers) + B->hdr->size)
+        return errno = EBADF, kzB_initfail(B);
+    B->data = (char *)B->hdr + kzB_metasize(B->hdr->readers);
+
+    /* take a free slot, or the one of a reader gone without leaving; the
+     * writer skips it until the real pid is stored, so it never sees the
+     * cursor of the previous reader */
+    for (i = 0, c = kzB_cursors(B); i < B->hdr->readers; ++i, ++c) {
+        pid = kzA_load(&c->pid);
+        if (pid == KZ_JOINING
+            || (pid != 0
+                && ((int)pid == B->self_pid || kz_pidexists((int)pid))))
+            continue;
+        if (kzA_cmpandswap(&c->pid, pid, KZ_JOINING)) break;
+    }
+    if (i == B->hdr->readers) return errno = EBUSY, kzB_initfail(B);
+    kzA_store64R(&c->dropped, 0);
+    kzA_store64(&c->head, kzA_load64(&B->hdr->tail));
+    kzA_store(&c->pid, (uint32_t)B->self_pid);
+    kzA_fence(); /* the pid goes before loading `start` */
+    /* the writer may have gone past the new head before seeing the pid,
+     * nothing was read yet so nothing is dropped */
+    if (kzA_load64R(&c->head) < kzA_load64(&B->hdr->start))
+        kzA_store64(&c->head, kzA_load64(&B->hdr->start));
+    B->cursor = c;
+    kzB_wakewriter(B, kzA_load64R(&c->head));
+    return KZ_OK;
 }
 
+static uint64_t kzB_minhead(kz_Bcast *B, kzB_ShmCursor **pslow) {
+    /* readers behind `start` are overrun, they are at `start` in effect */
+    kzB_ShmHdr    *hdr = B->hdr;
+    kzB_ShmCursor *c = kzB_cursors(B);
+    uint64_t       start = kzA_load64R(&hdr->start), head;
+    uint64_t       min = kzA_load64R(&hdr->tail);
+    uint32_t       i, pid;
+    *pslow = NULL;
+    for (i = 0; i < hdr->readers; ++i, ++c) {
+        pid = kzA_load(&c->pid);
+        if (pid == 0 || pid == KZ_JOINING) continue;
+        head = kzA_load64(&c->head);
+        if (head < start) head = start;
+        if (head < min) min = head, *pslow = c;
+    }
+    return min;
+}
+
+static int kzB_reclaim(kz_Bcast *B, kzB_ShmCursor *c) {
+    /* a reader gone without leaving blocks the writer forever */
+    uint32_t pid = kzA_load(&c->pid);
+    if (pid == 0 || pid == KZ_JOINING || (int)pid == B->self_pid
+        || kz_pidexists((int)pid))
+        return 0;
+    return kzA_cmpandswap(&c->pid, pid, 0);
+}
+
+static int kzB_room(kz_Bcast *B, uint32_t n) {
+    /* whether `n` bytes at `tail` overwrite no message unread */
+    kzB_ShmHdr    *hdr = B->hdr;
+    kzB_ShmCursor *slow;
+    uint64_t       end = kzA_load64R(&hdr->tail) + n;
+    if (end <= hdr->size + B->minhead) return 1;
+    for (;;) {
+        B->minhead = kzB_minhead(B, &slow);
+        if (end <= hdr->size + B->minhead) return 1;
+        if (slow == NULL || !kzB_reclaim(B, slow)) break;
+    }
+    return (hdr->flags & KZ_DROP) != 0;
+}
+
+static int kzB_reserve(kz_Bcast *B, uint32_t n) {
+    /* move `start` past the messages `n` bytes at `tail` overwrite */
+    kzB_ShmHdr *hdr = B->hdr;
+    uint64_t    end = kzA_load64R(&hdr->tail) + n, start;
+    uint32_t    pos, len;
+    if (!kzB_room(B, n)) return KZ_AGAIN;
+    if (end <= hdr->size) return KZ_OK;
+    start = kzA_load64R(&hdr->start);
+    if (start >= end - hdr->size) return KZ_OK;
+    while (start < end - hdr->size) {
+        pos = (uint32_t)(start % hdr->size);
+        len = kzA_loadR(kzB_hdrword(B, pos));
+        start += len == KZ_MARK ? hdr->size - pos : kzB_recsize(len);
+    }
+    kzA_store64(&hdr->start, start);
+    kzA_fence(); /* `start` goes before the data, see `kz_bcrecv()` */
+    return KZ_OK;
+}
+
+static void kzB_publish(kz_Bcast *B, uint64_t tail) {
+    kzB_ShmHdr *hdr = B->hdr;
+    kzA_store64(&hdr->tail, tail);
+    kzA_store(&hdr->seq, kzA_loadR(&hdr->seq) + 1);
+    kzA_fence(); /* pairs with the one in `kz_bcwait()` */
+    if (kzA_loadR(&hdr->waiters) != 0) kz_futex_wake(&hdr->seq, 1, 0);
+}
+
+static int kzB_overrun(kz_Bcast *B, uint64_t head) {
+    /* the writer went past `head`, go on from the oldest message kept */
+    kzB_ShmCursor *c = B->cursor;
+    uint64_t       start = kzA_load64(&B->hdr->start);
+    kzA_store64R(&c->dropped, kzA_load64R(&c->dropped) + (start - head));
+    kzA_store64(&c->head, start);
+    return KZ_DROPPED;
+}
+
+static int kzB_readable(kz_Bcast *B) {
+    uint64_t head = kzA_load64R(&B->cursor->head);
+    return head != kzA_load64(&B->hdr->tail)
+        || head < kzA_load64(&B->hdr->start);
+}
+
+static int kzB_waitspace(kz_Bcast *B, size_t len, int millis) {
+    kzB_ShmHdr *hdr = B->hdr;
+    uint32_t    n = kzB_recsize(len), freed = kzA_load(&hdr->freed);
+    uint32_t    pos = (uint32_t)(kzA_load64R(&hdr->tail) % hdr->size);
+    int         r = KZ_TIMEOUT;
+    if (len >= hdr->size || n > hdr->size) return KZ_TOOBIG;
+    if (n > hdr->size - pos) n = hdr->size - pos; /* the mark goes first */
+    kzA_store(&hdr->need, n);
+    kzA_fence(); /* pairs with the one in `kzB_wakewriter()` */
+    if (kzB_room(B, n))
+        r = KZ_OK;
+    else if (millis != 0)
+        r = kz_futex_wait(&hdr->freed, freed, millis, 0);
+    kzA_store(&hdr->need, 0);
+    return r;
+}
+
+KZ_API kz_Bcast *kz_bcopen(
+        const char *name, int flags, size_t bufsize, int readers) {
+    kz_Bcast *B;
+    int       r;
+    if ((flags & ~(KZ_CREATE | KZ_EXCL | KZ_RESET | KZ_DROP | 0x1FF)))
+        return errno = EINVAL, (kz_Bcast *)NULL;
+    if ((B = (kz_Bcast *)malloc(sizeof(kz_Bcast))) == NULL) return NULL;
+    memset(B, 0, sizeof(kz_Bcast));
+    B->self_pid = getpid();
+    B->shm_fd = -1;
+    r = (flags & KZ_CREATE) ? kzB_createshm(B, name, flags, bufsize, readers)
+                            : kzB_joinshm(B, name);
+    return r == KZ_OK ? B : NULL;
+}
+
+KZ_API void kz_bcclose(kz_Bcast *B) {
+    kzB_ShmHdr *hdr;
+    if (B == NULL) return;
+    hdr = B->hdr;
+    if (B->cursor != NULL) { /* leave, the writer may wait for this slot */
+        kzA_store(&B->cursor->pid, 0);
+        kzB_wakewriter(B, kzA_load64R(&hdr->tail));
+    } else if (kzA_cmpandswap(&hdr->owner_pid, B->self_pid, 0)) {
+        kzA_store(&hdr->closed, 1);
+        kzA_store(&hdr->seq, kzA_loadR(&hdr->seq) + 1);
+        kzA_fence();
+        kz_futex_wake(&hdr->seq, 1, 0);
+    }
+    munmap(B->hdr, B->shm_size);
+    close(B->shm_fd);
+    free(B);
+}
+
+KZ_API int kz_bcsend(kz_Bcast *B, const void *data, size_t len) {
+    kzB_ShmHdr *hdr;
+    uint64_t    tail;
+    uint32_t    n, pos;
+    int         r;
+    if (B == NULL || B->cursor != NULL) return KZ_INVALID;
+    hdr = B->hdr;
+    if (len >= hdr->size || (n = kzB_recsize(len)) > hdr->size)
+        return KZ_TOOBIG;
+    if (kzA_loadR(&hdr->closed)) return KZ_CLOSED;
+    tail = kzA_load64R(&hdr->tail);
+    pos = (uint32_t)(tail % hdr->size);
+    if (n > hdr->size - pos) { /* waste the end of the ring, never wrap */
+        if ((r = kzB_reserve(B, hdr->size - pos)) != KZ_OK) return r;
+        kzA_store(kzB_hdrword(B, pos), KZ_MARK);
+        tail += hdr->size - pos, pos = 0;
+        kzB_publish(B, tail); /* the writer may wait for readers past it */
+    }
+    if ((r = kzB_reserve(B, n)) != KZ_OK) return r;
+    kzA_store(kzB_hdrword(B, pos), (uint32_t)len);
+    memcpy(B->data + pos + sizeof(uint32_t), data, len);
+    kzB_publish(B, tail + n);
+    return KZ_OK;
+}
+
+KZ_API int kz_bcrecv(kz_Bcast *B, void *buf, size_t *plen) {
+    kzB_ShmHdr *hdr;
+    uint64_t    head;
+    uint32_t    pos, len;
+    if (B == NULL || B->cursor == NULL || plen == NULL) return KZ_INVALID;
+    hdr = B->hdr;
+    for (head = kzA_load64R(&B->cursor->head);;) {
+        if (kzA_load64(&hdr->start) > head) return kzB_overrun(B, head);
+        if (head == kzA_load64(&hdr->tail))
+            return kzA_load(&hdr->closed) ? KZ_CLOSED : KZ_AGAIN;
+
+        /* copy it out first, it is only good if not overrun meanwhile */
+        pos = (uint32_t)(head % hdr->size);
+        len = kzA_loadR(kzB_hdrword(B, pos));
+        if (len != KZ_MARK && len <= *plen
+            && len <= hdr->size - pos - sizeof(uint32_t))
+            memcpy(buf, B->data + pos + sizeof(uint32_t), len);
+        kzA_fence();
+        if (kzA_load64R(&hdr->start) > head) return kzB_overrun(B, head);
+        if (len != KZ_MARK) break;
+        head += hdr->size - pos;
+        kzA_store64(&B->cursor->head, head);
+        kzB_wakewriter(B, head);
+    }
+    if (len > *plen) return *plen = len, KZ_TOOBIG;
+    *plen = len;
+    head += kzB_recsize(len);
+    kzA_store64(&B->cursor->head, head);
+    kzB_wakewriter(B, head);
+    return KZ_OK;
+}
+
+KZ_API int kz_bcwait(kz_Bcast *B, size_t len, int millis) {
+    kzB_ShmHdr *hdr;
+    uint32_t    seq, pid;
+    int         r = KZ_TIMEOUT;
+    if (B == NULL) return KZ_INVALID;
+    if (B->cursor == NULL) return kzB_waitspace(B, len, millis);
+    hdr = B->hdr;
+    seq = kzA_load(&hdr->seq);
+    kzA_fetchadd(&hdr->waiters, 1);
+    kzA_fence(); /* pairs with the one in `kz_bcsend()` */
+    pid = kzA_load(&hdr->owner_pid);
+    if (kzB_readable(B))
+        r = KZ_OK;
+    else if (kzA_load(&hdr->closed) || pid == 0 || !kz_pidexists((int)pid))
+        r = KZ_CLOSED;
+    else if (millis != 0)
+        r = kz_futex_wait(&hdr->seq, seq, millis, 0);
+    kzA_subfetch(&hdr->waiters, 1);
+    return r;
+}
+
+KZ_API int kz_bcreaders(const kz_Bcast *B) {
+    const kzB_ShmCursor *c;
+    uint32_t             i;
+    int                  n = 0;
+    if (B == NULL) return KZ_INVALID;
+    for (i = 0, c = kzB_cursors(B); i < B->hdr->readers; ++i, ++c)
+        n += kzA_load((uint32_t *)&c->pid) != 0;
+    return n;
+}
+
+KZ_API uint64_t kz_bcdropped(const kz_Bcast *B) {
+    if (B == NULL || B->cursor == NULL) return 0;
+    return kzA_load64R(&B->cursor->dropped);
+}
+
+#else /* broadcast rings are not supported on Windows */
+
+/* clang-format off */
+KZ_API kz_Bcast *kz_bcopen(
+        const char *name, int flags, size_t bufsize, int readers) {
+    (void)name, (void)flags, (void)bufsize, (void)readers;
+    return errno = ENOSYS, (kz_Bcast *)NULL;
+}
+
+KZ_API void kz_bcclose(kz_Bcast *B) { (void)B; }
+
+KZ_API int kz_bcsend(kz_Bcast *B, const void *data, size_t len)
+{ return (void)B, (void)data, (void)len, KZ_INVALID; }
+
+KZ_API int kz_bcrecv(kz_Bcast *B, void *buf, size_t *plen)
+{ return (void)B, (void)buf, (void)plen, KZ_INVALID; }
+
+KZ_API int kz_bcwait(kz_Bcast *B, size_t len, int millis)
+{ return (void)B, (void)len, (void)millis, KZ_INVALID; }
+
+KZ_API int kz_bcreaders(const kz_Bcast *B) { return (void)B, KZ_INVALID; }
+
+KZ_API uint64_t kz_bcdropped(const kz_Bcast *B) { return (void)B, 0; }
+/* clang-format on */
+
+#endif
+
+/* channel directory */
+
+#ifndef _WIN32
+# define KZ_DIRNAME 52         /* bytes of a name in the entry table */
+# define KZ_DIRWAIT 1000000000 /* nanos to wait for an entry being created */
+
+/* The entries are claimed by the hash of their name in an open addressing
+ * table and never removed. A channel image is carved from `used` before its
+ * entry is claimed, then the entry is published by storing its offset, so
+ * the lookups take no lock and the creators of different names never wait
+ * for each other; one of the same name waits for the entry being published
+ * to compare the name, and the image it carved is lost. */
+typedef struct kzD_ShmHdr {
+    uint32_t size;  /* Size of the directory. */
+    uint32_t count; /* Slots of the entry table, stored last at creation. */
+    uint32_t used;  /* Bytes handed out, the entry table included. */
+    uint32_t padding[13];
+} kzD_ShmHdr;
+
+typedef struct kzD_ShmEntry {
+    uint32_t hash;   /* Hash of the name, 0 for a free slot. */
+    uint32_t offset; /* Offset of the channel image, 0 until published. */
+    uint32_t size;   /* Size of the channel image. */
+    char     name[KZ_DIRNAME];
+} kzD_ShmEntry;
+
+KZ_STATIC_ASSERT(sizeof(kzD_ShmHdr) == 64 && sizeof(kzD_ShmEntry) == 64);
+
+struct kz_Dir {
+    size_t      shm_size;
+    uint32_t    refs; /* The handle and the channels opened in it. */
+    kzD_ShmHdr *hdr;
+};
+
+/* clang-format off */
+static size_t kzD_metasize(size_t count)
+{ return sizeof(kzD_ShmHdr) + sizeof(kzD_ShmEntry) * count; }
+
+static kzD_ShmEntry *kzD_entries(const kz_Dir *D)
+{ return (kzD_ShmEntry *)(D->hdr + 1); }
+/* clang-format on */
+
+static uint32_t kzD_hash(const char *name, size_t len) {
+    /* FNV-1a, 0 is left for the free slots */
+    uint32_t h = 2166136261U;
+    size_t   i;
+    for (i = 0; i < len; ++i) h = (h ^ (unsigned char)name[i]) * 16777619U;
+    return h != 0 ? h : 1;
+}
+
+static void kzD_release(kz_Dir *D) {
+    if (kzA_subfetch(&D->refs, 1) != 0) return;
+    munmap(D->hdr, D->shm_size);
+    free(D);
+}
+
+static int kzD_ready(kzD_ShmEntry *e) {
+    /* the creator publishes the entry right after claiming it, unless it
+     * died in between */
+    uint64_t deadline = 0, now;
+    while (kzA_load(&e->offset) == 0) {
+        now = kz_now();
+        if (deadline == 0)
+            deadline = now + KZ_DIRWAIT;
+        else if (now > deadline)
+            return 0;
+        kz_yield();
+    }
+    return 1;
+}
+
+static int kzD_find(kz_Dir *D, const char *name, size_t len,
+                    kzD_ShmEntry **pe) {
+    /* `KZ_OK` with the entry of `name`, or `KZ_AGAIN` with the free slot it
+     * would take, NULL if the table is full */
+    kzD_ShmEntry *entries = kzD_entries(D), *e;
+    uint32_t      i, h = kzD_hash(name, len), n = D->hdr->count, eh;
+    for (i = 0; i < n; ++i) {
+        e = &entries[(h + i) % n];
+        if ((eh = kzA_load(&e->hash)) == 0) return *pe = e, KZ_AGAIN;
+        if (eh != h) continue;
+        if (!kzD_ready(e)) return errno = EBUSY, KZ_BUSY;
+        if (memcmp(e->name, name, len + 1) == 0) return *pe = e, KZ_OK;
+    }
+    return *pe = NULL, KZ_AGAIN;
+}
+
+static uint32_t kzD_carve(kz_Dir *D, size_t size) {
+    uint32_t used;
+    do {
+        used = kzA_load(&D->hdr->used);
+        if (used + size > D->hdr->size) return 0;
+    } while (!kzA_cmpandswap(&D->hdr->used, used, used + (uint32_t)size));
+    return used;
+}
+
+static int kzD_createat(kz_State *S, int flags, size_t bufsize) {
+    kz_Dir       *D = S->dir;
+    kzD_ShmEntry *e;
+    size_t        size = kz_get_aligned_size(kz_hdrsize(flags) + bufsize, 64);
+    uint32_t      off = 0;
+    int           r, created = 1;
+    if (bufsize >= KZ_MAX_SIZE
+        || size < kz_hdrsize(flags) + sizeof(uint32_t) * 4)
+        return errno = EINVAL, kz_initfail(S);
+    while ((r = kzD_find(D, S->name_buf, S->name_len, &e)) == KZ_AGAIN) {
+        if (e == NULL || (off == 0 && (off = kzD_carve(D, size)) == 0))
+            return errno = ENOSPC, kz_initfail(S);
+        if (kzA_cmpandswap(&e->hash, 0, kzD_hash(S->name_buf, S->name_len)))
+            break;
+    }
+    if (r == KZ_BUSY) return kz_initfail(S);
+    if (r == KZ_OK) {
+        if ((flags & KZ_EXCL)) return errno = EEXIST, kz_initfail(S);
+        created = (flags & KZ_RESET) != 0;
+        off = e->offset, size = e->size;
+        if (created && size < kz_hdrsize(flags) + sizeof(uint32_t) * 4)
+            return errno = EINVAL, kz_initfail(S);
+    } else {
+        memcpy(e->name, S->name_buf, S->name_len + 1);
+        e->size = (uint32_t)size;
+    }
+
+    S->hdr = (kz_ShmHdr *)((char *)D->hdr + off);
+    S->shm_size = size;
+    if (created) {
+        kz_clearhdr(S->hdr, flags);
+        S->hdr->size = (uint32_t)size;
+        S->hdr->flags = flags & KZ_SHMFLAGS;
+    }
+    if (r != KZ_OK) S->hdr->owner_pid = S->self_pid; /* a new entry */
+    else if (!kz_claimpid(S, &S->hdr->owner_pid))
+        return errno = EACCES, kz_initfail(S);
+    if (created) kz_initqueues(S);
+    else kz_resetqueues(S);
+    if (r != KZ_OK) kzA_store(&e->offset, off); /* publish it */
+    return KZ_OK;
+}
+
+static int kzD_openat(kz_State *S) {
+    kz_Dir       *D = S->dir;
+    kzD_ShmEntry *e;
+    int           r = kzD_find(D, S->name_buf, S->name_len, &e);
+    if (r != KZ_OK)
+        return r == KZ_AGAIN ? (errno = ENOENT, kz_initfail(S))
+                             : kz_initfail(S);
+    S->hdr = (kz_ShmHdr *)((char *)D->hdr + e->offset);
+    S->shm_size = e->size;
+    if (S->hdr->size != e->size) return errno = EBADF, kz_initfail(S);
+    if (!kz_claimpid(S, &S->hdr->user_pid))
+        return errno = EACCES, kz_initfail(S);
+    return kz_resetqueues(S);
+}
+
+KZ_API kz_Dir *kz_opendir(
+        const char *name, int flags, size_t size, size_t count) {
+    kz_Dir     *D;
+    struct stat statbuf;
+    int         fd, oflags = O_RDWR, created, err;
+    void       *p;
+    if ((flags & KZ_CREATE)
+        && (count == 0 || size >= KZ_MAX_SIZE
+            || count >= KZ_MAX_SIZE / sizeof(kzD_ShmEntry)
+            || size < kzD_metasize(count)))
+        return errno = EINVAL, (kz_Dir *)NULL;
+    if ((flags & KZ_CREATE)) oflags |= O_CREAT;
+    if ((flags & KZ_EXCL)) oflags |= O_EXCL;
+    fd = shm_open(name, oflags, (flags & KZ_CREATE) ? flags & 0x1FF : 0);
+    if (fd == -1) return NULL;
+    if (fstat(fd, &statbuf) == -1) goto fail;
+    created = (flags & KZ_CREATE)
+           && (statbuf.st_size == 0 || (flags & KZ_RESET));
+    if (created && ftruncate(fd, (off_t)size) == -1) goto fail;
+    if (!created) size = (size_t)statbuf.st_size;
+    if (size < sizeof(kzD_ShmHdr)) goto badf;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) goto fail;
+    close(fd);
+    if ((D = (kz_Dir *)malloc(sizeof(kz_Dir))) == NULL)
+        return munmap(p, size), (kz_Dir *)NULL;
+    D->shm_size = size;
+    D->refs = 1;
+    D->hdr = (kzD_ShmHdr *)p;
+    if (created) {
+        memset(D->hdr, 0, kzD_metasize(count));
+        D->hdr->size = (uint32_t)size;
+        D->hdr->used = (uint32_t)kzD_metasize(count);
+        kzA_store(&D->hdr->count, (uint32_t)count);
+    }
+    if (kzA_load(&D->hdr->count) == 0 || D->hdr->size != size
+        || kzD_metasize(D->hdr->count) > size) {
+        kzD_release(D);
+        return errno = EBADF, (kz_Dir *)NULL;
+    }
+#ifdef MADV_HUGEPAGE /* transparent huge pages of shmem, if enabled */
+    if ((flags & KZ_HUGEPAGE)) madvise(D->hdr, size, MADV_HUGEPAGE);
+#endif
+    return D;
+
+badf:
+    errno = EBADF;
+fail:
+    err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+}
+
+KZ_API void kz_closedir(kz_Dir *D) {
+    if (D != NULL) kzD_release(D);
+}
+
+KZ_API kz_State *kz_openat(
+        kz_Dir *D, const char *name, int flags, size_t bufsize) {
+    kz_State *S;
+    size_t    len = name != NULL ? strlen(name) : 0;
+    int       r;
+    if (len >= KZ_DIRNAME) return errno = ENAMETOOLONG, (kz_State *)NULL;
+    if (D == NULL || len == 0
+        || (flags & (KZ_HUGEPAGE | KZ_MIRROR | KZ_LANEMASK))
+        || ((flags & KZ_MPSC) && (flags & KZ_INDEXED)))
+        return errno = EINVAL, (kz_State *)NULL;
+    if ((S = kz_newstate(name)) == NULL) return NULL;
+    S->dir = D;
+    kzA_fetchadd(&D->refs, 1);
+
+#ifdef SYS_futex_waitv
+    kz_check_waitv();
+#endif
+
+    r = (flags & KZ_CREATE) ? kzD_createat(S, flags, bufsize) : kzD_openat(S);
+    if (r != KZ_OK) return NULL;
+    if (((S->flags & KZ_NOTIFY) && kz_initnotify(S, flags & KZ_CREATE))
+            || kz_adviseshm(S, flags) != KZ_OK) {
+        kz_initfail(S);
+        return NULL;
+    }
+    if ((flags & KZ_SPIN)) kz_setspin(S, KZ_SPINDEFAULT);
+    kz_startwatch(S);
+    return S;
+}
+
+KZ_API int kz_openlocal(int flags, size_t bufsize, kz_State **Ss) {
+    /* a directory of just the channel, in anonymous memory, with no entry
+     * table, mapped by both sides */
+    size_t  off = kzD_metasize(0);
+    size_t  size = kz_get_aligned_size(kz_hdrsize(flags) + bufsize, 64);
+    kz_Dir *D;
+    void   *p;
+    int     i, err;
+    if (Ss == NULL || bufsize >= KZ_MAX_SIZE
+        || size < kz_hdrsize(flags) + sizeof(uint32_t) * 4
+        || (flags & (KZ_HUGEPAGE | KZ_MIRROR | KZ_LANEMASK))
+        || ((flags & KZ_MPSC) && (flags & KZ_INDEXED)))
+        return errno = EINVAL, KZ_FAIL;
+    p = mmap(NULL, off + size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return KZ_FAIL;
+    if ((D = (kz_Dir *)malloc(sizeof(kz_Dir))) == NULL)
+        return munmap(p, off + size), KZ_FAIL;
+    D->shm_size = off + size;
+    D->refs = 1; /* dropped once both sides are set up */
+    D->hdr = (kzD_ShmHdr *)p;
+    D->hdr->size = D->hdr->used = (uint32_t)(off + size);
+
+    Ss[0] = Ss[1] = NULL;
+    for (i = 0; i < 2; ++i) {
+        if ((Ss[i] = kz_newstate("")) == NULL) goto fail;
+        Ss[i]->dir = D;
+        kzA_fetchadd(&D->refs, 1);
+        Ss[i]->hdr = (kz_ShmHdr *)((char *)p + off);
+        Ss[i]->shm_size = size;
+    }
+    Ss[0]->hdr->size = (uint32_t)size;
+    Ss[0]->hdr->flags = (flags & KZ_SHMFLAGS) | KZ_LOCAL;
+    Ss[0]->hdr->owner_pid = Ss[0]->self_pid;
+    kz_initqueues(Ss[0]);
+    kz_resetqueues(Ss[1]);
+    for (i = 0; i < 2; ++i) { /* the owner imports from the user at once */
+        if ((flags & KZ_NOTIFY) && kz_initnotify(Ss[1 - i], i) != KZ_OK)
+            goto fail;
+        if ((flags & KZ_SPIN)) kz_setspin(Ss[i], KZ_SPINDEFAULT);
+    }
+    if (kz_adviseshm(Ss[0], flags) != KZ_OK) goto fail;
+    kzD_release(D);
+    return KZ_OK;
+
+fail:
+    err = errno;
+    for (i = 0; i < 2; ++i)
+        if (Ss[i] != NULL) kz_initfail(Ss[i]), Ss[i] = NULL;
+    kzD_release(D);
+    errno = err;
+    return KZ_FAIL;
+}
+
+#else /* directories and local channels are not supported on Windows */
+
+/* clang-format off */
+KZ_API kz_Dir *kz_opendir(
+        const char *name, int flags, size_t size, size_t count) {
+    (void)name, (void)flags, (void)size, (void)count;
+    return errno = ENOSYS, (kz_Dir *)NULL;
+}
+
+KZ_API void kz_closedir(kz_Dir *D) { (void)D; }
+
+KZ_API kz_State *kz_openat(
+        kz_Dir *D, const char *name, int flags, size_t bufsize) {
+    (void)D, (void)name, (void)flags, (void)bufsize;
+    return errno = ENOSYS, (kz_State *)NULL;
+}
+
+KZ_API int kz_openlocal(int flags, size_t bufsize, kz_State **Ss)
+{ return (void)flags, (void)bufsize, (void)Ss, errno = ENOSYS, KZ_FAIL; }
+/* clang-format on */
+
+#endif
+
 KZ_NS_END
 
 #endif /* KZ_IMPLEMENTATION */
@@ -0,0 +1,23 @@
+//! Benchmarks of the C ring buffer, see `bench.c`.
+//!
+//! Run with `cargo run --release -p kaze-core --features bench --bin
+//! kaze-bench -- [options] [suite]`, `-h` lists the options.
+
+use std::ffi::{CString, c_char, c_int};
+
+#[link(name = "kazebench")]
+unsafe extern "C" {
+    fn kz_bench_main(argc: c_int, argv: *mut *mut c_char) -> c_int;
+}
+
+fn main() {
+    let args: Vec<CString> = std::env::args()
+        .map(|arg| CString::new(arg).expect("argument contains NUL"))
+        .collect();
+    let mut argv: Vec<*mut c_char> =
+        args.iter().map(|arg| arg.as_ptr() as *mut c_char).collect();
+    argv.push(std::ptr::null_mut());
+    let code =
+        unsafe { kz_bench_main(args.len() as c_int, argv.as_mut_ptr()) };
+    std::process::exit(code);
+}
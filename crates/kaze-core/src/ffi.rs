@@ -11,21 +11,50 @@ pub const KZ_TOOBIG: c_int = -4;
 pub const KZ_AGAIN: c_int = -5;
 pub const KZ_BUSY: c_int = -6;
 pub const KZ_TIMEOUT: c_int = -7;
+pub const KZ_DROPPED: c_int = -8;
 
 pub const KZ_CREATE: c_int = 1 << 16;
 pub const KZ_EXCL: c_int = 1 << 17;
 pub const KZ_RESET: c_int = 1 << 18;
+pub const KZ_SPIN: c_int = 1 << 19;
+pub const KZ_MPSC: c_int = 1 << 20;
+pub const KZ_NOTIFY: c_int = 1 << 21;
+pub const KZ_HUGEPAGE: c_int = 1 << 22;
+pub const KZ_PREFAULT: c_int = 1 << 23;
+pub const KZ_MLOCK: c_int = 1 << 24;
+pub const KZ_MIRROR: c_int = 1 << 25;
+pub const KZ_INDEXED: c_int = 1 << 26;
+pub const KZ_TIMESTAMP: c_int = 1 << 27;
+pub const KZ_RESIZABLE: c_int = 1 << 13;
+pub const KZ_DROP: c_int = 1 << 12;
+
+#[allow(non_snake_case)]
+pub const fn KZ_LANES(n: usize) -> c_int {
+    ((n as c_int - 1) & 7) << 28
+}
 
 pub const KZ_READ: c_int = 1 << 0;
 pub const KZ_WRITE: c_int = 1 << 1;
 pub const KZ_BOTH: c_int = KZ_READ | KZ_WRITE;
 
 pub const KZ_MAX_SIZE: usize = 0xFFFFFFFFusize;
+pub const KZ_WAITMAX: usize = 128;
+pub const KZ_HISTMAX: usize = 256;
+pub const KZ_MAXLANES: usize = 8;
+pub const KZ_FUTEXMAX: usize = 4;
 
 #[repr(C)]
 #[allow(non_camel_case_types)]
 pub struct kz_State(*mut c_void);
 
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct kz_Bcast(*mut c_void);
+
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct kz_Dir(*mut c_void);
+
 #[repr(C)]
 #[allow(non_camel_case_types)]
 pub struct kz_Context {
@@ -54,14 +83,35 @@ unsafe extern "C" {
         flags: c_int,
         bufsize: usize,
     ) -> *mut kz_State;
+    pub fn kz_openarena(
+        name: *const c_char,
+        flags: c_int,
+        bufsize: usize,
+        blocksize: usize,
+        count: usize,
+    ) -> *mut kz_State;
     pub fn kz_close(S: *mut kz_State);
     pub fn kz_shutdown(S: *mut kz_State, mode: c_int) -> c_int;
+    pub fn kz_resize(S: *mut kz_State, bufsize: usize) -> c_int;
 
     pub fn kz_name(S: *const kz_State) -> *const c_char;
     pub fn kz_size(S: *const kz_State) -> usize;
     pub fn kz_pid(S: *const kz_State) -> c_int;
     pub fn kz_isowner(S: *const kz_State) -> c_int;
     pub fn kz_isclosed(S: *const kz_State) -> c_int;
+    pub fn kz_stats(S: *const kz_State, stats: *mut crate::Stats) -> c_int;
+    pub fn kz_histogram(
+        S: *const kz_State,
+        mode: c_int,
+        hist: *mut crate::Histogram,
+    ) -> c_int;
+    pub fn kz_lanes(S: *const kz_State) -> c_int;
+    pub fn kz_lane(S: *mut kz_State, lane: c_int) -> *mut kz_State;
+    pub fn kz_readlanes(S: *mut kz_State, ctx: *mut kz_Context) -> c_int;
+    pub fn kz_waitlanes(S: *mut kz_State, millis: c_int) -> c_int;
+
+    pub fn kz_percentile(hist: *const crate::Histogram, q: f64) -> u64;
+    pub fn kz_histbound(bucket: usize) -> u64;
 
     pub fn kz_read(S: *mut kz_State, ctx: *mut kz_Context) -> c_int;
     pub fn kz_write(
@@ -73,8 +123,117 @@ unsafe extern "C" {
     pub fn kz_buffer(ctx: *mut kz_Context, plen: *mut usize) -> *mut c_char;
     pub fn kz_commit(ctx: *mut kz_Context, len: usize) -> c_int;
     pub fn kz_cancel(ctx: *mut kz_Context);
+    pub fn kz_next(ctx: *mut kz_Context) -> c_int;
     pub fn kz_isread(ctx: *const kz_Context) -> c_int;
 
+    pub fn kz_chunksize(S: *const kz_State) -> usize;
+    pub fn kz_commitchunk(
+        ctx: *mut kz_Context,
+        len: usize,
+        more: c_int,
+    ) -> c_int;
+    pub fn kz_more(ctx: *const kz_Context) -> c_int;
+
+    pub fn kz_blocksize(S: *const kz_State) -> usize;
+    pub fn kz_alloc(S: *mut kz_State, blk: *mut crate::Block) -> c_int;
+    pub fn kz_blockdata(
+        S: *mut kz_State,
+        blk: *const crate::Block,
+    ) -> *mut c_char;
+    pub fn kz_free(S: *mut kz_State, blk: *const crate::Block) -> c_int;
+
+    pub fn kz_openslots(
+        name: *const c_char,
+        flags: c_int,
+        bufsize: usize,
+        slot_size: usize,
+    ) -> *mut kz_State;
+    pub fn kz_slotsize(S: *const kz_State) -> usize;
+
+    pub fn kz_readv(
+        S: *mut kz_State,
+        ctxs: *mut kz_Context,
+        count: usize,
+        budget: usize,
+    ) -> c_int;
+    pub fn kz_writev(
+        S: *mut kz_State,
+        ctxs: *mut kz_Context,
+        lens: *const usize,
+        count: usize,
+    ) -> c_int;
+    pub fn kz_commitv(ctxs: *mut kz_Context, count: usize) -> c_int;
+
     pub fn kz_wait(S: *mut kz_State, len: usize, millis: c_int) -> c_int;
     pub fn kz_waitcontext(ctx: *mut kz_Context, millis: c_int) -> c_int;
+    pub fn kz_waitmany(
+        Ss: *mut *mut kz_State,
+        modes: *mut c_int,
+        count: usize,
+        len: usize,
+        millis: c_int,
+    ) -> c_int;
+
+    pub fn kz_setspin(S: *mut kz_State, micros: c_int) -> c_int;
+    pub fn kz_setcoalesce(
+        S: *mut kz_State,
+        bytes: usize,
+        count: usize,
+        micros: c_int,
+    ) -> c_int;
+    pub fn kz_flush(S: *mut kz_State) -> c_int;
+
+    pub fn kz_notifyfd(S: *const kz_State, mode: c_int) -> c_int;
+    #[allow(dead_code)] // used by `AsyncChannel`
+    pub fn kz_clearnotify(S: *mut kz_State, mode: c_int) -> c_int;
+    #[allow(dead_code)] // used by `AsyncChannel`
+    pub fn kz_register(S: *mut kz_State, mode: c_int, len: usize) -> c_int;
+    pub fn kz_unregister(S: *mut kz_State, mode: c_int) -> c_int;
+    pub fn kz_prepwait(
+        S: *mut kz_State,
+        mode: c_int,
+        len: usize,
+        waits: *mut crate::FutexWait,
+        pcount: *mut usize,
+    ) -> c_int;
+
+    pub fn kz_bcopen(
+        name: *const c_char,
+        flags: c_int,
+        bufsize: usize,
+        readers: c_int,
+    ) -> *mut kz_Bcast;
+    pub fn kz_bcclose(B: *mut kz_Bcast);
+    pub fn kz_bcsend(
+        B: *mut kz_Bcast,
+        data: *const c_char,
+        len: usize,
+    ) -> c_int;
+    pub fn kz_bcrecv(
+        B: *mut kz_Bcast,
+        buf: *mut c_char,
+        plen: *mut usize,
+    ) -> c_int;
+    pub fn kz_bcwait(B: *mut kz_Bcast, len: usize, millis: c_int) -> c_int;
+    pub fn kz_bcreaders(B: *const kz_Bcast) -> c_int;
+    pub fn kz_bcdropped(B: *const kz_Bcast) -> u64;
+
+    pub fn kz_opendir(
+        name: *const c_char,
+        flags: c_int,
+        size: usize,
+        count: usize,
+    ) -> *mut kz_Dir;
+    pub fn kz_closedir(D: *mut kz_Dir);
+    pub fn kz_openat(
+        D: *mut kz_Dir,
+        name: *const c_char,
+        flags: c_int,
+        bufsize: usize,
+    ) -> *mut kz_State;
+    pub fn kz_openlocal(
+        flags: c_int,
+        bufsize: usize,
+        Ss: *mut *mut kz_State,
+    ) -> c_int;
 }
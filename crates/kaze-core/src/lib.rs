@@ -1,12 +1,17 @@
 use std::{
     borrow::Cow,
     ffi::{CStr, CString},
+    mem::ManuallyDrop,
+    ops::Deref,
     path::{Path, PathBuf},
     slice,
     sync::Arc,
+    time::Duration,
 };
 
 mod ffi;
+#[cfg(all(feature = "tokio", unix))]
+mod notify;
 mod split;
 
 #[cfg(test)]
@@ -15,6 +20,8 @@ mod test;
 use bytes::{Buf, BufMut};
 
 pub use bytes;
+#[cfg(all(feature = "tokio", unix))]
+pub use notify::{AsyncChannel, AsyncReadHalf, AsyncWriteHalf};
 pub use split::{OwnedReadHalf, OwnedWriteHalf};
 
 /// Builder for creating a new channel or opening an existing one
@@ -22,6 +29,9 @@ pub struct OpenOptions {
     flags: i32,
     perm: u32,
     bufsize: usize,
+    spin: Option<Duration>,
+    arena: (usize, usize),
+    slot_size: usize,
 }
 
 impl OpenOptions {
@@ -31,6 +41,9 @@ impl OpenOptions {
             flags: 0,
             perm: 0o644, // Default permission
             bufsize: 0,  // Default buffer size
+            spin: None,  // Default no spinning
+            arena: (0, 0),
+            slot_size: 0,
         }
     }
 
@@ -38,18 +51,14 @@ impl OpenOptions {
     pub fn create(self, create: bool, bufsize: usize) -> Self {
         Self {
             flags: self.flags | if create { ffi::KZ_CREATE } else { 0 },
-            perm: self.perm,
             bufsize,
+            ..self
         }
     }
 
     /// Sets the permission for the channel file.
     pub fn perm(self, perm: u32) -> Self {
-        Self {
-            flags: self.flags,
-            perm,
-            bufsize: self.bufsize,
-        }
+        Self { perm, ..self }
     }
 
     /// Sets the option to create a new file, failing if it already exists.
@@ -61,8 +70,8 @@ impl OpenOptions {
                 } else {
                     0
                 },
-            perm: self.perm,
             bufsize,
+            ..self
         }
     }
 
@@ -70,14 +79,263 @@ impl OpenOptions {
     pub fn reset(self) -> Self {
         Self {
             flags: self.flags | ffi::KZ_RESET,
-            perm: self.perm,
-            bufsize: self.bufsize,
+            ..self
+        }
+    }
+
+    /// Spin at most `budget` before sleeping when waiting on the channel.
+    ///
+    /// The actual spin time adapts to recent wait durations, and spinning
+    /// is disabled on single CPU machines.
+    pub fn spin(self, budget: Duration) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_SPIN,
+            spin: Some(budget),
+            ..self
+        }
+    }
+
+    /// Allow concurrent writers on both sides of a newly created channel.
+    ///
+    /// Writers reserve their space without blocking each other, so a
+    /// channel can be written from many threads without an external lock.
+    /// Opening an existing channel follows the mode it was created with.
+    pub fn mpsc(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_MPSC,
+            ..self
+        }
+    }
+
+    /// Signal a pollable fd of a newly created channel when the peer may
+    /// be ready, so `AsyncChannel` waits without blocking a thread.
+    ///
+    /// The user creates the eventfds on open and the owner imports them,
+    /// as a parent process may take the fds of its children, this is only
+    /// supported on Linux. Opening an existing channel follows the mode it
+    /// was created with.
+    pub fn notify(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_NOTIFY,
+            ..self
+        }
+    }
+
+    /// Back a newly created channel by huge pages.
+    ///
+    /// The ring is created on hugetlbfs and the size is rounded up to the
+    /// huge page size. If huge pages are unavailable, it falls back to plain
+    /// shared memory advised for transparent huge pages (Linux only).
+    pub fn hugepage(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_HUGEPAGE,
+            ..self
+        }
+    }
+
+    /// Map the queues of a newly created channel twice back to back.
+    ///
+    /// Every message is contiguous in memory wherever it starts, so the
+    /// space at the end of the queue is never wasted and a message can use
+    /// all the free space. The queues are rounded up to whole pages. Opening
+    /// an existing channel follows the mode it was created with.
+    pub fn mirror(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_MIRROR,
+            ..self
+        }
+    }
+
+    /// Keep the read and write indices of a newly created channel on cache
+    /// lines of their own.
+    ///
+    /// Each side only writes its own index, and reads the index of the peer
+    /// only when its cached copy says the queue is full or empty, so the
+    /// sides no longer bounce a shared counter between their cores. Can not
+    /// be combined with [`OpenOptions::mpsc`]. Opening an existing channel
+    /// follows the mode it was created with.
+    pub fn indexed(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_INDEXED,
+            ..self
+        }
+    }
+
+    /// Stamp every message of a newly created channel with the time it is
+    /// committed, and keep a histogram of the time the messages stay in
+    /// each queue.
+    ///
+    /// The histograms live in the shared memory and can be read from either
+    /// side while the channel is in use, see [`Channel::histogram`]. Each
+    /// message takes 8 more bytes of the queue. Opening an existing channel
+    /// follows the mode it was created with.
+    pub fn timestamp(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_TIMESTAMP,
+            ..self
+        }
+    }
+
+    /// Let [`Channel::resize`] grow a newly created channel beyond the size
+    /// it is created with.
+    ///
+    /// Both sides reserve address space for the growth (1 GiB on 64-bit
+    /// targets) at open, so it is only worth it when the channel is to be
+    /// resized. The channel grows at most to what both sides could reserve.
+    /// Opening an existing channel follows the mode it was created with.
+    pub fn resizable(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_RESIZABLE,
+            ..self
         }
     }
 
+    /// Split a newly created channel into `lanes` channels of equal size,
+    /// at most [`Channel::MAX_LANES`].
+    ///
+    /// Every lane is a queue pair of its own in the same shared memory, so
+    /// messages written to a lane never wait behind the ones of the others.
+    /// [`Channel::read_lanes`] drains the lanes in order, lane 0 first, and
+    /// waits on all of them at once. Can not be combined with
+    /// [`OpenOptions::mirror`] or [`OpenOptions::notify`]. Opening an
+    /// existing channel follows the lanes it was created with.
+    pub fn lanes(self, lanes: usize) -> Self {
+        let lanes = lanes.clamp(1, ffi::KZ_MAXLANES);
+        Self {
+            flags: self.flags | ffi::KZ_LANES(lanes),
+            ..self
+        }
+    }
+
+    /// Fault in the whole channel memory at open, so the first pass over
+    /// the ring does not take page faults.
+    pub fn prefault(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_PREFAULT,
+            ..self
+        }
+    }
+
+    /// Lock the channel memory in RAM at open, this implies `prefault`.
+    ///
+    /// Opening fails if the memory can not be locked, e.g. exceeding
+    /// `RLIMIT_MEMLOCK`.
+    pub fn mlock(self) -> Self {
+        Self {
+            flags: self.flags | ffi::KZ_MLOCK,
+            ..self
+        }
+    }
+
+    /// Add an arena of `count` blocks of `block_size` bytes to a newly
+    /// created channel, for payloads passed by [`Block`] descriptors.
+    ///
+    /// Both sides allocate blocks with [`Channel::alloc_block`], send the
+    /// descriptor through the queue, and the receiver frees the block with
+    /// [`Channel::read_block`], so large payloads are never copied through
+    /// the queue. The block size is rounded up to cache lines. Can not be
+    /// combined with [`OpenOptions::mirror`] or [`OpenOptions::lanes`], and
+    /// the channel can not be resized. Opening an existing channel follows
+    /// the arena it was created with.
+    pub fn arena(self, block_size: usize, count: usize) -> Self {
+        Self {
+            arena: (block_size, count),
+            ..self
+        }
+    }
+
+    /// Make the queues of a newly created channel arrays of equal slots of
+    /// `slot_size` bytes, for messages of one fixed size.
+    ///
+    /// A slot has no length header and never wraps, every message takes a
+    /// whole slot and is read as one, so a batch of slots is contiguous up
+    /// to the end of the ring. The slot size is rounded up to 4 bytes and
+    /// must be at most half the buffer size. Can not be combined with
+    /// [`OpenOptions::mpsc`], [`OpenOptions::mirror`],
+    /// [`OpenOptions::timestamp`], [`OpenOptions::lanes`] or
+    /// [`OpenOptions::arena`], and [`Channel::write_large`] is not
+    /// supported. Opening an existing channel follows the slots it was
+    /// created with.
+    pub fn slots(self, slot_size: usize) -> Self {
+        Self { slot_size, ..self }
+    }
+
     /// Opens an channel with name and the options specified by self.
     pub fn open(self, name: impl AsRef<Path>) -> IoResult<Channel> {
-        Channel::raw_open(name, self.flags | self.perm as i32, self.bufsize)
+        let flags = self.flags | self.perm as i32;
+        let (block_size, count) = self.arena;
+        let channel = match self.slot_size {
+            0 => Channel::raw_open_arena(
+                name,
+                flags,
+                self.bufsize,
+                block_size,
+                count,
+            )?,
+            _ if count != 0 => {
+                return Err(std::io::ErrorKind::InvalidInput.into());
+            }
+            slot_size => {
+                Channel::raw_open_slots(name, flags, self.bufsize, slot_size)?
+            }
+        };
+        if let Some(budget) = self.spin {
+            channel.set_spin(budget);
+        }
+        Ok(channel)
+    }
+
+    /// Opens a channel named `name` in the directory `dir`, creating it in
+    /// the directory with [`OpenOptions::create`]. Can not be combined with
+    /// [`OpenOptions::hugepage`] (given to the directory instead),
+    /// [`OpenOptions::mirror`], [`OpenOptions::lanes`],
+    /// [`OpenOptions::arena`] or [`OpenOptions::slots`], and the channel can
+    /// not be resized.
+    pub fn open_in(
+        self,
+        dir: &Directory,
+        name: impl AsRef<str>,
+    ) -> IoResult<Channel> {
+        if self.arena.1 != 0 || self.slot_size != 0 {
+            return Err(std::io::ErrorKind::InvalidInput.into());
+        }
+        let name = CString::new(name.as_ref()).unwrap();
+        let flags = self.flags | self.perm as i32;
+        let ptr = unsafe {
+            ffi::kz_openat(dir.ptr, name.as_ptr(), flags, self.bufsize)
+        };
+        if ptr.is_null() {
+            return Err(std::io::Error::last_os_error());
+        }
+        let channel = Channel { ptr };
+        if let Some(budget) = self.spin {
+            channel.set_spin(budget);
+        }
+        Ok(channel)
+    }
+
+    /// Opens a channel between the threads of this process, returns the
+    /// owner side and the user side. Backed by anonymous memory and waiting
+    /// on private futexes (Unix only), with the same restrictions as
+    /// [`OpenOptions::open_in`]; the buffer size is the one given to
+    /// [`OpenOptions::create`].
+    pub fn open_local(self) -> IoResult<(Channel, Channel)> {
+        if self.arena.1 != 0 || self.slot_size != 0 {
+            return Err(std::io::ErrorKind::InvalidInput.into());
+        }
+        let mut ptrs = [std::ptr::null_mut(); 2];
+        let r = unsafe {
+            ffi::kz_openlocal(self.flags, self.bufsize, ptrs.as_mut_ptr())
+        };
+        if r != ffi::KZ_OK {
+            return Err(std::io::Error::last_os_error());
+        }
+        let sides = (Channel { ptr: ptrs[0] }, Channel { ptr: ptrs[1] });
+        if let Some(budget) = self.spin {
+            sides.0.set_spin(budget);
+            sides.1.set_spin(budget);
+        }
+        Ok(sides)
     }
 }
 
@@ -110,11 +368,21 @@ impl Channel {
     /// Maximum size in bytes of the queue in channel
     pub const MAX_SIZE: usize = ffi::KZ_MAX_SIZE;
 
+    /// Maximum number of channels waited by `wait_many`
+    pub const MAX_WAIT: usize = ffi::KZ_WAITMAX;
+
+    /// Maximum number of lanes of a channel, see [`OpenOptions::lanes`]
+    pub const MAX_LANES: usize = ffi::KZ_MAXLANES;
+
+    /// Maximum number of futex words filled by [`Channel::prepare_wait`]
+    pub const MAX_FUTEX: usize = ffi::KZ_FUTEXMAX;
+
     /// Calculate buffer size that is aligned to page size (with header)
     ///
     /// returns the buffer size that makes shared memory size requested aligned
     /// to page size. so the returned size could a little less than the aligned
-    /// page size
+    /// page size. zero `page_size` means the huge page size, or the system
+    /// page size if huge pages are unavailable.
     pub fn aligned(required_size: usize, page_size: usize) -> usize {
         unsafe { ffi::kz_aligned(required_size, page_size) }
     }
@@ -164,14 +432,58 @@ impl Channel {
         Self::raw_open(name, 0, 0)
     }
 
+    /// Create a channel between the threads of this process, see
+    /// [`OpenOptions::open_local`]
+    pub fn local(bufsize: usize) -> IoResult<(Self, Self)> {
+        OpenOptions::new().create(true, bufsize).open_local()
+    }
+
     fn raw_open(
         name: impl AsRef<Path>,
         flags: i32,
         bufsize: usize,
+    ) -> IoResult<Self> {
+        Self::raw_open_arena(name, flags, bufsize, 0, 0)
+    }
+
+    fn raw_open_arena(
+        name: impl AsRef<Path>,
+        flags: i32,
+        bufsize: usize,
+        block_size: usize,
+        count: usize,
     ) -> IoResult<Self> {
         let name =
             CString::new(name.as_ref().to_string_lossy().as_bytes()).unwrap();
-        let ptr = unsafe { ffi::kz_open(name.as_ptr(), flags, bufsize) };
+        let ptr = unsafe {
+            match count {
+                0 => ffi::kz_open(name.as_ptr(), flags, bufsize),
+                _ => ffi::kz_openarena(
+                    name.as_ptr(),
+                    flags,
+                    bufsize,
+                    block_size,
+                    count,
+                ),
+            }
+        };
+        if ptr.is_null() {
+            return Err(std::io::Error::last_os_error());
+        }
+        Ok(Self { ptr })
+    }
+
+    fn raw_open_slots(
+        name: impl AsRef<Path>,
+        flags: i32,
+        bufsize: usize,
+        slot_size: usize,
+    ) -> IoResult<Self> {
+        let name =
+            CString::new(name.as_ref().to_string_lossy().as_bytes()).unwrap();
+        let ptr = unsafe {
+            ffi::kz_openslots(name.as_ptr(), flags, bufsize, slot_size)
+        };
         if ptr.is_null() {
             return Err(std::io::Error::last_os_error());
         }
@@ -220,6 +532,89 @@ impl Channel {
         unsafe { ffi::kz_isowner(self.ptr) != 0 }
     }
 
+    /// Set the spin budget before sleeping in waits, zero disables spinning
+    pub fn set_spin(&self, budget: Duration) {
+        let micros = budget.as_micros().min(i32::MAX as u128) as i32;
+        unsafe { ffi::kz_setspin(self.ptr, micros) };
+    }
+
+    /// Coalesce the wakes of the reader, woken once `bytes` or `count` are
+    /// written (zero for no limit) or `delay` passed since the first write not
+    /// woken for, zero `delay` disables coalescing. The delay is checked by
+    /// the writes and waits, so [`Channel::flush`] before going idle.
+    pub fn set_coalesce(&self, bytes: usize, count: usize, delay: Duration) {
+        let micros = delay.as_micros().min(i32::MAX as u128) as i32;
+        unsafe { ffi::kz_setcoalesce(self.ptr, bytes, count, micros) };
+    }
+
+    /// Size of the blocks of the arena, zero if the channel has none, see
+    /// [`OpenOptions::arena`]
+    pub fn block_size(&self) -> usize {
+        unsafe { ffi::kz_blocksize(self.ptr) }
+    }
+
+    /// Size of the slots of the queues, zero if the channel has none, see
+    /// [`OpenOptions::slots`]
+    pub fn slot_size(&self) -> usize {
+        unsafe { ffi::kz_slotsize(self.ptr) }
+    }
+
+    /// Allocate a block of the arena and `fill` it, which returns the bytes
+    /// used. Send the returned descriptor to the peer to hand the block
+    /// over, `Error::Again` if all the blocks are in use.
+    pub fn alloc_block(
+        &self,
+        fill: impl FnOnce(&mut [u8]) -> usize,
+    ) -> Result<Block> {
+        let mut blk = Block::default();
+        let r = unsafe { ffi::kz_alloc(self.ptr, &mut blk) };
+        if r != ffi::KZ_OK {
+            return Err(Error::from_retcode(r));
+        }
+        let data = unsafe {
+            let p = ffi::kz_blockdata(self.ptr, &blk);
+            slice::from_raw_parts_mut(p.cast(), self.block_size())
+        };
+        blk.len = fill(data).min(data.len()) as u32;
+        Ok(blk)
+    }
+
+    /// Pass the payload of a block received from the peer to `f`, then
+    /// free the block. `Error::Invalid` if the descriptor is stale.
+    pub fn read_block<R>(
+        &self,
+        blk: &Block,
+        f: impl FnOnce(&[u8]) -> R,
+    ) -> Result<R> {
+        let p = unsafe { ffi::kz_blockdata(self.ptr, blk) };
+        if p.is_null() {
+            return Err(Error::Invalid);
+        }
+        let r =
+            f(unsafe { slice::from_raw_parts(p.cast(), blk.len as usize) });
+        self.free_block(blk)?;
+        Ok(r)
+    }
+
+    /// Free a block without reading it
+    pub fn free_block(&self, blk: &Block) -> Result<()> {
+        let r = unsafe { ffi::kz_free(self.ptr, blk) };
+        Error::get_result(r, ())
+    }
+
+    /// Wake the reader for the writes held back by [`Channel::set_coalesce`]
+    pub fn flush(&self) -> Result<()> {
+        let r = unsafe { ffi::kz_flush(self.ptr) };
+        Error::get_result(r, ())
+    }
+
+    /// The fd polled readable once the peer may have made `mode` ready,
+    /// for channels created with `notify()`
+    pub fn notify_fd(&self, mode: Mode) -> Option<i32> {
+        let fd = unsafe { ffi::kz_notifyfd(self.ptr, mode.as_raw()) };
+        (fd >= 0).then_some(fd)
+    }
+
     /// Check if the channel is closed
     pub fn is_closed(&self, mode: Mode) -> bool {
         let mode = mode.as_raw();
@@ -229,6 +624,77 @@ impl Channel {
         unsafe { (ffi::kz_isclosed(self.ptr) & mode) == mode }
     }
 
+    /// Runtime statistics of both queues of the channel
+    pub fn stats(&self) -> Stats {
+        let mut stats = Stats::default();
+        unsafe { ffi::kz_stats(self.ptr, &mut stats) };
+        stats
+    }
+
+    /// Dwell time histogram of the queue read (`Mode::READ`) or written
+    /// (`Mode::WRITE`) by this side, `None` if the channel is not created
+    /// with [`OpenOptions::timestamp`]
+    pub fn histogram(&self, mode: Mode) -> Option<Histogram> {
+        let mut hist = Histogram::default();
+        let r =
+            unsafe { ffi::kz_histogram(self.ptr, mode.as_raw(), &mut hist) };
+        (r == ffi::KZ_OK).then_some(hist)
+    }
+
+    /// Number of lanes of the channel, 1 for channels without lanes
+    pub fn lanes(&self) -> usize {
+        unsafe { ffi::kz_lanes(self.ptr) as usize }
+    }
+
+    /// The lane `lane` of the channel, lane 0 is the channel itself
+    pub fn lane(&self, lane: usize) -> Option<Lane<'_>> {
+        let lane = lane.min(i32::MAX as usize) as i32;
+        let ptr = unsafe { ffi::kz_lane(self.ptr, lane) };
+        (!ptr.is_null()).then(|| Lane {
+            channel: ManuallyDrop::new(Channel { ptr }),
+            _marker: std::marker::PhantomData,
+        })
+    }
+
+    /// Read a message from the first ready lane, returns the lane and the
+    /// length of the message.
+    pub fn read_lanes(&self, write: impl BufMut) -> Result<(usize, usize)> {
+        self.read_lanes_util(write, -1)
+    }
+
+    /// Read a message from the first ready lane with timeout
+    pub fn read_lanes_util(
+        &self,
+        mut write: impl BufMut,
+        millis: i32,
+    ) -> Result<(usize, usize)> {
+        loop {
+            let mut ctx = std::mem::MaybeUninit::uninit();
+            let r = unsafe { ffi::kz_readlanes(self.ptr, ctx.as_mut_ptr()) };
+            if r >= 0 {
+                let ctx = Context {
+                    raw: unsafe { ctx.assume_init() },
+                    request_size: 0,
+                    _marker: std::marker::PhantomData,
+                };
+                return Ok((r as usize, ctx.read(&mut write)?));
+            }
+            if r != ffi::KZ_AGAIN {
+                return Err(Error::from_retcode(r));
+            }
+            self.wait_lanes_util(millis)?;
+        }
+    }
+
+    /// Wait until any lane is ready for read with timeout, returns the
+    /// number of ready lanes, closed lanes are ready.
+    pub fn wait_lanes_util(&self, millis: i32) -> Result<usize> {
+        match unsafe { ffi::kz_waitlanes(self.ptr, millis) } {
+            0 => Err(Error::Again),
+            r => Error::get_count(r),
+        }
+    }
+
     /// Runs f, and ignore the `Closed` error
     pub fn with_closed_handled(
         &self,
@@ -253,6 +719,19 @@ impl Channel {
         Error::get_result(r, ())
     }
 
+    /// Resize the buffer of the channel, in place, owner only.
+    ///
+    /// Both queues must be empty and no one in them, or it fails with
+    /// `Again` or `Busy` to be retried later. The peer picks up the new size
+    /// on its next operation. Grows only channels created with
+    /// [`OpenOptions::resizable`], or it fails with `TooBig`. Not supported
+    /// for channels opened with [`OpenOptions::mirror`],
+    /// [`OpenOptions::hugepage`] or [`OpenOptions::lanes`].
+    pub fn resize(&self, bufsize: usize) -> Result<()> {
+        let r = unsafe { ffi::kz_resize(self.ptr, bufsize) };
+        Error::get_result(r, ())
+    }
+
     /// Wait if the channel is not ready for read/write
     pub fn wait(&self, request_size: usize) -> Result<Mode> {
         self.wait_util(request_size, -1)
@@ -267,6 +746,86 @@ impl Channel {
         Ok(Mode(r))
     }
 
+    /// Publish the interest in `mode` and fill `waits` with the futex words
+    /// to wait on out of line, e.g. by io_uring `IORING_OP_FUTEX_WAITV`
+    /// (Linux 6.7+). Returns the modes already ready with nothing
+    /// registered, or `Mode::NULL` and the number of words to wait on, then
+    /// [`Channel::finish_wait`] once the wait completes in any way.
+    pub fn prepare_wait(
+        &self,
+        mode: Mode,
+        request_size: usize,
+        waits: &mut [FutexWait; Self::MAX_FUTEX],
+    ) -> Result<(Mode, usize)> {
+        let mut count = 0;
+        let r = unsafe {
+            ffi::kz_prepwait(
+                self.ptr,
+                mode.as_raw(),
+                request_size,
+                waits.as_mut_ptr(),
+                &mut count,
+            )
+        };
+        if r < 0 {
+            return Err(Error::from_retcode(r));
+        }
+        Ok((Mode(r), count))
+    }
+
+    /// Withdraw the interest published by [`Channel::prepare_wait`]
+    pub fn finish_wait(&self, mode: Mode) -> Result<()> {
+        let r = unsafe { ffi::kz_unregister(self.ptr, mode.as_raw()) };
+        Error::get_result(r, ())
+    }
+
+    /// Wait until any of `channels` is ready for the mode in `modes`.
+    ///
+    /// On return `modes` holds the readiness of each channel, and closed
+    /// channels are ready for all the modes asked. Returns the number of
+    /// ready channels, at most `MAX_WAIT` channels can be watched.
+    pub fn wait_many(
+        channels: &[&Channel],
+        modes: &mut [Mode],
+        request_size: usize,
+    ) -> Result<usize> {
+        Self::wait_many_util(channels, modes, request_size, -1)
+    }
+
+    pub fn wait_many_util(
+        channels: &[&Channel],
+        modes: &mut [Mode],
+        request_size: usize,
+        millis: i32,
+    ) -> Result<usize> {
+        let count = channels.len();
+        if count != modes.len() || count > Self::MAX_WAIT {
+            return Err(Error::Invalid);
+        }
+        let mut ptrs = [std::ptr::null_mut(); ffi::KZ_WAITMAX];
+        let mut raw = [0; ffi::KZ_WAITMAX];
+        for i in 0..count {
+            ptrs[i] = channels[i].ptr;
+            raw[i] = modes[i].as_raw();
+        }
+        let r = unsafe {
+            ffi::kz_waitmany(
+                ptrs.as_mut_ptr(),
+                raw.as_mut_ptr(),
+                count,
+                request_size,
+                millis,
+            )
+        };
+        if r < 0 {
+            return Err(Error::from_retcode(r));
+        }
+        for (mode, raw) in modes.iter_mut().zip(raw) {
+            *mode = Mode(raw);
+        }
+        Ok(r as usize)
+    }
+
     /// Read data from the channel
     pub fn read(&self, write: impl BufMut) -> Result<usize> {
         self.read_util(write, -1)
@@ -283,6 +842,59 @@ impl Channel {
         Ok(ctx.read(&mut write)?)
     }
 
+    /// Read a batch of messages from the channel, `f` is called on each
+    /// message, returns the number of messages read.
+    ///
+    /// At most `max` messages are read, and reading stops before the total
+    /// size of messages exceeds `budget` (0 for no limit), but at least one
+    /// message is read. All messages are committed at once.
+    pub fn read_batch(
+        &self,
+        max: usize,
+        budget: usize,
+        f: impl FnMut(&[u8]),
+    ) -> Result<usize> {
+        self.read_batch_util(max, budget, -1, f)
+    }
+
+    /// Read a batch of messages from the channel with timeout
+    pub fn read_batch_util(
+        &self,
+        max: usize,
+        budget: usize,
+        millis: i32,
+        mut f: impl FnMut(&[u8]),
+    ) -> Result<usize> {
+        if max == 0 {
+            return Err(Error::Invalid);
+        }
+        let mut ctxs: Vec<ffi::kz_Context> = Vec::with_capacity(max);
+        let n = loop {
+            let p = ctxs.as_mut_ptr();
+            let r = unsafe { ffi::kz_readv(self.ptr, p, max, budget) };
+            if r != ffi::KZ_AGAIN {
+                break Error::get_count(r)?;
+            }
+            // the first context is a pending read context, wait on it and
+            // then release it to read the whole batch again.
+            let r = unsafe { ffi::kz_waitcontext(p, millis) };
+            unsafe { ffi::kz_cancel(p) };
+            Error::get_result(r, ())?;
+        };
+        unsafe { ctxs.set_len(n) };
+        for ctx in ctxs.iter_mut() {
+            let mut len = 0;
+            let p = unsafe { ffi::kz_buffer(ctx, &mut len) };
+            f(if len == 0 {
+                &[]
+            } else {
+                unsafe { slice::from_raw_parts(p.cast(), len) }
+            });
+        }
+        let r = unsafe { ffi::kz_commitv(ctxs.as_mut_ptr(), n) };
+        Error::get_result(r, n)
+    }
+
     /// Write data to the channel
     pub fn write(&self, data: impl Buf) -> Result<()> {
         self.write_util(data, -1)
@@ -297,6 +909,128 @@ impl Channel {
         Ok(())
     }
 
+    /// Write a batch of messages to the channel, the reader sees all of
+    /// them at once or none of them.
+    pub fn write_batch(&self, bufs: &mut [impl Buf]) -> Result<()> {
+        self.write_batch_util(bufs, -1)
+    }
+
+    /// Write a batch of messages to the channel with timeout
+    pub fn write_batch_util(
+        &self,
+        bufs: &mut [impl Buf],
+        millis: i32,
+    ) -> Result<()> {
+        if bufs.is_empty() {
+            return Ok(());
+        }
+        let lens: Vec<usize> = bufs.iter().map(|b| b.remaining()).collect();
+        let mut ctxs: Vec<ffi::kz_Context> = Vec::with_capacity(lens.len());
+        loop {
+            let p = ctxs.as_mut_ptr();
+            let r = unsafe {
+                ffi::kz_writev(self.ptr, p, lens.as_ptr(), lens.len())
+            };
+            if r != ffi::KZ_AGAIN {
+                Error::get_result(r, ())?;
+                break;
+            }
+            // the first context waits for the space of the whole batch and
+            // reserves nothing, lay the batch out again after the wait
+            let r = unsafe { ffi::kz_waitcontext(p, millis) };
+            unsafe { ffi::kz_cancel(p) };
+            Error::get_result(r, ())?;
+        }
+        unsafe { ctxs.set_len(lens.len()) };
+        for (ctx, buf) in ctxs.iter_mut().zip(bufs.iter_mut()) {
+            let mut len = 0;
+            let p = unsafe { ffi::kz_buffer(ctx, &mut len) };
+            if len != 0 {
+                buf.copy_to_slice(unsafe {
+                    slice::from_raw_parts_mut(p.cast(), len)
+                });
+            }
+        }
+        let r = unsafe { ffi::kz_commitv(ctxs.as_mut_ptr(), ctxs.len()) };
+        Error::get_result(r, ())
+    }
+
+    /// Largest chunk written at once by `write_large`
+    pub fn chunk_size(&self) -> usize {
+        unsafe { ffi::kz_chunksize(self.ptr) }
+    }
+
+    /// Write a message of any size, split into chunks of `chunk_size()`
+    /// bytes, the reader gets it by `read_large` or `read_chunks`.
+    ///
+    /// Only the last chunk can be written to a channel created with
+    /// [`OpenOptions::mpsc`], the chunks of writers would interleave.
+    pub fn write_large(&self, data: impl Buf) -> Result<()> {
+        self.write_large_util(data, -1)
+    }
+
+    /// Write a message of any size with timeout on each chunk
+    pub fn write_large_util(
+        &self,
+        mut data: impl Buf,
+        millis: i32,
+    ) -> Result<()> {
+        let chunk = self.chunk_size();
+        if chunk == 0 {
+            return Err(Error::TooBig);
+        }
+        loop {
+            let len = data.remaining().min(chunk);
+            let more = data.remaining() > len;
+            let mut ctx = self.write_context(len)?.wait_util(millis)?;
+            data.copy_to_slice(&mut ctx.buffer_mut()[..len]);
+            ctx.commit_chunk(len, more)?;
+            if !more {
+                return Ok(());
+            }
+        }
+    }
+
+    /// Read a message written by `write_large`, returns its length
+    pub fn read_large(&self, write: impl BufMut) -> Result<usize> {
+        self.read_large_util(write, -1)
+    }
+
+    /// Read a message written by `write_large` with timeout on each chunk
+    pub fn read_large_util(
+        &self,
+        mut write: impl BufMut,
+        millis: i32,
+    ) -> Result<usize> {
+        self.read_chunks_util(millis, |chunk| write.put_slice(chunk))
+    }
+
+    /// Read the chunks of a message written by `write_large`, `f` is
+    /// called on each chunk, returns the length of the message.
+    pub fn read_chunks(&self, f: impl FnMut(&[u8])) -> Result<usize> {
+        self.read_chunks_util(-1, f)
+    }
+
+    /// Read the chunks of a message with timeout on each chunk
+    pub fn read_chunks_util(
+        &self,
+        millis: i32,
+        mut f: impl FnMut(&[u8]),
+    ) -> Result<usize> {
+        let mut total = 0;
+        loop {
+            let ctx = self.read_context()?.wait_util(millis)?;
+            let more = ctx.is_more();
+            let chunk = ctx.buffer();
+            total += chunk.len();
+            f(chunk);
+            ctx.commit(0)?;
+            if !more {
+                return Ok(total);
+            }
+        }
+    }
+
     /// create a context for read operation
     pub fn read_context(&self) -> Result<Context<'_>> {
         let mut ctx = std::mem::MaybeUninit::uninit();
@@ -306,6 +1040,7 @@ impl Channel {
         }
         Ok(Context {
             raw: unsafe { ctx.assume_init() },
+            request_size: 0,
             _marker: std::marker::PhantomData,
         })
     }
@@ -319,14 +1054,229 @@ impl Channel {
         }
         Ok(Context {
             raw: unsafe { ctx.assume_init() },
+            request_size: len,
             _marker: std::marker::PhantomData,
         })
     }
 }
 
+/// What the writer of a [`Broadcast`] ring does when the slowest reader
+/// has not read the space it needs.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Overflow {
+    /// Wait for the reader, [`Broadcast::try_send`] returns `Error::Again`
+    Block,
+    /// Overwrite the messages unread, the reader gets `Error::Dropped` once
+    /// and goes on from the oldest message kept
+    Drop,
+}
+
+/// A broadcast ring in shared memory, one writer and many readers, every
+/// reader gets every message sent after it joined (Unix only).
+pub struct Broadcast {
+    ptr: *mut ffi::kz_Bcast,
+}
+
+unsafe impl Send for Broadcast {}
+
+impl Drop for Broadcast {
+    fn drop(&mut self) {
+        unsafe { ffi::kz_bcclose(self.ptr) }
+    }
+}
+
+impl Broadcast {
+    /// Create the ring as its writer, for `readers` readers at most. The
+    /// ring left by a writer gone is taken over with its readers.
+    pub fn create(
+        name: impl AsRef<Path>,
+        bufsize: usize,
+        readers: usize,
+        overflow: Overflow,
+    ) -> IoResult<Self> {
+        let mut flags = ffi::KZ_CREATE | 0o666;
+        if overflow == Overflow::Drop {
+            flags |= ffi::KZ_DROP;
+        }
+        let readers = readers.min(i32::MAX as usize) as i32;
+        Self::raw_open(name, flags, bufsize, readers)
+    }
+
+    /// Join the ring as a reader, leaves it when dropped
+    pub fn join(name: impl AsRef<Path>) -> IoResult<Self> {
+        Self::raw_open(name, 0, 0, 0)
+    }
+
+    fn raw_open(
+        name: impl AsRef<Path>,
+        flags: i32,
+        bufsize: usize,
+        readers: i32,
+    ) -> IoResult<Self> {
+        let name =
+            CString::new(name.as_ref().to_string_lossy().as_bytes()).unwrap();
+        let ptr =
+            unsafe { ffi::kz_bcopen(name.as_ptr(), flags, bufsize, readers) };
+        if ptr.is_null() {
+            return Err(std::io::Error::last_os_error());
+        }
+        Ok(Self { ptr })
+    }
+
+    /// Number of readers joined
+    pub fn readers(&self) -> usize {
+        unsafe { ffi::kz_bcreaders(self.ptr).max(0) as usize }
+    }
+
+    /// Bytes of the messages this reader lost to a [`Overflow::Drop`]
+    /// writer
+    pub fn dropped(&self) -> u64 {
+        unsafe { ffi::kz_bcdropped(self.ptr) }
+    }
+
+    /// Send a message to all readers, waits for the slowest reader
+    pub fn send(&self, data: &[u8]) -> Result<()> {
+        self.send_util(data, -1)
+    }
+
+    /// Send a message to all readers with timeout
+    pub fn send_util(&self, data: &[u8], millis: i32) -> Result<()> {
+        loop {
+            match self.try_send(data) {
+                Err(Error::Again) => self.wait_util(data.len(), millis)?,
+                r => return r,
+            }
+        }
+    }
+
+    /// Send a message without waiting
+    pub fn try_send(&self, data: &[u8]) -> Result<()> {
+        let r = unsafe {
+            ffi::kz_bcsend(self.ptr, data.as_ptr().cast(), data.len())
+        };
+        Error::get_result(r, ())
+    }
+
+    /// Receive the next message, appended to `buf`. `Error::Dropped` if
+    /// messages were overwritten before read, then go on receiving.
+    pub fn recv(&self, buf: &mut Vec<u8>) -> Result<usize> {
+        self.recv_util(buf, -1)
+    }
+
+    /// Receive the next message with timeout
+    pub fn recv_util(&self, buf: &mut Vec<u8>, millis: i32) -> Result<usize> {
+        loop {
+            match self.try_recv(buf) {
+                Err(Error::Again) => self.wait_util(0, millis)?,
+                r => return r,
+            }
+        }
+    }
+
+    /// Receive the next message without waiting
+    pub fn try_recv(&self, buf: &mut Vec<u8>) -> Result<usize> {
+        let off = buf.len();
+        loop {
+            let mut len = buf.capacity() - off;
+            let r = unsafe {
+                let data = buf.as_mut_ptr().add(off);
+                ffi::kz_bcrecv(self.ptr, data.cast(), &mut len)
+            };
+            match r {
+                ffi::KZ_OK => {
+                    unsafe { buf.set_len(off + len) };
+                    return Ok(len);
+                }
+                ffi::KZ_TOOBIG => buf.reserve(len),
+                _ => return Err(Error::from_retcode(r)),
+            }
+        }
+    }
+
+    /// Wait until `len` bytes can be sent for the writer, or a message
+    /// arrives for a reader; may return early
+    pub fn wait(&self, len: usize) -> Result<()> {
+        self.wait_util(len, -1)
+    }
+
+    /// Wait with timeout, see [`Broadcast::wait`]
+    pub fn wait_util(&self, len: usize, millis: i32) -> Result<()> {
+        let r = unsafe { ffi::kz_bcwait(self.ptr, len, millis) };
+        Error::get_result(r, ())
+    }
+}
+
+/// A directory of channels in one shared memory object, so many channels
+/// share one mapping (Unix only). Channels are opened in it by
+/// [`OpenOptions::open_in`], and keep it mapped after it is dropped.
+pub struct Directory {
+    ptr: *mut ffi::kz_Dir,
+}
+
+unsafe impl Send for Directory {}
+unsafe impl Sync for Directory {}
+
+impl Drop for Directory {
+    fn drop(&mut self) {
+        unsafe { ffi::kz_closedir(self.ptr) }
+    }
+}
+
+impl Directory {
+    /// Create the directory of `size` bytes in total, for `count` channels
+    /// at most, or open it if it already exists
+    pub fn create(
+        name: impl AsRef<Path>,
+        size: usize,
+        count: usize,
+    ) -> IoResult<Self> {
+        Self::raw_open(name, ffi::KZ_CREATE | 0o666, size, count)
+    }
+
+    /// Open an existing directory
+    pub fn open(name: impl AsRef<Path>) -> IoResult<Self> {
+        Self::raw_open(name, 0, 0, 0)
+    }
+
+    fn raw_open(
+        name: impl AsRef<Path>,
+        flags: i32,
+        size: usize,
+        count: usize,
+    ) -> IoResult<Self> {
+        let name =
+            CString::new(name.as_ref().to_string_lossy().as_bytes()).unwrap();
+        let ptr =
+            unsafe { ffi::kz_opendir(name.as_ptr(), flags, size, count) };
+        if ptr.is_null() {
+            return Err(std::io::Error::last_os_error());
+        }
+        Ok(Self { ptr })
+    }
+}
+
+/// A lane of a channel created with [`OpenOptions::lanes`], lives as long
+/// as the channel, and closed together with it.
+pub struct Lane<'a> {
+    channel: ManuallyDrop<Channel>,
+    _marker: std::marker::PhantomData<&'a Channel>,
+}
+
+unsafe impl Send for Lane<'_> {}
+unsafe impl Sync for Lane<'_> {}
+
+impl Deref for Lane<'_> {
+    type Target = Channel;
+
+    fn deref(&self) -> &Channel {
+        &self.channel
+    }
+}
+
 /// Context used to perform read/write operations
 pub struct Context<'a> {
     raw: ffi::kz_Context,
+    request_size: usize,
     _marker: std::marker::PhantomData<&'a ()>,
 }
 
@@ -380,6 +1330,7 @@ impl Context<'_> {
     pub unsafe fn into_static(self) -> Context<'static> {
         Context {
             raw: self.raw,
+            request_size: self.request_size,
             _marker: std::marker::PhantomData,
         }
     }
@@ -395,6 +1346,22 @@ impl Context<'_> {
         Error::get_result(r, self)
     }
 
+    /// Retry the operation without blocking, `would_block` tells whether
+    /// it is still pending.
+    #[cfg(all(feature = "tokio", unix))]
+    pub(crate) fn retry(&mut self) -> Result<()> {
+        match unsafe { ffi::kz_waitcontext(&mut self.raw, 0) } {
+            ffi::KZ_AGAIN => Ok(()),
+            r => Error::get_result(r, ()),
+        }
+    }
+
+    /// Size requested by the write context
+    #[cfg(all(feature = "tokio", unix))]
+    pub(crate) fn request_size(&self) -> usize {
+        self.request_size
+    }
+
     /// Cancel the read/write operation of this context
     pub fn cancel(&mut self) {
         unsafe { ffi::kz_cancel(&mut self.raw) }
@@ -426,11 +1393,34 @@ impl Context<'_> {
         }
     }
 
+    /// Move a read context to the next published message without
+    /// committing, `false` if none follows yet. Committing it consumes all
+    /// the messages up to it.
+    pub fn next(&mut self) -> Result<bool> {
+        match unsafe { ffi::kz_next(&mut self.raw) } {
+            ffi::KZ_AGAIN => Ok(false),
+            r => Error::get_result(r, true),
+        }
+    }
+
     /// Commit copied data with actual length
     pub fn commit(mut self, len: usize) -> Result<()> {
         let code = unsafe { ffi::kz_commit(&mut self.raw, len) };
         Error::get_result(code, ())
     }
+
+    /// Commit a chunk of a large message, `more` tells the reader that
+    /// more chunks of the message follow.
+    pub fn commit_chunk(mut self, len: usize, more: bool) -> Result<()> {
+        let more = more as i32;
+        let code = unsafe { ffi::kz_commitchunk(&mut self.raw, len, more) };
+        Error::get_result(code, ())
+    }
+
+    /// Check if more chunks follow the one read by this context
+    pub fn is_more(&self) -> bool {
+        unsafe { ffi::kz_more(&self.raw) != 0 }
+    }
 }
 
 /// Mode used to indicate the channel is ready for read/write
@@ -488,6 +1478,143 @@ impl Mode {
     }
 }
 
+/// Statistics of one queue, kept in the shared memory by both sides
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct QueueStats {
+    /// Messages committed by the writers
+    pub pushes: u64,
+    /// Messages committed by the reader
+    pub pops: u64,
+    /// Payload bytes of `pushes`
+    pub push_bytes: u64,
+    /// Payload bytes of `pops`
+    pub pop_bytes: u64,
+    /// Waits of the writers slept in the kernel
+    pub push_sleeps: u32,
+    /// Waits of the reader slept in the kernel
+    pub pop_sleeps: u32,
+    /// Wakes issued by the writers
+    pub push_wakes: u32,
+    /// Wakes issued by the reader
+    pub pop_wakes: u32,
+    /// `Again` results of the writers, rechecks in waits included
+    pub push_again: u32,
+    /// `Again` results of the reader, rechecks in waits included
+    pub pop_again: u32,
+    /// `Busy` results of the writers
+    pub push_busy: u32,
+    /// `Busy` results of the reader
+    pub pop_busy: u32,
+    /// High-water mark of the bytes used
+    pub peak: u32,
+    /// Size of the queue in bytes
+    pub size: u32,
+    /// Bytes used at the time of the call
+    pub used: u32,
+}
+
+/// Statistics of a channel, see [`Channel::stats`]
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Stats {
+    /// The queue written by this side
+    pub write: QueueStats,
+    /// The queue read by this side
+    pub read: QueueStats,
+}
+
+/// Descriptor of a block of the arena, see [`OpenOptions::arena`]
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Block {
+    /// Offset of the block in the arena
+    pub offset: u32,
+    /// Bytes of the payload
+    pub len: u32,
+    /// Generation of the block, the descriptor is stale once freed
+    pub generation: u32,
+}
+
+impl Block {
+    /// Size of the descriptor in bytes
+    pub const SIZE: usize = 12;
+
+    /// The descriptor as bytes to send through the queue
+    pub fn to_bytes(&self) -> [u8; Self::SIZE] {
+        let mut buf = [0; Self::SIZE];
+        buf[0..4].copy_from_slice(&self.offset.to_ne_bytes());
+        buf[4..8].copy_from_slice(&self.len.to_ne_bytes());
+        buf[8..12].copy_from_slice(&self.generation.to_ne_bytes());
+        buf
+    }
+
+    /// The descriptor from the bytes received, `None` if not one
+    pub fn from_bytes(buf: &[u8]) -> Option<Self> {
+        let buf: &[u8; Self::SIZE] = buf.try_into().ok()?;
+        let word = |i: usize| {
+            u32::from_ne_bytes([buf[i], buf[i + 1], buf[i + 2], buf[i + 3]])
+        };
+        Some(Self {
+            offset: word(0),
+            len: word(4),
+            generation: word(8),
+        })
+    }
+}
+
+/// A futex word to wait on, laid out as `struct futex_waitv`, see
+/// [`Channel::prepare_wait`]
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct FutexWait {
+    /// Value of the word seen before the wait
+    pub val: u64,
+    /// Address of the word, shared between processes
+    pub uaddr: u64,
+    /// `FUTEX2_SIZE_U32`
+    pub flags: u32,
+    reserved: u32,
+}
+
+/// Time the messages stayed in a queue, in nanoseconds, see
+/// [`Channel::histogram`]
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Histogram {
+    /// Messages recorded
+    pub count: u64,
+    /// Total dwell time of `count` messages
+    pub sum: u64,
+    /// Messages in each bucket, see [`Histogram::bound`]
+    pub buckets: [u32; ffi::KZ_HISTMAX],
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Self {
+            count: 0,
+            sum: 0,
+            buckets: [0; ffi::KZ_HISTMAX],
+        }
+    }
+}
+
+impl Histogram {
+    /// The least dwell time counted in `bucket`, exact below 16ns and with
+    /// 8 buckets for each power of two above; the last bucket has no upper
+    /// bound
+    pub fn bound(bucket: usize) -> u64 {
+        unsafe { ffi::kz_histbound(bucket) }
+    }
+
+    /// Upper bound of the bucket holding the `q` quantile, e.g. 0.99 for
+    /// p99, or 0 for an empty histogram
+    pub fn percentile(&self, q: f64) -> u64 {
+        unsafe { ffi::kz_percentile(self, q) }
+    }
+}
+
 /// A shutdown guard, will close the channel when dropped
 #[derive(Debug)]
 pub struct ShutdownGuard(*mut ffi::kz_State, Mode);
@@ -545,6 +1672,7 @@ pub enum Error {
     Again,
     Busy,
     Timeout,
+    Dropped,
 }
 
 impl std::error::Error for Error {
@@ -572,6 +1700,13 @@ impl Error {
         }
     }
 
+    fn get_count(code: i32) -> Result<usize> {
+        match code {
+            n if n > 0 => Ok(n as usize),
+            _ => Err(Error::from_retcode(code)),
+        }
+    }
+
     fn from_retcode(code: i32) -> Self {
         match code {
             ffi::KZ_OK => Error::Ok,
@@ -582,6 +1717,7 @@ impl Error {
             ffi::KZ_AGAIN => Error::Again,
             ffi::KZ_BUSY => Error::Busy,
             ffi::KZ_TIMEOUT => Error::Timeout,
+            ffi::KZ_DROPPED => Error::Dropped,
             _ => Error::Fail(std::io::Error::new(
                 std::io::ErrorKind::Other,
                 format!("Unknown error({})", code),
@@ -605,6 +1741,7 @@ impl std::fmt::Display for Error {
             Error::Again => write!(f, "Try again"),
             Error::Busy => write!(f, "Resource is busy"),
             Error::Timeout => write!(f, "Operation timed out"),
+            Error::Dropped => write!(f, "Messages dropped for lagging"),
         }
     }
 }
@@ -637,6 +1774,7 @@ impl Into<std::io::Error> for Error {
             Error::Again => IoError::new(ErrorKind::WouldBlock, self),
             Error::Busy => IoError::new(ErrorKind::ResourceBusy, self),
             Error::Timeout => IoError::new(ErrorKind::TimedOut, self),
+            Error::Dropped => IoError::new(ErrorKind::Interrupted, self),
         }
     }
 }
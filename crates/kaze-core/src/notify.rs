@@ -0,0 +1,338 @@
+use std::{
+    future::poll_fn,
+    os::fd::{AsRawFd, RawFd},
+    pin::pin,
+    sync::{
+        Arc, OnceLock,
+        atomic::{AtomicU64, Ordering},
+    },
+    task::Poll,
+};
+
+use bytes::{Buf, BufMut};
+use tokio::{
+    io::{Interest, unix::AsyncFd},
+    sync::Notify,
+    task::spawn_blocking,
+};
+
+use crate::{Channel, Context, Error, Mode, Result, ShutdownGuard, ffi};
+
+/// The fd owned by the channel, never closed here
+struct NotifyFd(RawFd);
+
+impl AsRawFd for NotifyFd {
+    fn as_raw_fd(&self) -> RawFd {
+        self.0
+    }
+}
+
+/// A channel waited on the tokio reactor instead of blocking a thread.
+///
+/// Channels opened with `OpenOptions::notify` are waited by polling the
+/// fds signaled by the peer, one for each direction. Other channels, or
+/// channels whose peer can not signal the fds, are waited on the blocking
+/// pool.
+pub struct AsyncChannel {
+    sides: [Side; 2],
+    channel: Arc<Channel>,
+    blocking_waits: AtomicU64,
+}
+
+/// The fd of a direction, shared by all the tasks waiting on it
+struct Side {
+    fd: OnceLock<Option<AsyncFd<NotifyFd>>>,
+    /// Woken when the readiness of `fd` is cleared, so every other waiter
+    /// registers its interest again instead of sleeping on the cleared fd
+    cleared: Notify,
+}
+
+impl Side {
+    fn new() -> Self {
+        Self {
+            fd: OnceLock::new(),
+            cleared: Notify::new(),
+        }
+    }
+}
+
+impl std::fmt::Debug for AsyncChannel {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "AsyncChannel({:?})", self.channel)
+    }
+}
+
+/// Interest registered by `kz_register`, unregistered on drop
+struct Registered<'a>(&'a Channel, Mode);
+
+impl Drop for Registered<'_> {
+    fn drop(&mut self) {
+        unsafe { ffi::kz_unregister(self.0.ptr, self.1.as_raw()) };
+    }
+}
+
+/// A pending context, cancelled if the waiting is dropped
+struct Pending<'a>(Option<Context<'a>>);
+
+impl Drop for Pending<'_> {
+    fn drop(&mut self) {
+        if let Some(ctx) = self.0.as_mut() {
+            ctx.cancel();
+        }
+    }
+}
+
+impl AsyncChannel {
+    /// Create an async channel, the fds are registered to the reactor of
+    /// the first waiting task.
+    pub fn new(channel: Channel) -> Self {
+        Self {
+            sides: [Side::new(), Side::new()],
+            channel: Arc::new(channel),
+            blocking_waits: AtomicU64::new(0),
+        }
+    }
+
+    /// Number of the waits fallen back to the blocking pool, as the channel
+    /// is not created with `notify()` or the peer can not signal it.
+    pub fn blocking_waits(&self) -> u64 {
+        self.blocking_waits.load(Ordering::Relaxed)
+    }
+
+    /// The underlying channel
+    pub fn channel(&self) -> &Channel {
+        &self.channel
+    }
+
+    /// Split the channel into read and write parts
+    pub fn into_split(self) -> (AsyncReadHalf, AsyncWriteHalf) {
+        let rc = Arc::new(self);
+        (AsyncReadHalf::new(rc.clone()), AsyncWriteHalf::new(rc))
+    }
+
+    fn fd(&self, mode: Mode) -> Option<&AsyncFd<NotifyFd>> {
+        let side = &self.sides[(mode.0 == Mode::WRITE.0) as usize];
+        let fd = side.fd.get_or_init(|| {
+            let fd = self.channel.notify_fd(mode)?;
+            AsyncFd::with_interest(NotifyFd(fd), Interest::READABLE).ok()
+        });
+        fd.as_ref()
+    }
+
+    /// Wait until the channel is ready for `mode`, `request_size` is the
+    /// size to write.
+    pub async fn ready(&self, mode: Mode, request_size: usize) -> Result<Mode> {
+        let modes = [Mode::READ, Mode::WRITE];
+        let fds = modes.map(|m| (mode.0 & m.0 != 0).then(|| self.fd(m)));
+        if fds.iter().any(|fd| matches!(fd, Some(None))) {
+            return self.ready_blocking(mode, request_size).await;
+        }
+        loop {
+            // enabled before registering, so a clear by another waiter
+            // after that wakes this one as well
+            let mut read_cleared = pin!(self.sides[0].cleared.notified());
+            let mut write_cleared = pin!(self.sides[1].cleared.notified());
+            read_cleared.as_mut().enable();
+            write_cleared.as_mut().enable();
+            let r = unsafe {
+                ffi::kz_register(self.channel.ptr, mode.as_raw(), request_size)
+            };
+            if r == ffi::KZ_AGAIN {
+                return self.ready_blocking(mode, request_size).await;
+            }
+            if r != 0 {
+                return Error::get_count(r).map(|_| Mode(r));
+            }
+            let _registered = Registered(&self.channel, mode);
+            poll_fn(|cx| {
+                for (i, m) in modes.into_iter().enumerate() {
+                    let Some(Some(fd)) = fds[i] else { continue };
+                    let cleared = match i {
+                        0 => read_cleared.as_mut(),
+                        _ => write_cleared.as_mut(),
+                    };
+                    if cleared.poll(cx).is_ready() {
+                        return Poll::Ready(Ok(()));
+                    }
+                    let mut guard = match fd.poll_read_ready(cx) {
+                        Poll::Ready(Ok(guard)) => guard,
+                        Poll::Ready(Err(e)) => return Poll::Ready(Err(e)),
+                        Poll::Pending => continue,
+                    };
+                    // the signals are consumed here, everyone waiting on
+                    // the fd checks the channel again
+                    unsafe {
+                        ffi::kz_clearnotify(self.channel.ptr, m.as_raw())
+                    };
+                    guard.clear_ready();
+                    self.sides[i].cleared.notify_waiters();
+                    return Poll::Ready(Ok(()));
+                }
+                Poll::Pending
+            })
+            .await?;
+        }
+    }
+
+    async fn ready_blocking(
+        &self,
+        mode: Mode,
+        request_size: usize,
+    ) -> Result<Mode> {
+        self.blocking_waits.fetch_add(1, Ordering::Relaxed);
+        let channel = self.channel.clone();
+        spawn_blocking(move || {
+            let mut modes = [mode];
+            Channel::wait_many(&[&channel], &mut modes, request_size)?;
+            Ok(modes[0])
+        })
+        .await
+        .map_err(|e| Error::Fail(std::io::Error::other(e)))?
+    }
+
+    /// Wait until a context that would block is ready.
+    pub async fn wait_context<'a>(
+        &'a self,
+        ctx: Context<'a>,
+    ) -> Result<Context<'a>> {
+        let (mode, len) = if ctx.is_read() {
+            (Mode::READ, 0)
+        } else {
+            (Mode::WRITE, ctx.request_size())
+        };
+        let mut pending = Pending(Some(ctx));
+        while let Some(ctx) = pending.0.as_mut() {
+            if !ctx.would_block() {
+                break;
+            }
+            self.ready(mode, len).await?;
+            ctx.retry()?;
+        }
+        Ok(pending.0.take().unwrap())
+    }
+
+    /// Create a context for read operation, waiting for the data
+    pub async fn read_context(&self) -> Result<Context<'_>> {
+        let ctx = self.channel.read_context()?;
+        self.wait_context(ctx).await
+    }
+
+    /// Create a context for write operation, waiting for the space
+    pub async fn write_context(&self, len: usize) -> Result<Context<'_>> {
+        let ctx = self.channel.write_context(len)?;
+        self.wait_context(ctx).await
+    }
+
+    /// Read data from the channel
+    pub async fn read(&self, write: impl BufMut) -> Result<usize> {
+        self.read_context().await?.read(write)
+    }
+
+    /// Write data to the channel
+    pub async fn write(&self, data: impl Buf) -> Result<()> {
+        let len = data.remaining();
+        self.write_context(len).await?.write(data)?;
+        Ok(())
+    }
+}
+
+/// A read part of the async channel
+#[derive(Clone, Debug)]
+pub struct AsyncReadHalf {
+    inner: Arc<AsyncChannel>,
+}
+
+impl AsyncReadHalf {
+    fn new(inner: Arc<AsyncChannel>) -> Self {
+        Self { inner }
+    }
+
+    /// The underlying channel
+    pub fn channel(&self) -> &Channel {
+        self.inner.channel()
+    }
+
+    /// Create a guard for shutdown the read part when dropped
+    pub fn shutdown_lock(&self) -> ShutdownGuard {
+        self.inner.channel.shutdown_guard(Mode::READ)
+    }
+
+    /// Number of the waits of both parts fallen back to the blocking pool
+    pub fn blocking_waits(&self) -> u64 {
+        self.inner.blocking_waits()
+    }
+
+    /// Shutdown the read part
+    pub fn shutdown(&self) -> Result<()> {
+        self.inner.channel.shutdown(Mode::BOTH)
+    }
+
+    /// Wait until a read context that would block is ready.
+    pub async fn wait_context<'a>(
+        &'a self,
+        ctx: Context<'a>,
+    ) -> Result<Context<'a>> {
+        self.inner.wait_context(ctx).await
+    }
+
+    /// Create a context for read operation, waiting for the data
+    pub async fn read_context(&self) -> Result<Context<'_>> {
+        self.inner.read_context().await
+    }
+
+    /// Read data from the channel
+    pub async fn read(&self, write: impl BufMut) -> Result<usize> {
+        self.inner.read(write).await
+    }
+}
+
+/// A write part of the async channel
+#[derive(Debug)]
+pub struct AsyncWriteHalf {
+    inner: Arc<AsyncChannel>,
+}
+
+impl Drop for AsyncWriteHalf {
+    fn drop(&mut self) {
+        let _ = self.inner.channel.shutdown(Mode::WRITE);
+    }
+}
+
+impl AsyncWriteHalf {
+    fn new(inner: Arc<AsyncChannel>) -> Self {
+        Self { inner }
+    }
+
+    /// The underlying channel
+    pub fn channel(&self) -> &Channel {
+        self.inner.channel()
+    }
+
+    /// Create a guard for shutdown the read part when dropped
+    pub fn shutdown_lock(&self) -> ShutdownGuard {
+        self.inner.channel.shutdown_guard(Mode::READ)
+    }
+
+    /// Number of the waits of both parts fallen back to the blocking pool
+    pub fn blocking_waits(&self) -> u64 {
+        self.inner.blocking_waits()
+    }
+
+    /// Wait until a write context that would block is ready.
+    pub async fn wait_context<'a>(
+        &'a self,
+        ctx: Context<'a>,
+    ) -> Result<Context<'a>> {
+        self.inner.wait_context(ctx).await
+    }
+
+    /// Create a context for write operation, waiting for the space
+    pub async fn write_context(&self, len: usize) -> Result<Context<'_>> {
+        self.inner.write_context(len).await
+    }
+
+    /// Write data to the channel
+    pub async fn write(&self, data: impl Buf) -> Result<()> {
+        self.inner.write(data).await
+    }
+}
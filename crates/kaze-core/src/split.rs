@@ -70,6 +70,20 @@ impl OwnedWriteHalf {
         self.channel.write_util(data, millis)
     }
 
+    /// Write a batch of messages to the channel
+    pub fn write_batch(&self, bufs: &mut [impl Buf]) -> crate::Result<()> {
+        self.channel.write_batch_util(bufs, -1)
+    }
+
+    /// Write a batch of messages to the channel with timeout
+    pub fn write_batch_util(
+        &self,
+        bufs: &mut [impl Buf],
+        millis: i32,
+    ) -> crate::Result<()> {
+        self.channel.write_batch_util(bufs, millis)
+    }
+
     /// create a context for write operation
     pub fn write_context(&self, len: usize) -> crate::Result<Context<'_>> {
         self.channel.write_context(len)
@@ -130,6 +144,27 @@ impl OwnedReadHalf {
         self.channel.read_util(write, millis)
     }
 
+    /// Read a batch of messages from the channel
+    pub fn read_batch(
+        &self,
+        max: usize,
+        budget: usize,
+        f: impl FnMut(&[u8]),
+    ) -> crate::Result<usize> {
+        self.channel.read_batch_util(max, budget, -1, f)
+    }
+
+    /// Read a batch of messages from the channel with timeout
+    pub fn read_batch_util(
+        &self,
+        max: usize,
+        budget: usize,
+        millis: i32,
+        f: impl FnMut(&[u8]),
+    ) -> crate::Result<usize> {
+        self.channel.read_batch_util(max, budget, millis, f)
+    }
+
     /// create a context for read operation
     pub fn read_context(&self) -> crate::Result<Context<'_>> {
         self.channel.read_context()
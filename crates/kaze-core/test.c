@@ -5,11 +5,11 @@
 #include "kz_threads.h"
 
 static void *echo_thread(void *ud) {
-    kz_State *S = kz_open("test", 0, 0);
+    /* the user side given, or opened by name */
+    kz_State *S = ud != NULL ? (kz_State *)ud : kz_open("test", 0, 0);
     if (S == NULL) perror("kz_open");
     assert(S != NULL);
     assert(!kz_isowner(S));
-    (void)ud;
     printf("echo thread start\n");
     while (!kz_isclosed(S)) {
         kz_Context rctx, wctx;
@@ -46,7 +46,7 @@ static void test_echo(void) {
     int       ownerpid, userpid;
     int       count;
     printf("--- test echo ---\n");
-    assert(kz_aligned(1024, 4096) == 3824);
+    assert(kz_aligned(1024, 4096) == 4096 - sizeof(kz_ShmHdr));
     assert(!kz_exists("test", NULL, NULL));
     assert(kz_open("test", KZ_CREATE | 0666, 0) == NULL);
     if (sizeof(size_t) > 4)
@@ -107,40 +107,1613 @@ static kz_State *kz_shadow(kz_State *S) {
     return S1;
 }
 
+static void test_hugepage(void) {
+    kz_State  *S, *S1;
+    kz_Context ctx;
+    size_t     buflen = 0;
+    int        r;
+
+    printf("--- test hugepage ---\n");
+    assert(kz_aligned(1024, 0) >= kz_aligned(1024, 4096));
+    kz_unlink("test");
+
+    /* falls back to plain shm when huge pages are unavailable */
+    S = kz_open("test", KZ_CREATE | KZ_HUGEPAGE | 0666, 1024);
+    assert(S != NULL);
+    assert(kz_size(S) >= 1024 / 2);
+    assert(kz_exists("test", NULL, NULL) == 1);
+    S1 = kz_open("test", 0, 0);
+    assert(S1 != NULL);
+    assert(kz_size(S1) == kz_size(S));
+
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), "hello", 5);
+    kz_commit(&ctx, 5);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK);
+    assert(memcmp(kz_buffer(&ctx, &buflen), "hello", 5) == 0);
+    assert(buflen == 5);
+    kz_commit(&ctx, buflen);
+
+    kz_close(S1);
+    kz_close(S);
+    assert(kz_unlink("test") == KZ_OK);
+    assert(kz_exists("test", NULL, NULL) == 0);
+    printf("--- test hugepage ---\n");
+}
+
+static void test_prefault(void) {
+    kz_State  *S, *S1;
+    kz_Context ctx;
+    size_t     buflen = 0;
+    int        r;
+
+    printf("--- test prefault ---\n");
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | KZ_PREFAULT | KZ_MLOCK | 0666, 8192);
+    assert(S != NULL);
+    S1 = kz_open("test", KZ_PREFAULT, 0);
+    assert(S1 != NULL);
+    r = kz_write(S1, &ctx, 5);
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), "hello", 5);
+    kz_commit(&ctx, 5);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_OK);
+    assert(memcmp(kz_buffer(&ctx, &buflen), "hello", 5) == 0);
+    kz_commit(&ctx, buflen);
+    kz_close(S1);
+    kz_close(S);
+    kz_unlink("test");
+    printf("--- test prefault ---\n");
+}
+
+static void test_mirror(void) {
+    kz_State  *S, *S1;
+    kz_Context ctx;
+    size_t     buflen = 0, len, i;
+    char      *buf;
+    int        r, round;
+
+    printf("--- test mirror ---\n");
+    for (round = 0; round < 2; ++round) {
+        int flags = round ? KZ_MPSC : 0;
+        kz_unlink("test");
+        S = kz_open("test", KZ_CREATE | KZ_MIRROR | flags | 0666, 8000);
+        assert(S != NULL);
+        len = kz_size(S);
+        assert(len >= 4000 && len % 4096 == 0);
+        S1 = kz_open("test", 0, 0);
+        assert(S1 != NULL);
+        assert(kz_size(S1) == len);
+
+        /* move the tail off the start, then use the whole ring at once */
+        r = kz_write(S, &ctx, 100);
+        assert(r == KZ_OK);
+        kz_commit(&ctx, 100);
+        r = kz_read(S1, &ctx);
+        assert(r == KZ_OK);
+        kz_commit(&ctx, 0);
+        r = kz_write(S, &ctx, len - sizeof(uint32_t));
+        assert(r == KZ_OK);
+        buf = kz_buffer(&ctx, &buflen);
+        assert(buflen >= len - sizeof(uint32_t));
+        for (i = 0; i < len - sizeof(uint32_t); ++i) buf[i] = (char)i;
+        r = kz_commit(&ctx, len - sizeof(uint32_t));
+        assert(r == KZ_OK);
+        r = kz_write(S, &ctx, 1);
+        assert(r == KZ_AGAIN);
+        kz_cancel(&ctx);
+
+        /* the record crosses the end of the ring, but reads contiguously */
+        r = kz_read(S1, &ctx);
+        assert(r == KZ_OK);
+        buf = kz_buffer(&ctx, &buflen);
+        assert(buflen == len - sizeof(uint32_t));
+        for (i = 0; i < buflen; ++i) assert(buf[i] == (char)i);
+        kz_commit(&ctx, 0);
+
+        kz_close(S1);
+        kz_close(S);
+    }
+    kz_unlink("test");
+    printf("--- test mirror ---\n");
+}
+
 static void test_unsplit(void) {
     kz_State  *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
     kz_State  *S1 = kz_shadow(S);
     kz_Context ctx;
-    size_t     buflen = 0, len;
+    size_t     buflen = 0, len;
+    int        r;
+
+    printf("--- test unsplit ---\n");
+    len = kz_size(S);
+    assert(len > 0);
+    r = kz_write(S, &ctx, len - 10);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, len - 10);
+
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK);
+    kz_buffer(&ctx, &buflen);
+    assert(buflen == len - 10);
+    kz_commit(&ctx, len - 10);
+
+    r = kz_write(S, &ctx, 10);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, 10);
+
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK);
+    kz_buffer(&ctx, &buflen);
+    assert(buflen == 10);
+    kz_commit(&ctx, 10);
+
+    kz_close(S);
+    free(S1);
+    printf("--- test unsplit ---\n");
+}
+
+static void test_wrap(void) {
+    kz_State  *S, *S1;
+    kz_Context ctx;
+    size_t     len, buflen;
+    int        r;
+
+    printf("--- test wrap ---\n");
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | 0666, 200);
+    assert(S != NULL);
+    S1 = kz_shadow(S);
+    len = kz_size(S);
+    assert(len == 100);
+    r = kz_write(S, &ctx, len / 2 - 4);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, len / 2 - 4);
+    r = kz_write(S, &ctx, len / 2 - 40);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, len / 2 - 40);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, 0);
+
+    /* wraps around, the tail after the mark must be counted as used */
+    r = kz_write(S, &ctx, 30);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, 30);
+    r = kz_write(S, &ctx, 20);
+    assert(r == KZ_AGAIN);
+    kz_cancel(&ctx);
+    r = kz_write(S, &ctx, 8);
+    assert(r == KZ_OK);
+    kz_buffer(&ctx, &buflen);
+    assert(buflen == 12);
+    kz_commit(&ctx, 8);
+
+    r = kz_readv(S1, &ctx, 1, 0);
+    assert(r == 1);
+    kz_commit(&ctx, 0);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, 0);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK);
+    kz_commit(&ctx, 0);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_AGAIN);
+    kz_cancel(&ctx);
+
+    kz_close(S);
+    free(S1);
+    kz_unlink("test");
+    printf("--- test wrap ---\n");
+}
+
+static void test_readv(void) {
+    kz_State  *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    kz_State  *S1 = kz_shadow(S);
+    kz_Context ctx, ctxs[8];
+    size_t     buflen;
+    char      *buf;
+    int        i, r, round;
+
+    printf("--- test readv ---\n");
+    r = kz_readv(S1, ctxs, 8, 0);
+    assert(r == KZ_AGAIN);
+    r = kz_waitcontext(&ctxs[0], 10);
+    assert(r == KZ_TIMEOUT);
+    kz_cancel(&ctxs[0]);
+
+    for (round = 0; round < 20; ++round) {
+        for (i = 0; i < 5; ++i) {
+            r = kz_write(S, &ctx, 37 + i);
+            assert(r == KZ_OK);
+            buf = kz_buffer(&ctx, NULL);
+            memset(buf, 'a' + i, 37 + i);
+            kz_commit(&ctx, 37 + i);
+        }
+        r = kz_readv(S1, ctxs, 8, 37 * 3 + 3);
+        assert(r == 3);
+        for (i = 0; i < r; ++i) {
+            buf = kz_buffer(&ctxs[i], &buflen);
+            assert(buflen == (size_t)(37 + i));
+            assert(buf[0] == 'a' + i && buf[buflen - 1] == 'a' + i);
+        }
+        assert(kz_read(S1, &ctx) == KZ_BUSY);
+        r = kz_commitv(ctxs, 2);
+        assert(r == KZ_OK);
+
+        r = kz_readv(S1, ctxs, 8, 0);
+        assert(r == 3);
+        for (i = 0; i < r; ++i) {
+            buf = kz_buffer(&ctxs[i], &buflen);
+            assert(buflen == (size_t)(39 + i));
+            assert(buf[0] == 'c' + i);
+        }
+        r = kz_commitv(ctxs, r);
+        assert(r == KZ_OK);
+        r = kz_read(S1, &ctx);
+        assert(r == KZ_AGAIN);
+        kz_cancel(&ctx);
+    }
+
+    kz_close(S);
+    free(S1);
+    printf("--- test readv ---\n");
+}
+
+static void test_cursor(void) {
+    int        flags[3] = {0, KZ_MPSC, KZ_INDEXED | KZ_TIMESTAMP};
+    kz_Context ctx, cur, chosen;
+    kz_Stats   st;
+    size_t     buflen;
+    char      *buf;
+    int        f, i, r, round;
+
+    printf("--- test cursor ---\n");
+    for (f = 0; f < 3; ++f) {
+        int       oflags = KZ_CREATE | KZ_RESET | flags[f] | 0666;
+        kz_State *S, *S1;
+        kz_unlink("test");
+        S = kz_open("test", oflags, 1024);
+        assert(S != NULL);
+        S1 = kz_shadow(S);
+        for (round = 0; round < 20; ++round) {
+            for (i = 0; i < 4; ++i) {
+                r = kz_write(S, &ctx, 41 + i);
+                assert(r == KZ_OK);
+                memset(kz_buffer(&ctx, NULL), 'a' + i, 41 + i);
+                r = kz_commit(&ctx, 41 + i);
+                assert(r == KZ_OK);
+            }
+            r = kz_write(S, &ctx, 10); /* pending ones end the walk */
+            assert(r == KZ_OK);
+            if (!(flags[f] & KZ_MPSC)) kz_cancel(&ctx);
+
+            r = kz_peek(S1, &cur);
+            assert(r == KZ_OK);
+            assert(kz_next(&ctx) == KZ_INVALID);
+            for (i = 0; i < 4; ++i) {
+                buf = kz_buffer(&cur, &buflen);
+                assert(buflen == (size_t)(41 + i) && buf[0] == 'a' + i);
+                if (i == 2) chosen = cur;
+                r = kz_next(&cur);
+                assert(r == (i < 3 ? KZ_OK : KZ_AGAIN));
+            }
+            r = kz_commit(&chosen, 0); /* consumes the first three */
+            assert(r == KZ_OK);
+            if ((flags[f] & KZ_MPSC)) kz_cancel(&ctx);
+
+            r = kz_read(S1, &ctx);
+            assert(r == KZ_OK);
+            buf = kz_buffer(&ctx, &buflen);
+            assert(buflen == 44 && buf[0] == 'd');
+            r = kz_next(&ctx);
+            assert(r == KZ_AGAIN);
+            r = kz_commit(&ctx, 0);
+            assert(r == KZ_OK);
+        }
+        r = kz_stats(S, &st);
+        assert(r == KZ_OK && st.write.pops == 80);
+        assert(st.write.pop_bytes == 20 * (41 + 42 + 43 + 44));
+        if ((flags[f] & KZ_TIMESTAMP)) {
+            kz_Histogram hist;
+            r = kz_histogram(S, KZ_WRITE, &hist);
+            assert(r == KZ_OK && hist.count == 80);
+        }
+        kz_close(S);
+        free(S1);
+    }
+    kz_unlink("test");
+    printf("--- test cursor ---\n");
+}
+
+#define WRITEV_ROUNDS 1000
+
+static void *writev_reader(void *ud) {
+    kz_State  *S1 = (kz_State *)ud;
+    kz_Context ctx;
+    size_t     i, len, size = kz_size(S1);
+    char      *buf;
+    int        r;
+    usleep(20000); /* let the writer wait on its second batch */
+    for (i = 0; i < WRITEV_ROUNDS * 2; ++i) {
+        r = kz_read(S1, &ctx);
+        if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, -1);
+        assert(r == KZ_OK);
+        buf = kz_buffer(&ctx, &len);
+        assert(len == (i % 2 ? size * 3 / 10 : size / 4 + 8));
+        assert(buf[0] == (char)i && buf[len - 1] == (char)i);
+        r = kz_commit(&ctx, len);
+        assert(r == KZ_OK);
+    }
+    return NULL;
+}
+
+static void writev_batches(kz_State *S, kz_State *S1) {
+    /* every batch takes more than half of the queue, so it waits for the
+     * reader; the wait reserves nothing, the batch fits once drained */
+    kz_Context ctxs[2];
+    kz_Thread  t;
+    kz_Stats   st;
+    size_t     lens[2], size = kz_size(S), i, waits = 0;
+    int        r;
+    lens[0] = size / 4 + 8, lens[1] = size * 3 / 10;
+    r = kzT_spawn(&t, writev_reader, S1);
+    assert(r == 0);
+    for (i = 0; i < WRITEV_ROUNDS * 2; i += 2) {
+        while ((r = kz_writev(S, ctxs, lens, 2)) == KZ_AGAIN) {
+            r = kz_waitcontext(&ctxs[0], -1);
+            assert(r == KZ_OK && kz_buffer(&ctxs[0], NULL) == NULL);
+            assert(ctxs[0].result == KZ_AGAIN); /* still pending */
+            kz_cancel(&ctxs[0]);
+            ++waits;
+        }
+        assert(r == KZ_OK);
+        memset(kz_buffer(&ctxs[0], NULL), (char)i, lens[0]);
+        memset(kz_buffer(&ctxs[1], NULL), (char)(i + 1), lens[1]);
+        r = kz_commitv(ctxs, 2);
+        assert(r == KZ_OK);
+    }
+    kzT_join(t, NULL);
+    assert(waits > 0);
+    r = kz_stats(S, &st);
+    assert(r == KZ_OK && st.write.used == 0);
+    assert(st.write.pushes == st.write.pops);
+}
+
+static void test_writev(void) {
+    kz_State  *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    kz_State  *S1 = kz_shadow(S);
+    kz_Context ctx, ctxs[8];
+    size_t     lens[8], buflen = 0, size = kz_size(S);
+    char      *buf;
+    int        i, r, round;
+
+    printf("--- test writev ---\n");
+    lens[0] = size;
+    r = kz_writev(S, ctxs, lens, 1);
+    assert(r == KZ_TOOBIG);
+    for (round = 0; round < 30; ++round) {
+        for (i = 0; i < 8; ++i) lens[i] = 13 + round + i;
+        r = kz_writev(S, ctxs, lens, 8);
+        assert(r == KZ_OK);
+        for (i = 0; i < 8; ++i) {
+            buf = kz_buffer(&ctxs[i], &buflen);
+            assert(buflen == lens[i]);
+            memset(buf, 'a' + i, buflen);
+        }
+        r = kz_read(S1, &ctx);
+        assert(r == KZ_AGAIN); /* nothing visible before commit */
+        kz_cancel(&ctx);
+        r = kz_commitv(ctxs, 8);
+        assert(r == KZ_OK);
+
+        r = kz_readv(S1, ctxs, 8, 0);
+        assert(r == 8);
+        for (i = 0; i < 8; ++i) {
+            buf = kz_buffer(&ctxs[i], &buflen);
+            assert(buflen == lens[i]);
+            assert(buf[0] == 'a' + i && buf[buflen - 1] == 'a' + i);
+        }
+        r = kz_commitv(ctxs, 8);
+        assert(r == KZ_OK);
+    }
+
+    writev_batches(S, S1);
+
+    /* fill the queue, then wait on the whole batch */
+    for (;;) {
+        r = kz_write(S, &ctx, 100);
+        if (r == KZ_AGAIN) break;
+        kz_commit(&ctx, 100);
+    }
+    kz_cancel(&ctx);
+    lens[0] = lens[1] = 100;
+    r = kz_writev(S, ctxs, lens, 2);
+    assert(r == KZ_AGAIN);
+    r = kz_waitcontext(&ctxs[0], 10);
+    assert(r == KZ_TIMEOUT);
+    kz_cancel(&ctxs[0]);
+
+    kz_close(S);
+    free(S1);
+    printf("--- test writev ---\n");
+}
+
+#define CHUNK_TOTAL 20000
+
+static void *chunk_writer(void *ud) {
+    kz_State  *S = (kz_State *)ud;
+    kz_Context ctx;
+    size_t     i, n, off, chunk = kz_chunksize(S);
+    char      *buf;
+    int        r;
+    for (off = 0; off < CHUNK_TOTAL; off += n) {
+        n = CHUNK_TOTAL - off < chunk ? CHUNK_TOTAL - off : chunk;
+        r = kz_write(S, &ctx, n);
+        if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, -1);
+        assert(r == KZ_OK);
+        buf = kz_buffer(&ctx, NULL);
+        for (i = 0; i < n; ++i) buf[i] = (char)((off + i) * 7);
+        r = kz_commitchunk(&ctx, n, off + n < CHUNK_TOTAL);
+        assert(r == KZ_OK);
+    }
+    return NULL;
+}
+
+static void test_chunks(void) {
+    kz_State  *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    kz_State  *S1 = kz_shadow(S);
+    kz_Context ctx, ctxs[8];
+    kz_Thread  t;
+    size_t     i, len, total = 0, chunks = 0, chunk = kz_chunksize(S);
+    char      *buf;
+    int        r, more = 1;
+
+    printf("--- test chunks ---\n");
+    assert(chunk > 0 && chunk < kz_size(S) / 2);
+    assert(kz_write(S, &ctx, kz_size(S)) == KZ_TOOBIG);
+
+    /* the reader reassembles a message larger than the queue */
+    r = kzT_spawn(&t, chunk_writer, S);
+    assert(r == 0);
+    while (more) {
+        r = kz_read(S1, &ctx);
+        if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, -1);
+        assert(r == KZ_OK);
+        more = kz_more(&ctx);
+        buf = kz_buffer(&ctx, &len);
+        assert(len == chunk || !more);
+        for (i = 0; i < len; ++i) assert(buf[i] == (char)((total + i) * 7));
+        total += len, ++chunks;
+        assert(kz_commit(&ctx, 0) == KZ_OK);
+    }
+    kzT_join(t, NULL);
+    assert(total == CHUNK_TOTAL && chunks == (total + chunk - 1) / chunk);
+
+    /* chunks are plain records for batches, and commits of reads */
+    r = kz_write(S, &ctx, 3);
+    assert(r == KZ_OK && kz_commitchunk(&ctx, 3, 1) == KZ_OK);
+    r = kz_write(S, &ctx, 2);
+    assert(r == KZ_OK && kz_commitchunk(&ctx, 2, 0) == KZ_OK);
+    r = kz_readv(S1, ctxs, 8, 0);
+    assert(r == 2 && kz_more(&ctxs[0]) && !kz_more(&ctxs[1]));
+    assert(kz_commitchunk(&ctxs[0], 0, 0) == KZ_INVALID);
+    kz_buffer(&ctxs[0], &len);
+    assert(len == 3);
+    assert(kz_commitv(ctxs, 2) == KZ_OK);
+    kz_close(S);
+    free(S1);
+
+    /* the chunks of `KZ_MPSC` writers would interleave */
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_MPSC | 0666, 1024);
+    assert(S != NULL);
+    S1 = kz_shadow(S);
+    r = kz_write(S, &ctx, 3);
+    assert(r == KZ_OK && kz_commitchunk(&ctx, 3, 1) == KZ_INVALID);
+    assert(kz_commitchunk(&ctx, 3, 0) == KZ_OK);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK && !kz_more(&ctx));
+    assert(kz_commit(&ctx, 0) == KZ_OK);
+    kz_close(S);
+    free(S1);
+    printf("--- test chunks ---\n");
+}
+
+#define MPSC_WRITERS 4
+#define MPSC_COUNT   2000
+
+typedef struct MpscWriter {
+    kz_State *S;
+    uint32_t  id;
+} MpscWriter;
+
+static void test_arena(void) {
+    kz_State  *S, *U;
+    kz_Context ctx;
+    kz_Block   blks[5], blk;
+    size_t     buflen;
+    char      *data;
+    int        i, r;
+
+    printf("--- test arena ---\n");
+    kz_unlink("test");
+    S = kz_openarena("test", KZ_CREATE | KZ_MIRROR | 0666, 1024, 100, 4);
+    assert(S == NULL && errno == EINVAL);
+    S = kz_openarena("test", KZ_CREATE | 0666, 1024, 100, 36);
+    assert(S != NULL);
+    assert(kz_blocksize(S) == 128);
+    assert(kz_size(S) >= 480 && kz_size(S) <= 512);
+    assert(kz_resize(S, 4096) == KZ_INVALID);
+    U = kz_open("test", 0, 0);
+    assert(U != NULL && kz_blocksize(U) == 128);
+
+    /* all the blocks, even across the bitmap words, then none is left */
+    for (i = 0; i < 36; ++i) {
+        r = kz_alloc(i % 2 ? U : S, &blk);
+        assert(r == KZ_OK && blk.offset % 128 == 0 && blk.len == 0);
+        if (i < 5) blks[i] = blk;
+    }
+    r = kz_alloc(S, &blk);
+    assert(r == KZ_AGAIN);
+
+    /* only the descriptor goes through the queue */
+    data = kz_blockdata(S, &blks[0]);
+    assert(data != NULL);
+    memset(data, 'x', 128);
+    blks[0].len = 128;
+    r = kz_write(S, &ctx, sizeof(kz_Block));
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), &blks[0], sizeof(kz_Block));
+    r = kz_commit(&ctx, sizeof(kz_Block));
+    assert(r == KZ_OK);
+    r = kz_read(U, &ctx);
+    assert(r == KZ_OK);
+    memcpy(&blk, kz_buffer(&ctx, &buflen), sizeof(kz_Block));
+    assert(buflen == sizeof(kz_Block));
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+    data = kz_blockdata(U, &blk);
+    assert(data != NULL && data == kz_blockdata(U, &blks[0]));
+    assert(blk.len == 128 && data[0] == 'x' && data[127] == 'x');
+    r = kz_free(U, &blk);
+    assert(r == KZ_OK);
+
+    /* freed descriptors are stale */
+    assert(kz_blockdata(U, &blk) == NULL);
+    r = kz_free(S, &blk);
+    assert(r == KZ_INVALID);
+    blk.offset += 1;
+    assert(kz_blockdata(S, &blk) == NULL);
+    r = kz_alloc(S, &blk);
+    assert(r == KZ_OK);
+    assert(blk.offset == blks[0].offset && blk.gen == blks[0].gen + 1);
+    r = kz_alloc(S, &blk);
+    assert(r == KZ_AGAIN);
+
+    kz_close(U);
+    kz_close(S);
+    r = kz_alloc(NULL, &blk);
+    assert(r == KZ_CLOSED);
+    S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    assert(S != NULL && kz_blocksize(S) == 0);
+    r = kz_alloc(S, &blk);
+    assert(r == KZ_INVALID);
+    kz_close(S);
+    kz_unlink("test");
+    printf("--- test arena ---\n");
+}
+
+static void test_slots(void) {
+    kz_State  *S, *U;
+    kz_Context ctx, ctxs[15];
+    size_t     lens[15], buflen, i, n;
+    char       out[15 * 32], in[15 * 32], *p;
+    int        r, round;
+
+    printf("--- test slots ---\n");
+    kz_unlink("test");
+    S = kz_openslots("test", KZ_CREATE | KZ_MPSC | 0666, 1000, 30);
+    assert(S == NULL && errno == EINVAL);
+    S = kz_openslots("test", KZ_CREATE | 0666, 1000, 0);
+    assert(S == NULL && errno == EINVAL);
+    S = kz_openslots("test", KZ_CREATE | 0666, 1000, 501);
+    assert(S == NULL && errno == EINVAL);
+    S = kz_openslots("test", KZ_CREATE | KZ_RESIZABLE | 0666, 1000, 30);
+    assert(S != NULL);
+    assert(kz_slotsize(S) == 32 && kz_size(S) == 480);
+    assert(kz_chunksize(S) == 0);
+    U = kz_open("test", 0, 0);
+    assert(U != NULL && kz_slotsize(U) == 32 && kz_size(U) == 480);
+
+    /* a message takes a whole slot, and is read as one */
+    r = kz_write(S, &ctx, 33);
+    assert(r == KZ_TOOBIG);
+    r = kz_write(S, &ctx, 10);
+    assert(r == KZ_OK);
+    p = kz_buffer(&ctx, &buflen);
+    assert(p != NULL && buflen == 32);
+    memcpy(p, "0123456789", 10);
+    assert(kz_commitchunk(&ctx, 10, 1) == KZ_INVALID);
+    r = kz_commit(&ctx, 33);
+    assert(r == KZ_INVALID);
+    r = kz_commit(&ctx, 10);
+    assert(r == KZ_OK);
+    r = kz_read(U, &ctx);
+    assert(r == KZ_OK && kz_more(&ctx) == 0);
+    p = kz_buffer(&ctx, &buflen);
+    assert(buflen == 32 && memcmp(p, "0123456789", 10) == 0);
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+
+    /* batches of all the slots, wrapped at a different one every round,
+     * moved by a `memcpy()` for each side of the wrap */
+    for (i = 0; i < sizeof(out); ++i) out[i] = (char)i;
+    for (round = 0; round < 15; ++round) {
+        for (i = 0; i < 15; ++i) lens[i] = i % 2 ? 32 : 1;
+        r = kz_writev(S, ctxs, lens, 15);
+        assert(r == KZ_OK);
+        p = kz_buffer(&ctxs[0], NULL);
+        for (n = 1; n < 15 && kz_buffer(&ctxs[n], NULL) == p + n * 32;) ++n;
+        assert(n == (size_t)(15 - (round + 1) % 15));
+        memcpy(p, out, n * 32);
+        if (n < 15) /* the rest from the start of the ring */
+            memcpy(kz_buffer(&ctxs[n], NULL), out + n * 32, (15 - n) * 32);
+        r = kz_commitv(ctxs, 15);
+        assert(r == KZ_OK);
+        r = kz_write(S, &ctx, 1);
+        assert(r == KZ_AGAIN);
+        kz_cancel(&ctx);
+
+        r = kz_readv(U, ctxs, 15, 0);
+        assert(r == 15);
+        for (i = 0; i < 15; ++i) {
+            assert(kz_buffer(&ctxs[i], &buflen) != NULL && buflen == 32);
+            memcpy(in + i * 32, kz_buffer(&ctxs[i], NULL), 32);
+        }
+        assert(memcmp(in, out, sizeof(out)) == 0);
+        r = kz_commitv(ctxs, 15);
+        assert(r == KZ_OK);
+
+        /* move the ring on by one slot */
+        r = kz_write(S, &ctx, 4);
+        assert(r == KZ_OK);
+        r = kz_commit(&ctx, 4);
+        assert(r == KZ_OK);
+        r = kz_read(U, &ctx);
+        assert(r == KZ_OK);
+        r = kz_commit(&ctx, 0);
+        assert(r == KZ_OK);
+    }
+
+    /* a resize keeps the queues in whole slots */
+    r = kz_resize(S, 2000);
+    assert(r == KZ_OK);
+    assert(kz_size(S) % 32 == 0 && kz_size(S) > 480);
+    r = kz_write(U, &ctx, 32);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 32);
+    assert(r == KZ_OK);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+
+    kz_close(U);
+    kz_close(S);
+    kz_unlink("test");
+    printf("--- test slots ---\n");
+}
+
+#define BCAST_COUNT 2000
+
+static void *bcast_reader(void *ud) {
+    kz_Bcast *B = (kz_Bcast *)ud;
+    uint32_t  i, n;
+    size_t    len;
+    char      buf[64];
+    for (i = 0; i < BCAST_COUNT;) {
+        int r = kz_bcrecv(B, buf, (len = sizeof(buf), &len));
+        if (r == KZ_AGAIN) {
+            r = kz_bcwait(B, 0, -1);
+            assert(r == KZ_OK);
+            continue;
+        }
+        assert(r == KZ_OK);
+        memcpy(&n, buf, sizeof(n));
+        assert(n == i && len == sizeof(n) + i % 40);
+        ++i;
+    }
+    assert(kz_bcrecv(B, buf, (len = sizeof(buf), &len)) == KZ_AGAIN);
+    return NULL;
+}
+
+static void test_broadcast(void) {
+    kz_Bcast      *W, *Rs[3];
+    kzB_ShmCursor *slow;
+    kz_Thread      ts[2];
+    size_t         len;
+    char           buf[64], msg[64];
+    uint32_t       i;
+    int            r;
+
+    printf("--- test broadcast ---\n");
+    kz_unlink("test");
+    assert(kz_bcopen("test", 0, 0, 0) == NULL && errno == ENOENT);
+    assert(kz_bcopen("test", KZ_CREATE | 0666, 64, 0) == NULL);
+    W = kz_bcopen("test", KZ_CREATE | 0666, 64, 2);
+    assert(W != NULL && kz_bcreaders(W) == 0);
+    Rs[0] = kz_bcopen("test", 0, 0, 0);
+    Rs[1] = kz_bcopen("test", 0, 0, 0);
+    assert(Rs[0] != NULL && Rs[1] != NULL && kz_bcreaders(W) == 2);
+    assert(kz_bcopen("test", 0, 0, 0) == NULL && errno == EBUSY);
+    assert(kz_bcrecv(W, buf, &len) == KZ_INVALID);
+    assert(kz_bcsend(Rs[0], "x", 1) == KZ_INVALID);
+    assert(kz_bcsend(W, msg, 64) == KZ_TOOBIG);
+
+    /* every reader gets every message */
+    assert(kz_bcsend(W, "hello", 5) == KZ_OK);
+    for (i = 0; i < 2; ++i) {
+        len = 2;
+        assert(kz_bcrecv(Rs[i], buf, &len) == KZ_TOOBIG && len == 5);
+        assert(kz_bcrecv(Rs[i], buf, &len) == KZ_OK);
+        assert(len == 5 && memcmp(buf, "hello", 5) == 0);
+        assert(kz_bcrecv(Rs[i], buf, &len) == KZ_AGAIN);
+        assert(kz_bcwait(Rs[i], 0, 0) == KZ_TIMEOUT);
+    }
+
+    /* the slowest reader holds the writer */
+    for (i = 0; (r = kz_bcsend(W, msg, 12)) == KZ_OK; ++i)
+        assert(kz_bcrecv(Rs[0], buf, (len = sizeof(buf), &len)) == KZ_OK);
+    assert(r == KZ_AGAIN && i == 3 && kz_bcwait(W, 12, 0) == KZ_TIMEOUT);
+    assert(kz_bcrecv(Rs[1], buf, (len = sizeof(buf), &len)) == KZ_OK);
+    assert(kz_bcwait(W, 12, 0) == KZ_OK && kz_bcsend(W, msg, 12) == KZ_OK);
+
+    /* leaving frees the writer, a new reader starts at the tail */
+    kz_bcclose(Rs[1]);
+    assert(kz_bcreaders(W) == 1 && kz_bcsend(W, "new", 3) == KZ_OK);
+    Rs[1] = kz_bcopen("test", 0, 0, 0);
+    assert(Rs[1] != NULL && kz_bcreaders(W) == 2);
+    assert(kz_bcrecv(Rs[1], buf, (len = sizeof(buf), &len)) == KZ_AGAIN);
+    for (i = 0; kz_bcrecv(Rs[0], buf, (len = sizeof(buf), &len)) == KZ_OK;)
+        i = len == 3 && memcmp(buf, "new", 3) == 0;
+    assert(i == 1);
+
+    /* blocking writer across many wraps, readers in their own threads */
+    for (i = 0; i < 2; ++i) assert(kzT_spawn(&ts[i], bcast_reader, Rs[i]) == 0);
+    for (i = 0; i < BCAST_COUNT; ++i) {
+        memcpy(msg, &i, sizeof(i));
+        while ((r = kz_bcsend(W, msg, sizeof(i) + i % 40)) == KZ_AGAIN)
+            kz_bcwait(W, sizeof(i) + i % 40, -1);
+        assert(r == KZ_OK);
+    }
+    for (i = 0; i < 2; ++i) kzT_join(ts[i], NULL);
+
+    /* readers drain the ring after the writer closes */
+    assert(kz_bcsend(W, "bye", 3) == KZ_OK);
+    kz_bcclose(W);
+    assert(kz_bcrecv(Rs[0], buf, (len = sizeof(buf), &len)) == KZ_OK);
+    assert(kz_bcrecv(Rs[0], buf, (len = sizeof(buf), &len)) == KZ_CLOSED);
+    assert(kz_bcwait(Rs[0], 0, -1) == KZ_CLOSED);
+    kz_bcclose(Rs[0]);
+    kz_bcclose(Rs[1]);
+
+    /* a `KZ_DROP` writer overruns the lagging reader, which is told */
+    assert(kz_bcopen("test", KZ_CREATE | KZ_MPSC | 0666, 64, 3) == NULL);
+    assert(errno == EINVAL);
+    W = kz_bcopen("test", KZ_CREATE | KZ_RESET | KZ_DROP | 0666, 64, 3);
+    assert(W != NULL);
+    Rs[0] = kz_bcopen("test", 0, 0, 0);
+    Rs[1] = kz_bcopen("test", 0, 0, 0);
+    assert(Rs[0] != NULL && Rs[1] != NULL);
+    for (i = 0; i < 20; ++i) {
+        memcpy(msg, &i, sizeof(i));
+        assert(kz_bcsend(W, msg, 4 + i % 9) == KZ_OK);
+        assert(kz_bcrecv(Rs[0], buf, (len = sizeof(buf), &len)) == KZ_OK);
+        assert(len == 4 + i % 9 && memcmp(buf, &i, sizeof(i)) == 0);
+    }
+    assert(kz_bcdropped(Rs[0]) == 0 && kz_bcdropped(W) == 0);
+    assert(kz_bcrecv(Rs[1], buf, (len = sizeof(buf), &len)) == KZ_DROPPED);
+    assert(kz_bcdropped(Rs[1]) > 0);
+    assert(kz_bcrecv(Rs[1], buf, (len = sizeof(buf), &len)) == KZ_OK);
+    memcpy(&i, buf, sizeof(i));
+    assert(i > 0 && i < 19 && len == 4 + i % 9);
+    while ((r = kz_bcrecv(Rs[1], buf, (len = sizeof(buf), &len))) == KZ_OK) {
+        ++i;
+        assert(len == 4 + i % 9 && memcmp(buf, &i, sizeof(i)) == 0);
+    }
+    assert(r == KZ_AGAIN && i == 19);
+
+    /* the slot of a reader gone without leaving is taken over */
+    Rs[2] = kz_bcopen("test", 0, 0, 0);
+    assert(Rs[2] != NULL && kz_bcopen("test", 0, 0, 0) == NULL);
+    Rs[2]->cursor->pid = 0x7FFFFFF0; /* no such process, and gone */
+    munmap(Rs[2]->hdr, Rs[2]->shm_size);
+    close(Rs[2]->shm_fd);
+    free(Rs[2]);
+    assert(kz_bcreaders(W) == 3);
+    Rs[2] = kz_bcopen("test", 0, 0, 0);
+    assert(Rs[2] != NULL && kz_bcreaders(W) == 3);
+    assert(kz_bcdropped(Rs[2]) == 0);
+
+    /* a slot being joined is neither taken nor holds the writer back */
+    Rs[2]->cursor->pid = KZ_JOINING;
+    Rs[2]->cursor->head = 0;
+    assert(kz_bcopen("test", 0, 0, 0) == NULL && errno == EBUSY);
+    assert(kzB_minhead(W, &slow) == W->hdr->tail && slow == NULL);
+    Rs[2]->cursor->pid = (uint32_t)getpid();
+    kz_bcclose(Rs[2]);
+    kz_bcclose(Rs[1]);
+    kz_bcclose(Rs[0]);
+    kz_bcclose(W);
+    kz_unlink("test");
+    printf("--- test broadcast ---\n");
+}
+
+#define DIR_THREADS 4
+
+static void *dir_creator(void *ud) {
+    kz_Dir   *D = (kz_Dir *)ud;
+    kz_State *Ss[8];
+    char      name[8];
+    int       i;
+    for (i = 0; i < 8; ++i) {
+        snprintf(name, sizeof(name), "ch%d", i);
+        Ss[i] = kz_openat(D, name, KZ_CREATE, 256);
+        assert(Ss[i] != NULL && kz_size(Ss[i]) >= 96);
+    }
+    for (i = 0; i < 8; ++i) kz_close(Ss[i]);
+    return NULL;
+}
+
+static void test_directory(void) {
+    kz_Dir       *D, *D2;
+    kz_State     *S, *U, *S2;
+    kz_Thread     ts[DIR_THREADS];
+    kz_Context    ctx;
+    kzD_ShmEntry *e;
+    size_t        buflen;
+    uint32_t      i, n;
+    char          name[8];
+    int           r;
+
+    printf("--- test directory ---\n");
+    kz_unlink("test");
+    assert(kz_opendir("test", 0, 0, 0) == NULL && errno == ENOENT);
+    D = kz_opendir("test", KZ_CREATE | 0666, 64, 4);
+    assert(D == NULL && errno == EINVAL);
+    D = kz_opendir("test", KZ_CREATE | 0666, 16384, 16);
+    assert(D != NULL);
+    assert(kz_openat(D, "a", 0, 0) == NULL && errno == ENOENT);
+    S = kz_openat(D, "a", KZ_CREATE | KZ_MIRROR, 1024);
+    assert(S == NULL && errno == EINVAL);
+    S = kz_openat(D, "0123456789012345678901234567890123456789012345678901",
+                  KZ_CREATE, 1024);
+    assert(S == NULL && errno == ENAMETOOLONG);
+    S = kz_openat(D, "a", KZ_CREATE, 1024);
+    assert(S != NULL && kz_isowner(S) == 1 && kz_size(S) >= 480);
+    assert(strcmp(kz_name(S), "a") == 0 && kz_resize(S, 2048) == KZ_INVALID);
+    S2 = kz_openat(D, "a", KZ_CREATE | KZ_EXCL, 1024);
+    assert(S2 == NULL && errno == EEXIST);
+
+    /* another mapping of the directory attaches the same channel */
+    D2 = kz_opendir("test", 0, 0, 0);
+    assert(D2 != NULL);
+    U = kz_openat(D2, "a", 0, 0);
+    kz_closedir(D2); /* the channel keeps it mapped */
+    assert(U != NULL && kz_isowner(U) == 0 && kz_size(U) == kz_size(S));
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), "hello", 5);
+    assert(kz_commit(&ctx, 5) == KZ_OK);
+    r = kz_read(U, &ctx);
+    assert(r == KZ_OK);
+    assert(memcmp(kz_buffer(&ctx, &buflen), "hello", 5) == 0 && buflen == 5);
+    assert(kz_commit(&ctx, 0) == KZ_OK);
+
+    /* channels are apart from each other */
+    S2 = kz_openat(D, "b", KZ_CREATE | KZ_INDEXED, 512);
+    assert(S2 != NULL && kz_size(S2) < kz_size(S));
+    r = kz_write(S2, &ctx, 5);
+    assert(r == KZ_OK && kz_commit(&ctx, 5) == KZ_OK);
+    assert(kz_read(U, &ctx) == KZ_AGAIN);
+    kz_close(S2);
+
+    /* creators of the same names at once end up with one channel each */
+    for (i = 0; i < DIR_THREADS; ++i)
+        assert(kzT_spawn(&ts[i], dir_creator, D) == 0);
+    for (i = 0; i < DIR_THREADS; ++i) kzT_join(ts[i], NULL);
+    e = (kzD_ShmEntry *)(D->hdr + 1);
+    for (i = 0, n = 0; i < D->hdr->count; ++i) n += e[i].hash != 0;
+    assert(n == 10);
+
+    /* until there is no room, or no slot left */
+    S2 = kz_openat(D, "big", KZ_CREATE, 16384);
+    assert(S2 == NULL && errno == ENOSPC);
+    for (i = n; i < 16; ++i) {
+        snprintf(name, sizeof(name), "x%u", (unsigned)i);
+        S2 = kz_openat(D, name, KZ_CREATE, 64);
+        assert(S2 != NULL);
+        kz_close(S2);
+    }
+    S2 = kz_openat(D, "y", KZ_CREATE, 64);
+    assert(S2 == NULL && errno == ENOSPC);
+    S2 = kz_openat(D, "b", 0, 0);
+    assert(S2 != NULL && kz_isowner(S2) == 0);
+    kz_close(S2);
+
+    kz_closedir(D);
+    kz_close(U);
+    kz_close(S);
+    kz_unlink("test");
+    printf("--- test directory ---\n");
+}
+
+static void test_stats(void) {
+    kz_State  *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    kz_State  *S1 = kz_shadow(S);
+    kz_Context ctx, ctxs[8];
+    kz_Stats   st, st1;
+    size_t     lens[2] = {10, 20};
+    uint64_t   n;
+    int        r;
+
+    printf("--- test stats ---\n");
+    assert(kz_stats(NULL, &st) == KZ_INVALID);
+    r = kz_stats(S, &st);
+    assert(r == KZ_OK);
+    assert(st.write.pushes == 0 && st.write.pops == 0 && st.write.peak == 0);
+    assert(st.write.size == kz_size(S) && st.read.size == kz_size(S));
+    assert(st.write.used == 0 && st.read.used == 0);
+
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_AGAIN);
+    assert(kz_read(S1, &ctxs[0]) == KZ_BUSY);
+    r = kz_waitcontext(&ctx, 10);
+    assert(r == KZ_TIMEOUT);
+    kz_cancel(&ctx);
+
+    r = kz_writev(S, ctxs, lens, 2);
+    assert(r == KZ_OK);
+    r = kz_commitv(ctxs, 2);
+    assert(r == KZ_OK);
+    r = kz_write(S, &ctx, 30);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 30);
+    assert(r == KZ_OK);
+    for (n = 0; (r = kz_write(S, &ctx, 100)) == KZ_OK; ++n)
+        kz_commit(&ctx, 100);
+    assert(r == KZ_AGAIN);
+    kz_cancel(&ctx);
+    r = kz_readv(S1, ctxs, 8, 0);
+    assert(r == (int)n + 3);
+    r = kz_commitv(ctxs, 3);
+    assert(r == KZ_OK);
+
+    r = kz_stats(S, &st);
+    assert(r == KZ_OK);
+    assert(st.write.pushes == n + 3 && st.write.push_bytes == n * 100 + 60);
+    assert(st.write.pops == 3 && st.write.pop_bytes == 60);
+    assert(st.write.push_again == 1 && st.write.push_busy == 0);
+    assert(st.write.peak <= st.write.size);
+    assert(st.write.peak + 104 > st.write.size);
+    assert(st.write.used == n * 104);
+    assert(st.read.pushes == 0 && st.read.pops == 0);
+
+    /* the peer sees the same queue from the other side */
+    r = kz_stats(S1, &st1);
+    assert(r == KZ_OK);
+    assert(memcmp(&st1.read, &st.write, sizeof(kz_QueueStats)) == 0);
+    assert(st.write.pop_again >= 2 && st.write.pop_busy == 1);
+    assert(st.write.pop_sleeps >= 1);
+
+    kz_close(S);
+    free(S1);
+    printf("--- test stats ---\n");
+}
+
+static void test_timestamp(void) {
+    kz_State    *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    kz_State    *S1 = kz_shadow(S), *S2;
+    kz_Context   ctx, ctxs[8];
+    kz_Histogram h, h1;
+    size_t       i, len, lens[3] = {1, 2, 3};
+    char        *buf;
+    int          r;
+
+    printf("--- test timestamp ---\n");
+    assert(kz_histogram(S, KZ_WRITE, &h) == KZ_INVALID);
+    kz_close(S);
+    free(S1);
+
+    /* every bucket starts at its bound, and they never go backwards */
+    for (i = 0; i < KZ_HISTMAX; ++i) {
+        assert(kz_histbucket(kz_histbound(i)) == i);
+        assert(kz_histbound(i + 1) > kz_histbound(i));
+        assert(kz_histbucket(kz_histbound(i + 1) - 1) == i);
+    }
+    assert(kz_histbucket((uint64_t)-1) == KZ_HISTMAX - 1);
+
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_TIMESTAMP | 0666, 1024);
+    assert(S != NULL);
+    S1 = kz_shadow(S);
+    assert(kz_histogram(S, 0, &h) == KZ_INVALID);
+    r = kz_histogram(S, KZ_WRITE, &h);
+    assert(r == KZ_OK && h.count == 0 && kz_percentile(&h, 0.99) == 0);
+
+    /* a message stays in the queue over a timed out wait */
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), "hello", 5);
+    assert(kz_commit(&ctx, 5) == KZ_OK);
+    assert(kz_read(S, &ctx) == KZ_AGAIN);
+    assert(kz_waitcontext(&ctx, 5) == KZ_TIMEOUT);
+    kz_cancel(&ctx);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_OK);
+    buf = kz_buffer(&ctx, &len);
+    assert(len == 5 && memcmp(buf, "hello", 5) == 0);
+    assert(kz_commit(&ctx, 0) == KZ_OK);
+    r = kz_histogram(S, KZ_WRITE, &h);
+    assert(r == KZ_OK && h.count == 1 && h.sum >= 5000000);
+    assert(kz_percentile(&h, 0.99) > 5000000);
+    assert(kz_percentile(&h, 0.99) <= h.sum * 2);
+    assert(kz_histogram(S1, KZ_READ, &h1) == KZ_OK);
+    assert(memcmp(&h, &h1, sizeof(h)) == 0);
+
+    /* batches and wrapping records keep their stamps */
+    for (i = 0; i < 64; ++i) {
+        r = kz_writev(S, ctxs, lens, 3);
+        assert(r == KZ_OK);
+        assert(kz_commitv(ctxs, 3) == KZ_OK);
+        r = kz_write(S, &ctx, 100 + i);
+        assert(r == KZ_OK);
+        memset(kz_buffer(&ctx, NULL), (int)i, 100 + i);
+        assert(kz_commit(&ctx, 100 + i) == KZ_OK);
+        r = kz_readv(S1, ctxs, 8, 0);
+        assert(r == 4);
+        buf = kz_buffer(&ctxs[3], &len);
+        assert(len == 100 + i && buf[len - 1] == (char)i);
+        assert(kz_commitv(ctxs, 4) == KZ_OK);
+    }
+    r = kz_histogram(S1, KZ_READ, &h);
+    assert(r == KZ_OK && h.count == 1 + 64 * 4);
+    assert(kz_histogram(S1, KZ_WRITE, &h) == KZ_OK && h.count == 0);
+    kz_close(S);
+    free(S1);
+
+    /* `KZ_MPSC` writers stamp their records too */
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_TIMESTAMP | KZ_MPSC | 0666,
+                1024);
+    assert(S != NULL);
+    S2 = kz_open("test", 0, 0);
+    assert(S2 != NULL);
+    r = kz_writev(S2, ctxs, lens, 3);
+    assert(r == KZ_OK);
+    assert(kz_commitv(ctxs, 3) == KZ_OK);
+    r = kz_readv(S, ctxs, 8, 0);
+    assert(r == 3);
+    assert(kz_commitv(ctxs, 3) == KZ_OK);
+    r = kz_histogram(S, KZ_READ, &h);
+    assert(r == KZ_OK && h.count == 3);
+    kz_close(S2);
+    kz_close(S);
+    kz_unlink("test");
+    printf("--- test timestamp ---\n");
+}
+
+static void *mpsc_writer(void *ud) {
+    MpscWriter *w = (MpscWriter *)ud;
+    uint32_t    seq, msg[16];
+    for (seq = 0; seq < MPSC_COUNT; ++seq) {
+        kz_Context ctx;
+        size_t     len = sizeof(uint32_t) * (2 + seq % 14);
+        int        r = kz_write(w->S, &ctx, len);
+        if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, -1);
+        assert(r == KZ_OK);
+        msg[0] = w->id, msg[1] = seq;
+        memcpy(kz_buffer(&ctx, NULL), msg, len);
+        r = kz_commit(&ctx, len);
+        assert(r == KZ_OK);
+    }
+    return NULL;
+}
+
+static void test_mpsc(void) {
+    kz_State  *S, *S1;
+    kz_Context ctx, ctx2, ctxs[4];
+    kz_Thread  ts[MPSC_WRITERS];
+    MpscWriter ws[MPSC_WRITERS];
+    uint32_t   next[MPSC_WRITERS] = {0}, msg[2];
+    size_t     lens[3] = {5, 6, 7}, buflen = 0, i, total;
+    char      *buf;
+    int        r;
+
+    printf("--- test mpsc ---\n");
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | KZ_MPSC | 0666, 1024);
+    assert(S != NULL);
+    S1 = kz_shadow(S);
+
+    /* out of order commits are only visible in order */
+    r = kz_write(S, &ctx, 10);
+    assert(r == KZ_OK);
+    r = kz_write(S, &ctx2, 20);
+    assert(r == KZ_OK);
+    memset(kz_buffer(&ctx2, &buflen), 'b', 20);
+    assert(buflen == 20);
+    r = kz_commit(&ctx2, 20);
+    assert(r == KZ_OK);
+    r = kz_read(S1, &ctxs[0]);
+    assert(r == KZ_AGAIN);
+    kz_cancel(&ctxs[0]);
+    memset(kz_buffer(&ctx, &buflen), 'a', 10);
+    assert(buflen == 10);
+    r = kz_commit(&ctx, 3); /* shrinked, the rest is skipped */
+    assert(r == KZ_OK);
+    r = kz_readv(S1, ctxs, 4, 0);
+    assert(r == 2);
+    buf = kz_buffer(&ctxs[0], &buflen);
+    assert(buflen == 3 && buf[0] == 'a');
+    buf = kz_buffer(&ctxs[1], &buflen);
+    assert(buflen == 20 && buf[19] == 'b');
+    r = kz_commitv(ctxs, 2);
+    assert(r == KZ_OK);
+
+    /* cancelled reservations are dropped by the reader */
+    r = kz_write(S, &ctx, 30);
+    assert(r == KZ_OK);
+    kz_cancel(&ctx);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_AGAIN);
+    kz_cancel(&ctx);
+    r = kz_writev(S, ctxs, lens, 3);
+    assert(r == KZ_OK);
+    for (i = 0; i < 3; ++i) memset(kz_buffer(&ctxs[i], NULL), 'x', lens[i]);
+    r = kz_commitv(ctxs, 3);
+    assert(r == KZ_OK);
+    r = kz_readv(S1, ctxs, 4, 0);
+    assert(r == 3);
+    for (i = 0; i < 3; ++i) {
+        kz_buffer(&ctxs[i], &buflen);
+        assert(buflen == lens[i]);
+    }
+    r = kz_commitv(ctxs, 3);
+    assert(r == KZ_OK);
+
+    /* concurrent writers without any lock */
+    for (i = 0; i < MPSC_WRITERS; ++i) {
+        ws[i].S = S, ws[i].id = (uint32_t)i;
+        r = kzT_spawn(&ts[i], mpsc_writer, &ws[i]);
+        assert(r == 0);
+    }
+    for (total = 0; total < MPSC_WRITERS * MPSC_COUNT; ++total) {
+        r = kz_read(S1, &ctx);
+        if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, -1);
+        assert(r == KZ_OK);
+        buf = kz_buffer(&ctx, &buflen);
+        memcpy(msg, buf, sizeof(msg));
+        assert(msg[0] < MPSC_WRITERS && msg[1] == next[msg[0]]);
+        assert(buflen == sizeof(uint32_t) * (2 + msg[1] % 14));
+        next[msg[0]] += 1;
+        r = kz_commit(&ctx, buflen);
+        assert(r == KZ_OK);
+    }
+    for (i = 0; i < MPSC_WRITERS; ++i) kzT_join(ts[i], NULL);
+    r = kz_read(S1, &ctx);
+    assert(r == KZ_AGAIN);
+    kz_cancel(&ctx);
+
+    /* a pending batch waits for its space without reserving any */
+    writev_batches(S, S1);
+
+    kz_close(S);
+    free(S1);
+    kz_unlink("test");
+    printf("--- test mpsc ---\n");
+}
+
+static void *waitmany_writer(void *ud) {
+    kz_State  *S = (kz_State *)ud;
+    kz_Context ctx;
+    int        r = kz_read(S, &ctx);
+
+    /* let the main thread block first */
+    assert(r == KZ_AGAIN);
+    r = kz_waitcontext(&ctx, 20);
+    assert(r == KZ_TIMEOUT);
+    kz_cancel(&ctx);
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), "hello", 5);
+    r = kz_commit(&ctx, 5);
+    assert(r == KZ_OK);
+    return NULL;
+}
+
+static void test_waitmany(void) {
+    const char *names[3] = {"test", "test1", "test2"};
+    kz_State   *Ss[3], *Us[3];
+    kz_Context  ctx;
+    kz_Thread   t;
+    int         i, r, modes[3];
+
+    printf("--- test waitmany ---\n");
+    for (i = 0; i < 3; ++i) {
+        Ss[i] = kz_open(names[i], KZ_CREATE | KZ_RESET | 0666, 1024);
+        assert(Ss[i] != NULL);
+        Us[i] = kz_shadow(Ss[i]);
+    }
+
+    for (i = 0; i < 3; ++i) modes[i] = KZ_BOTH;
+    r = kz_waitmany(Us, modes, 3, 10, 0);
+    assert(r == 3);
+    for (i = 0; i < 3; ++i) assert(modes[i] == KZ_WRITE);
+    for (i = 0; i < 3; ++i) modes[i] = KZ_READ;
+    r = kz_waitmany(Us, modes, 3, 0, 0);
+    assert(r == 0);
+    r = kz_waitmany(Us, modes, 3, 0, 0);
+    assert(r == KZ_INVALID); /* `modes` are overwritten by readiness */
+    for (i = 0; i < 3; ++i) modes[i] = KZ_READ;
+    r = kz_waitmany(Us, modes, 3, 0, 10);
+    assert(r == KZ_TIMEOUT);
+    for (i = 0; i < 3; ++i) modes[i] = KZ_READ;
+    r = kz_waitmany(Us, modes, 3, kz_size(Us[0]), 0);
+    assert(r == 0); /* no write interest, the length is not checked */
+    modes[0] = KZ_WRITE;
+    r = kz_waitmany(Us, modes, 3, kz_size(Us[0]), 0);
+    assert(r == KZ_TOOBIG);
+
+    /* block until the last channel becomes readable */
+    for (i = 0; i < 3; ++i) modes[i] = KZ_READ;
+    r = kzT_spawn(&t, waitmany_writer, Ss[2]);
+    assert(r == 0);
+    r = kz_waitmany(Us, modes, 3, 0, -1);
+    assert(r == 1);
+    assert(modes[0] == 0 && modes[1] == 0 && modes[2] == KZ_READ);
+    kzT_join(t, NULL);
+    r = kz_read(Us[2], &ctx);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+
+    /* closed channels are ready */
+    kz_shutdown(Ss[1], KZ_WRITE);
+    for (i = 0; i < 3; ++i) modes[i] = KZ_READ;
+    r = kz_waitmany(Us, modes, 3, 0, 100);
+    assert(r == 1 && modes[1] == KZ_READ);
+    r = kz_read(Us[1], &ctx);
+    assert(r == KZ_CLOSED);
+
+    for (i = 0; i < 3; ++i) {
+        kz_close(Ss[i]);
+        free(Us[i]);
+        if (i > 0) kz_unlink(names[i]);
+    }
+    printf("--- test waitmany ---\n");
+}
+
+static void *lanes_writer(void *ud) {
+    kz_State  *L = kz_lane((kz_State *)ud, 2);
+    kz_Context ctx;
+    int        r = kz_read(L, &ctx);
+
+    /* let the main thread block first */
+    assert(r == KZ_AGAIN);
+    r = kz_waitcontext(&ctx, 20);
+    assert(r == KZ_TIMEOUT);
+    kz_cancel(&ctx);
+    r = kz_write(L, &ctx, 5);
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), "hello", 5);
+    r = kz_commit(&ctx, 5);
+    assert(r == KZ_OK);
+    return NULL;
+}
+
+static void test_lanes(void) {
+    kz_State  *S, *U;
+    kz_Context ctx, ctx1;
+    kz_Thread  t;
+    size_t     i, len;
+    char      *buf;
     int        r;
 
-    printf("--- test unsplit ---\n");
-    len = kz_size(S);
-    assert(len > 0);
-    r = kz_write(S, &ctx, len - 10);
+    printf("--- test lanes ---\n");
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_LANES(2) | KZ_MIRROR | 0666,
+                1024);
+    assert(S == NULL && errno == EINVAL);
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_LANES(2) | KZ_NOTIFY | 0666,
+                1024);
+    assert(S == NULL && errno == EINVAL);
+
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_LANES(3) | 0666, 3072);
+    assert(S != NULL && kz_lanes(S) == 3 && kz_size(S) >= 512);
+    assert(kz_lane(S, 0) == S && kz_lane(S, 3) == NULL);
+    assert(kz_lane(S, -1) == NULL && kz_lanes(kz_lane(S, 1)) == 1);
+    U = kz_open("test", 0, 0);
+    assert(U != NULL && kz_lanes(U) == 3 && !kz_isowner(U));
+    for (i = 0; i < 3; ++i) {
+        assert(kz_size(kz_lane(U, (int)i)) == kz_size(S));
+        assert(kz_isowner(kz_lane(S, (int)i)) == 1);
+    }
+
+    /* bulk messages fill the last lane, control ones overtake them */
+    for (i = 0; (r = kz_write(kz_lane(S, 2), &ctx, 100)) == KZ_OK; ++i) {
+        memset(kz_buffer(&ctx, NULL), 'b', 100);
+        assert(kz_commit(&ctx, 100) == KZ_OK);
+    }
+    assert(r == KZ_AGAIN && i > 0);
+    kz_cancel(&ctx);
+    r = kz_write(kz_lane(S, 1), &ctx, 3);
     assert(r == KZ_OK);
-    kz_commit(&ctx, len - 10);
+    memcpy(kz_buffer(&ctx, NULL), "rpc", 3);
+    assert(kz_commit(&ctx, 3) == KZ_OK);
+    r = kz_write(S, &ctx, 4);
+    assert(r == KZ_OK);
+    memcpy(kz_buffer(&ctx, NULL), "exit", 4);
+    assert(kz_commit(&ctx, 4) == KZ_OK);
+    assert(kz_waitlanes(U, 0) == 3);
+    r = kz_readlanes(U, &ctx);
+    assert(r == 0);
+    buf = kz_buffer(&ctx, &len);
+    assert(len == 4 && memcmp(buf, "exit", 4) == 0);
+    assert(kz_commit(&ctx, len) == KZ_OK);
+    r = kz_readlanes(U, &ctx);
+    assert(r == 1);
+    buf = kz_buffer(&ctx, &len);
+    assert(len == 3 && memcmp(buf, "rpc", 3) == 0);
+    assert(kz_commit(&ctx, len) == KZ_OK);
+    for (; i > 0; --i) {
+        r = kz_readlanes(U, &ctx);
+        assert(r == 2);
+        buf = kz_buffer(&ctx, &len);
+        assert(len == 100 && buf[99] == 'b');
+        assert(kz_commit(&ctx, len) == KZ_OK);
+    }
+    assert(kz_readlanes(U, &ctx) == KZ_AGAIN);
+    assert(kz_waitlanes(U, 0) == 0);
+    assert(kz_waitlanes(U, 10) == KZ_TIMEOUT);
 
-    r = kz_read(S1, &ctx);
+    /* a lane in reading makes the others report busy */
+    r = kz_write(S, &ctx, 1);
+    assert(r == KZ_OK && kz_commit(&ctx, 1) == KZ_OK);
+    assert(kz_read(U, &ctx) == KZ_OK);
+    assert(kz_readlanes(U, &ctx1) == KZ_BUSY);
+    assert(kz_commit(&ctx, 0) == KZ_OK);
+
+    /* one wait covers all the lanes */
+    r = kzT_spawn(&t, lanes_writer, S);
+    assert(r == 0);
+    r = kz_waitlanes(U, -1);
+    assert(r == 1);
+    kzT_join(t, NULL);
+    r = kz_readlanes(U, &ctx);
+    assert(r == 2);
+    buf = kz_buffer(&ctx, &len);
+    assert(len == 5 && memcmp(buf, "hello", 5) == 0);
+    assert(kz_commit(&ctx, len) == KZ_OK);
+
+    /* lanes are closed together with the channel */
+    kz_close(kz_lane(S, 1));
+    assert(kz_isclosed(kz_lane(U, 1)) == 0);
+    kz_shutdown(S, KZ_WRITE);
+    assert(kz_waitlanes(U, 100) == 3);
+    assert(kz_readlanes(U, &ctx) == KZ_CLOSED);
+    kz_close(U);
+    kz_close(S);
+    kz_unlink("test");
+    printf("--- test lanes ---\n");
+}
+
+#ifdef KZ_USE_EVENTFD
+#include <poll.h>
+#include <sys/wait.h>
+
+static int notify_signaled(kz_State *S, int mode, int millis) {
+    struct pollfd pfd;
+    pfd.fd = kz_notifyfd(S, mode);
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, millis) != 1) return 0;
+    return kz_clearnotify(S, mode) == mode;
+}
+
+static void test_notify(void) {
+    int        flags = KZ_CREATE | KZ_RESET | KZ_NOTIFY | 0666;
+    kz_State  *S = kz_open("test", flags, 1024);
+    kz_State  *U = kz_shadow(S);
+    kz_Context ctx;
+    int        r;
+
+    printf("--- test notify ---\n");
+    assert(S != NULL);
+    assert(kz_notifyfd(S, KZ_READ) >= 0 && kz_notifyfd(S, KZ_WRITE) >= 0);
+    assert(kz_notifyfd(S, KZ_BOTH) < 0);
+    r = kz_register(S, KZ_READ, 0);
+    assert(r == KZ_AGAIN); /* no user published the eventfds */
+    U->epoll_fds[0] = U->epoll_fds[1] = -1;
+    r = kz_initnotify(U, 0);
     assert(r == KZ_OK);
-    kz_buffer(&ctx, &buflen);
-    assert(buflen == len - 10);
-    kz_commit(&ctx, len - 10);
+    r = kz_register(U, KZ_READ, 0);
+    assert(r == KZ_AGAIN); /* the owner has not imported them */
+    r = kz_register(S, KZ_READ, 0);
+    assert(r == 0);
+    r = kz_unregister(S, KZ_READ);
+    assert(r == KZ_OK);
+    assert(kz_notifyfd(U, KZ_READ) >= 0);
+    assert(kz_notifyfd(U, KZ_READ) != kz_notifyfd(U, KZ_WRITE));
 
-    r = kz_write(S, &ctx, 10);
+    r = kz_register(U, KZ_WRITE, 10);
+    assert(r == KZ_WRITE); /* ready already, nothing registered */
+    r = kz_register(U, KZ_WRITE, kz_size(U));
+    assert(r == KZ_TOOBIG);
+    r = kz_register(U, KZ_READ, 0);
+    assert(r == 0);
+    assert(!notify_signaled(U, KZ_READ, 0));
+
+    /* the writer signals only the registered reader */
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 5);
+    assert(r == KZ_OK);
+    assert(notify_signaled(U, KZ_READ, 0));
+    assert(!notify_signaled(U, KZ_WRITE, 0));
+    assert(!notify_signaled(S, KZ_READ, 0));
+    kz_unregister(U, KZ_READ);
+    r = kz_register(U, KZ_READ, 0);
+    assert(r == KZ_READ);
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 5);
+    assert(r == KZ_OK);
+    assert(!notify_signaled(U, KZ_READ, 0));
+    r = kz_read(U, &ctx);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+    r = kz_read(U, &ctx);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 0);
     assert(r == KZ_OK);
-    kz_commit(&ctx, 10);
 
-    r = kz_read(S1, &ctx);
+    /* writers wait for the space freed by the reader */
+    r = kz_write(U, &ctx, kz_size(U) - 16);
     assert(r == KZ_OK);
-    kz_buffer(&ctx, &buflen);
-    assert(buflen == 10);
-    kz_commit(&ctx, 10);
+    r = kz_commit(&ctx, kz_size(U) - 16);
+    assert(r == KZ_OK);
+    r = kz_register(U, KZ_WRITE, 32);
+    assert(r == 0);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+    assert(notify_signaled(U, KZ_WRITE, 0));
+    assert(!notify_signaled(U, KZ_READ, 0));
+    r = kz_unregister(U, KZ_WRITE);
+    assert(r == KZ_OK);
+
+    /* shutdown wakes the pollers */
+    r = kz_register(S, KZ_READ, 0);
+    assert(r == 0);
+    kz_shutdown(U, KZ_WRITE);
+    assert(notify_signaled(S, KZ_READ, 0));
+    r = kz_register(S, KZ_READ, 0);
+    assert(r == KZ_READ);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_CLOSED);
+
+    kz_close(S);
+    kz_closenotify(U);
+    free(U);
+    printf("--- test notify ---\n");
+}
+
+static void test_notifypeer(void) {
+    kz_State  *S, *U;
+    kz_Context ctx;
+    pid_t      pid;
+    int        r, status;
+
+    printf("--- test notifypeer ---\n");
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_NOTIFY | 0666, 1024);
+    assert(S != NULL);
+    fflush(stdout);
+    if ((pid = fork()) == 0) { /* the owner imports from its child */
+        if ((U = kz_open("test", 0, 0)) == NULL) _exit(1);
+        while (kzA_load(&U->hdr->notified) != (uint32_t)getpid())
+            usleep(1000);
+        if (kz_write(U, &ctx, 5) != KZ_OK || kz_commit(&ctx, 5) != KZ_OK)
+            _exit(2);
+        if (kz_read(U, &ctx) == KZ_AGAIN) kz_waitcontext(&ctx, 5000);
+        _exit(kz_commit(&ctx, 0) == KZ_OK ? 0 : 3);
+    }
+    assert(pid > 0);
+    while (kzA_load(&S->hdr->notify_pid) != (uint32_t)pid) usleep(1000);
+    r = kz_register(S, KZ_READ, 0);
+    assert(r == 0 || r == KZ_READ);
+    assert(kzA_load(&S->hdr->notified) == (uint32_t)pid);
+    if (r == 0) assert(notify_signaled(S, KZ_READ, 5000));
+    r = kz_unregister(S, KZ_READ);
+    assert(r == KZ_OK);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 5);
+    assert(r == KZ_OK);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    kz_close(S);
+    printf("--- test notifypeer ---\n");
+}
+#endif
 
+#ifdef __linux__
+static void test_prepwait(void) {
+    kz_State    *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    kz_State    *S1 = kz_shadow(S);
+    kz_FutexWait waits[KZ_FUTEXMAX];
+    kz_Context   ctx;
+    kz_Stats     st;
+    size_t       n = 0;
+    int          r;
+
+    printf("--- test prepwait ---\n");
+    r = kz_prepwait(S1, 0, 0, waits, &n);
+    assert(r == KZ_INVALID);
+    r = kz_prepwait(S1, KZ_WRITE, kz_size(S1), waits, &n);
+    assert(r == KZ_TOOBIG);
+    r = kz_prepwait(S1, KZ_BOTH, 10, waits, &n);
+    assert(r == KZ_WRITE && n == 0); /* ready already, nothing registered */
+    assert(S1->write.info->need == 0 && S1->read.info->need == 0);
+
+    /* the reader waits on `used`, the writer wakes it and changes it */
+    r = kz_prepwait(S1, KZ_READ, 0, waits, &n);
+    assert(r == 0 && n == 1);
+    assert(waits[0].uaddr == (uintptr_t)&S1->read.info->used);
+    assert(waits[0].val == 0 && waits[0].flags == 2);
+#ifdef SYS_futex_waitv
+    if (kz_has_futex_waitv == 1) {
+        r = kz_futex_waitv((struct futex_waitv *)waits, (int)n, 10);
+        assert(r == KZ_TIMEOUT);
+    }
+#endif
+    r = kz_write(S, &ctx, 5);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 5);
+    assert(r == KZ_OK);
+    assert(*(uint32_t *)(uintptr_t)waits[0].uaddr != waits[0].val);
+    r = kz_stats(S, &st);
+    assert(r == KZ_OK && st.write.push_wakes == 1);
+    r = kz_unregister(S1, KZ_READ);
+    assert(r == KZ_OK);
+    r = kz_prepwait(S1, KZ_READ, 0, waits, &n);
+    assert(r == KZ_READ && n == 0);
     kz_close(S);
     free(S1);
-    printf("--- test unsplit ---\n");
+
+    /* the indices are the words, closing marks `used` */
+    S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_INDEXED | 0666, 1024);
+    assert(S != NULL);
+    r = kz_prepwait(S, KZ_READ, 0, waits, &n);
+    assert(r == 0 && n == 2);
+    assert(waits[0].uaddr == (uintptr_t)&S->read.index->tail);
+    assert(waits[1].uaddr == (uintptr_t)&S->read.info->used);
+    kz_shutdown(S, KZ_READ);
+    assert(*(uint32_t *)(uintptr_t)waits[1].uaddr != waits[1].val);
+    kz_unregister(S, KZ_READ);
+    kz_close(S);
+    printf("--- test prepwait ---\n");
 }
+#endif
 
 static void test_timeout(void) {
     kz_State   *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
@@ -206,6 +1779,238 @@ static void test_reset(void) {
     printf("--- test reset ---\n");
 }
 
+static void test_resize(void) {
+    kz_State  *S, *S1;
+    kz_Context ctx, ctx2;
+    size_t     len, buflen, i;
+    int        r, round;
+
+    printf("--- test resize ---\n");
+    for (round = 0; round < 2; ++round) {
+        int flags = round ? KZ_INDEXED : 0;
+        kz_unlink("test");
+        S = kz_open("test", KZ_CREATE | flags | 0666, 1024);
+        assert(S != NULL);
+        assert(kz_resize(S, 4096) == KZ_TOOBIG); /* nothing reserved */
+        kz_close(S);
+        kz_unlink("test");
+        S = kz_open("test", KZ_CREATE | KZ_RESIZABLE | flags | 0666, 1024);
+        assert(S != NULL);
+        S1 = kz_open("test", 0, 0);
+        assert(S1 != NULL);
+        len = kz_size(S);
+        assert(kz_resize(S1, 4096) == KZ_INVALID);
+
+        /* up to what the peer mapped, if its reservation failed */
+        kzA_store(&S->hdr->user_map, (uint32_t)S1->shm_size);
+        assert(kz_resize(S, 4096) == KZ_TOOBIG);
+        kzA_store(&S->hdr->user_map, (uint32_t)S1->map_size);
+
+        /* only at a message boundary, with no one in the queues */
+        r = kz_write(S, &ctx, 10);
+        assert(r == KZ_OK);
+        assert(kz_resize(S, 4096) == KZ_BUSY);
+        r = kz_commit(&ctx, 10);
+        assert(r == KZ_OK);
+        assert(kz_resize(S, 4096) == KZ_AGAIN);
+        r = kz_read(S1, &ctx);
+        assert(r == KZ_OK);
+        r = kz_commit(&ctx, 0);
+        assert(r == KZ_OK);
+
+        /* grow, the peer moves on its next operation */
+        r = kz_resize(S, 4096);
+        assert(r == KZ_OK);
+        assert(kz_size(S) > len && kz_size(S1) == kz_size(S));
+        for (i = 0; i < 3; ++i) {
+            kz_State *w = i & 1 ? S1 : S, *rd = i & 1 ? S : S1;
+            r = kz_write(w, &ctx, 1500);
+            assert(r == KZ_OK);
+            memset(kz_buffer(&ctx, NULL), (char)i, 1500);
+            r = kz_commit(&ctx, 1500);
+            assert(r == KZ_OK);
+            r = kz_read(rd, &ctx);
+            assert(r == KZ_OK);
+            assert(kz_buffer(&ctx, &buflen)[1499] == (char)i);
+            assert(buflen == 1500);
+            r = kz_commit(&ctx, 0);
+            assert(r == KZ_OK);
+        }
+
+        /* a waiting reader is moved as well */
+        r = kz_read(S1, &ctx);
+        assert(r == KZ_AGAIN);
+        r = kz_resize(S, 1024);
+        assert(r == KZ_OK);
+        assert(kz_size(S) == len);
+        r = kz_read(S1, &ctx2);
+        assert(r == KZ_BUSY);
+        r = kz_write(S, &ctx2, 100);
+        assert(r == KZ_OK);
+        memset(kz_buffer(&ctx2, NULL), 'x', 100);
+        r = kz_commit(&ctx2, 100);
+        assert(r == KZ_OK);
+        r = kz_waitcontext(&ctx, 0);
+        assert(r == KZ_OK);
+        assert(kz_buffer(&ctx, &buflen)[99] == 'x' && buflen == 100);
+        r = kz_commit(&ctx, 0);
+        assert(r == KZ_OK);
+
+        /* and it stays small */
+        r = kz_write(S1, &ctx, 1500);
+        assert(r == KZ_TOOBIG);
+        r = kz_write(S1, &ctx, 100);
+        assert(r == KZ_OK);
+        r = kz_commit(&ctx, 100);
+        assert(r == KZ_OK);
+        r = kz_read(S, &ctx);
+        assert(r == KZ_OK);
+        kz_buffer(&ctx, &buflen);
+        assert(buflen == 100);
+        r = kz_commit(&ctx, 0);
+        assert(r == KZ_OK);
+        kz_close(S1);
+        kz_close(S);
+    }
+
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | KZ_MIRROR | 0666, 1024);
+    assert(S != NULL);
+    assert(kz_resize(S, 4096) == KZ_INVALID);
+    kz_close(S);
+
+    /* `KZ_MPSC` writers move when they reserve next */
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | KZ_MPSC | KZ_RESIZABLE | 0666, 1024);
+    assert(S != NULL);
+    S1 = kz_open("test", 0, 0);
+    assert(S1 != NULL);
+    r = kz_write(S1, &ctx, 10);
+    assert(r == KZ_OK);
+    assert(kz_resize(S, 4096) == KZ_AGAIN);
+    kz_cancel(&ctx);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_AGAIN); /* frees the discarded record */
+    kz_cancel(&ctx);
+    r = kz_resize(S, 4096);
+    assert(r == KZ_OK);
+    r = kz_write(S1, &ctx, 1500);
+    assert(r == KZ_OK);
+    r = kz_commit(&ctx, 1500);
+    assert(r == KZ_OK);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_OK);
+    kz_buffer(&ctx, &buflen);
+    assert(buflen == 1500);
+    r = kz_commit(&ctx, 0);
+    assert(r == KZ_OK);
+    kz_close(S1);
+    kz_close(S);
+    printf("--- test resize ---\n");
+}
+
+#ifdef KZ_USE_WATCHER
+# include <dirent.h>
+# include <sys/wait.h>
+
+static int count_threads(void) {
+    DIR *d = opendir("/proc/self/task");
+    int  n = 0;
+    assert(d != NULL);
+    while (readdir(d) != NULL) ++n;
+    closedir(d);
+    return n - 2; /* "." and ".." */
+}
+
+static pid_t peerexit_user(int exchange) {
+    pid_t pid;
+    fflush(stdout);
+    if ((pid = fork()) == 0) { /* a user crashed with the channel open */
+        kz_State  *S = kz_open("test", 0, 0);
+        kz_Context ctx;
+        if (S == NULL) _exit(1);
+        if (exchange) { /* the reopened queues work */
+            if (kz_write(S, &ctx, 1) != KZ_OK) _exit(2);
+            *kz_buffer(&ctx, NULL) = 'u';
+            if (kz_commit(&ctx, 1) != KZ_OK) _exit(3);
+            if (kz_read(S, &ctx) == KZ_AGAIN
+                && kz_waitcontext(&ctx, 10000) != KZ_OK)
+                _exit(4);
+            if (*kz_buffer(&ctx, NULL) != 'o') _exit(5);
+        }
+        usleep(100000);
+        kill(getpid(), SIGKILL);
+    }
+    assert(pid > 0);
+    return pid;
+}
+
+static void peerexit_wait(kz_State *S, pid_t pid) {
+    kz_Context ctx;
+    uint64_t   start;
+    int        r, status;
+
+    /* the waiter wakes on the exit, not on the timeout */
+    r = kz_read(S, &ctx);
+    assert(r == KZ_AGAIN);
+    start = kz_now();
+    r = kz_waitcontext(&ctx, 10000);
+    assert(r == KZ_CLOSED);
+    assert(kz_now() - start < (uint64_t)5000000000);
+    assert(kz_isclosed(S));
+    assert(waitpid(pid, &status, 0) == pid && WIFSIGNALED(status));
+}
+
+static void test_peerexit(void) {
+    kz_State  *S, *S1, *S2;
+    kz_Context ctx;
+    pid_t      pid;
+    int        r, user = 0, status, threads = count_threads();
+
+    printf("--- test peerexit ---\n");
+    kz_unlink("test");
+    S = kz_open("test", KZ_CREATE | 0666, 1024);
+    assert(S != NULL);
+    fflush(stdout);
+    if ((pid = fork()) == 0) { /* leaves the watcher of the parent alone */
+        kz_stopwatch(S);
+        _exit(0);
+    }
+    assert(pid > 0);
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status));
+    pid = peerexit_user(0);
+    while (kz_exists("test", NULL, &user) == 1 && user != pid) usleep(1000);
+    peerexit_wait(S, pid);
+
+    /* a new user is not closed by the exit of the old one */
+    pid = peerexit_user(1);
+    while (kz_isclosed(S)) usleep(1000); /* until it resets the queues */
+    r = kz_read(S, &ctx);
+    if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, 10000);
+    assert(r == KZ_OK);
+    assert(*kz_buffer(&ctx, NULL) == 'u');
+    assert(kz_commit(&ctx, 0) == KZ_OK);
+    assert(!kz_isclosed(S));
+    assert(kz_write(S, &ctx, 1) == KZ_OK);
+    *kz_buffer(&ctx, NULL) = 'o';
+    assert(kz_commit(&ctx, 1) == KZ_OK);
+    peerexit_wait(S, pid);
+
+    /* one watcher thread for all channels of the process */
+    kz_unlink("test1"), kz_unlink("test2");
+    S1 = kz_open("test1", KZ_CREATE | 0666, 1024);
+    S2 = kz_open("test2", KZ_CREATE | 0666, 1024);
+    assert(S1 != NULL && S2 != NULL);
+    assert(S->watcher != NULL);
+    assert(S1->watcher == S->watcher && S2->watcher == S->watcher);
+    assert(count_threads() == threads + 1);
+    kz_close(S2), kz_close(S1), kz_close(S);
+    assert(count_threads() == threads);
+    kz_unlink("test1"), kz_unlink("test2");
+    printf("--- test peerexit ---\n");
+}
+#endif
+
 static void bench_n(kz_State *S, size_t count) {
     size_t readcount = 0, writecount = 0;
     char   data[] = "1234567890123";
@@ -238,6 +2043,222 @@ static void bench_n(kz_State *S, size_t count) {
     }
 }
 
+static uint32_t coalesce_wakes(kz_State *S, size_t msgs) {
+    kz_Context ctx;
+    kz_Stats   st;
+    size_t     i;
+    int        r;
+    for (i = 0; i < msgs; ++i) {
+        r = kz_write(S, &ctx, 8);
+        assert(r == KZ_OK);
+        r = kz_commit(&ctx, 8);
+        assert(r == KZ_OK);
+    }
+    r = kz_stats(S, &st);
+    assert(r == KZ_OK);
+    return st.write.push_wakes;
+}
+
+static void test_coalesce(void) {
+    kz_State  *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
+    kz_State  *S1 = kz_shadow(S);
+    kz_Context ctx;
+    int        r;
+
+    printf("--- test coalesce ---\n");
+    assert(kz_setcoalesce(NULL, 0, 0, 10) == KZ_INVALID);
+    kzQ_setneed(&S1->read, KZ_WAITREAD); /* as if the reader sleeps */
+    assert(coalesce_wakes(S, 1) == 1);
+
+    /* woken once per `count` messages */
+    r = kz_setcoalesce(S, 0, 3, 1000000);
+    assert(r == KZ_OK);
+    assert(coalesce_wakes(S, 2) == 1);
+    assert(coalesce_wakes(S, 1) == 2);
+    assert(coalesce_wakes(S, 5) == 3);
+
+    /* or per `bytes` */
+    r = kz_setcoalesce(S, 20, 0, 1000000); /* flushes the pending one */
+    assert(r == KZ_OK);
+    assert(coalesce_wakes(S, 0) == 4);
+    assert(coalesce_wakes(S, 2) == 4);
+    assert(coalesce_wakes(S, 1) == 5);
+
+    /* flush wakes the pending ones only */
+    assert(coalesce_wakes(S, 1) == 5);
+    assert(kz_flush(S) == KZ_OK);
+    assert(coalesce_wakes(S, 0) == 6);
+    assert(kz_flush(S) == KZ_OK);
+    assert(coalesce_wakes(S, 0) == 6);
+
+    /* the deadline is checked by the next commit */
+    r = kz_setcoalesce(S, 0, 0, 1000);
+    assert(r == KZ_OK);
+    assert(coalesce_wakes(S, 1) == 6);
+    usleep(2000);
+    assert(coalesce_wakes(S, 1) == 7);
+
+    /* and a wait of the writer flushes */
+    assert(coalesce_wakes(S, 1) == 7);
+    r = kz_read(S, &ctx);
+    assert(r == KZ_AGAIN);
+    r = kz_waitcontext(&ctx, 1);
+    assert(r == KZ_TIMEOUT);
+    kz_cancel(&ctx);
+    assert(coalesce_wakes(S, 0) == 8);
+
+    kz_close(S);
+    free(S1);
+    printf("--- test coalesce ---\n");
+}
+
+static void test_indexed(void) {
+    kz_State  *S, *S1;
+    kz_Context ctx;
+    kz_Thread  t;
+    size_t     len, buflen, n, i;
+    int        r, round, loop;
+
+    printf("--- test indexed ---\n");
+    kz_unlink("test");
+    assert(kz_open("test", KZ_CREATE | KZ_INDEXED | KZ_MPSC | 0666, 1024)
+           == NULL);
+    for (round = 0; round < 2; ++round) {
+        int flags = KZ_INDEXED | (round ? KZ_MIRROR : 0);
+        kz_unlink("test");
+        S = kz_open("test", KZ_CREATE | flags | 0666, 1024);
+        assert(S != NULL);
+        len = kz_size(S);
+        assert(len >= 1024 / 2);
+        S1 = kz_open("test", 0, 0);
+        assert(S1 != NULL);
+
+        /* fill and drain a few times, the indices run over the ring twice */
+        for (loop = 0; loop < 8; ++loop) {
+            for (n = 0; (r = kz_write(S, &ctx, 100)) == KZ_OK; ++n) {
+                memset(kz_buffer(&ctx, NULL), (char)n, 100);
+                r = kz_commit(&ctx, 100);
+                assert(r == KZ_OK);
+            }
+            assert(r == KZ_AGAIN && n > 0);
+            kz_cancel(&ctx);
+            for (i = 0; i < n; ++i) {
+                r = kz_read(S1, &ctx);
+                assert(r == KZ_OK);
+                assert(kz_buffer(&ctx, &buflen)[99] == (char)i);
+                assert(buflen == 100);
+                r = kz_commit(&ctx, 0);
+                assert(r == KZ_OK);
+                if (i == 0) { /* the writer sees the space freed */
+                    r = kz_write(S, &ctx, 100);
+                    assert(r == KZ_OK);
+                    kz_cancel(&ctx);
+                }
+            }
+            r = kz_read(S1, &ctx);
+            assert(r == KZ_AGAIN);
+            kz_cancel(&ctx);
+        }
+        if (round) { /* a record of the whole ring is told from none */
+            r = kz_write(S, &ctx, len - sizeof(uint32_t));
+            assert(r == KZ_OK);
+            r = kz_commit(&ctx, len - sizeof(uint32_t));
+            assert(r == KZ_OK);
+            r = kz_write(S, &ctx, 1);
+            assert(r == KZ_AGAIN);
+            kz_cancel(&ctx);
+            r = kz_wait(S1, 0, 0);
+            assert(r & KZ_READ);
+            r = kz_read(S1, &ctx);
+            assert(r == KZ_OK);
+            kz_commit(&ctx, 0);
+            assert(kz_wait(S, 1, 0) & KZ_WRITE);
+        }
+        r = kz_read(S1, &ctx);
+        assert(r == KZ_AGAIN);
+        r = kz_waitcontext(&ctx, 10);
+        assert(r == KZ_TIMEOUT);
+        kz_cancel(&ctx);
+        kz_shutdown(S, KZ_WRITE);
+        assert(kz_write(S, &ctx, 10) == KZ_CLOSED);
+        assert(kz_read(S1, &ctx) == KZ_CLOSED);
+        kz_close(S1);
+        kz_close(S);
+
+        S = kz_open("test", KZ_CREATE | KZ_RESET | flags | 0666, 1024);
+        assert(S != NULL);
+        r = kzT_spawn(&t, &echo_thread, NULL);
+        assert(r == 0);
+        bench_n(S, 10000);
+        kz_close(S);
+        kzT_join(t, NULL);
+    }
+    kz_unlink("test");
+    printf("--- test indexed ---\n");
+}
+
+static void test_spin(void) {
+    kz_State  *S = kz_open("test", KZ_CREATE | KZ_RESET | KZ_SPIN | 0666, 1024);
+    kz_Context ctx;
+    kz_Thread  t;
+    uint64_t   before;
+    int        r;
+
+    printf("--- test spin ---\n");
+    assert(S != NULL);
+    before = kzT_time();
+    r = kz_read(S, &ctx);
+    assert(r == KZ_AGAIN);
+    r = kz_waitcontext(&ctx, 100);
+    assert(r == KZ_TIMEOUT);
+    kz_cancel(&ctx);
+    assert(kzT_time() - before >= 100000000);
+
+    r = kzT_spawn(&t, &echo_thread, NULL);
+    assert(r == 0);
+    bench_n(S, 10000);
+    assert(kz_setspin(S, 0) == KZ_OK);
+    bench_n(S, 1000);
+    kz_close(S);
+    kzT_join(t, NULL);
+    printf("--- test spin ---\n");
+}
+
+#ifndef _WIN32
+static void test_local(void) {
+    kz_State *Ss[2];
+    kz_Thread t;
+    int       r;
+
+    printf("--- test local ---\n");
+    assert(kz_openlocal(KZ_MIRROR, 1024, Ss) == KZ_FAIL && errno == EINVAL);
+    r = kz_openlocal(KZ_MPSC | KZ_INDEXED, 1024, Ss);
+    assert(r == KZ_FAIL && errno == EINVAL);
+    r = kz_openlocal(0, 1024, Ss);
+    assert(r == KZ_OK && kz_isowner(Ss[0]) == 1 && kz_isowner(Ss[1]) == 0);
+    assert(kz_size(Ss[0]) == kz_size(Ss[1]) && kz_size(Ss[0]) >= 480);
+    assert(kz_resize(Ss[0], 2048) == KZ_INVALID);
+# ifdef __linux__
+    { /* the words are private to this process */
+        kz_FutexWait w[KZ_FUTEXMAX];
+        size_t       n;
+        r = kz_prepwait(Ss[1], KZ_READ, 0, w, &n);
+        assert(r == 0 && n >= 1 && w[0].flags == (0x02 | 0x80));
+        kz_unregister(Ss[1], KZ_READ);
+    }
+# endif
+
+    /* both sides sleep and wake each other across the threads */
+    r = kzT_spawn(&t, &echo_thread, Ss[1]);
+    assert(r == 0);
+    bench_n(Ss[0], 10000);
+    kz_shutdown(Ss[0], KZ_BOTH);
+    kzT_join(t, NULL);
+    kz_close(Ss[0]);
+    printf("--- test local ---\n");
+}
+#endif
+
 static void bench_echo(void) {
     kz_State *S = kz_open("test", KZ_CREATE | KZ_RESET | 0666, 1024);
     kz_Thread t;
@@ -263,9 +2284,45 @@ static void bench_echo(void) {
 int main(void) {
     kz_unlink("test");
     test_echo();
+    test_hugepage();
+    test_prefault();
+    test_mirror();
     test_unsplit();
+    test_wrap();
+    test_readv();
+    test_cursor();
+    test_writev();
+    test_chunks();
+    test_arena();
+    test_slots();
+#ifndef _WIN32
+    test_broadcast();
+    test_directory();
+#endif
+    test_stats();
+    test_timestamp();
+    test_mpsc();
+    test_waitmany();
+    test_lanes();
+#ifdef KZ_USE_EVENTFD
+    test_notify();
+    test_notifypeer();
+#endif
+#ifdef __linux__
+    test_prepwait();
+#endif
     test_timeout();
+#ifdef KZ_USE_WATCHER
+    test_peerexit();
+#endif
     test_reset();
+    test_resize();
+    test_spin();
+    test_coalesce();
+    test_indexed();
+#ifndef _WIN32
+    test_local();
+#endif
     bench_echo();
     kz_unlink("test");
 }
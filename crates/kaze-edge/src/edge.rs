@@ -1,7 +1,10 @@
 use std::{
     borrow::Cow,
     net::Ipv4Addr,
-    sync::{Arc, OnceLock},
+    sync::{
+        Arc, OnceLock,
+        atomic::{AtomicBool, Ordering},
+    },
 };
 
 use anyhow::{Context, Result, bail};
@@ -10,11 +13,12 @@ use kaze_plugin::{
     Plugin, service::AsyncService, util::tower_ext::ServiceExt as _,
 };
 use kaze_protocol::packet::Packet;
-use metrics::counter;
-use tokio::{select, sync::Mutex, task::spawn_blocking};
+use metrics::{counter, gauge};
+use tokio::select;
 use tracing::{info, trace, warn};
 
-use kaze_core::{Channel, OwnedReadHalf, OwnedWriteHalf};
+use kaze_core::{AsyncChannel, AsyncReadHalf, AsyncWriteHalf};
+use kaze_core::{Channel, Histogram, Mode, OpenOptions, QueueStats};
 use kaze_plugin::protocol::{bytes::Buf, message::Message};
 
 pub use kaze_core::Error;
@@ -24,6 +28,7 @@ pub use kaze_core::UnlinkGuard;
 pub struct Edge {
     channel: Channel,
     ident: Ipv4Addr,
+    max_bufsize: usize,
 }
 
 impl std::fmt::Display for Edge {
@@ -39,7 +44,10 @@ impl Edge {
         prefix: impl AsRef<str>,
         ident: Ipv4Addr,
         bufsize: usize,
+        max_bufsize: usize,
         unlink: bool,
+        prefault: bool,
+        mlock: bool,
     ) -> Result<Self> {
         let name = Self::get_channel_name(prefix, ident);
 
@@ -60,9 +68,31 @@ impl Edge {
 
         let page_size = page_size::get();
         let bufsize = Channel::aligned(bufsize, page_size);
-        let channel = Channel::create(&name, bufsize)
+        let mut options =
+            OpenOptions::new().create(true, bufsize).perm(0).mpsc();
+        if cfg!(target_os = "linux") {
+            // let the host wake the async waits without blocking threads
+            options = options.notify();
+        }
+        if max_bufsize != 0 {
+            // only reserve the address space to grow into when asked to
+            options = options.resizable();
+        }
+        if prefault {
+            // warm the channel before the host starts to use it
+            options = options.prefault();
+        }
+        if mlock {
+            options = options.mlock();
+        }
+        let channel = options
+            .open(&name)
             .context("Failed to create submission queue")?;
-        Ok(Self { channel, ident })
+        Ok(Self {
+            channel,
+            ident,
+            max_bufsize,
+        })
     }
 
     /// Get the channel name.
@@ -78,8 +108,9 @@ impl Edge {
     }
 
     pub fn into_split(self) -> (Sender, Receiver) {
-        let (rx, tx) = self.channel.into_split();
-        (Sender::new(tx, self.ident), Receiver::new(rx))
+        let (rx, tx) = AsyncChannel::new(self.channel).into_split();
+        let rx = Receiver::new(rx).with_max_bufsize(self.max_bufsize);
+        (Sender::new(tx, self.ident), rx)
     }
 
     pub fn unlink(prefix: impl AsRef<str>, ident: Ipv4Addr) -> Result<()> {
@@ -101,14 +132,53 @@ impl Edge {
 #[derive(Clone)]
 pub struct Receiver {
     ctx: OnceLock<kaze_plugin::Context>,
-    rx: OwnedReadHalf,
+    rx: AsyncReadHalf,
+    max_bufsize: usize,
+    blocking_warned: Arc<AtomicBool>,
 }
 
 impl Receiver {
-    pub fn new(rx: OwnedReadHalf) -> Self {
+    pub fn new(rx: AsyncReadHalf) -> Self {
         Self {
             rx,
             ctx: OnceLock::new(),
+            max_bufsize: 0,
+            blocking_warned: Arc::new(AtomicBool::new(false)),
+        }
+    }
+
+    /// Grow the channel up to `max_bufsize` bytes when the queues run
+    /// nearly full, see [`Receiver::autosize`].
+    pub fn with_max_bufsize(mut self, max_bufsize: usize) -> Self {
+        self.max_bufsize = max_bufsize;
+        self
+    }
+
+    /// Double the buffer of the channel if the peak occupancy of any queue
+    /// reached 3/4 of it, until `max_bufsize`.
+    ///
+    /// The resize only happens with both queues empty, so it is tried when
+    /// the receiver is about to wait; a busy channel retries next time.
+    pub fn autosize(&self) {
+        let channel = self.rx.channel();
+        let size = channel.size();
+        if self.max_bufsize <= size * 2 {
+            return;
+        }
+        let stats = channel.stats();
+        let peak = stats.read.peak.max(stats.write.peak) as usize;
+        if peak < size / 4 * 3 {
+            return;
+        }
+        let bufsize =
+            Channel::aligned(size * 4, page_size::get()).min(self.max_bufsize);
+        match channel.resize(bufsize) {
+            Ok(()) => {
+                counter!("kaze_queue_resizes_total").increment(1);
+                info!(from = size, to = channel.size(), "channel resized");
+            }
+            Err(Error::Again | Error::Busy) => {}
+            Err(e) => warn!(error = %e, "Failed to resize channel"),
         }
     }
 
@@ -117,23 +187,61 @@ impl Receiver {
         self.rx.shutdown().map_err(Into::into)
     }
 
+    /// Publish the shared memory counters of both queues to `metrics`.
+    ///
+    /// The counters live in the channel header, so this also covers the
+    /// host side of the channel; call it periodically from the exporter.
+    /// Channels created with timestamps also report the dwell time
+    /// percentiles of the messages.
+    pub fn record_stats(&self) {
+        let channel = self.rx.channel();
+        let stats = channel.stats();
+        record_queue_stats("completion", &stats.read);
+        record_queue_stats("submission", &stats.write);
+        if let Some(hist) = channel.histogram(Mode::READ) {
+            record_dwell("completion", &hist);
+        }
+        if let Some(hist) = channel.histogram(Mode::WRITE) {
+            record_dwell("submission", &hist);
+        }
+        counter!("kaze_blocking_waits_total")
+            .absolute(self.rx.blocking_waits());
+    }
+
+    /// Warn once the waits hold threads of the blocking pool, when the host
+    /// can not signal the channel, e.g. its fds can not be imported.
+    fn check_blocking(&self) {
+        if self.rx.blocking_waits() > 0
+            && !self.blocking_warned.swap(true, Ordering::Relaxed)
+        {
+            warn!(
+                channel = %self.rx.channel().name(),
+                "Async waits fall back to the blocking pool"
+            );
+        }
+    }
+
     pub async fn read_packet(&mut self) -> Result<Packet> {
         let mut ctx = self
             .rx
+            .channel()
             .read_context()
             .context("Failed to create read context")?;
         if ctx.would_block() {
             counter!("kaze_completion_blocking_total").increment(1);
-            // SAFETY: we use it only in spawn_blocking.
-            let spawn_ctx = unsafe { ctx.into_static() };
-            ctx = spawn_blocking(move || spawn_ctx.wait())
-                .await?
+            // a waiting reader does not keep the queue from moving
+            self.autosize();
+            ctx = self
+                .rx
+                .wait_context(ctx)
+                .await
                 .map_err(|e| {
                     counter!("kaze_completion_blocking_errors_total")
                         .increment(1);
                     e
                 })
                 .context("kaze blocking wait completion error")?;
+            self.check_blocking();
         }
         let mut bytes = self.context().pool().pull_owned();
         let buf = ctx.buffer();
@@ -156,6 +264,50 @@ impl Receiver {
     }
 }
 
+fn record_queue_stats(queue: &'static str, stats: &QueueStats) {
+    counter!("kaze_queue_pushes_total", "queue" => queue)
+        .absolute(stats.pushes);
+    counter!("kaze_queue_pops_total", "queue" => queue).absolute(stats.pops);
+    counter!("kaze_queue_push_bytes_total", "queue" => queue)
+        .absolute(stats.push_bytes);
+    counter!("kaze_queue_pop_bytes_total", "queue" => queue)
+        .absolute(stats.pop_bytes);
+    counter!("kaze_queue_push_sleeps_total", "queue" => queue)
+        .absolute(stats.push_sleeps.into());
+    counter!("kaze_queue_pop_sleeps_total", "queue" => queue)
+        .absolute(stats.pop_sleeps.into());
+    counter!("kaze_queue_push_wakes_total", "queue" => queue)
+        .absolute(stats.push_wakes.into());
+    counter!("kaze_queue_pop_wakes_total", "queue" => queue)
+        .absolute(stats.pop_wakes.into());
+    counter!("kaze_queue_push_again_total", "queue" => queue)
+        .absolute(stats.push_again.into());
+    counter!("kaze_queue_pop_again_total", "queue" => queue)
+        .absolute(stats.pop_again.into());
+    counter!("kaze_queue_push_busy_total", "queue" => queue)
+        .absolute(stats.push_busy.into());
+    counter!("kaze_queue_pop_busy_total", "queue" => queue)
+        .absolute(stats.pop_busy.into());
+    gauge!("kaze_queue_peak_bytes", "queue" => queue).set(stats.peak);
+    gauge!("kaze_queue_size_bytes", "queue" => queue).set(stats.size);
+    gauge!("kaze_queue_used_bytes", "queue" => queue).set(stats.used);
+}
+
+fn record_dwell(queue: &'static str, hist: &Histogram) {
+    counter!("kaze_queue_dwell_messages_total", "queue" => queue)
+        .absolute(hist.count);
+    counter!("kaze_queue_dwell_nanoseconds_total", "queue" => queue)
+        .absolute(hist.sum);
+    for (quantile, q) in [("0.5", 0.5), ("0.9", 0.9), ("0.99", 0.99)] {
+        gauge!(
+            "kaze_queue_dwell_nanoseconds",
+            "queue" => queue,
+            "quantile" => quantile
+        )
+        .set(hist.percentile(q) as f64);
+    }
+}
+
 impl Plugin for Receiver {
     #[inline]
     fn context_storage(&self) -> Option<&OnceLock<kaze_plugin::Context>> {
@@ -188,16 +340,16 @@ pub struct Sender {
 
 struct SenderInner {
     ctx: OnceLock<kaze_plugin::Context>,
-    tx: Mutex<OwnedWriteHalf>,
+    tx: AsyncWriteHalf,
 }
 
 impl Sender {
-    fn new(tx: OwnedWriteHalf, ident: Ipv4Addr) -> Self {
+    fn new(tx: AsyncWriteHalf, ident: Ipv4Addr) -> Self {
         Self {
             ident,
             inner: Arc::new(SenderInner {
                 ctx: OnceLock::new(),
-                tx: Mutex::new(tx),
+                tx,
             }),
         }
     }
@@ -208,20 +360,25 @@ impl Sender {
     }
 
     pub async fn lock(&self) -> kaze_core::ShutdownGuard {
-        self.inner.tx.lock().await.shutdown_lock()
+        self.inner.tx.shutdown_lock()
     }
 
     pub async fn send_buf(&self, data: impl Buf) -> Result<()> {
-        let tx = self.inner.tx.lock().await;
-        let mut ctx = tx
+        // the channel is created with `mpsc()`, so concurrent sends do
+        // not need a lock
+        let mut ctx = self
+            .inner
+            .tx
+            .channel()
             .write_context(data.remaining())
             .context("Failed to create write context")?;
         if ctx.would_block() {
             counter!("kaze_submission_blocking_total").increment(1);
-            // SAFETY: we use it only in spawn_blocking.
-            let spawn_ctx = unsafe { ctx.into_static() };
-            ctx = spawn_blocking(|| spawn_ctx.wait())
-                .await?
+            ctx = self
+                .inner
+                .tx
+                .wait_context(ctx)
+                .await
                 .map_err(|e| {
                     counter!("kaze_submission_blocking_errors_total")
                         .increment(1);
@@ -30,11 +30,28 @@ pub struct Options {
     #[arg(value_name = "BYTES")]
     pub bufsize: usize,
 
+    /// Grow the buffer up to this size when the queues run nearly full,
+    /// zero to keep the size fixed
+    #[serde(default)]
+    #[arg(long, default_value_t = 0)]
+    #[arg(value_name = "BYTES")]
+    pub max_bufsize: usize,
+
     /// Unlink shared memory object if it exists
     #[arg(short, long, action = clap::ArgAction::SetTrue)]
     #[arg(default_value_t = default_unlink())]
     #[serde(skip)]
     pub unlink: bool,
+
+    /// Fault in the shared memory at creation to avoid first-touch latency
+    #[serde(default)]
+    #[arg(long, action = clap::ArgAction::SetTrue)]
+    pub prefault: bool,
+
+    /// Lock the shared memory in RAM at creation (implies prefault)
+    #[serde(default)]
+    #[arg(long, action = clap::ArgAction::SetTrue)]
+    pub mlock: bool,
 }
 
 impl Options {
@@ -61,15 +78,41 @@ impl Options {
         self
     }
 
+    /// set max bufsize
+    pub fn with_max_bufsize(mut self, max_bufsize: usize) -> Self {
+        self.max_bufsize = max_bufsize;
+        self
+    }
+
     /// set unlink
     pub fn with_unlink(mut self, unlink: bool) -> Self {
         self.unlink = unlink;
         self
     }
 
+    /// set prefault
+    pub fn with_prefault(mut self, prefault: bool) -> Self {
+        self.prefault = prefault;
+        self
+    }
+
+    /// set mlock
+    pub fn with_mlock(mut self, mlock: bool) -> Self {
+        self.mlock = mlock;
+        self
+    }
+
     /// build
     pub fn build(&self) -> Result<Edge> {
-        Edge::new(&self.name, self.ident, self.bufsize, self.unlink)
+        Edge::new(
+            &self.name,
+            self.ident,
+            self.bufsize,
+            self.max_bufsize,
+            self.unlink,
+            self.prefault,
+            self.mlock,
+        )
     }
 }
 
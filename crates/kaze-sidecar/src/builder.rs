@@ -206,7 +206,10 @@ mod tests {
             name: "test-sidecar".to_string(),
             ident: Ipv4Addr::new(0, 0, 0, 1),
             bufsize: 1024,
+            max_bufsize: 0,
             unlink: true,
+            prefault: false,
+            mlock: false,
         };
         config.insert(edge_opts);
 
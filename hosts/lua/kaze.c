@@ -7,6 +7,8 @@
 
 #define LKZ_State   "kaze.State"
 #define LKZ_Context "kaze.Context"
+#define LKZ_Bcast   "kaze.Bcast"
+#define LKZ_Dir     "kaze.Dir"
 
 /* clang-format off */
 static int Lkz_pusherror_aux(lua_State *L)
@@ -31,6 +33,7 @@ static int lkz_pusherror(lua_State *L, int r) {
     case KZ_AGAIN:   lua_pushliteral(L, "AGAIN"); break;
     case KZ_BUSY:    lua_pushliteral(L, "BUSY"); break;
     case KZ_TIMEOUT: lua_pushliteral(L, "TIMEOUT"); break;
+    case KZ_DROPPED: lua_pushliteral(L, "DROPPED"); break;
     default: lua_pushfstring(L, "Unknown(%d)", r); break;
     } /* clang-format on */
     return 2;
@@ -92,6 +95,23 @@ static int Lctx_read(lua_State *L) {
     }
 }
 
+static int Lctx_peek(lua_State *L) {
+    kz_Context *ctx = lkz_checkcontext(L, 1);
+    size_t      len;
+    char       *buf;
+    if (!kz_isread(ctx))
+        return luaL_error(L, "attempt to call 'peek' of a write context");
+    if (ctx->result != KZ_OK) return lkz_pusherror(L, ctx->result);
+    buf = kz_buffer(ctx, &len);
+    return lua_pushlstring(L, buf, len), 1;
+}
+
+static int Lctx_next(lua_State *L) {
+    kz_Context *ctx = lkz_checkcontext(L, 1);
+    int         r = kz_next(ctx);
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
 static int Lctx_write(lua_State *L) {
     kz_Context *ctx = (kz_Context *)luaL_checkudata(L, 1, LKZ_Context);
     if (kz_isread(ctx)) {
@@ -126,6 +146,8 @@ static int open_context(lua_State *L) {
         ENTRY(isread),
         ENTRY(wouldblock),
         ENTRY(read),
+        ENTRY(peek),
+        ENTRY(next),
         ENTRY(write),   
         ENTRY(wait),
 #undef  ENTRY
@@ -140,6 +162,92 @@ static int open_context(lua_State *L) {
     return LUA_OK;
 }
 
+/* broadcast */
+
+static kz_Bcast *lkz_checkbcast(lua_State *L, int idx) {
+    kz_Bcast **pB = (kz_Bcast **)luaL_checkudata(L, idx, LKZ_Bcast);
+    if (*pB == NULL) luaL_argerror(L, 1, "broadcast closed");
+    return *pB;
+}
+
+static int lkz_pushbcast(lua_State *L, kz_Bcast *B) {
+    if (B == NULL) return lkz_pusherror(L, KZ_FAIL);
+    *(kz_Bcast **)lua_newuserdata(L, sizeof(kz_Bcast *)) = B;
+    luaL_setmetatable(L, LKZ_Bcast);
+    return 1;
+}
+
+static int Lbc_close(lua_State *L) {
+    kz_Bcast **pB = (kz_Bcast **)luaL_checkudata(L, 1, LKZ_Bcast);
+    if (*pB != NULL) kz_bcclose(*pB), *pB = NULL;
+    return 0;
+}
+
+static int Lbc_readers(lua_State *L)
+{ return lua_pushinteger(L, kz_bcreaders(lkz_checkbcast(L, 1))), 1; }
+
+static int Lbc_dropped(lua_State *L) {
+    kz_Bcast *B = lkz_checkbcast(L, 1);
+    return lua_pushinteger(L, (lua_Integer)kz_bcdropped(B)), 1;
+}
+
+static int Lbc_send(lua_State *L) {
+    kz_Bcast   *B = lkz_checkbcast(L, 1);
+    size_t      len;
+    const char *data = luaL_checklstring(L, 2, &len);
+    lua_Integer millis = luaL_optinteger(L, 3, -1);
+    int         r;
+    while ((r = kz_bcsend(B, data, len)) == KZ_AGAIN && millis != 0)
+        if ((r = kz_bcwait(B, len, (int)millis)) != KZ_OK) break;
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
+static int Lbc_recv(lua_State *L) {
+    kz_Bcast   *B = lkz_checkbcast(L, 1);
+    lua_Integer millis = luaL_optinteger(L, 2, -1);
+    luaL_Buffer b;
+    size_t      len = LUAL_BUFFERSIZE;
+    int         r;
+    luaL_buffinit(L, &b);
+    for (;;) {
+        char *buf = luaL_prepbuffsize(&b, len);
+        r = kz_bcrecv(B, buf, &len);
+        if (r == KZ_OK) break;
+        if (r == KZ_TOOBIG) continue; /* `len` is the size needed */
+        if (r != KZ_AGAIN || millis == 0) return lkz_pusherror(L, r);
+        if ((r = kz_bcwait(B, 0, (int)millis)) != KZ_OK)
+            return lkz_pusherror(L, r);
+        len = LUAL_BUFFERSIZE;
+    }
+    luaL_addsize(&b, len);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+static int open_bcast(lua_State *L) {
+    luaL_Reg libs[] = {/* clang-format off */
+        { "__name",  NULL },
+        { "__index", NULL },
+        { "__gc",    Lbc_close },
+        { "__close", Lbc_close },
+#define ENTRY(name) { #name, Lbc_##name }
+        ENTRY(close),
+        ENTRY(readers),
+        ENTRY(dropped),
+        ENTRY(send),
+        ENTRY(recv),
+#undef  ENTRY
+        { NULL, NULL }
+    }; /* clang-format off */
+    if (luaL_newmetatable(L, LKZ_Bcast)) {
+        luaL_setfuncs(L, libs, 0);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+    }
+    lua_pop(L, 1);
+    return LUA_OK;
+}
+
 /* state */
 
 static int Laligned(lua_State *L) {
@@ -171,9 +279,22 @@ static int lkz_parseflags(lua_State *L, int idx) {
     int         r = 0;
     for (; *mode != '\0'; ++mode) {
         switch (*mode) { /* clang-format off */
-        case 'c': r |= KZ_CREATE; break;
-        case 'e': r |= KZ_EXCL;   break;
-        case 'r': r |= KZ_RESET;  break;
+        case 'c': r |= KZ_CREATE;    break;
+        case 'e': r |= KZ_EXCL;      break;
+        case 'r': r |= KZ_RESET;     break;
+        case 's': r |= KZ_SPIN;      break;
+        case 'm': r |= KZ_MPSC;      break;
+        case 'n': r |= KZ_NOTIFY;    break;
+        case 'h': r |= KZ_HUGEPAGE;  break;
+        case 'p': r |= KZ_PREFAULT;  break;
+        case 'l': r |= KZ_MLOCK;     break;
+        case 'd': r |= KZ_MIRROR;    break;
+        case 'i': r |= KZ_INDEXED;   break;
+        case 't': r |= KZ_TIMESTAMP; break;
+        case 'g': r |= KZ_RESIZABLE; break;
+        case '2': case '3': case '4': case '5': case '6': case '7': case '8':
+            r = (r & ~KZ_LANES(8)) | KZ_LANES(*mode - '0');
+            break;
         } /* clang-format on */
     }
     return r;
@@ -208,6 +329,150 @@ static int Lopen(lua_State *L) {
     return 1;
 }
 
+static int Lcreatearena(lua_State *L) {
+    const char *shmname = luaL_checkstring(L, 1);
+    lua_Integer bufsize = luaL_checkinteger(L, 2);
+    lua_Integer blocksize = luaL_checkinteger(L, 3);
+    lua_Integer count = luaL_checkinteger(L, 4);
+    int         mode  = (int)luaL_optinteger(L, 6, 0666);
+    int         flags = KZ_CREATE | lkz_parseflags(L, 5) | mode;
+    kz_State   *S;
+    luaL_argcheck(L, blocksize > 0, 3, "invalid block size");
+    luaL_argcheck(L, count > 0, 4, "invalid block count");
+    S = kz_openarena(shmname, flags, bufsize, blocksize, count);
+    if (S == NULL) return lkz_pusherror(L, KZ_FAIL);
+    *(kz_State **)lua_newuserdata(L, sizeof(kz_State *)) = S;
+    luaL_setmetatable(L, LKZ_State);
+    return 1;
+}
+
+static int Lcreateslots(lua_State *L) {
+    const char *shmname = luaL_checkstring(L, 1);
+    lua_Integer bufsize = luaL_checkinteger(L, 2);
+    lua_Integer slotsize = luaL_checkinteger(L, 3);
+    int         mode  = (int)luaL_optinteger(L, 5, 0666);
+    int         flags = KZ_CREATE | lkz_parseflags(L, 4) | mode;
+    kz_State   *S;
+    luaL_argcheck(L, slotsize > 0, 3, "invalid slot size");
+    S = kz_openslots(shmname, flags, bufsize, slotsize);
+    if (S == NULL) return lkz_pusherror(L, KZ_FAIL);
+    *(kz_State **)lua_newuserdata(L, sizeof(kz_State *)) = S;
+    luaL_setmetatable(L, LKZ_State);
+    return 1;
+}
+
+static int Lopenlocal(lua_State *L) {
+    lua_Integer bufsize = luaL_checkinteger(L, 1);
+    int         flags = lkz_parseflags(L, 2), i;
+    kz_State   *Ss[2], **pSs[2];
+    for (i = 0; i < 2; ++i) { /* both sides closed by `__gc` on errors */
+        pSs[i] = (kz_State **)lua_newuserdata(L, sizeof(kz_State *));
+        *pSs[i] = NULL;
+        luaL_setmetatable(L, LKZ_State);
+    }
+    if (kz_openlocal(flags, bufsize, Ss) != KZ_OK)
+        return lkz_pusherror(L, KZ_FAIL);
+    *pSs[0] = Ss[0], *pSs[1] = Ss[1];
+    return 2;
+}
+
+static int Lbcreate(lua_State *L) {
+    const char *shmname = luaL_checkstring(L, 1);
+    lua_Integer bufsize = luaL_checkinteger(L, 2);
+    lua_Integer readers = luaL_checkinteger(L, 3);
+    const char *policy = luaL_optstring(L, 4, "block");
+    int         mode = (int)luaL_optinteger(L, 5, 0666);
+    int         flags = KZ_CREATE | mode;
+    luaL_argcheck(L, readers > 0 && readers <= INT_MAX, 3, "invalid readers");
+    if (strcmp(policy, "drop") == 0) flags |= KZ_DROP;
+    else if (strcmp(policy, "block") != 0)
+        return luaL_argerror(L, 4, "'block' or 'drop' expected");
+    return lkz_pushbcast(L, kz_bcopen(shmname, flags, bufsize, (int)readers));
+}
+
+static int Lbjoin(lua_State *L)
+{ return lkz_pushbcast(L, kz_bcopen(luaL_checkstring(L, 1), 0, 0, 0)); }
+
+/* directory */
+
+static kz_Dir *lkz_checkdir(lua_State *L, int idx) {
+    kz_Dir **pD = (kz_Dir **)luaL_checkudata(L, idx, LKZ_Dir);
+    if (*pD == NULL) luaL_argerror(L, 1, "directory closed");
+    return *pD;
+}
+
+static int lkz_pushdir(lua_State *L, kz_Dir *D) {
+    if (D == NULL) return lkz_pusherror(L, KZ_FAIL);
+    *(kz_Dir **)lua_newuserdata(L, sizeof(kz_Dir *)) = D;
+    luaL_setmetatable(L, LKZ_Dir);
+    return 1;
+}
+
+static int Ldir_close(lua_State *L) {
+    kz_Dir **pD = (kz_Dir **)luaL_checkudata(L, 1, LKZ_Dir);
+    if (*pD != NULL) kz_closedir(*pD), *pD = NULL;
+    return 0;
+}
+
+static int Ldir_create(lua_State *L) {
+    kz_Dir     *D = lkz_checkdir(L, 1);
+    const char *name = luaL_checkstring(L, 2);
+    lua_Integer bufsize = luaL_checkinteger(L, 3);
+    int         mode = (int)luaL_optinteger(L, 5, 0666);
+    int         flags = KZ_CREATE | lkz_parseflags(L, 4) | mode;
+    kz_State   *S = kz_openat(D, name, flags, bufsize);
+    if (S == NULL) return lkz_pusherror(L, KZ_FAIL);
+    *(kz_State **)lua_newuserdata(L, sizeof(kz_State *)) = S;
+    luaL_setmetatable(L, LKZ_State);
+    return 1;
+}
+
+static int Ldir_open(lua_State *L) {
+    kz_Dir     *D = lkz_checkdir(L, 1);
+    const char *name = luaL_checkstring(L, 2);
+    kz_State   *S = kz_openat(D, name, lkz_parseflags(L, 3), 0);
+    if (S == NULL) return lkz_pusherror(L, KZ_FAIL);
+    *(kz_State **)lua_newuserdata(L, sizeof(kz_State *)) = S;
+    luaL_setmetatable(L, LKZ_State);
+    return 1;
+}
+
+static int open_dir(lua_State *L) {
+    luaL_Reg libs[] = {/* clang-format off */
+        { "__name",  NULL },
+        { "__index", NULL },
+        { "__gc",    Ldir_close },
+        { "__close", Ldir_close },
+#define ENTRY(name) { #name, Ldir_##name }
+        ENTRY(close),
+        ENTRY(create),
+        ENTRY(open),
+#undef  ENTRY
+        { NULL, NULL }
+    }; /* clang-format off */
+    if (luaL_newmetatable(L, LKZ_Dir)) {
+        luaL_setfuncs(L, libs, 0);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+    }
+    lua_pop(L, 1);
+    return LUA_OK;
+}
+
+static int Lcreatedir(lua_State *L) {
+    const char *shmname = luaL_checkstring(L, 1);
+    lua_Integer size = luaL_checkinteger(L, 2);
+    lua_Integer count = luaL_checkinteger(L, 3);
+    int         mode = (int)luaL_optinteger(L, 5, 0666);
+    int         flags = KZ_CREATE | lkz_parseflags(L, 4) | mode;
+    luaL_argcheck(L, size > 0, 2, "invalid size");
+    luaL_argcheck(L, count > 0, 3, "invalid count");
+    return lkz_pushdir(L, kz_opendir(shmname, flags, size, count));
+}
+
+static int Lopendir(lua_State *L)
+{ return lkz_pushdir(L, kz_opendir(luaL_checkstring(L, 1), 0, 0, 0)); }
+
 static int lkz_parsemode(lua_State *L, int idx) {
     const char *mode = luaL_optstring(L, idx, "");
     int         r = 0;
@@ -227,6 +492,13 @@ static int Lshutdown(lua_State *L) {
     return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
 }
 
+static int Lresize(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    size_t    bufsize = (size_t)luaL_checkinteger(L, 2);
+    int       r = kz_resize(S, bufsize);
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
 static int Lclose(lua_State *L) {
     kz_State **pS = (kz_State **)luaL_checkudata(L, 1, LKZ_State);
     if (*pS != NULL) kz_close(*pS);
@@ -244,6 +516,11 @@ static int Lsize(lua_State *L) {
     return lua_pushinteger(L, kz_size(S)), 1;
 }
 
+static int Lslotsize(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    return lua_pushinteger(L, kz_slotsize(S)), 1;
+}
+
 static int Lpid(lua_State *L) {
     kz_State *S = lkz_checkstate(L, 1);
     return lua_pushinteger(L, kz_pid(S)), 1;
@@ -264,6 +541,120 @@ static int Lisclosed(lua_State *L) {
     return 0;
 }
 
+static void lkz_pushqstats(lua_State *L, const kz_QueueStats *qs) {
+    lua_createtable(L, 0, 15);
+#define FIELD(name) \
+    (lua_pushinteger(L, (lua_Integer)qs->name), lua_setfield(L, -2, #name))
+    FIELD(pushes); FIELD(pops); FIELD(push_bytes);
+    FIELD(pop_bytes); FIELD(push_sleeps); FIELD(pop_sleeps);
+    FIELD(push_wakes); FIELD(pop_wakes); FIELD(push_again);
+    FIELD(pop_again); FIELD(push_busy); FIELD(pop_busy);
+    FIELD(peak); FIELD(size); FIELD(used);
+#undef FIELD
+}
+
+static int Lstats(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    kz_Stats  stats;
+    int       r = kz_stats(S, &stats);
+    if (r != KZ_OK) return lkz_pusherror(L, r);
+    lua_createtable(L, 0, 2);
+    lkz_pushqstats(L, &stats.write), lua_setfield(L, -2, "write");
+    lkz_pushqstats(L, &stats.read), lua_setfield(L, -2, "read");
+    return 1;
+}
+
+static int Lhistogram(lua_State *L) {
+    kz_State    *S = lkz_checkstate(L, 1);
+    kz_Histogram hist;
+    int          i, r = kz_histogram(S, lkz_parsemode(L, 2), &hist);
+    if (r != KZ_OK) return lkz_pusherror(L, r);
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, (lua_Integer)hist.count), lua_setfield(L, -2, "count");
+    lua_pushinteger(L, (lua_Integer)hist.sum), lua_setfield(L, -2, "sum");
+#define PERCENTILE(name, q)                                    \
+    (lua_pushinteger(L, (lua_Integer)kz_percentile(&hist, q)), \
+     lua_setfield(L, -2, name))
+    PERCENTILE("p50", 0.5);
+    PERCENTILE("p90", 0.9);
+    PERCENTILE("p99", 0.99);
+    PERCENTILE("p999", 0.999);
+#undef PERCENTILE
+    lua_createtable(L, KZ_HISTMAX, 0);
+    for (i = 0; i < KZ_HISTMAX; ++i) {
+        lua_pushinteger(L, (lua_Integer)hist.buckets[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "buckets");
+    return 1;
+}
+
+static int Lsetspin(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    lua_Integer micros = luaL_optinteger(L, 2, -1);
+    int         r = kz_setspin(S, (int)micros);
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
+static int Lsetcoalesce(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    lua_Integer bytes = luaL_optinteger(L, 2, 0);
+    lua_Integer count = luaL_optinteger(L, 3, 0);
+    lua_Integer micros = luaL_optinteger(L, 4, 0);
+    int         r;
+    luaL_argcheck(L, bytes >= 0, 2, "negative bytes");
+    luaL_argcheck(L, count >= 0, 3, "negative count");
+    r = kz_setcoalesce(S, (size_t)bytes, (size_t)count, (int)micros);
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
+static int Lflush(lua_State *L) {
+    int r = kz_flush(lkz_checkstate(L, 1));
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
+static void lkz_checkblock(lua_State *L, int idx, kz_Block *blk) {
+    blk->offset = (uint32_t)luaL_checkinteger(L, idx);
+    blk->len = (uint32_t)luaL_checkinteger(L, idx + 1);
+    blk->gen = (uint32_t)luaL_checkinteger(L, idx + 2);
+}
+
+static int Lalloc(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    size_t      len;
+    const char *data = luaL_checklstring(L, 2, &len);
+    kz_Block    blk;
+    int         r;
+    luaL_argcheck(L, len <= kz_blocksize(S), 2, "data too big");
+    if ((r = kz_alloc(S, &blk)) != KZ_OK) return lkz_pusherror(L, r);
+    memcpy(kz_blockdata(S, &blk), data, len);
+    blk.len = (uint32_t)len;
+    lua_pushinteger(L, (lua_Integer)blk.offset);
+    lua_pushinteger(L, (lua_Integer)blk.len);
+    lua_pushinteger(L, (lua_Integer)blk.gen);
+    return 3;
+}
+
+static int Lblockdata(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    kz_Block  blk;
+    char     *data;
+    lkz_checkblock(L, 2, &blk);
+    if ((data = kz_blockdata(S, &blk)) == NULL)
+        return lkz_pusherror(L, KZ_INVALID);
+    lua_pushlstring(L, data, blk.len);
+    return 1;
+}
+
+static int Lfree(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    kz_Block  blk;
+    int       r;
+    lkz_checkblock(L, 2, &blk);
+    r = kz_free(S, &blk);
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
 static int Lreadcontext(lua_State *L) {
     kz_State   *S = lkz_checkstate(L, 1);
     kz_Context *ctx = (kz_Context *)lua_newuserdata(L, sizeof(kz_Context));
@@ -296,6 +687,70 @@ static int Lwait(lua_State *L) {
     return 2;
 }
 
+static int Lwaitmany(lua_State *L) {
+    kz_State   *Ss[KZ_WAITMAX];
+    int         modes[KZ_WAITMAX];
+    int         mode = lkz_parsemode(L, 2);
+    lua_Integer request = luaL_optinteger(L, 3, 0);
+    lua_Integer millis = luaL_optinteger(L, 4, -1);
+    lua_Integer i, count;
+    int         r;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    count = (lua_Integer)lua_rawlen(L, 1);
+    luaL_argcheck(L, count <= KZ_WAITMAX, 1, "too many states");
+    for (i = 0; i < count; ++i) {
+        lua_rawgeti(L, 1, i + 1);
+        Ss[i] = lkz_checkstate(L, -1);
+        modes[i] = mode ? mode : KZ_READ;
+        lua_pop(L, 1);
+    }
+    r = kz_waitmany(Ss, modes, (size_t)count, request, millis);
+    if (r <= 0) return lkz_pusherror(L, r);
+    lua_createtable(L, 0, r);
+    for (i = 0; i < count; ++i) {
+        if (modes[i] == 0) continue;
+        lua_pushstring(L, modes[i] == KZ_BOTH ? "rw"
+                        : modes[i] == KZ_READ ? "r" : "w");
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static int Lnotifyfd(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    int       mode = lua_isnoneornil(L, 2) ? KZ_READ : lkz_parsemode(L, 2);
+    int       fd = kz_notifyfd(S, mode);
+    if (fd < 0) return luaL_pushfail(L), 1;
+    lua_pushinteger(L, fd);
+    return 1;
+}
+
+static int Lclearnotify(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    int       r = kz_clearnotify(S, lkz_parsemode(L, 2));
+    if (r < 0) return lkz_pusherror(L, r);
+    lua_pushboolean(L, (r & KZ_READ));
+    lua_pushboolean(L, (r & KZ_WRITE));
+    return 2;
+}
+
+static int Lregister(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    int         mode = lkz_parsemode(L, 2);
+    lua_Integer request = luaL_optinteger(L, 3, 0);
+    int         r = kz_register(S, mode, request);
+    if (r < 0) return lkz_pusherror(L, r);
+    lua_pushboolean(L, (r & KZ_READ));
+    lua_pushboolean(L, (r & KZ_WRITE));
+    return 2;
+}
+
+static int Lunregister(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    int       r = kz_unregister(S, lkz_parsemode(L, 2));
+    return r == KZ_OK ? (lua_settop(L, 1), 1) : lkz_pusherror(L, r);
+}
+
 static int Lread(lua_State *L) {
     kz_State   *S = lkz_checkstate(L, 1);
     lua_Integer millis = luaL_optinteger(L, 2, -1);
@@ -313,13 +768,107 @@ static int Lread(lua_State *L) {
     return 1;
 }
 
+static int Llanes(lua_State *L) {
+    kz_State *S = lkz_checkstate(L, 1);
+    return lua_pushinteger(L, kz_lanes(S)), 1;
+}
+
+static int Lreadlanes(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    lua_Integer millis = luaL_optinteger(L, 2, -1);
+    kz_Context  ctx;
+    int         lane, r;
+    while ((lane = kz_readlanes(S, &ctx)) == KZ_AGAIN) {
+        if ((r = kz_waitlanes(S, (int)millis)) > 0) continue;
+        lane = r == 0 ? KZ_AGAIN : r;
+        break;
+    }
+    if (lane == KZ_CLOSED) return 0;
+    if (lane < 0) return lkz_pusherror(L, lane), lua_error(L);
+    lua_pushcfunction(L, lkz_buffer_aux);
+    lua_pushlightuserdata(L, &ctx);
+    lua_pcall(L, 1, 1, 0);
+    r = kz_commit(&ctx, 0);
+    if (r == KZ_CLOSED) return 0;
+    if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+    lua_pushinteger(L, lane);
+    return 2;
+}
+
+static int Lreadlarge(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    lua_Integer millis = luaL_optinteger(L, 2, -1);
+    kz_Context  ctx;
+    luaL_Buffer b;
+    int         r, more = 1;
+    luaL_buffinit(L, &b);
+    while (more) {
+        r = kz_read(S, &ctx);
+        if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, millis);
+        if (r == KZ_CLOSED) return 0;
+        if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+        more = kz_more(&ctx);
+        lua_pushcfunction(L, lkz_buffer_aux);
+        lua_pushlightuserdata(L, &ctx);
+        lua_pcall(L, 1, 1, 0);
+        r = kz_commit(&ctx, 0);
+        if (r == KZ_CLOSED) return 0;
+        if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+        luaL_addvalue(&b);
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+static int lkz_readv_aux(lua_State *L) {
+    kz_Context *ctxs = (kz_Context *)lua_touserdata(L, 1);
+    int         i, count = (int)lua_tointeger(L, 2);
+    lua_createtable(L, count, 0);
+    for (i = 0; i < count; ++i) {
+        size_t len;
+        char  *buf = kz_buffer(&ctxs[i], &len);
+        lua_pushlstring(L, buf, len);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static int Lreadv(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    lua_Integer count = luaL_optinteger(L, 2, 64);
+    lua_Integer budget = luaL_optinteger(L, 3, 0);
+    lua_Integer millis = luaL_optinteger(L, 4, -1);
+    kz_Context *ctxs;
+    int         r;
+    luaL_argcheck(L, count > 0, 2, "positive count expected");
+    ctxs = (kz_Context *)lua_newuserdata(L, sizeof(kz_Context) * count);
+    while ((r = kz_readv(S, ctxs, count, budget)) == KZ_AGAIN) {
+        r = kz_waitcontext(ctxs, millis);
+        kz_cancel(ctxs);
+        if (r != KZ_OK) break;
+    }
+    if (r == KZ_CLOSED) return 0;
+    if (r < 0) return lkz_pusherror(L, r), lua_error(L);
+    lua_pushcfunction(L, lkz_readv_aux);
+    lua_pushlightuserdata(L, ctxs);
+    lua_pushinteger(L, r);
+    if (lua_pcall(L, 2, 1, 0) != LUA_OK) return kz_cancel(ctxs), lua_error(L);
+    r = kz_commitv(ctxs, r);
+    if (r == KZ_CLOSED) return 0;
+    if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+    return 1;
+}
+
 static int Lwrite(lua_State *L) {
     kz_State   *S = lkz_checkstate(L, 1);
     size_t      len;
     const char *data = luaL_checklstring(L, 2, &len);
     lua_Integer millis = luaL_optinteger(L, 3, -1);
+    lua_Integer lane = luaL_optinteger(L, 4, 0);
     kz_Context  ctx;
-    int         r = kz_write(S, &ctx, len);
+    int         r;
+    luaL_argcheck(L, lane >= 0 && lane < kz_lanes(S), 4, "invalid lane");
+    r = kz_write(kz_lane(S, (int)lane), &ctx, len);
     if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, millis);
     if (r == KZ_CLOSED) return 0;
     if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
@@ -330,6 +879,63 @@ static int Lwrite(lua_State *L) {
     return lua_settop(L, 1), 1;
 }
 
+static int Lwritelarge(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    size_t      len, n, off = 0, chunk = kz_chunksize(S);
+    const char *data = luaL_checklstring(L, 2, &len);
+    lua_Integer millis = luaL_optinteger(L, 3, -1);
+    kz_Context  ctx;
+    int         r;
+    if (chunk == 0) return lkz_pusherror(L, KZ_TOOBIG), lua_error(L);
+    do {
+        n = len - off < chunk ? len - off : chunk;
+        r = kz_write(S, &ctx, n);
+        if (r == KZ_AGAIN) r = kz_waitcontext(&ctx, millis);
+        if (r == KZ_CLOSED) return 0;
+        if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+        memcpy(kz_buffer(&ctx, NULL), data + off, n);
+        off += n;
+        r = kz_commitchunk(&ctx, n, off < len);
+        if (r == KZ_CLOSED) return 0;
+        if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+    } while (off < len);
+    return lua_settop(L, 1), 1;
+}
+
+static int Lwritev(lua_State *L) {
+    kz_State   *S = lkz_checkstate(L, 1);
+    lua_Integer millis = luaL_optinteger(L, 3, -1);
+    kz_Context *ctxs;
+    size_t     *lens;
+    int         i, count, r;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    count = (int)lua_rawlen(L, 2);
+    if (count == 0) return lua_settop(L, 1), 1;
+    luaL_checkstack(L, count, "too many messages");
+    lens = (size_t *)lua_newuserdata(L, sizeof(size_t) * count);
+    ctxs = (kz_Context *)lua_newuserdata(L, sizeof(kz_Context) * count);
+    for (i = 0; i < count; ++i) {
+        lua_rawgeti(L, 2, i + 1);
+        if (lua_tolstring(L, -1, &lens[i]) == NULL)
+            return luaL_error(L, "string expected at index %d", i + 1);
+    }
+    while ((r = kz_writev(S, ctxs, lens, count)) == KZ_AGAIN) {
+        r = kz_waitcontext(ctxs, millis);
+        kz_cancel(ctxs);
+        if (r != KZ_OK) break;
+    }
+    if (r == KZ_CLOSED) return 0;
+    if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+    for (i = 0; i < count; ++i) {
+        const char *data = lua_tolstring(L, i - count, NULL);
+        memcpy(kz_buffer(&ctxs[i], NULL), data, lens[i]);
+    }
+    r = kz_commitv(ctxs, count);
+    if (r == KZ_CLOSED) return 0;
+    if (r != KZ_OK) return lkz_pusherror(L, r), lua_error(L);
+    return lua_settop(L, 1), 1;
+}
+
 LUALIB_API int luaopen_kaze(lua_State *L) {
     luaL_Reg libs[] = {
             {"__gc", Lclose},    {"__close", Lclose},
@@ -339,10 +945,21 @@ LUALIB_API int luaopen_kaze(lua_State *L) {
             ENTRY(shutdown),     ENTRY(name),         ENTRY(size),
             ENTRY(pid),          ENTRY(isowner),      ENTRY(isclosed),
             ENTRY(read),         ENTRY(write),        ENTRY(readcontext),
-            ENTRY(writecontext), ENTRY(wait),
+            ENTRY(writecontext), ENTRY(wait),         ENTRY(readv),
+            ENTRY(writev),       ENTRY(setspin),      ENTRY(waitmany),
+            ENTRY(notifyfd),     ENTRY(register),     ENTRY(unregister),
+            ENTRY(stats),        ENTRY(histogram),    ENTRY(lanes),
+            ENTRY(readlanes),    ENTRY(readlarge),    ENTRY(writelarge),
+            ENTRY(resize),       ENTRY(setcoalesce),  ENTRY(flush),
+            ENTRY(createarena),  ENTRY(alloc),        ENTRY(blockdata),
+            ENTRY(free),         ENTRY(bcreate),      ENTRY(bjoin),
+            ENTRY(createdir),    ENTRY(opendir),      ENTRY(openlocal),
+            ENTRY(createslots),  ENTRY(slotsize),     ENTRY(clearnotify),
 #undef ENTRY
             {NULL, NULL}};
     open_context(L);
+    open_bcast(L);
+    open_dir(L);
     if (luaL_newmetatable(L, LKZ_State)) {
         luaL_setfuncs(L, libs, 0);
         lua_pushvalue(L, -1);